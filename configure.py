@@ -149,9 +149,23 @@ lib_engine = ObjectList(
         "model_loader.cpp",
         "res.cpp",
         "terrain.cpp",
+        "terrain_cache.cpp",
+        "terrain_clipmap.cpp",
+        "terrain_quadtree.cpp",
+        "terrain_raycast.cpp",
+        "terrain_tile_store.cpp",
         "render/renderer.cpp",
         "render/mesh_renderer.cpp",
+        "render/draw_packets.cpp",
+        "render/upload_ring.cpp",
+        "render/transient_arena.cpp",
+        "render/geometry_arena.cpp",
+        "render/render_graph.cpp",
+        "render/occlusion.cpp",
+        "render/entity_bvh.cpp",
+        "render/light_clusters.cpp",
         "render/imgui_renderer.cpp",
+        "render/im3d_staging.cpp",
         "render/im3d_renderer.cpp",
         "render/wireframe_renderer.cpp",
         "render/linavg_renderer.cpp",
@@ -159,11 +173,17 @@ lib_engine = ObjectList(
         "systems/observer.cpp",
         "systems/player.cpp",
         "systems/boid.cpp",
+        "systems/boid_recorder.cpp",
         "core/log.cpp",
         "core/file.cpp",
+        "core/lz.cpp",
+        "core/cpu.cpp",
+        "core/bvh.cpp",
+        "core/mapped_file.cpp",
         "core/random.cpp",
         "core/win32_utils.cpp",
         "terrain_algo.cpp",
+        "terrain_algo_simd.cpp",
         "vk_mem_alloc.cpp",
         "stb/stb.c"
     ],
@@ -224,6 +244,253 @@ exe_test_ecs = Executable(
     additional_libs=['kernel32.lib']
 )
 
+lib_test_terrain = ObjectList(
+    name="test_terrain_lib",
+    basepath="engine",
+    source_files=[
+        "test_terrain.cpp",
+        "terrain_algo.cpp",
+        "terrain_algo_simd.cpp",
+        "terrain_cache.cpp",
+        "terrain_clipmap.cpp",
+        "terrain_raycast.cpp",
+        "terrain_tile_store.cpp",
+        "core/cpu.cpp",
+        "core/lz.cpp",
+        "core/log.cpp",
+        "core/mapped_file.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_fmt, lib_doctest, lib_nanothread, lib_tracy, lib_parallel_hashmap]
+)
+
+exe_test_terrain = Executable(
+    name="test_terrain_exe",
+    dest=f"{project.binary_path}/test_terrain.exe",
+    deps=[lib_test_terrain],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_draw_packets = ObjectList(
+    name="test_draw_packets_lib",
+    basepath="engine",
+    source_files=[
+        "test_draw_packets.cpp",
+        "render/draw_packets.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_doctest, lib_nanothread, lib_tracy, lib_gen_arena]
+)
+
+exe_test_draw_packets = Executable(
+    name="test_draw_packets_exe",
+    dest=f"{project.binary_path}/test_draw_packets.exe",
+    deps=[lib_test_draw_packets],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_upload_ring = ObjectList(
+    name="test_upload_ring_lib",
+    basepath="engine",
+    source_files=[
+        "test_upload_ring.cpp",
+        "render/upload_ring.cpp"
+    ],
+    includes=["."],
+    deps=[lib_doctest]
+)
+
+exe_test_upload_ring = Executable(
+    name="test_upload_ring_exe",
+    dest=f"{project.binary_path}/test_upload_ring.exe",
+    deps=[lib_test_upload_ring],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_geometry_arena = ObjectList(
+    name="test_geometry_arena_lib",
+    basepath="engine",
+    source_files=[
+        "test_geometry_arena.cpp",
+        "render/geometry_arena.cpp"
+    ],
+    includes=["."],
+    deps=[lib_doctest]
+)
+
+exe_test_geometry_arena = Executable(
+    name="test_geometry_arena_exe",
+    dest=f"{project.binary_path}/test_geometry_arena.exe",
+    deps=[lib_test_geometry_arena],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_render_graph = ObjectList(
+    name="test_render_graph_lib",
+    basepath="engine",
+    source_files=[
+        "test_render_graph.cpp",
+        "render/render_graph.cpp"
+    ],
+    includes=["."],
+    deps=[lib_doctest]
+)
+
+exe_test_render_graph = Executable(
+    name="test_render_graph_exe",
+    dest=f"{project.binary_path}/test_render_graph.exe",
+    deps=[lib_test_render_graph],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_occlusion = ObjectList(
+    name="test_occlusion_lib",
+    basepath="engine",
+    source_files=[
+        "test_occlusion.cpp",
+        "render/occlusion.cpp",
+        "core/cpu.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_doctest]
+)
+
+exe_test_occlusion = Executable(
+    name="test_occlusion_exe",
+    dest=f"{project.binary_path}/test_occlusion.exe",
+    deps=[lib_test_occlusion],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_bvh = ObjectList(
+    name="test_bvh_lib",
+    basepath="engine",
+    source_files=[
+        "test_bvh.cpp",
+        "core/bvh.cpp",
+        "core/cpu.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_doctest, lib_nanothread, lib_tracy]
+)
+
+exe_test_bvh = Executable(
+    name="test_bvh_exe",
+    dest=f"{project.binary_path}/test_bvh.exe",
+    deps=[lib_test_bvh],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_light_clusters = ObjectList(
+    name="test_light_clusters_lib",
+    basepath="engine",
+    source_files=[
+        "test_light_clusters.cpp",
+        "render/light_clusters.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_doctest, lib_nanothread, lib_tracy]
+)
+
+exe_test_light_clusters = Executable(
+    name="test_light_clusters_exe",
+    dest=f"{project.binary_path}/test_light_clusters.exe",
+    deps=[lib_test_light_clusters],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_im3d_staging = ObjectList(
+    name="test_im3d_staging_lib",
+    basepath="engine",
+    source_files=[
+        "test_im3d_staging.cpp",
+        "render/im3d_staging.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_doctest, lib_nanothread]
+)
+
+exe_test_im3d_staging = Executable(
+    name="test_im3d_staging_exe",
+    dest=f"{project.binary_path}/test_im3d_staging.exe",
+    deps=[lib_test_im3d_staging],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_transient_arena = ObjectList(
+    name="test_transient_arena_lib",
+    basepath="engine",
+    source_files=[
+        "test_transient_arena.cpp",
+        "render/transient_arena.cpp"
+    ],
+    includes=["."],
+    deps=[lib_doctest]
+)
+
+exe_test_transient_arena = Executable(
+    name="test_transient_arena_exe",
+    dest=f"{project.binary_path}/test_transient_arena.exe",
+    deps=[lib_test_transient_arena],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_test_boid_recorder = ObjectList(
+    name="test_boid_recorder_lib",
+    basepath="engine",
+    source_files=[
+        "test_boid_recorder.cpp",
+        "systems/boid_recorder.cpp",
+        "core/lz.cpp",
+        "core/log.cpp"
+    ],
+    includes=["."],
+    deps=[lib_glm, lib_fmt, lib_doctest, lib_nanothread, lib_tracy]
+)
+
+exe_test_boid_recorder = Executable(
+    name="test_boid_recorder_exe",
+    dest=f"{project.binary_path}/test_boid_recorder.exe",
+    deps=[lib_test_boid_recorder],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
+lib_packer = ObjectList(
+    name="packer_lib",
+    basepath=".",
+    source_files=[
+        "packer/main.cpp",
+        "engine/terrain_algo.cpp",
+        "engine/terrain_algo_simd.cpp",
+        "engine/terrain_tile_store.cpp",
+        "engine/core/cpu.cpp",
+        "engine/core/lz.cpp",
+        "engine/core/log.cpp",
+        "engine/core/mapped_file.cpp"
+    ],
+    includes=["engine"],
+    deps=[lib_glm, lib_fmt, lib_nanothread, lib_tracy, lib_parallel_hashmap]
+)
+
+exe_packer = Executable(
+    name="packer_exe",
+    dest=f"{project.binary_path}/packer.exe",
+    deps=[lib_packer],
+    subsystem='console',
+    additional_libs=['kernel32.lib']
+)
+
 copy_sdl2_dll = Copy(
     name="copy_sdl2_dll",
     source=f"{lib_sdl.basepath}/lib/x64/SDL2.dll",
@@ -246,9 +513,17 @@ alias_linavg_test = Alias(
 
 alias_tests = Alias(
     name="tests",
-    deps=[exe_test_ecs]
+    deps=[exe_test_ecs, exe_test_terrain, exe_test_draw_packets, exe_test_upload_ring,
+        exe_test_geometry_arena, exe_test_render_graph, exe_test_occlusion,
+        exe_test_bvh, exe_test_light_clusters, exe_test_im3d_staging,
+        exe_test_transient_arena, exe_test_boid_recorder]
+)
+
+alias_packer = Alias(
+    name="packer",
+    deps=[exe_packer]
 )
 
-project.add_targets([alias_flock3d, alias_linavg_test, alias_tests])
+project.add_targets([alias_flock3d, alias_linavg_test, alias_tests, alias_packer])
 
 project.generate()
\ No newline at end of file
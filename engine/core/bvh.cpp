@@ -0,0 +1,571 @@
+#include "bvh.h"
+
+#include "core/cpu.h"
+
+#include <float.h>
+#include <algorithm>
+
+#include <glm/vec2.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <immintrin.h>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+// Subtrees below this depth of the rebuild are built as separate tasks, trees smaller than the threshold in one go
+constexpr uint32_t PARALLEL_BUILD_DEPTH = 4;
+constexpr uint32_t PARALLEL_BUILD_MIN_LEAVES = 1024;
+constexpr uint32_t BUILD_BINS = 16;
+
+static float surface_area(glm::vec3 aabb_min, glm::vec3 aabb_max) {
+    glm::vec3 d = aabb_max - aabb_min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static bool overlaps(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max) {
+    return a_min.x <= b_max.x && a_max.x >= b_min.x
+        && a_min.y <= b_max.y && a_max.y >= b_min.y
+        && a_min.z <= b_max.z && a_max.z >= b_min.z;
+}
+
+// Same slab test as the terrain raycast, rays parallel to a slab only hit it if they start inside
+bool intersect_ray_aabb(glm::vec3 origin, glm::vec3 dir, float max_t, glm::vec3 aabb_min, glm::vec3 aabb_max, float* t) {
+    float t0 = 0.0f, t1 = max_t;
+    for (int k = 0; k < 3; k++) {
+        if (dir[k] == 0.0f) {
+            if (origin[k] < aabb_min[k] || origin[k] > aabb_max[k]) return false;
+            continue;
+        }
+        float inv = 1.0f / dir[k];
+        float ta = (aabb_min[k] - origin[k]) * inv;
+        float tb = (aabb_max[k] - origin[k]) * inv;
+        t0 = glm::max(t0, glm::min(ta, tb));
+        t1 = glm::min(t1, glm::max(ta, tb));
+        if (t0 > t1) return false;
+    }
+    if (t) *t = t0;
+    return true;
+}
+
+uint32_t DynamicBvh::alloc_node() {
+    if (_free_list != NIL) {
+        uint32_t node = _free_list;
+        _free_list = _nodes[node].parent;
+        return node;
+    }
+    _nodes.push_empty();
+    return _nodes.size() - 1;
+}
+
+void DynamicBvh::free_node(uint32_t node) {
+    _nodes[node].parent = _free_list;
+    _nodes[node].user = NIL;
+    _free_list = node;
+}
+
+uint32_t DynamicBvh::insert(uint32_t user, glm::vec3 aabb_min, glm::vec3 aabb_max) {
+    uint32_t leaf = alloc_node();
+    Node& node = _nodes[leaf];
+    node.aabb_min = aabb_min;
+    node.aabb_max = aabb_max;
+    node.parent = NIL;
+    node.user = user;
+    node.children[0] = NIL;
+    node.children[1] = NIL;
+    insert_leaf(leaf);
+    _num_leaves++;
+    return leaf;
+}
+
+void DynamicBvh::insert_leaf(uint32_t leaf) {
+    if (_root == NIL) {
+        _root = leaf;
+        _nodes[leaf].parent = NIL;
+        return;
+    }
+
+    // Every node is a candidate sibling. Its cost is the area of the new parent plus what the new box adds to the
+    // ancestors, which only grows going down, so subtrees that can't beat the best candidate are skipped.
+    glm::vec3 leaf_min = _nodes[leaf].aabb_min;
+    glm::vec3 leaf_max = _nodes[leaf].aabb_max;
+    float leaf_area = surface_area(leaf_min, leaf_max);
+
+    struct Candidate {
+        uint32_t node;
+        float inherited_cost;
+    };
+    Vector<Candidate> stack;
+    stack.push_back(Candidate{_root, 0.0f});
+    uint32_t sibling = _root;
+    float best_cost = FLT_MAX;
+    while (!stack.empty()) {
+        Candidate candidate = stack.pop_back();
+        const Node& node = _nodes[candidate.node];
+        float union_area = surface_area(glm::min(node.aabb_min, leaf_min), glm::max(node.aabb_max, leaf_max));
+        float cost = union_area + candidate.inherited_cost;
+        if (cost < best_cost) {
+            best_cost = cost;
+            sibling = candidate.node;
+        }
+        if (node.is_leaf()) continue;
+
+        float inherited_cost = candidate.inherited_cost + union_area - surface_area(node.aabb_min, node.aabb_max);
+        if (leaf_area + inherited_cost < best_cost) {
+            stack.push_back(Candidate{node.children[0], inherited_cost});
+            stack.push_back(Candidate{node.children[1], inherited_cost});
+        }
+    }
+
+    uint32_t old_parent = _nodes[sibling].parent;
+    uint32_t parent = alloc_node();
+    Node& node = _nodes[parent];
+    node.parent = old_parent;
+    node.user = NIL;
+    node.children[0] = sibling;
+    node.children[1] = leaf;
+    _nodes[sibling].parent = parent;
+    _nodes[leaf].parent = parent;
+    if (old_parent == NIL) {
+        _root = parent;
+    }
+    else {
+        Node& grandparent = _nodes[old_parent];
+        grandparent.children[grandparent.children[0] == sibling ? 0 : 1] = parent;
+    }
+    refit_ancestors(parent);
+}
+
+void DynamicBvh::remove(uint32_t leaf) {
+    _num_leaves--;
+    if (leaf == _root) {
+        _root = NIL;
+        free_node(leaf);
+        return;
+    }
+
+    uint32_t parent = _nodes[leaf].parent;
+    uint32_t grandparent = _nodes[parent].parent;
+    uint32_t sibling = _nodes[parent].children[_nodes[parent].children[0] == leaf ? 1 : 0];
+    _nodes[sibling].parent = grandparent;
+    if (grandparent == NIL) {
+        _root = sibling;
+    }
+    else {
+        Node& node = _nodes[grandparent];
+        node.children[node.children[0] == parent ? 0 : 1] = sibling;
+        refit_ancestors(grandparent);
+    }
+    free_node(parent);
+    free_node(leaf);
+}
+
+void DynamicBvh::refit(uint32_t leaf, glm::vec3 aabb_min, glm::vec3 aabb_max) {
+    _nodes[leaf].aabb_min = aabb_min;
+    _nodes[leaf].aabb_max = aabb_max;
+    if (_nodes[leaf].parent != NIL) {
+        refit_ancestors(_nodes[leaf].parent);
+    }
+}
+
+void DynamicBvh::update_bounds(uint32_t index) {
+    Node& node = _nodes[index];
+    const Node& a = _nodes[node.children[0]];
+    const Node& b = _nodes[node.children[1]];
+    node.aabb_min = glm::min(a.aabb_min, b.aabb_min);
+    node.aabb_max = glm::max(a.aabb_max, b.aabb_max);
+}
+
+void DynamicBvh::refit_ancestors(uint32_t node) {
+    while (node != NIL) {
+        update_bounds(node);
+        rotate(node);
+        node = _nodes[node].parent;
+    }
+}
+
+// Swaps a child of the node with a grandchild on the other side if that shrinks the child it ends up in.
+// The node itself keeps the same leaves and bounds.
+void DynamicBvh::rotate(uint32_t index) {
+    const Node& node = _nodes[index];
+    float best_gain = 0.0f;
+    uint32_t best_side = NIL, best_grandchild = NIL;
+    for (uint32_t side = 0; side < 2; side++) {
+        const Node& child = _nodes[node.children[side]];
+        const Node& other = _nodes[node.children[1 - side]];
+        if (other.is_leaf()) continue;
+        float other_area = surface_area(other.aabb_min, other.aabb_max);
+        for (uint32_t k = 0; k < 2; k++) {
+            // The child takes the place of grandchild k, which moves up
+            const Node& kept = _nodes[other.children[1 - k]];
+            float gain = other_area - surface_area(glm::min(child.aabb_min, kept.aabb_min), glm::max(child.aabb_max, kept.aabb_max));
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_side = side;
+                best_grandchild = k;
+            }
+        }
+    }
+    if (best_side == NIL) return;
+
+    uint32_t child = node.children[best_side];
+    uint32_t other = node.children[1 - best_side];
+    uint32_t grandchild = _nodes[other].children[best_grandchild];
+    _nodes[index].children[best_side] = grandchild;
+    _nodes[grandchild].parent = index;
+    _nodes[other].children[best_grandchild] = child;
+    _nodes[child].parent = other;
+    update_bounds(other);
+}
+
+float DynamicBvh::cost() const {
+    if (_root == NIL || _nodes[_root].is_leaf()) return 0.0f;
+
+    float total_area = 0.0f;
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.pop_back()];
+        if (node.is_leaf()) continue;
+        total_area += surface_area(node.aabb_min, node.aabb_max);
+        stack.push_back(node.children[0]);
+        stack.push_back(node.children[1]);
+    }
+    return total_area / surface_area(_nodes[_root].aabb_min, _nodes[_root].aabb_max);
+}
+
+uint32_t DynamicBvh::height() const {
+    if (_root == NIL) return 0;
+
+    uint32_t max_depth = 0;
+    Vector<glm::uvec2> stack;
+    stack.push_back(glm::uvec2(_root, 1));
+    while (!stack.empty()) {
+        glm::uvec2 entry = stack.pop_back();
+        const Node& node = _nodes[entry.x];
+        max_depth = glm::max(max_depth, entry.y);
+        if (!node.is_leaf()) {
+            stack.push_back(glm::uvec2(node.children[0], entry.y + 1));
+            stack.push_back(glm::uvec2(node.children[1], entry.y + 1));
+        }
+    }
+    return max_depth;
+}
+
+bool DynamicBvh::validate() const {
+    if (_root == NIL) return _num_leaves == 0;
+    if (_nodes[_root].parent != NIL) return false;
+
+    uint32_t num_leaves = 0;
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop_back();
+        const Node& node = _nodes[index];
+        if (node.is_leaf()) {
+            num_leaves++;
+            continue;
+        }
+        for (uint32_t child_index : node.children) {
+            const Node& child = _nodes[child_index];
+            if (child.parent != index) return false;
+            if (glm::any(glm::lessThan(child.aabb_min, node.aabb_min))) return false;
+            if (glm::any(glm::greaterThan(child.aabb_max, node.aabb_max))) return false;
+            stack.push_back(child_index);
+        }
+    }
+    return num_leaves == _num_leaves;
+}
+
+void DynamicBvh::rebuild(Pool* thread_pool) {
+    ZoneScoped;
+
+    if (_num_leaves < 3) return;
+
+    // The leaves stay where they are, the internal nodes are reused for the new tree
+    Vector<BuildRef> refs;
+    Vector<uint32_t> internal;
+    refs.reserve(_num_leaves);
+    internal.reserve(_num_leaves - 1);
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop_back();
+        const Node& node = _nodes[index];
+        if (node.is_leaf()) {
+            refs.push_back(BuildRef{index, 0.5f * (node.aabb_min + node.aabb_max)});
+        }
+        else {
+            internal.push_back(index);
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+
+    // The top of the tree is split serially, the subtrees below it take a range of the internal nodes each
+    Vector<BuildTask> tasks;
+    bool parallel = _num_leaves >= PARALLEL_BUILD_MIN_LEAVES;
+    Span<const uint32_t> internal_nodes(internal.data(), internal.size());
+    _root = build(refs, 0, refs.size(), internal_nodes, 0, PARALLEL_BUILD_DEPTH, parallel ? &tasks : nullptr);
+    _nodes[_root].parent = NIL;
+
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, tasks.size(), 1), [&](auto range) {
+        ZoneScopedN("BuildBvhSubtree");
+        for (uint32_t i : range) {
+            const auto& task = tasks[i];
+            build(refs, task.begin, task.end, internal_nodes, task.first_internal, 0, nullptr);
+        }
+    }, thread_pool);
+}
+
+// Builds the subtree over refs [begin, end) out of the internal nodes [first_internal, first_internal + end - begin - 1)
+// and returns its root. Parents link their children, the root's parent is left to the caller.
+uint32_t DynamicBvh::build(Span<BuildRef> refs, uint32_t begin, uint32_t end, Span<const uint32_t> internal,
+        uint32_t first_internal, uint32_t parallel_depth, Vector<BuildTask>* tasks) {
+
+    uint32_t count = end - begin;
+    if (count == 1) return refs[begin].leaf;
+
+    uint32_t index = internal[first_internal];
+    if (tasks && parallel_depth == 0) {
+        tasks->push_back(BuildTask{begin, end, first_internal});
+        return index;
+    }
+
+    glm::vec3 aabb_min = glm::vec3(FLT_MAX), aabb_max = glm::vec3(-FLT_MAX);
+    glm::vec3 centroid_min = glm::vec3(FLT_MAX), centroid_max = glm::vec3(-FLT_MAX);
+    for (uint32_t i = begin; i < end; i++) {
+        const Node& leaf = _nodes[refs[i].leaf];
+        aabb_min = glm::min(aabb_min, leaf.aabb_min);
+        aabb_max = glm::max(aabb_max, leaf.aabb_max);
+        centroid_min = glm::min(centroid_min, refs[i].centroid);
+        centroid_max = glm::max(centroid_max, refs[i].centroid);
+    }
+
+    glm::vec3 extent = centroid_max - centroid_min;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    uint32_t mid = begin + count / 2;
+    if (extent[axis] > 0.0f) {
+        // Binned SAH along the axis with the widest spread of centroids
+        float scale = BUILD_BINS / extent[axis];
+        auto bin_of = [&](const BuildRef& ref) {
+            return glm::min(BUILD_BINS - 1, (uint32_t)((ref.centroid[axis] - centroid_min[axis]) * scale));
+        };
+
+        uint32_t bin_counts[BUILD_BINS] = {};
+        glm::vec3 bin_min[BUILD_BINS], bin_max[BUILD_BINS];
+        for (uint32_t b = 0; b < BUILD_BINS; b++) {
+            bin_min[b] = glm::vec3(FLT_MAX);
+            bin_max[b] = glm::vec3(-FLT_MAX);
+        }
+        for (uint32_t i = begin; i < end; i++) {
+            const Node& leaf = _nodes[refs[i].leaf];
+            uint32_t b = bin_of(refs[i]);
+            bin_counts[b]++;
+            bin_min[b] = glm::min(bin_min[b], leaf.aabb_min);
+            bin_max[b] = glm::max(bin_max[b], leaf.aabb_max);
+        }
+
+        // Right side costs of splitting before each bin
+        float right_cost[BUILD_BINS] = {};
+        glm::vec3 right_min = glm::vec3(FLT_MAX), right_max = glm::vec3(-FLT_MAX);
+        uint32_t right_count = 0;
+        for (uint32_t b = BUILD_BINS - 1; b > 0; b--) {
+            right_min = glm::min(right_min, bin_min[b]);
+            right_max = glm::max(right_max, bin_max[b]);
+            right_count += bin_counts[b];
+            right_cost[b] = right_count ? right_count * surface_area(right_min, right_max) : 0.0f;
+        }
+
+        float best_cost = FLT_MAX;
+        uint32_t best_split = 0;
+        glm::vec3 left_min = glm::vec3(FLT_MAX), left_max = glm::vec3(-FLT_MAX);
+        uint32_t left_count = 0;
+        for (uint32_t b = 1; b < BUILD_BINS; b++) {
+            left_min = glm::min(left_min, bin_min[b - 1]);
+            left_max = glm::max(left_max, bin_max[b - 1]);
+            left_count += bin_counts[b - 1];
+            if (left_count == 0 || left_count == count) continue;
+            float cost = left_count * surface_area(left_min, left_max) + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        if (best_split != 0) {
+            BuildRef* split = std::partition(refs.begin() + begin, refs.begin() + end, [&](const BuildRef& ref) {
+                return bin_of(ref) < best_split;
+            });
+            mid = (uint32_t)(split - refs.begin());
+        }
+    }
+
+    uint32_t left_count = mid - begin;
+    uint32_t child_depth = parallel_depth > 0 ? parallel_depth - 1 : 0;
+    uint32_t left = build(refs, begin, mid, internal, first_internal + 1, child_depth, tasks);
+    uint32_t right = build(refs, mid, end, internal, first_internal + left_count, child_depth, tasks);
+
+    Node& node = _nodes[index];
+    node.aabb_min = aabb_min;
+    node.aabb_max = aabb_max;
+    node.user = NIL;
+    node.children[0] = left;
+    node.children[1] = right;
+    _nodes[left].parent = index;
+    _nodes[right].parent = index;
+    return index;
+}
+
+void DynamicBvh::add_subtree(uint32_t root, Vector<uint32_t>& users) const {
+    Vector<uint32_t> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.pop_back()];
+        if (node.is_leaf()) {
+            users.push_back(node.user);
+        }
+        else {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+void DynamicBvh::query_frustum(const Frustum& frustum, Vector<uint32_t>& users) const {
+    if (cpu_supports_avx2()) {
+        query_frustum_avx2(frustum, users);
+    }
+    else {
+        query_frustum_scalar(frustum, users);
+    }
+}
+
+// Nodes outside of a plane are skipped, nodes inside of all of them add their whole subtree without further tests
+void DynamicBvh::query_frustum_scalar(const Frustum& frustum, Vector<uint32_t>& users) const {
+    ZoneScoped;
+
+    if (_root == NIL) return;
+
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop_back();
+        const Node& node = _nodes[index];
+        bool outside = false, inside = true;
+        for (const auto& plane : frustum.planes) {
+            glm::vec3 normal = glm::vec3(plane);
+            glm::bvec3 positive = glm::greaterThanEqual(normal, glm::vec3(0.0f));
+            glm::vec3 farthest = glm::mix(node.aabb_min, node.aabb_max, positive);
+            glm::vec3 nearest = glm::mix(node.aabb_max, node.aabb_min, positive);
+            if (glm::dot(normal, farthest) + plane.w < 0.0f) {
+                outside = true;
+                break;
+            }
+            inside &= glm::dot(normal, nearest) + plane.w >= 0.0f;
+        }
+
+        if (outside) continue;
+        if (inside) {
+            add_subtree(index, users);
+        }
+        else if (node.is_leaf()) {
+            users.push_back(node.user);
+        }
+        else {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+// All six planes at once in the lanes of a register, the last two lanes hold planes that everything is inside of
+CPU_TARGET_AVX2 void DynamicBvh::query_frustum_avx2(const Frustum& frustum, Vector<uint32_t>& users) const {
+    ZoneScoped;
+
+    if (_root == NIL) return;
+
+    alignas(32) float plane_x[8] = {}, plane_y[8] = {}, plane_z[8] = {}, plane_w[8] = {0, 0, 0, 0, 0, 0, 1, 1};
+    for (uint32_t i = 0; i < 6; i++) {
+        plane_x[i] = frustum.planes[i].x;
+        plane_y[i] = frustum.planes[i].y;
+        plane_z[i] = frustum.planes[i].z;
+        plane_w[i] = frustum.planes[i].w;
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 nx = _mm256_load_ps(plane_x);
+    const __m256 ny = _mm256_load_ps(plane_y);
+    const __m256 nz = _mm256_load_ps(plane_z);
+    const __m256 nw = _mm256_load_ps(plane_w);
+    const __m256 positive_x = _mm256_cmp_ps(nx, zero, _CMP_GE_OQ);
+    const __m256 positive_y = _mm256_cmp_ps(ny, zero, _CMP_GE_OQ);
+    const __m256 positive_z = _mm256_cmp_ps(nz, zero, _CMP_GE_OQ);
+
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        uint32_t index = stack.pop_back();
+        const Node& node = _nodes[index];
+        __m256 min_x = _mm256_set1_ps(node.aabb_min.x), max_x = _mm256_set1_ps(node.aabb_max.x);
+        __m256 min_y = _mm256_set1_ps(node.aabb_min.y), max_y = _mm256_set1_ps(node.aabb_max.y);
+        __m256 min_z = _mm256_set1_ps(node.aabb_min.z), max_z = _mm256_set1_ps(node.aabb_max.z);
+
+        __m256 farthest = _mm256_fmadd_ps(nx, _mm256_blendv_ps(min_x, max_x, positive_x),
+            _mm256_fmadd_ps(ny, _mm256_blendv_ps(min_y, max_y, positive_y),
+            _mm256_fmadd_ps(nz, _mm256_blendv_ps(min_z, max_z, positive_z), nw)));
+        if (_mm256_movemask_ps(_mm256_cmp_ps(farthest, zero, _CMP_LT_OQ)) != 0) continue;
+
+        __m256 nearest = _mm256_fmadd_ps(nx, _mm256_blendv_ps(max_x, min_x, positive_x),
+            _mm256_fmadd_ps(ny, _mm256_blendv_ps(max_y, min_y, positive_y),
+            _mm256_fmadd_ps(nz, _mm256_blendv_ps(max_z, min_z, positive_z), nw)));
+        if (_mm256_movemask_ps(_mm256_cmp_ps(nearest, zero, _CMP_LT_OQ)) == 0) {
+            add_subtree(index, users);
+        }
+        else if (node.is_leaf()) {
+            users.push_back(node.user);
+        }
+        else {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+void DynamicBvh::query_aabb(glm::vec3 aabb_min, glm::vec3 aabb_max, Vector<uint32_t>& users) const {
+    if (_root == NIL) return;
+
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.pop_back()];
+        if (!overlaps(node.aabb_min, node.aabb_max, aabb_min, aabb_max)) continue;
+        if (node.is_leaf()) {
+            users.push_back(node.user);
+        }
+        else {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+void DynamicBvh::query_ray(glm::vec3 origin, glm::vec3 dir, float max_t, Vector<uint32_t>& users) const {
+    if (_root == NIL) return;
+
+    Vector<uint32_t> stack;
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.pop_back()];
+        if (!intersect_ray_aabb(origin, dir, max_t, node.aabb_min, node.aabb_max)) continue;
+        if (node.is_leaf()) {
+            users.push_back(node.user);
+        }
+        else {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/frustum.h"
+
+#include <stdint.h>
+#include <glm/vec3.hpp>
+
+struct Pool;
+
+// Distance along the ray to where it enters the box, 0 if it starts inside
+bool intersect_ray_aabb(glm::vec3 origin, glm::vec3 dir, float max_t, glm::vec3 aabb_min, glm::vec3 aabb_max, float* t = nullptr);
+
+// Dynamic AABB tree with one leaf per box. Boxes are inserted next to the sibling that adds the least surface area
+// to the tree (branch and bound over the SAH cost of the insertion), moved boxes are refitted in place and the
+// nodes above them are rotated where that shrinks them. That keeps the tree good enough for a while, once cost()
+// has grown too much rebuild() replaces all of the internal nodes with a binned SAH build.
+// Leaves keep their index until they're removed, also across rebuilds, and carry a user value that queries return.
+class DynamicBvh {
+public:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    uint32_t insert(uint32_t user, glm::vec3 aabb_min, glm::vec3 aabb_max);
+    void remove(uint32_t leaf);
+    void refit(uint32_t leaf, glm::vec3 aabb_min, glm::vec3 aabb_max);
+
+    // Disjoint subtrees are built in parallel on the thread pool
+    void rebuild(Pool* thread_pool = nullptr);
+
+    // Summed surface area of the internal nodes relative to the root's, proportional to the cost of a query
+    float cost() const;
+
+    // Queries append the user values of the leaves whose boxes are touched, in no particular order
+    void query_frustum(const Frustum& frustum, Vector<uint32_t>& users) const;
+    void query_frustum_scalar(const Frustum& frustum, Vector<uint32_t>& users) const;
+    void query_frustum_avx2(const Frustum& frustum, Vector<uint32_t>& users) const;
+    void query_aabb(glm::vec3 aabb_min, glm::vec3 aabb_max, Vector<uint32_t>& users) const;
+    void query_ray(glm::vec3 origin, glm::vec3 dir, float max_t, Vector<uint32_t>& users) const;
+
+    uint32_t size() const { return _num_leaves; }
+    uint32_t height() const;
+    uint32_t user(uint32_t leaf) const { return _nodes[leaf].user; }
+    glm::vec3 aabb_min(uint32_t leaf) const { return _nodes[leaf].aabb_min; }
+    glm::vec3 aabb_max(uint32_t leaf) const { return _nodes[leaf].aabb_max; }
+
+    // Checks the links and that every node encloses its children, for tests
+    bool validate() const;
+
+private:
+    struct Node {
+        glm::vec3 aabb_min;
+        uint32_t parent;        // next free node while on the free list
+        glm::vec3 aabb_max;
+        uint32_t user;          // NIL for internal nodes
+        uint32_t children[2];
+
+        bool is_leaf() const { return user != NIL; }
+    };
+
+    struct BuildRef {
+        uint32_t leaf;
+        glm::vec3 centroid;
+    };
+
+    struct BuildTask {
+        uint32_t begin, end;
+        uint32_t first_internal;
+    };
+
+    uint32_t alloc_node();
+    void free_node(uint32_t node);
+    void insert_leaf(uint32_t leaf);
+    void refit_ancestors(uint32_t node);
+    void rotate(uint32_t node);
+    void update_bounds(uint32_t node);
+    void add_subtree(uint32_t node, Vector<uint32_t>& users) const;
+
+    uint32_t build(Span<BuildRef> refs, uint32_t begin, uint32_t end, Span<const uint32_t> internal,
+        uint32_t first_internal, uint32_t parallel_depth, Vector<BuildTask>* tasks);
+
+    Vector<Node> _nodes;
+    uint32_t _free_list = NIL;
+    uint32_t _root = NIL;
+    uint32_t _num_leaves = 0;
+};
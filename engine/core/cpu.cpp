@@ -0,0 +1,38 @@
+#include "cpu.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(int leaf, int subleaf, int regs[4]) {
+#ifdef _WIN32
+    __cpuidex(regs, leaf, subleaf);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+static bool detect_avx2() {
+    int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7) return false;
+
+    cpuid(1, 0, regs);
+    bool osxsave = regs[2] & (1 << 27);
+    bool avx = regs[2] & (1 << 28);
+    bool fma = regs[2] & (1 << 12);
+
+    cpuid(7, 0, regs);
+    bool avx2 = regs[1] & (1 << 5);
+
+    return osxsave && avx && fma && avx2;
+}
+
+bool cpu_supports_avx2() {
+    static bool supported = detect_avx2();
+    return supported;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Runtime CPU feature detection, results are cached after the first call.
+bool cpu_supports_avx2();
+
+// Marks a function as compiled for AVX2+FMA (needed by clang/gcc to use the intrinsics
+// without enabling AVX2 for the whole translation unit).
+#if defined(__clang__) || defined(__GNUC__)
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define CPU_TARGET_AVX2
+#endif
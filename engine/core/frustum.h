@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/geometric.hpp>
+
+// View frustum as 6 inward-facing planes (left, right, bottom, top, near, far), dot(plane, vec4(p, 1)) >= 0 inside.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb-Hartmann plane extraction from a projection*view matrix.
+    // The near plane uses the -w <= z convention, which is also conservative for [0, 1] depth.
+    static Frustum from_matrix(const glm::mat4& m) {
+        glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum f;
+        f.planes[0] = row3 + row0;
+        f.planes[1] = row3 - row0;
+        f.planes[2] = row3 + row1;
+        f.planes[3] = row3 - row1;
+        f.planes[4] = row3 + row2;
+        f.planes[5] = row3 - row2;
+        for (auto& plane : f.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        return f;
+    }
+
+    // Conservative test, may return true for boxes that are just outside near the frustum corners.
+    bool intersects_aabb(glm::vec3 aabb_min, glm::vec3 aabb_max) const {
+        for (const auto& plane : planes) {
+            // Corner of the box furthest along the plane normal
+            glm::vec3 p = glm::vec3(
+                plane.x >= 0 ? aabb_max.x : aabb_min.x,
+                plane.y >= 0 ? aabb_max.y : aabb_min.y,
+                plane.z >= 0 ? aabb_max.z : aabb_min.z);
+            if (glm::dot(glm::vec3(plane), p) + plane.w < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersects_sphere(glm::vec3 center, float radius) const {
+        for (const auto& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,120 @@
+#include "lz.h"
+
+#include <string.h>
+
+static constexpr uint32_t LZ_MIN_MATCH = 4;
+static constexpr uint32_t LZ_MAX_OFFSET = 65535;
+static constexpr uint32_t LZ_HASH_BITS = 14;
+
+static inline uint32_t lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void lz_write_length(Vector<uint8_t>& out, uint32_t len) {
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back((uint8_t)len);
+}
+
+static void lz_write_sequence(Vector<uint8_t>& out, const uint8_t* literals, uint32_t lit_len,
+                              uint32_t offset, uint32_t match_len) {
+    uint32_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4) | (uint8_t)(ml < 15 ? ml : 15);
+    out.push_back(token);
+    if (lit_len >= 15) lz_write_length(out, lit_len - 15);
+    if (lit_len) out.append(literals, lit_len);
+    if (match_len) {
+        out.push_back((uint8_t)(offset & 0xFF));
+        out.push_back((uint8_t)(offset >> 8));
+        if (ml >= 15) lz_write_length(out, ml - 15);
+    }
+}
+
+Vector<uint8_t> lz_compress(Span<const uint8_t> src) {
+    Vector<uint8_t> out;
+    out.reserve(src.size() / 2 + 16);
+
+    const uint8_t* base = src.data();
+    const uint32_t n = src.size();
+
+    int32_t table[1 << LZ_HASH_BITS];
+    for (int32_t& t : table) t = -1;
+
+    uint32_t ip = 0, anchor = 0;
+    while (n >= LZ_MIN_MATCH && ip <= n - LZ_MIN_MATCH) {
+        uint32_t seq = lz_read32(base + ip);
+        uint32_t h = lz_hash(seq);
+        int32_t ref = table[h];
+        table[h] = (int32_t)ip;
+
+        if (ref < 0 || ip - (uint32_t)ref > LZ_MAX_OFFSET || lz_read32(base + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        uint32_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < n && base[ref + match_len] == base[ip + match_len]) {
+            match_len++;
+        }
+        lz_write_sequence(out, base + anchor, ip - anchor, ip - (uint32_t)ref, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    // Trailing literals, terminated without a match
+    lz_write_sequence(out, base + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+bool lz_decompress(Span<const uint8_t> src, Span<uint8_t> dst) {
+    const uint8_t* ip = src.data();
+    const uint8_t* ip_end = ip + src.size();
+    uint8_t* op = dst.data();
+    uint8_t* op_end = op + dst.size();
+
+    auto read_length = [&](uint32_t len) -> int64_t {
+        if (len < 15) return len;
+        uint8_t b;
+        do {
+            if (ip >= ip_end) return -1;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return len;
+    };
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        int64_t lit_len = read_length(token >> 4);
+        if (lit_len < 0 || lit_len > ip_end - ip || lit_len > op_end - op) return false;
+        if (lit_len) memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == ip_end) break;
+
+        if (ip_end - ip < 2) return false;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int64_t match_len = read_length(token & 0xF);
+        if (match_len < 0) return false;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - dst.data() || match_len > op_end - op) return false;
+
+        // Byte-wise copy, matches may overlap the output
+        const uint8_t* match = op - offset;
+        for (int64_t i = 0; i < match_len; i++) {
+            op[i] = match[i];
+        }
+        op += match_len;
+    }
+    return op == op_end;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+
+// Minimal LZ77 byte compressor (LZ4-style block layout: token, literals, 16-bit offset, match length).
+// Fast enough to run per frame on a worker thread, no external dependencies.
+
+Vector<uint8_t> lz_compress(Span<const uint8_t> src);
+
+// dst must be exactly the size of the uncompressed data. Returns false on malformed input.
+bool lz_decompress(Span<const uint8_t> src, Span<uint8_t> dst);
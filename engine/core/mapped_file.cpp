@@ -0,0 +1,102 @@
+#include "core/mapped_file.h"
+#include "core/log.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* filename) {
+    close();
+
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_error("Failed to open file {}!", filename);
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        log_error("Failed to map empty file {}!", filename);
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        log_error("Failed to map file {}!", filename);
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    _file_handle = file;
+    _mapping_handle = mapping;
+    _data = (const uint8_t*)view;
+    _size = (size_t)file_size.QuadPart;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping_handle);
+        CloseHandle(_file_handle);
+    }
+    _data = nullptr;
+    _size = 0;
+    _file_handle = nullptr;
+    _mapping_handle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const char* filename) {
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        log_error("Failed to open file {}!", filename);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        log_error("Failed to map empty file {}!", filename);
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        log_error("Failed to map file {}!", filename);
+        ::close(fd);
+        return false;
+    }
+    madvise(view, (size_t)st.st_size, MADV_RANDOM);
+
+    _fd = fd;
+    _data = (const uint8_t*)view;
+    _size = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap((void*)_data, _size);
+        ::close(_fd);
+    }
+    _data = nullptr;
+    _size = 0;
+    _fd = -1;
+}
+
+#endif
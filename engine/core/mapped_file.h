@@ -0,0 +1,40 @@
+#pragma once
+
+#include "core/span.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Read-only memory mapping of a whole file.
+// Nothing is read up front, pages are brought in by the OS the first time they're touched.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* filename);
+    void close();
+
+    bool is_open() const { return _data != nullptr; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // Returns an empty span if the range isn't inside the file.
+    Span<const uint8_t> range(uint64_t offset, uint64_t size) const {
+        if (offset > _size || size > _size - offset) return {};
+        return Span<const uint8_t>(_data + offset, (uint32_t)size);
+    }
+
+private:
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* _file_handle = nullptr;
+    void* _mapping_handle = nullptr;
+#else
+    int _fd = -1;
+#endif
+};
@@ -14,7 +14,7 @@ class Vector {
 public:
     Vector(uint32_t size = 0) : _capacity(size), _size(size), _data(size ? new T[size] : nullptr) {}
 
-    Vector(uint32_t size, const T& item) {
+    Vector(uint32_t size, const T& item) : _capacity(size), _size(size), _data(size ? new T[size] : nullptr) {
         for (uint32_t i = 0; i < _size; i++) {
             _data[i] = item;
         }
@@ -94,6 +94,12 @@ public:
         return _data[_size++];
     }
 
+    void append(const T* items, uint32_t n) {
+        ensure_capacity(_size + n);
+        copy(items, n, _data + _size);
+        _size += n;
+    }
+
     template <class ...Args>
     void emplace_back(Args&&... args) {
         ensure_capacity(_size + 1);
@@ -106,7 +112,7 @@ public:
 
     void resize(uint32_t new_size) {
         T* new_data = new T[new_size];
-        copy(_data, _size, new_data);
+        copy(_data, _size < new_size ? _size : new_size, new_data);
         delete[] _data;
         _data = new_data;
         _capacity = _size = new_size;
@@ -129,6 +135,11 @@ public:
         _capacity = _size = 0;
     }
 
+    // Drops the elements past new_size but keeps the memory, for containers that are refilled every frame
+    void truncate(uint32_t new_size = 0) {
+        if (new_size < _size) _size = new_size;
+    }
+
     T* find(const T& item) {
         for (uint32_t i = 0; i < _size; i++) {
             if (_data[i] == item) return &_data[i];
@@ -256,6 +256,19 @@ public:
 		return components[cid];
 	}
 
+	// nullptr if the entity doesn't have the component
+	template <class Component>
+	Component* try_get_component(Entity entity) {
+		constexpr uint32_t ctid = (uint32_t)get_component_enum<Component>();
+		uint32_t eid = get_entity_index(entity);
+		auto& storage = _comp_storages[ctid];
+		if (storage.sparse == nullptr) return nullptr;
+		uint32_t cid = storage.sparse[eid];
+		if (cid == NIL) return nullptr;
+		Component* components = static_cast<Component*>(storage.dense);
+		return &components[cid];
+	}
+
 	template <class... Component>
 	class Query {
 	private:
@@ -267,25 +280,26 @@ public:
 
 		template <class Fun>
 		void foreach(Fun&& fun) {
+			foreach_range(0, size(), std::forward<Fun>(fun));
+		}
+
+		// Number of entries foreach_range() goes through (not all of them have to match the query)
+		uint32_t size() const {
+			return _ecs->_comp_storages[driving_ctid()].dense_size;
+		}
+
+		// Visits the entries [begin, end) of the query, disjoint ranges can be visited from multiple threads at once.
+		template <class Fun>
+		void foreach_range(uint32_t begin, uint32_t end, Fun&& fun) {
 			constexpr uint32_t num_components = sizeof...(Component);
-			static_assert(num_components >= 1, "Invalid usage of _ecs foreach: no components specified!");
 			constexpr Array<uint32_t, num_components> ctids = {get_component_enum<Component>()...};
-			uint32_t min_ctid = ctids[0];
-			uint32_t min_ctid_size = _ecs->_comp_storages[min_ctid].dense_size;
-			for (uint32_t i = 1; i < ctids.size(); i++) {
-				uint32_t cur_ctid = ctids[i];
-				uint32_t cur_ctid_size = _ecs->_comp_storages[cur_ctid].dense_size;
-				if (min_ctid_size < cur_ctid_size) {
-					min_ctid = cur_ctid;
-					min_ctid_size = cur_ctid_size;
-				}
-			}
+			uint32_t min_ctid = driving_ctid();
 			auto& min_comp_storage = _ecs->_comp_storages[min_ctid];
 			Array<void*, num_components> cur_compoments;
 			for (uint32_t k = 0; k < num_components; k++) {
 				cur_compoments[k] = nullptr;
 			}
-			for (uint32_t i = 0; i < min_comp_storage.dense_size; i++) {
+			for (uint32_t i = begin; i < end; i++) {
 				uint32_t eid = min_comp_storage.dense_to_sparse[i];
 				uint32_t entity_gen = _ecs->_entity_sparse[_ecs->_entity_dense_to_sparse[eid]].generation;
 				bool found = true;
@@ -313,6 +327,24 @@ public:
 		}
 
 	private:
+		// Component storage whose dense array drives the iteration
+		uint32_t driving_ctid() const {
+			constexpr uint32_t num_components = sizeof...(Component);
+			static_assert(num_components >= 1, "Invalid usage of _ecs foreach: no components specified!");
+			constexpr Array<uint32_t, num_components> ctids = {get_component_enum<Component>()...};
+			uint32_t min_ctid = ctids[0];
+			uint32_t min_ctid_size = _ecs->_comp_storages[min_ctid].dense_size;
+			for (uint32_t i = 1; i < ctids.size(); i++) {
+				uint32_t cur_ctid = ctids[i];
+				uint32_t cur_ctid_size = _ecs->_comp_storages[cur_ctid].dense_size;
+				if (min_ctid_size < cur_ctid_size) {
+					min_ctid = cur_ctid;
+					min_ctid_size = cur_ctid_size;
+				}
+			}
+			return min_ctid;
+		}
+
 		template <class Fun, int... Is>
 		void call_foreach_fun(Fun&& fun, Entity entity, const Array<void*, sizeof...(Component)>& comp_ptrs, index_list<Is...>) {
 			fun(entity, *static_cast<Component*>(comp_ptrs[Is])...);
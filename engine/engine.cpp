@@ -153,6 +153,7 @@ void Engine::init_internal() {
 void Engine::cleanup_internal() {
     ZoneScoped; 
 
+    model_loader->unload();
     mesh_renderer->cleanup();
     wireframe->cleanup();
     imgui->cleanup();
@@ -174,6 +175,9 @@ void Engine::run() {
 
     init();
 
+    // The engine's and the game's render interfaces only queued their pipelines, compile them all at once
+    renderer->build_pipelines();
+
     is_initialized = true;
 
     SDL_Event e;
@@ -259,6 +263,8 @@ void Engine::run() {
 
         ImGui::Render();
 
+        // begin_frame() waits for the previous frame's recording and snapshots this one, render() then records
+        // and presents it on the thread pool while the loop goes on with the next frame's update
         renderer->begin_frame();
         renderer->render();
         renderer->end_frame();
@@ -9,14 +9,19 @@
 #include "res.h"
 #include "model_loader.h"
 #include "terrain.h"
+#include "terrain_cache.h"
 
 #include "render/imgui_renderer.h"
+#include "render/im3d_renderer.h"
+#include "render/mesh_renderer.h"
 
 #include "systems/observer.h"
 #include "systems/player.h"
 #include "systems/controls.h"
 #include "systems/boid.h"
 
+#include "nanothread/nanothread.h"
+
 class Flock3DApp : public Engine {
 public:
     ENGINE_IMPL(Flock3DApp)
@@ -26,16 +31,23 @@ public:
     void cleanup() override;
 
     UniquePtr<Terrain> terrain;
+    UniquePtr<TerrainHeightCache> terrain_cache;
     UniquePtr<BoidSystem> boid_system;
     UniquePtr<TerrainRenderer> terrain_renderer;
 
     Entity observer, player;
+    bool draw_boid_velocities = false;
+
+private:
+    void update_terrain_occluders(glm::vec2 center);
+    void draw_boid_velocity_lines();
 };
 
 void Flock3DApp::init() {
     terrain = UniquePtr(new Terrain());
     srand(time(nullptr));
     terrain->seed = rand();
+    terrain_cache = UniquePtr(new TerrainHeightCache(thread_pool, terrain.get()));
 
     BoidConfig boid_cfg;
     boid_system = UniquePtr(new BoidSystem(ecs.get(), thread_pool, boid_cfg));
@@ -173,9 +185,15 @@ void Flock3DApp::update() {
     float dt = get_cur_deltatime();
 
     update_observer(ecs.get(), pressed_keys, window_extent, mouse_offset, dt);
-    update_player(ecs.get(), *terrain, pressed_keys, window_extent, mouse_offset, dt);
+    auto& player_comp = ecs->get_component<Player>(player);
+    terrain_cache->update(glm::vec2(player_comp.pos.x, player_comp.pos.z));
+    update_terrain_occluders(glm::vec2(player_comp.pos.x, player_comp.pos.z));
+    update_player(ecs.get(), *terrain_cache, pressed_keys, window_extent, mouse_offset, dt);
 
     boid_system->update(dt);
+    if (draw_boid_velocities) {
+        draw_boid_velocity_lines();
+    }
 
     // _camera->imgui();
 
@@ -190,6 +208,8 @@ void Flock3DApp::update() {
         update_fps_controls_imgui(ecs->get_component<FPSControls>(player));
     }
     if (ImGui::CollapsingHeader("Terrain")) {
+        const char* noise_names[] = {"Hash", "Table"};
+        ImGui::Combo("noise", (int*)&terrain->noise, noise_names, IM_ARRAYSIZE(noise_names));
         ImGui::DragFloat("scale", &terrain->scale, 0.01f);
         ImGui::SliderInt("octaves", &terrain->octaves, 1, 4);
         ImGui::InputInt("seed", &terrain->seed);
@@ -197,17 +217,57 @@ void Flock3DApp::update() {
         ImGui::SliderFloat("lacunarity", &terrain->lacunarity, 1.0f, 10.0f);
         ImGui::DragFloat("chunk_width", &terrain->chunk_width, 0.01f);
         ImGui::DragFloat("height_multiplier", &terrain->height_multiplier, 0.01f);
+        auto quadtree = terrain_renderer->quadtree();
+        ImGui::SliderInt("max_level", &quadtree->max_level, 0, 10);
+        ImGui::SliderInt("root_radius", &quadtree->root_radius, 0, 4);
+        ImGui::DragFloat("lod_distance", &quadtree->lod_distance, 0.01f, 0.5f, 8.0f);
+        ImGui::Checkbox("frustum_culling", &quadtree->frustum_culling);
+        ImGui::Text("nodes: %u drawn, %u culled, %u pending", quadtree->num_selected, quadtree->num_culled, quadtree->num_pending);
+        ImGui::Text("clipmap: %u levels pending", terrain_renderer->clipmap()->num_pending());
+    }
+    if (ImGui::CollapsingHeader("Meshes")) {
+        ImGui::Checkbox("occlusion_culling", &mesh_renderer->occlusion_culling);
+        ImGui::Text("meshes occluded: %u", mesh_renderer->num_occluded);
+        const auto& entity_bvh = renderer->get_entity_bvh();
+        ImGui::Text("entities: %u in view of %u", renderer->get_visible_entities().size(), entity_bvh.tree().size());
+        ImGui::Text("entity bvh: cost %.1f, %u refits%s", entity_bvh.tree().cost(), entity_bvh.num_refits,
+            entity_bvh.rebuilt ? ", rebuilt" : "");
     }
     if (ImGui::CollapsingHeader("Boids")) {
         auto& cfg = boid_system->cfg;
         ImGui::DragFloat("nearby_dist", &cfg.nearby_dist, 0.1f);
-        ImGui::DragFloat("avoid_dist", &cfg.avoid_dist, 0.1f);
+        ImGui::DragFloat("avoid_dist", &cfg.avoid_dist, 0.1f, 0.0f, cfg.nearby_dist, "%.3f", ImGuiSliderFlags_AlwaysClamp);
         ImGui::DragFloat("pos_match_factor", &cfg.pos_match_factor, 0.1f);
         ImGui::DragFloat("vel_match_factor", &cfg.vel_match_factor, 0.1f);
         ImGui::DragFloat("avoid_factor", &cfg.avoid_factor, 0.1f);
         ImGui::DragFloat("target_follow_factor", &cfg.target_follow_factor, 0.1f);
         ImGui::DragFloat("vel_limit", &cfg.vel_limit, 0.1f);
         ImGui::DragFloat("angvel_limit", &cfg.angvel_limit, 0.1f);
+        ImGui::CheckboxFlags("cohesion", &cfg.rules, BOID_RULE_COHESION);
+        ImGui::CheckboxFlags("alignment", &cfg.rules, BOID_RULE_ALIGNMENT);
+        ImGui::CheckboxFlags("separation", &cfg.rules, BOID_RULE_SEPARATION);
+        ImGui::CheckboxFlags("target_follow", &cfg.rules, BOID_RULE_TARGET_FOLLOW);
+        ImGui::CheckboxFlags("speed_limit", &cfg.rules, BOID_RULE_SPEED_LIMIT);
+        ImGui::Checkbox("draw_velocities", &draw_boid_velocities);
+
+        if (boid_system->is_recording()) {
+            ImGui::Text("Recording: %u frames", boid_system->recorder->num_frames());
+            if (ImGui::Button("Stop recording")) boid_system->stop_recording();
+        }
+        else if (!boid_system->is_playing() && ImGui::Button("Record")) {
+            boid_system->start_recording("boids.rec");
+        }
+        if (boid_system->is_playing()) {
+            int frame = boid_system->playback_frame;
+            if (ImGui::SliderInt("frame", &frame, 0, (int)boid_system->player->num_frames() - 1)) {
+                boid_system->playback_frame = frame;
+            }
+            ImGui::Checkbox("paused", &boid_system->playback_paused);
+            if (ImGui::Button("Stop playback")) boid_system->stop_playback();
+        }
+        else if (!boid_system->is_recording() && ImGui::Button("Play recording")) {
+            boid_system->start_playback("boids.rec");
+        }
 
         if (ImGui::BeginTable("Boid Table", 3)) {
             ImGui::TableSetupColumn("Boid");
@@ -237,8 +297,42 @@ void Flock3DApp::update() {
     ImGui::End();
 }
 
+// The cached ring of terrain tiles as occluders for the meshes, in cells of 8x8 cache samples
+void Flock3DApp::update_terrain_occluders(glm::vec2 center) {
+    constexpr int OCCLUDER_LEVEL = 3;
+    constexpr int CELLS_PER_TILE = TerrainHeightCache::TILE_RES >> OCCLUDER_LEVEL;
+
+    auto& occluders = mesh_renderer->occluders();
+    int ring_width = 2 * terrain_cache->ring_radius() + 1;
+    glm::ivec2 first_tile = terrain_cache->tile_coord(center) - terrain_cache->ring_radius();
+    occluders.cell_size = terrain_cache->tile_size() / CELLS_PER_TILE;
+    occluders.res = ring_width * CELLS_PER_TILE;
+    occluders.origin = glm::vec2(first_tile) * terrain_cache->tile_size();
+    if (occluders.min_heights.size() != occluders.res * occluders.res) {
+        occluders.min_heights.resize(occluders.res * occluders.res);
+    }
+    terrain_cache->min_heights(OCCLUDER_LEVEL, first_tile * CELLS_PER_TILE, occluders.res, occluders.min_heights);
+}
+
+// Every block of boids goes into the Im3d staging of the thread that drew it, in one bulk push
+void Flock3DApp::draw_boid_velocity_lines() {
+    auto boids = ecs->get_component_array<Boid>();
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, boids.size(), 1024), [&](auto range) {
+        Vector<glm::vec3> lines;
+        lines.reserve(2 * (range.end() - range.begin()));
+        for (uint32_t i : range) {
+            lines.push_back(boids[i].pos);
+            lines.push_back(boids[i].pos + boids[i].vel);
+        }
+        auto& staging = im3d->thread_staging();
+        staging.set_line_color(glm::vec4(1.0f, 0.8f, 0.0f, 1.0f));
+        staging.push_lines(Span<const glm::vec3>(lines.data(), lines.size()));
+    }, thread_pool);
+}
+
 void Flock3DApp::cleanup() {
     terrain_renderer->cleanup();
+    terrain_cache.reset();
 
     Engine::cleanup();
 }
@@ -267,16 +267,12 @@ void ModelLoader::load(const char* path) {
     }
 
     // Load all textures and upload to GPU
-    VkCommandBuffer cmd_buffer = _renderer->begin_single_time_commands();
-    Vector<Buffer> staging_buffers;
-    staging_buffers.reserve(image_data_pool.size());
     image_data_pool.foreach_with_ref([&](Ref<GLTFImageCpuData> img_data_id, GLTFImageCpuData& img_data) {
         if (!img_data.path.empty()) {
             img_data.load_from_file(img_data.path, img_data.data_channels);
         }
         Image* image;
         std::tie(img_data.image_id, image) = res->_image_pool.emplace();
-        auto& staging_buffer = staging_buffers.push_empty();
         VkFormat format;
         if (img_data.type == ImageType::BaseColor) {
             format = VK_FORMAT_R8G8B8A8_SRGB;
@@ -287,7 +283,7 @@ void ModelLoader::load(const char* path) {
         else if (img_data.type == ImageType::AO) {
             format = VK_FORMAT_R8_SNORM;
         }
-        _renderer->upload_to_gpu(cmd_buffer, img_data, format, *image, staging_buffer);
+        _renderer->upload_to_gpu(img_data, format, *image);
         img_data.texture_id = _renderer->create_texture(*image, format);
     });
 
@@ -300,15 +296,8 @@ void ModelLoader::load(const char* path) {
             mesh_cpu.aabb_max = glm::max(mesh_cpu.aabb_max, vert.pos);
         }
         auto [mesh_id, mesh] = res->_textured_mesh_pool.emplace();
-        Buffer vertex_staging_buffer, index_staging_buffer;
-        _renderer->create_static_render_buffer_from_cpu(cmd_buffer, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            mesh_cpu.vertices.data(), mesh_cpu.vertices.size() * sizeof(TexturedVertex),
-            vertex_staging_buffer, mesh->vertex_buffer);
-        _renderer->create_static_render_buffer_from_cpu(cmd_buffer, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            mesh_cpu.indices.data(), mesh_cpu.indices.size() * sizeof(uint16_t),
-            index_staging_buffer, mesh->index_buffer);
-        mesh->vertex_count = mesh_cpu.vertices.size();
-        mesh->index_count = mesh_cpu.indices.size();
+        _renderer->create_mesh_geometry(*mesh, mesh_cpu.vertices.data(), mesh_cpu.vertices.size(),
+            mesh_cpu.indices.data(), mesh_cpu.indices.size());
         mesh->aabb_min = mesh_cpu.aabb_min;
         mesh->aabb_max = mesh_cpu.aabb_max;
         auto [mat_id, mat] = res->_material_pool.emplace();
@@ -322,8 +311,7 @@ void ModelLoader::load(const char* path) {
         mat->albedo_tex_id = albedo_img->texture_id;
         mat->metallic_roughness_tex_id = mr_img->texture_id;
         mat->ao_tex_id = ao_img->texture_id;
-        staging_buffers.push_back(vertex_staging_buffer);
-        staging_buffers.push_back(index_staging_buffer);
+        _renderer->set_material_dirty(mat_id);
 
         Model& model = _models.at(mesh_cpu.model_name);
         model.meshes.push_back(mesh_id);
@@ -339,12 +327,6 @@ void ModelLoader::load(const char* path) {
         }
     }
 
-    _renderer->end_single_time_commands(cmd_buffer);
-    for (auto& staging_buffer : staging_buffers) {
-        _renderer->destroy_buffer(staging_buffer);
-    }
-    staging_buffers.clear();
-
     image_data_pool.get(default_base_color_img_data_id)->pixels = nullptr;
     image_data_pool.get(default_mr_img_data_id)->pixels = nullptr;
     image_data_pool.get(default_ao_img_data_id)->pixels = nullptr;
@@ -355,5 +337,14 @@ void ModelLoader::load(const char* path) {
 }
 
 void ModelLoader::unload() {
-
+    auto res = Res::inst();
+    for (auto& [name, model] : _models) {
+        for (auto mesh_id : model.meshes) {
+            TexturedMesh* mesh = res->get(mesh_id);
+            _renderer->destroy_mesh_geometry(*mesh);
+            res->_material_pool.release(mesh->mat_id);
+            res->_textured_mesh_pool.release(mesh_id);
+        }
+    }
+    _models.clear();
 }
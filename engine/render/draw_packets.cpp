@@ -0,0 +1,121 @@
+#include "draw_packets.h"
+
+#include <string.h>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+uint64_t make_draw_sort_key(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+    // Non-negative floats sort like their bit patterns, the top 24 bits keep the exponent and 15 bits of mantissa
+    uint32_t depth_bits = 0;
+    if (depth > 0.0f) {
+        memcpy(&depth_bits, &depth, sizeof(float));
+        depth_bits >>= 32 - DRAW_KEY_DEPTH_BITS;
+    }
+    return ((uint64_t)(pipeline & 0xFF) << 56)
+         | ((uint64_t)(material & 0xFFF) << 44)
+         | ((uint64_t)(mesh & 0xFFFFF) << DRAW_KEY_DEPTH_BITS)
+         | (uint64_t)depth_bits;
+}
+
+void radix_sort_draw_packets(Span<DrawPacket> packets, Span<DrawPacket> scratch) {
+    ZoneScoped;
+
+    const uint32_t n = packets.size();
+    if (n <= 1) return;
+
+    // Histograms of all 8 bytes in a single pass
+    uint32_t counts[8][256] = {};
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t key = packets[i].sort_key;
+        for (int b = 0; b < 8; b++) {
+            counts[b][(key >> (8 * b)) & 0xFF]++;
+        }
+    }
+
+    DrawPacket* src = packets.data();
+    DrawPacket* dst = scratch.data();
+    for (int b = 0; b < 8; b++) {
+        uint32_t* count = counts[b];
+        if (count[(src[0].sort_key >> (8 * b)) & 0xFF] == n) continue;
+
+        uint32_t offsets[256];
+        uint32_t offset = 0;
+        for (int d = 0; d < 256; d++) {
+            offsets[d] = offset;
+            offset += count[d];
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            dst[offsets[(src[i].sort_key >> (8 * b)) & 0xFF]++] = src[i];
+        }
+        DrawPacket* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != packets.data()) {
+        memcpy(packets.data(), src, sizeof(DrawPacket) * n);
+    }
+}
+
+void DrawPacketList::begin(Pool* thread_pool) {
+    // Worker ids go from 1 to pool_size(), threads outside of the pool get 0
+    uint32_t num_arenas = pool_size(thread_pool) + 1;
+    if (_arenas.size() != num_arenas) {
+        _arenas.clear();
+        _arenas.resize(num_arenas);
+    }
+    for (auto& arena : _arenas) {
+        arena.packets.truncate();
+        arena.transforms.truncate();
+    }
+}
+
+DrawPacketArena& DrawPacketList::arena() {
+    return _arenas[pool_thread_id()];
+}
+
+void DrawPacketList::finish() {
+    ZoneScoped;
+
+    uint32_t num_packets = 0, num_transforms = 0;
+    for (const auto& arena : _arenas) {
+        num_packets += arena.packets.size();
+        num_transforms += arena.transforms.size();
+    }
+    if (_packets.size() != num_packets) {
+        _packets.resize(num_packets);
+        _scratch.resize(num_packets);
+        _instance_transforms.resize(num_packets);
+    }
+    if (_transforms.size() != num_transforms) {
+        _transforms.resize(num_transforms);
+    }
+
+    // Merge the arenas, transform indices become global
+    uint32_t packet_offset = 0, transform_offset = 0;
+    for (const auto& arena : _arenas) {
+        for (uint32_t i = 0; i < arena.packets.size(); i++) {
+            DrawPacket packet = arena.packets[i];
+            packet.transform += transform_offset;
+            _packets[packet_offset + i] = packet;
+        }
+        memcpy(_transforms.data() + transform_offset, arena.transforms.data(), sizeof(glm::mat4) * arena.transforms.size());
+        packet_offset += arena.packets.size();
+        transform_offset += arena.transforms.size();
+    }
+
+    radix_sort_draw_packets(_packets, _scratch);
+
+    _batches.truncate();
+    for (uint32_t i = 0; i < num_packets; i++) {
+        const auto& packet = _packets[i];
+        _instance_transforms[i] = _transforms[packet.transform];
+        if (_batches.empty() || !same_draw_state(_packets[i - 1].sort_key, packet.sort_key)
+            || _packets[i - 1].mesh != packet.mesh || _packets[i - 1].material != packet.material) {
+            _batches.push_back(DrawBatch{packet.mesh, packet.material, (uint32_t)(packet.sort_key >> 56), i, 0});
+        }
+        _batches.back().instance_count++;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+#include "core/storage.h"
+
+#include <glm/mat4x4.hpp>
+
+struct Pool;
+struct TexturedMesh;
+
+// One mesh of one entity to draw. Packets are produced by the extraction pass on the thread pool,
+// recording only walks the sorted packets and never touches the ECS.
+struct DrawPacket {
+    uint64_t sort_key;
+    Ref<TexturedMesh> mesh;
+    uint32_t material;          // index into the material buffer
+    uint32_t transform;         // index into the transforms of the arena, into DrawPacketList::transforms() after finish()
+};
+
+// Sort key, most significant first: pipeline (8 bits) | material (12 bits) | mesh (20 bits) | depth (24 bits).
+// Sorting by it minimizes state changes, packets with the same pipeline, material and mesh end up next to
+// each other so that they can be drawn instanced, and within such a run they're ordered front to back.
+// The fields are truncated to their bits, so packets whose indices collide can share a key; batches are also split
+// on the packets' own mesh and material.
+static constexpr int DRAW_KEY_DEPTH_BITS = 24;
+
+uint64_t make_draw_sort_key(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+inline bool same_draw_state(uint64_t key_a, uint64_t key_b) {
+    return (key_a >> DRAW_KEY_DEPTH_BITS) == (key_b >> DRAW_KEY_DEPTH_BITS);
+}
+
+// Stable LSD radix sort by sort_key, 8 bits per pass. Passes in which all keys have the same byte are skipped,
+// so sorting keys that only differ in a few fields is cheap. scratch needs the same size as packets.
+void radix_sort_draw_packets(Span<DrawPacket> packets, Span<DrawPacket> scratch);
+
+// A run of sorted packets with the same draw state, drawn with one instanced draw call
+struct DrawBatch {
+    Ref<TexturedMesh> mesh;
+    uint32_t material;
+    uint32_t pipeline;
+    uint32_t first_instance;
+    uint32_t instance_count;
+};
+
+// Per thread storage of the extraction pass. Aligned so that threads don't share cache lines while appending.
+struct alignas(64) DrawPacketArena {
+    Vector<DrawPacket> packets;
+    Vector<glm::mat4> transforms;
+
+    // Returns the index to put in DrawPacket::transform
+    uint32_t add_transform(const glm::mat4& transform) {
+        transforms.push_back(transform);
+        return transforms.size() - 1;
+    }
+};
+
+// Collects the draw packets of a frame from the workers of a thread pool, then merges and sorts them.
+// Usage: begin(), fill arena() from the pool's workers (or the calling thread), finish().
+class DrawPacketList {
+public:
+    void begin(Pool* thread_pool = nullptr);
+
+    // Arena of the calling thread
+    DrawPacketArena& arena();
+
+    void finish();
+
+    Span<const DrawPacket> packets() const { return Span<const DrawPacket>(_packets.data(), _packets.size()); }
+    Span<const glm::mat4> transforms() const { return Span<const glm::mat4>(_transforms.data(), _transforms.size()); }
+    Span<const DrawBatch> batches() const { return Span<const DrawBatch>(_batches.data(), _batches.size()); }
+
+    // Transform of each sorted packet, instance i of a batch uses instance_transforms()[first_instance + i]
+    Span<const glm::mat4> instance_transforms() const {
+        return Span<const glm::mat4>(_instance_transforms.data(), _instance_transforms.size());
+    }
+
+private:
+    Vector<DrawPacketArena> _arenas;
+    Vector<DrawPacket> _packets;
+    Vector<DrawPacket> _scratch;
+    Vector<glm::mat4> _transforms;
+    Vector<glm::mat4> _instance_transforms;
+    Vector<DrawBatch> _batches;
+};
@@ -0,0 +1,154 @@
+#include "entity_bvh.h"
+
+#include "renderer.h"
+#include "res.h"
+#include "nanothread/nanothread.h"
+
+#include <float.h>
+
+#include <glm/common.hpp>
+
+#include "tracy/Tracy.hpp"
+
+// Leaf boxes are padded by this much of the entity's size plus a constant, in world units
+constexpr float LEAF_MARGIN_RELATIVE = 0.1f;
+constexpr float LEAF_MARGIN = 0.05f;
+// Refits have made the tree this much more expensive than right after the last rebuild
+constexpr float REBUILD_COST_RATIO = 1.5f;
+
+static void transform_aabb(const glm::mat4& m, glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3& out_min, glm::vec3& out_max) {
+    glm::vec3 center = glm::vec3(m * glm::vec4(0.5f * (aabb_min + aabb_max), 1.0f));
+    glm::vec3 half_extent = 0.5f * (aabb_max - aabb_min);
+    glm::vec3 extent = glm::abs(glm::vec3(m[0])) * half_extent.x
+        + glm::abs(glm::vec3(m[1])) * half_extent.y
+        + glm::abs(glm::vec3(m[2])) * half_extent.z;
+    out_min = center - extent;
+    out_max = center + extent;
+}
+
+static bool contains(glm::vec3 outer_min, glm::vec3 outer_max, glm::vec3 inner_min, glm::vec3 inner_max) {
+    return glm::all(glm::lessThanEqual(outer_min, inner_min)) && glm::all(glm::greaterThanEqual(outer_max, inner_max));
+}
+
+void EntityBvh::update(ECS* ecs, Pool* thread_pool) {
+    ZoneScoped;
+
+    _update_count++;
+    num_refits = 0;
+    rebuilt = false;
+
+    // World bounds are computed in parallel into the slots of the query, the tree is updated serially after
+    auto res = Res::inst();
+    auto query = ecs->query<Model, Transform>();
+    _bounds.resize(query.size());
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, query.size(), 256), [&](auto range) {
+        ZoneScopedN("EntityWorldBounds");
+        for (uint32_t i : range) {
+            _bounds[i].valid = false;
+        }
+        uint32_t slot = range.begin();
+        query.foreach_range(range.begin(), range.end(), [&](Entity entity, Model& model, const Transform& transform) {
+            glm::mat4 model_mat = transform.to_matrix();
+            glm::vec3 aabb_min = glm::vec3(FLT_MAX), aabb_max = glm::vec3(-FLT_MAX);
+            for (auto mesh_id : model.meshes) {
+                TexturedMesh* mesh = res->get(mesh_id);
+                glm::vec3 mesh_min, mesh_max;
+                transform_aabb(model_mat, mesh->aabb_min, mesh->aabb_max, mesh_min, mesh_max);
+                aabb_min = glm::min(aabb_min, mesh_min);
+                aabb_max = glm::max(aabb_max, mesh_max);
+            }
+            if (model.meshes.empty()) return;
+            // Entities of the range are packed at the start of its slots, the rest stay invalid
+            _bounds[slot++] = EntityBounds{entity, aabb_min, aabb_max, true};
+        });
+    }, thread_pool);
+
+    bool changed = false;
+    for (const auto& bounds : _bounds) {
+        if (!bounds.valid) continue;
+        glm::vec3 margin = LEAF_MARGIN_RELATIVE * (bounds.aabb_max - bounds.aabb_min) + glm::vec3(LEAF_MARGIN);
+        auto it = _proxies.find(bounds.entity.index);
+        if (it != _proxies.end() && it->second.generation != bounds.entity.generation) {
+            _tree.remove(it->second.leaf);
+            _proxies.erase(it);
+            it = _proxies.end();
+        }
+        if (it == _proxies.end()) {
+            uint32_t leaf = _tree.insert(bounds.entity.index, bounds.aabb_min - margin, bounds.aabb_max + margin);
+            _proxies[bounds.entity.index] = Proxy{bounds.entity.generation, leaf, _update_count, bounds.aabb_min, bounds.aabb_max};
+            changed = true;
+            continue;
+        }
+
+        Proxy& proxy = it->second;
+        proxy.last_update = _update_count;
+        proxy.aabb_min = bounds.aabb_min;
+        proxy.aabb_max = bounds.aabb_max;
+        if (!contains(_tree.aabb_min(proxy.leaf), _tree.aabb_max(proxy.leaf), bounds.aabb_min, bounds.aabb_max)) {
+            _tree.refit(proxy.leaf, bounds.aabb_min - margin, bounds.aabb_max + margin);
+            num_refits++;
+            changed = true;
+        }
+    }
+
+    // Entities that lost their model or transform
+    Vector<uint32_t> stale;
+    for (const auto& [index, proxy] : _proxies) {
+        if (proxy.last_update != _update_count) {
+            stale.push_back(index);
+        }
+    }
+    for (uint32_t index : stale) {
+        _tree.remove(_proxies[index].leaf);
+        _proxies.erase(index);
+        changed = true;
+    }
+
+    if (changed) {
+        float cost = _tree.cost();
+        if (cost > REBUILD_COST_RATIO * _rebuilt_cost) {
+            _tree.rebuild(thread_pool);
+            _rebuilt_cost = _tree.cost();
+            rebuilt = true;
+        }
+    }
+}
+
+void EntityBvh::to_entities(const Vector<uint32_t>& users, Vector<Entity>& entities) const {
+    for (uint32_t index : users) {
+        auto it = _proxies.find(index);
+        entities.push_back(Entity{index, it->second.generation});
+    }
+}
+
+void EntityBvh::query_frustum(const Frustum& frustum, Vector<Entity>& entities) const {
+    Vector<uint32_t> users;
+    _tree.query_frustum(frustum, users);
+    to_entities(users, entities);
+}
+
+void EntityBvh::query_aabb(glm::vec3 aabb_min, glm::vec3 aabb_max, Vector<Entity>& entities) const {
+    Vector<uint32_t> users;
+    _tree.query_aabb(aabb_min, aabb_max, users);
+    to_entities(users, entities);
+}
+
+bool EntityBvh::raycast(glm::vec3 origin, glm::vec3 dir, float max_t, Entity* entity, float* t) const {
+    Vector<uint32_t> users;
+    _tree.query_ray(origin, dir, max_t, users);
+
+    // The leaves are padded, the hits are sorted out against the actual bounds
+    bool hit = false;
+    float closest_t = max_t;
+    for (uint32_t index : users) {
+        const Proxy& proxy = _proxies.find(index)->second;
+        float entry_t;
+        if (intersect_ray_aabb(origin, dir, closest_t, proxy.aabb_min, proxy.aabb_max, &entry_t)) {
+            hit = true;
+            closest_t = entry_t;
+            *entity = Entity{index, proxy.generation};
+        }
+    }
+    if (hit && t) *t = closest_t;
+    return hit;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "core/bvh.h"
+#include "core/map.h"
+#include "core/vector.h"
+
+#include "ecs.h"
+
+struct Pool;
+
+// World bounds of every entity with a Model and a Transform in a DynamicBvh, for culling and picking.
+// Leaves hold the bounds grown by a margin, so entities that only move a little don't touch the tree. The others
+// are refitted, and once that has degraded the tree enough it's rebuilt on the thread pool.
+class EntityBvh {
+public:
+    // Brings the tree up to date with the ECS, on the main thread between the update and the rendering
+    void update(ECS* ecs, Pool* thread_pool);
+
+    // Entities whose leaf boxes are touched, which are a bit larger than the entities
+    void query_frustum(const Frustum& frustum, Vector<Entity>& entities) const;
+    void query_aabb(glm::vec3 aabb_min, glm::vec3 aabb_max, Vector<Entity>& entities) const;
+    // Closest entity whose world bounds are hit by the ray within max_t
+    bool raycast(glm::vec3 origin, glm::vec3 dir, float max_t, Entity* entity, float* t) const;
+
+    const DynamicBvh& tree() const { return _tree; }
+
+    // Statistics of the last update()
+    uint32_t num_refits = 0;
+    bool rebuilt = false;
+
+private:
+    struct Proxy {
+        uint32_t generation;
+        uint32_t leaf;
+        uint32_t last_update;
+        glm::vec3 aabb_min;     // unpadded world bounds
+        glm::vec3 aabb_max;
+    };
+
+    struct EntityBounds {
+        Entity entity;
+        glm::vec3 aabb_min;
+        glm::vec3 aabb_max;
+        bool valid;
+    };
+
+    void to_entities(const Vector<uint32_t>& users, Vector<Entity>& entities) const;
+
+    DynamicBvh _tree;
+    Map<uint32_t, Proxy> _proxies;      // by entity index
+    Vector<EntityBounds> _bounds;
+    uint32_t _update_count = 0;
+    float _rebuilt_cost = 0.0f;
+};
@@ -0,0 +1,108 @@
+#include "geometry_arena.h"
+
+void RangeAllocator::init(uint32_t capacity) {
+    _capacity = capacity;
+    _free_size = capacity;
+    _free_ranges.truncate();
+    if (capacity > 0) {
+        _free_ranges.push_back(Range{0, capacity});
+    }
+}
+
+bool RangeAllocator::allocate(uint32_t size, uint32_t& offset) {
+    if (size == 0) {
+        offset = 0;
+        return true;
+    }
+
+    uint32_t best = UINT32_MAX;
+    for (uint32_t i = 0; i < _free_ranges.size(); i++) {
+        uint32_t range_size = _free_ranges[i].size;
+        if (range_size >= size && (best == UINT32_MAX || range_size < _free_ranges[best].size)) {
+            best = i;
+            if (range_size == size) break;
+        }
+    }
+    if (best == UINT32_MAX) return false;
+
+    auto& range = _free_ranges[best];
+    offset = range.offset;
+    range.offset += size;
+    range.size -= size;
+    _free_size -= size;
+    if (range.size == 0) {
+        for (uint32_t i = best + 1; i < _free_ranges.size(); i++) {
+            _free_ranges[i - 1] = _free_ranges[i];
+        }
+        _free_ranges.truncate(_free_ranges.size() - 1);
+    }
+    return true;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t size) {
+    if (size == 0) return;
+    _free_size += size;
+
+    // First free range after the freed one
+    uint32_t lo = 0, hi = _free_ranges.size();
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (_free_ranges[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    uint32_t next = lo;
+
+    bool merge_prev = next > 0 && _free_ranges[next - 1].offset + _free_ranges[next - 1].size == offset;
+    bool merge_next = next < _free_ranges.size() && offset + size == _free_ranges[next].offset;
+    if (merge_prev && merge_next) {
+        _free_ranges[next - 1].size += size + _free_ranges[next].size;
+        for (uint32_t i = next + 1; i < _free_ranges.size(); i++) {
+            _free_ranges[i - 1] = _free_ranges[i];
+        }
+        _free_ranges.truncate(_free_ranges.size() - 1);
+    }
+    else if (merge_prev) {
+        _free_ranges[next - 1].size += size;
+    }
+    else if (merge_next) {
+        _free_ranges[next].offset = offset;
+        _free_ranges[next].size += size;
+    }
+    else {
+        _free_ranges.push_empty();
+        for (uint32_t i = _free_ranges.size() - 1; i > next; i--) {
+            _free_ranges[i] = _free_ranges[i - 1];
+        }
+        _free_ranges[next] = Range{offset, size};
+    }
+}
+
+bool GeometryArena::allocate(uint32_t vertex_count, uint32_t index_count, GeometryAllocation& allocation) {
+    for (uint32_t block_idx = 0; block_idx < _blocks.size(); block_idx++) {
+        auto& block = _blocks[block_idx];
+        if (block.vertices.free_size() < vertex_count || block.indices.free_size() < index_count) continue;
+
+        uint32_t vertex_offset, first_index;
+        if (!block.vertices.allocate(vertex_count, vertex_offset)) continue;
+        if (!block.indices.allocate(index_count, first_index)) {
+            block.vertices.free(vertex_offset, vertex_count);
+            continue;
+        }
+        allocation = GeometryAllocation{block_idx, vertex_offset, first_index};
+        return true;
+    }
+    return false;
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation, uint32_t vertex_count, uint32_t index_count) {
+    auto& block = _blocks[allocation.block];
+    block.vertices.free(allocation.vertex_offset, vertex_count);
+    block.indices.free(allocation.first_index, index_count);
+}
+
+uint32_t GeometryArena::add_block(uint32_t vertex_capacity, uint32_t index_capacity) {
+    auto& block = _blocks.push_empty();
+    block.vertices.init(vertex_capacity);
+    block.indices.init(index_capacity);
+    return _blocks.size() - 1;
+}
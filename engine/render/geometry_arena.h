@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "core/vector.h"
+
+// Best fit free list allocator of [0, capacity) ranges, in units of whatever the caller allocates.
+// Freed ranges are merged with their neighbours, so the free list stays short unless memory is fragmented.
+class RangeAllocator {
+public:
+    void init(uint32_t capacity);
+
+    // Returns false if no free range is large enough. Zero sized allocations always succeed at offset 0.
+    bool allocate(uint32_t size, uint32_t& offset);
+    void free(uint32_t offset, uint32_t size);
+
+    uint32_t capacity() const { return _capacity; }
+    uint32_t free_size() const { return _free_size; }
+    uint32_t num_free_ranges() const { return _free_ranges.size(); }
+
+private:
+    struct Range {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    uint32_t _capacity = 0;
+    uint32_t _free_size = 0;
+    Vector<Range> _free_ranges;     // sorted by offset, never touching each other
+};
+
+// Where the vertices and indices of a mesh live in the geometry arena
+struct GeometryAllocation {
+    uint32_t block;
+    uint32_t vertex_offset;
+    uint32_t first_index;
+};
+
+// Suballocates the vertex and index ranges of meshes from a few large blocks, so that draws of different meshes
+// don't have to rebind buffers. Only does the bookkeeping, the renderer owns a vertex and an index buffer per block.
+class GeometryArena {
+public:
+    // Returns false if no block has enough room left, the caller has to add one and try again
+    bool allocate(uint32_t vertex_count, uint32_t index_count, GeometryAllocation& allocation);
+    void free(const GeometryAllocation& allocation, uint32_t vertex_count, uint32_t index_count);
+
+    // Returns the index of the new block
+    uint32_t add_block(uint32_t vertex_capacity, uint32_t index_capacity);
+    uint32_t num_blocks() const { return _blocks.size(); }
+
+private:
+    struct Block {
+        RangeAllocator vertices;
+        RangeAllocator indices;
+    };
+    Vector<Block> _blocks;
+};
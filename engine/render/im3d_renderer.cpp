@@ -1,21 +1,21 @@
 #include "im3d_renderer.h"
 
 #include "vk_utils.h"
+#include "engine.h"
+#include "core/log.h"
+#include "nanothread/nanothread.h"
 
 #define TRACY_ENABLE
-#include "tracy/TracyVulkan.hpp"
+#include "tracy/Tracy.hpp"
 
 #define ARRAYSIZE(_ARR)          ((int)(sizeof(_ARR) / sizeof(*(_ARR))))     // Size of a static C-style array. Don't use on pointers!
 
+// Vertex buffers grow to this much more than was needed, so they don't have to be recreated every frame
+constexpr float VBO_GROWTH = 1.5f;
+
 void Im3dRenderer::init() {
-    _pipeline_data[(int)PrimType::Point].max_prim_count = 1000000;
-    _pipeline_data[(int)PrimType::Point].max_batch_count = 10000;
-    _pipeline_data[(int)PrimType::Line].max_prim_count = 1000000;
-    _pipeline_data[(int)PrimType::Line].max_batch_count = 10000;
-    _pipeline_data[(int)PrimType::Triangle].max_prim_count = 1000000;
-    _pipeline_data[(int)PrimType::Triangle].max_batch_count = 10000;
-
-    create_buffers();
+    _stagings.resize(pool_size(Engine::instance()->thread_pool) + 1);
+
     create_graphics_pipelines();
 
     _is_initialized = true;
@@ -186,91 +186,87 @@ void Im3dRenderer::create_graphics_pipelines() {
                 .subpass = 0,
         };
 
-        VK_CHECK(vkCreateGraphicsPipelines(_renderer->_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pl.graphics_pipeline));
-
-        vkDestroyShaderModule(_renderer->_device, vs_shader.module, nullptr);
-        vkDestroyShaderModule(_renderer->_device, fs_shader.module, nullptr);
+        _renderer->queue_graphics_pipeline(pipeline_info, &pl.graphics_pipeline);
     }
 }
 
-void Im3dRenderer::create_buffers() {
-    auto& point_data = _pipeline_data[(int)PrimType::Point];
-    auto& line_data = _pipeline_data[(int)PrimType::Line];
-    auto& tri_data = _pipeline_data[(int)PrimType::Triangle];
-
-    point_data.vbo = _renderer->create_dynamic_render_buffer(
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, point_data.max_prim_count * sizeof(glm::vec3));
-    line_data.vbo = _renderer->create_dynamic_render_buffer(
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 2*line_data.max_prim_count * sizeof(glm::vec3));
-    tri_data.vbo = _renderer->create_dynamic_render_buffer(
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 3*tri_data.max_prim_count * sizeof(glm::vec3));
+Im3dStaging& Im3dRenderer::thread_staging() {
+    uint32_t thread_id = pool_thread_id();
+    if (thread_id >= _stagings.size()) {
+        log_error("Im3d: drawing from thread {} which isn't part of the engine's thread pool", thread_id);
+        std::abort();
+    }
+    return _stagings[thread_id];
 }
 
 void Im3dRenderer::new_frame() {
-    auto& point_data = _pipeline_data[(int)PrimType::Point];
-    auto& line_data = _pipeline_data[(int)PrimType::Line];
-    auto& tri_data = _pipeline_data[(int)PrimType::Triangle];
-
-    for (auto& data : _pipeline_data) {
-        data.positions.clear();
-        data.positions.reserve(data.max_prim_count);
-        data.batch_data.clear();
-        data.batch_data.reserve(data.max_batch_count);
-        data.batch_starts.clear();
-        data.batch_starts.reserve(data.max_batch_count);
-        data.batch_starts.push_back(0);
-        data.cur_batch_data = {
-                .color = {1, 1, 1, 1},
-                .prim_width = 1.0f,
-                .blend_factor = 1.5f,
-        };
+    for (auto& staging : _stagings) {
+        staging.clear();
     }
 }
 
-void Im3dRenderer::render(VkCommandBuffer command_buffer) {
-    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "Im3dRenderer")
+void Im3dRenderer::begin_frame() {
+    ZoneScoped;
 
     const Camera& camera = _renderer->get_current_camera();
+    _frame_projview = camera.proj_mat * camera.get_view_matrix();
 
-    // If current batch isn't empty, then add to batch list now
-    start_new_point_batch();
-    start_new_line_batch();
-    start_new_tri_batch();
-
-    // If there are no batches, then skip render
+    // new_frame() of the next frame clears the stagings while this one is still being recorded, so they're
+    // gathered into the frame's own vertex buffer, whose fence has been waited on
+    uint32_t cur_frame = _renderer->get_current_frame();
     for (PrimType primtype : {PrimType::Point, PrimType::Line, PrimType::Triangle}) {
         auto& data = get_pipeline_data(primtype);
-        if (data.batch_data.empty()) continue;
+        data.frame_batches.truncate();
 
-        // Copy line vertex positions to vbo
-        void* p_vbo = _renderer->get_mapped_pointer(data.vbo);
-        memcpy(p_vbo, data.positions.data(), sizeof(glm::vec3) * data.positions.size());
+        uint32_t num_vertices = 0;
+        for (const auto& staging : _stagings) {
+            num_vertices += staging.num_vertices(primtype);
+        }
+        if (num_vertices == 0) continue;
+
+        size_t vbo_size = sizeof(glm::vec3) * num_vertices;
+        if (data.vbo.buffer_per_frame[cur_frame].size < vbo_size) {
+            _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cur_frame,
+                (size_t)(VBO_GROWTH * vbo_size), data.vbo);
+        }
+
+        glm::vec3* p_vbo = static_cast<glm::vec3*>(_renderer->get_mapped_pointer(data.vbo, cur_frame));
+        uint32_t first_vertex = 0;
+        for (const auto& staging : _stagings) {
+            staging.write(primtype, p_vbo + first_vertex, first_vertex, data.frame_batches);
+            first_vertex += staging.num_vertices(primtype);
+        }
+    }
+}
+
+void Im3dRenderer::render(VkCommandBuffer command_buffer) {
+    ZoneScopedN("Im3dRenderer");
+
+    uint32_t cur_frame = _renderer->get_current_frame();
+    glm::vec2 viewport_size = _renderer->get_window_extent();
+    for (PrimType primtype : {PrimType::Point, PrimType::Line, PrimType::Triangle}) {
+        auto& data = get_pipeline_data(primtype);
+        // If there are no batches, then skip render
+        if (data.frame_batches.empty()) continue;
 
         vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.graphics_pipeline);
 
-        VkBuffer vertex_buffers[] = {data.vbo.buffer};
+        VkBuffer vertex_buffers[] = {data.vbo.buffer_per_frame[cur_frame].buffer};
         VkDeviceSize offsets[] = {0};
         vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
 
-        for (int batch_idx = 0; batch_idx < data.batch_data.size(); batch_idx++) {
-            auto& push_constants = data.batch_data[batch_idx];
-            push_constants.projview = camera.proj_mat * camera.get_view_matrix();
-            push_constants.viewport_size = _renderer->get_window_extent();
-            uint32_t idx_start = data.batch_starts[batch_idx];
-            uint32_t idx_end = data.batch_starts[batch_idx + 1];
-            uint32_t num_prims = idx_end - idx_start;
+        for (const auto& batch : data.frame_batches) {
+            Im3dPushConstants push_constants = {
+                .projview = _frame_projview,
+                .color = batch.style.color,
+                .viewport_size = viewport_size,
+                .prim_width = batch.style.prim_width,
+                .blend_factor = batch.style.blend_factor
+            };
             vkCmdPushConstants(command_buffer, data.graphics_pipeline_layout,
                                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Im3dPushConstants), &push_constants);
             vkCmdSetLineWidth(command_buffer, push_constants.prim_width);
-            if (primtype == PrimType::Point) {
-                vkCmdDraw(command_buffer, num_prims, 1, idx_start, 0);
-            }
-            else if (primtype == PrimType::Line) {
-                vkCmdDraw(command_buffer, 2*num_prims, 1, 2*idx_start, 0);
-            }
-            else if (primtype == PrimType::Triangle) {
-                vkCmdDraw(command_buffer, 3*num_prims, 1, 3*idx_start, 0);
-            }
+            vkCmdDraw(command_buffer, batch.num_vertices, 1, batch.first_vertex, 0);
         }
     }
 
@@ -278,91 +274,13 @@ void Im3dRenderer::render(VkCommandBuffer command_buffer) {
 
 void Im3dRenderer::cleanup() {
     if (_is_initialized) {
-        _renderer->destroy_buffer(get_pipeline_data(PrimType::Point).vbo);
-        _renderer->destroy_buffer(get_pipeline_data(PrimType::Line).vbo);
-        _renderer->destroy_buffer(get_pipeline_data(PrimType::Triangle).vbo);
+        for (auto& data : _pipeline_data) {
+            for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                if (data.vbo.buffer_per_frame[i].buffer != VK_NULL_HANDLE) {
+                    _renderer->destroy_buffer(data.vbo.buffer_per_frame[i]);
+                }
+            }
+        }
         _is_initialized = false;
     }
 }
-
-void Im3dRenderer::set_point_color(glm::vec4 color) {
-    auto& cur_color = get_pipeline_data(PrimType::Point).cur_batch_data.color;
-    if (cur_color != color) {
-        start_new_line_batch();
-        cur_color = color;
-    }
-}
-
-void Im3dRenderer::set_point_size(float size) {
-    auto& cur_width = get_pipeline_data(PrimType::Point).cur_batch_data.prim_width;
-    if (cur_width != size) {
-        start_new_line_batch();
-        cur_width = size;
-    }
-}
-
-void Im3dRenderer::set_point_blend_factor(float blend_factor) {
-    auto& cur_blend_factor = get_pipeline_data(PrimType::Point).cur_batch_data.blend_factor;
-    if (cur_blend_factor != blend_factor) {
-        start_new_point_batch();
-        cur_blend_factor = blend_factor;
-    }
-}
-
-void Im3dRenderer::set_line_color(glm::vec4 color) {
-    auto& cur_color = get_pipeline_data(PrimType::Line).cur_batch_data.color;
-    if (cur_color != color) {
-        start_new_line_batch();
-        cur_color = color;
-    }
-}
-
-void Im3dRenderer::set_line_width(float width) {
-    auto& cur_width = get_pipeline_data(PrimType::Line).cur_batch_data.prim_width;
-    if (cur_width != width) {
-        start_new_line_batch();
-        cur_width = width;
-    }
-}
-
-void Im3dRenderer::set_line_blend_factor(float blend_factor) {
-    auto& cur_blend_factor = get_pipeline_data(PrimType::Line).cur_batch_data.blend_factor;
-    if (cur_blend_factor != blend_factor) {
-        start_new_line_batch();
-        cur_blend_factor = blend_factor;
-    }
-}
-
-void Im3dRenderer::set_tri_color(glm::vec4 color) {
-    auto& cur_color = get_pipeline_data(PrimType::Triangle).cur_batch_data.color;
-    if (cur_color != color) {
-        start_new_tri_batch();
-        cur_color = color;
-    }
-}
-
-void Im3dRenderer::push_point(const glm::vec3 &p) {
-    get_pipeline_data(PrimType::Point).positions.push_back(p);
-}
-
-void Im3dRenderer::push_line(const glm::vec3 &p1, const glm::vec3 &p2) {
-    auto& line_positions = get_pipeline_data(PrimType::Line).positions;
-    line_positions.push_back(p1);
-    line_positions.push_back(p2);
-}
-
-void Im3dRenderer::push_tri(const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3) {
-    auto& tri_positions = get_pipeline_data(PrimType::Triangle).positions;
-    tri_positions.push_back(p1);
-    tri_positions.push_back(p2);
-    tri_positions.push_back(p3);
-}
-
-void Im3dRenderer::start_new_batch(PrimType primtype) {
-    // only create new batch if current batch is not empty
-    auto& point_data = get_pipeline_data(primtype);
-    if (point_data.batch_starts.back() != point_data.positions.size()) {
-        point_data.batch_starts.push_back(point_data.positions.size());
-        point_data.batch_data.push_back(point_data.cur_batch_data);
-    }
-}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "renderer.h"
+#include "im3d_staging.h"
 
 struct alignas(16) Im3dPushConstants {
     glm::mat4 projview;
@@ -10,61 +11,64 @@ struct alignas(16) Im3dPushConstants {
     float blend_factor;
 };
 
+// Debug drawing of points, lines and triangles. Every thread of the engine's thread pool draws into a staging
+// of its own, so parallel systems can draw without locking, and the stagings are gathered into the frame's
+// vertex buffers in begin_frame(). Those grow with what is drawn.
 class Im3dRenderer : public RenderInterface {
 public:
-    enum class PrimType {
-        Point, Line, Triangle, _PrimCount
-    };
-    static constexpr int PrimTypeCount = (int) PrimType::_PrimCount;
+    using PrimType = Im3dPrimType;
+    static constexpr int PrimTypeCount = IM3D_PRIM_TYPE_COUNT;
 
     Im3dRenderer(Renderer* renderer) : RenderInterface(renderer) {}
 
     void init();
     void new_frame();
+    void begin_frame() override;
     void render(VkCommandBuffer command_buffer) override;
     void cleanup();
 
-    void set_point_color(glm::vec4 color);
-    void set_point_size(float size);
-    void set_point_blend_factor(float blend_factor);
+    // Staging of the calling thread, from the main thread or the engine's thread pool
+    Im3dStaging& thread_staging();
+
+    // Draw into the staging of the calling thread
+    void set_point_color(glm::vec4 color) { thread_staging().set_point_color(color); }
+    void set_point_size(float size) { thread_staging().set_point_size(size); }
+    void set_point_blend_factor(float blend_factor) { thread_staging().set_point_blend_factor(blend_factor); }
+
+    void set_line_color(glm::vec4 color) { thread_staging().set_line_color(color); }
+    void set_line_width(float width) { thread_staging().set_line_width(width); }
+    void set_line_blend_factor(float blend_factor) { thread_staging().set_line_blend_factor(blend_factor); }
 
-    void set_line_color(glm::vec4 color);
-    void set_line_width(float width);
-    void set_line_blend_factor(float blend_factor);
+    void set_tri_color(glm::vec4 color) { thread_staging().set_tri_color(color); }
 
-    void set_tri_color(glm::vec4 color);
+    void push_point(const glm::vec3& p) { thread_staging().push_point(p); }
+    void push_line(const glm::vec3& p1, const glm::vec3& p2) { thread_staging().push_line(p1, p2); }
+    void push_tri(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) { thread_staging().push_tri(p1, p2, p3); }
 
-    void push_point(const glm::vec3& p);
-    void push_line(const glm::vec3& p1, const glm::vec3& p2);
-    void push_tri(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3);
+    void push_points(Span<const glm::vec3> points) { thread_staging().push_points(points); }
+    void push_lines(Span<const glm::vec3> points) { thread_staging().push_lines(points); }
+    void push_tris(Span<const glm::vec3> points) { thread_staging().push_tris(points); }
 
 private:
     void create_graphics_pipelines();
-    void create_buffers();
-
-    void start_new_batch(PrimType primtype);
-    void start_new_point_batch() { start_new_batch(PrimType::Point); }
-    void start_new_line_batch() { start_new_batch(PrimType::Line); }
-    void start_new_tri_batch() { start_new_batch(PrimType::Triangle); }
 
     bool _is_initialized = false;
 
+    // One per thread of the pool, the main thread gets the first one
+    Vector<Im3dStaging> _stagings;
+
     struct PipelineData {
         VkPipelineLayout graphics_pipeline_layout;
         VkPipeline graphics_pipeline;
 
-        Vector<glm::vec3> positions;
-        Vector<uint32_t> batch_starts;
-        Vector<Im3dPushConstants> batch_data;
-        Im3dPushConstants cur_batch_data;
-
-        Buffer vbo;
+        // Batches of the frame being rendered, gathered in begin_frame()
+        Vector<Im3dBatch> frame_batches;
 
-        uint32_t max_prim_count;
-        uint32_t max_batch_count;
+        DynamicBuffer vbo;
     };
 
     PipelineData _pipeline_data[PrimTypeCount];
+    glm::mat4 _frame_projview;
 
     PipelineData& get_pipeline_data(PrimType type) { return _pipeline_data[(int)type]; }
 };
\ No newline at end of file
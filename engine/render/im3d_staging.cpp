@@ -0,0 +1,83 @@
+#include "im3d_staging.h"
+
+#include <string.h>
+
+void Im3dStaging::clear() {
+    for (auto& prims : _prims) {
+        prims.positions.truncate();
+        prims.batches.truncate();
+        prims.batch_start = 0;
+        prims.style = Im3dStyle{};
+    }
+}
+
+void Im3dStaging::set_color(Im3dPrimType type, glm::vec4 color) {
+    Im3dStyle style = get(type).style;
+    style.color = color;
+    set_style(type, style);
+}
+
+void Im3dStaging::set_width(Im3dPrimType type, float width) {
+    Im3dStyle style = get(type).style;
+    style.prim_width = width;
+    set_style(type, style);
+}
+
+void Im3dStaging::set_blend_factor(Im3dPrimType type, float blend_factor) {
+    Im3dStyle style = get(type).style;
+    style.blend_factor = blend_factor;
+    set_style(type, style);
+}
+
+void Im3dStaging::set_style(Im3dPrimType type, const Im3dStyle& style) {
+    auto& prims = get(type);
+    if (prims.style == style) return;
+
+    // Only close the batch if there is something in it
+    if (prims.positions.size() != prims.batch_start) {
+        prims.batches.push_back(Im3dBatch{prims.batch_start, prims.positions.size() - prims.batch_start, prims.style});
+        prims.batch_start = prims.positions.size();
+    }
+    prims.style = style;
+}
+
+void Im3dStaging::push_point(const glm::vec3& p) {
+    get(Im3dPrimType::Point).positions.push_back(p);
+}
+
+void Im3dStaging::push_line(const glm::vec3& p1, const glm::vec3& p2) {
+    auto& positions = get(Im3dPrimType::Line).positions;
+    positions.push_back(p1);
+    positions.push_back(p2);
+}
+
+void Im3dStaging::push_tri(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+    auto& positions = get(Im3dPrimType::Triangle).positions;
+    positions.push_back(p1);
+    positions.push_back(p2);
+    positions.push_back(p3);
+}
+
+void Im3dStaging::push_points(Span<const glm::vec3> points) {
+    get(Im3dPrimType::Point).positions.append(points.data(), points.size());
+}
+
+// An incomplete primitive at the end is left out
+void Im3dStaging::push_lines(Span<const glm::vec3> points) {
+    get(Im3dPrimType::Line).positions.append(points.data(), points.size() / 2 * 2);
+}
+
+void Im3dStaging::push_tris(Span<const glm::vec3> points) {
+    get(Im3dPrimType::Triangle).positions.append(points.data(), points.size() / 3 * 3);
+}
+
+void Im3dStaging::write(Im3dPrimType type, glm::vec3* dst, uint32_t first_vertex, Vector<Im3dBatch>& batches) const {
+    const auto& prims = get(type);
+    memcpy(dst, prims.positions.data(), sizeof(glm::vec3) * prims.positions.size());
+    for (const auto& batch : prims.batches) {
+        batches.push_back(Im3dBatch{first_vertex + batch.first_vertex, batch.num_vertices, batch.style});
+    }
+    if (prims.positions.size() != prims.batch_start) {
+        batches.push_back(Im3dBatch{first_vertex + prims.batch_start, prims.positions.size() - prims.batch_start, prims.style});
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+enum class Im3dPrimType {
+    Point, Line, Triangle, _PrimCount
+};
+constexpr int IM3D_PRIM_TYPE_COUNT = (int)Im3dPrimType::_PrimCount;
+
+struct Im3dStyle {
+    glm::vec4 color = {1, 1, 1, 1};
+    float prim_width = 1.0f;
+    float blend_factor = 1.5f;
+
+    bool operator==(const Im3dStyle& other) const = default;
+};
+
+// Run of vertices drawn with the same style
+struct Im3dBatch {
+    uint32_t first_vertex;
+    uint32_t num_vertices;
+    Im3dStyle style;
+};
+
+// Debug primitives of one thread for one frame, without anything Vulkan so it can be filled anywhere.
+// Vertices are appended per primitive type, changing the style closes the batch of the vertices before.
+class Im3dStaging {
+public:
+    void clear();
+
+    void set_point_color(glm::vec4 color) { set_color(Im3dPrimType::Point, color); }
+    void set_point_size(float size) { set_width(Im3dPrimType::Point, size); }
+    void set_point_blend_factor(float blend_factor) { set_blend_factor(Im3dPrimType::Point, blend_factor); }
+
+    void set_line_color(glm::vec4 color) { set_color(Im3dPrimType::Line, color); }
+    void set_line_width(float width) { set_width(Im3dPrimType::Line, width); }
+    void set_line_blend_factor(float blend_factor) { set_blend_factor(Im3dPrimType::Line, blend_factor); }
+
+    void set_tri_color(glm::vec4 color) { set_color(Im3dPrimType::Triangle, color); }
+
+    void push_point(const glm::vec3& p);
+    void push_line(const glm::vec3& p1, const glm::vec3& p2);
+    void push_tri(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3);
+
+    // Bulk versions, lines are pairs of points and triangles triples
+    void push_points(Span<const glm::vec3> points);
+    void push_lines(Span<const glm::vec3> points);
+    void push_tris(Span<const glm::vec3> points);
+
+    uint32_t num_vertices(Im3dPrimType type) const { return get(type).positions.size(); }
+
+    // Copies the vertices of the type to dst and appends their batches, moved to start at first_vertex
+    void write(Im3dPrimType type, glm::vec3* dst, uint32_t first_vertex, Vector<Im3dBatch>& batches) const;
+
+private:
+    struct Prims {
+        Vector<glm::vec3> positions;
+        Vector<Im3dBatch> batches;      // closed ones, the open one starts at batch_start
+        uint32_t batch_start = 0;
+        Im3dStyle style;
+    };
+
+    Prims& get(Im3dPrimType type) { return _prims[(int)type]; }
+    const Prims& get(Im3dPrimType type) const { return _prims[(int)type]; }
+
+    void set_color(Im3dPrimType type, glm::vec4 color);
+    void set_width(Im3dPrimType type, float width);
+    void set_blend_factor(Im3dPrimType type, float blend_factor);
+    void set_style(Im3dPrimType type, const Im3dStyle& style);
+
+    Prims _prims[IM3D_PRIM_TYPE_COUNT];
+};
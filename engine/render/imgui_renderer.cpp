@@ -8,15 +8,12 @@
 #include "vulkan/vulkan_core.h"
 
 #define TRACY_ENABLE
-#include "tracy/TracyVulkan.hpp"
+#include "tracy/Tracy.hpp"
 
 void ImGuiRenderer::init() {
     auto res = Res::inst();
     {
         // Create font texture
-        Buffer staging_buffer;
-        VkCommandBuffer command_buffer = _renderer->begin_single_time_commands();
-
         ImGuiIO& io = ImGui::GetIO();
 
         VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
@@ -25,10 +22,7 @@ void ImGuiRenderer::init() {
         img_cpu.channels = 4;
         img_cpu.data_channels = 4;
         io.Fonts->GetTexDataAsRGBA32(&img_cpu.pixels, &img_cpu.width, &img_cpu.height);
-        _renderer->upload_to_gpu(command_buffer, img_cpu, format, *image, staging_buffer);
-
-        _renderer->end_single_time_commands(command_buffer);
-        _renderer->destroy_buffer(staging_buffer);
+        _renderer->upload_to_gpu(img_cpu, format, *image);
         img_cpu.pixels = nullptr;
         img_cpu.cleanup();
 
@@ -177,10 +171,7 @@ void ImGuiRenderer::init() {
         .subpass = 0
     };
 
-    vkCreateGraphicsPipelines(_renderer->get_device(), VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &_graphics_pipeline);
-
-    vkDestroyShaderModule(_renderer->get_device(), vs_shader.module, nullptr);
-    vkDestroyShaderModule(_renderer->get_device(), fs_shader.module, nullptr);
+    _renderer->queue_graphics_pipeline(graphics_pipeline_create_info, &_graphics_pipeline);
 
     _is_initialized = true;
 }
@@ -188,30 +179,34 @@ void ImGuiRenderer::init() {
 void ImGuiRenderer::new_frame() {
 }
 
-void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
-    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "ImGuiRenderer")
+void ImGuiRenderer::begin_frame() {
+    ZoneScoped;
 
+    // ImGui::NewFrame() of the next frame invalidates the draw data while this frame is still being recorded,
+    // so the vertices are uploaded and the draw commands copied out of it here.
     auto res = Res::inst();
- 
+
     ImDrawData* draw_data = ImGui::GetDrawData();
+    _frame_commands.truncate();
+    _frame_has_vertices = false;
 
     // Avoid rendering when minimized, scale coordinates for retina displays (screen coordinates != framebuffer coordinates)
     int fb_width = (int)(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
     int fb_height = (int)(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
+    _frame_fb_width = fb_width;
+    _frame_fb_height = fb_height;
     if (fb_width <= 0 || fb_height <= 0)
         return;
 
-    uint32_t cur_frame = _renderer->get_current_frame();
-
     if (draw_data->TotalVtxCount > 0)
     {
-        // Create or resize the vertex/index buffers
+        // Suballocate the vertex/index data from the frame's transient buffer
         size_t vertex_size = draw_data->TotalVtxCount * sizeof(ImDrawVert);
         size_t index_size = draw_data->TotalIdxCount * sizeof(ImDrawIdx);
-        _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cur_frame, vertex_size, _vertex_buffer);
-        _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, cur_frame, index_size, _index_buffer);
-        ImDrawVert* vtx_dst = static_cast<ImDrawVert*>(_renderer->get_mapped_pointer(_vertex_buffer, cur_frame));
-        ImDrawIdx* idx_dst = static_cast<ImDrawIdx*>(_renderer->get_mapped_pointer(_index_buffer, cur_frame));
+        _frame_vertices = _renderer->allocate_transient(vertex_size);
+        _frame_indices = _renderer->allocate_transient(index_size);
+        ImDrawVert* vtx_dst = static_cast<ImDrawVert*>(_frame_vertices.data);
+        ImDrawIdx* idx_dst = static_cast<ImDrawIdx*>(_frame_indices.data);
         // Upload vertex/index data into a single contiguous GPU buffer
         for (int n = 0; n < draw_data->CmdListsCount; n++)
         {
@@ -221,15 +216,18 @@ void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
             vtx_dst += cmd_list->VtxBuffer.Size;
             idx_dst += cmd_list->IdxBuffer.Size;
         }
+        _frame_has_vertices = true;
     }
 
-    setup_render_state(command_buffer);
-
     // Will project scissor/clipping rectangles into framebuffer space
     ImVec2 clip_off = draw_data->DisplayPos;         // (0,0) unless using multi-viewports
     ImVec2 clip_scale = draw_data->FramebufferScale; // (1,1) unless using retina display which are often (2,2)
 
-    // Render command lists
+    ImGuiPushConstants pc;
+    pc.scale = {2.f / draw_data->DisplaySize.x, 2.f / draw_data->DisplaySize.y};
+    pc.translate = {-1.0f - draw_data->DisplayPos.x * pc.scale.x, -1.0f - draw_data->DisplayPos.y * pc.scale.y};
+
+    // Flatten the command lists
     // (Because we merged all buffers into a single one, we maintain our own offset into them)
     int global_vtx_offset = 0;
     int global_idx_offset = 0;
@@ -241,12 +239,12 @@ void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
             const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[cmd_i];
             if (pcmd->UserCallback != NULL)
             {
-                // User callback, registered via ImDrawList::AddCallback()
                 // (ImDrawCallback_ResetRenderState is a special callback value used by the user to request the renderer to reset render state.)
+                // Other user callbacks would run after their draw list is gone, they're not supported.
                 if (pcmd->UserCallback == ImDrawCallback_ResetRenderState)
-                    setup_render_state(command_buffer);
+                    _frame_commands.push_back(ImGuiFrameCommand {.reset_render_state = true});
                 else
-                    pcmd->UserCallback(cmd_list, pcmd);
+                    log_warn("ImGui user callbacks aren't supported, skipping it");
             }
             else
             {
@@ -262,29 +260,50 @@ void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
                 if (clip_max.x <= clip_min.x || clip_max.y <= clip_min.y)
                     continue;
 
-                // Apply scissor/clipping rectangle
-                VkRect2D scissor;
-                scissor.offset.x = (int32_t)(clip_min.x);
-                scissor.offset.y = (int32_t)(clip_min.y);
-                scissor.extent.width = (uint32_t)(clip_max.x - clip_min.x);
-                scissor.extent.height = (uint32_t)(clip_max.y - clip_min.y);
-                vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+                ImGuiFrameCommand command;
+                command.scissor.offset.x = (int32_t)(clip_min.x);
+                command.scissor.offset.y = (int32_t)(clip_min.y);
+                command.scissor.extent.width = (uint32_t)(clip_max.x - clip_min.x);
+                command.scissor.extent.height = (uint32_t)(clip_max.y - clip_min.y);
 
                 Ref<Texture> tex_id = Ref<Texture>::from_userpointer(pcmd->TextureId);
+                command.push_constants = pc;
+                command.push_constants.tex_id = res->_texture_pool.get_item_idx(tex_id);
 
-                ImGuiPushConstants pc;
-                pc.scale = {2.f / draw_data->DisplaySize.x, 2.f / draw_data->DisplaySize.y};
-                pc.translate = {-1.0f - draw_data->DisplayPos.x * pc.scale.x, -1.0f - draw_data->DisplayPos.y * pc.scale.y};
-                pc.tex_id = res->_texture_pool.get_item_idx(tex_id);
-                vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ImGuiPushConstants), &pc);
-
-                // Draw
-                vkCmdDrawIndexed(command_buffer, pcmd->ElemCount, 1, pcmd->IdxOffset + global_idx_offset, pcmd->VtxOffset + global_vtx_offset, 0);
+                command.elem_count = pcmd->ElemCount;
+                command.first_index = pcmd->IdxOffset + global_idx_offset;
+                command.vertex_offset = pcmd->VtxOffset + global_vtx_offset;
+                _frame_commands.push_back(command);
             }
         }
         global_idx_offset += cmd_list->IdxBuffer.Size;
         global_vtx_offset += cmd_list->VtxBuffer.Size;
     }
+}
+
+void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
+    ZoneScopedN("ImGuiRenderer");
+
+    if (_frame_fb_width <= 0 || _frame_fb_height <= 0)
+        return;
+
+    setup_render_state(command_buffer);
+
+    for (const auto& command : _frame_commands)
+    {
+        if (command.reset_render_state)
+        {
+            setup_render_state(command_buffer);
+            continue;
+        }
+
+        // Apply scissor/clipping rectangle
+        vkCmdSetScissor(command_buffer, 0, 1, &command.scissor);
+        vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ImGuiPushConstants), &command.push_constants);
+
+        // Draw
+        vkCmdDrawIndexed(command_buffer, command.elem_count, 1, command.first_index, command.vertex_offset, 0);
+    }
 
     // Note: at this point both vkCmdSetViewport() and vkCmdSetScissor() have been called.
     // Our last values will leak into user/application rendering IF:
@@ -293,7 +312,7 @@ void ImGuiRenderer::render(VkCommandBuffer command_buffer) {
     // If you use VK_DYNAMIC_STATE_VIEWPORT or VK_DYNAMIC_STATE_SCISSOR you are responsible for setting the values before rendering.
     // In theory we should aim to backup/restore those values but I am not sure this is possible.
     // We perform a call to vkCmdSetScissor() to set back a full viewport which is likely to fix things for 99% users but technically this is not perfect. (See github #4644)
-    VkRect2D scissor = { { 0, 0 }, { (uint32_t)fb_width, (uint32_t)fb_height } };
+    VkRect2D scissor = { { 0, 0 }, { (uint32_t)_frame_fb_width, (uint32_t)_frame_fb_height } };
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 }
 
@@ -304,28 +323,22 @@ void ImGuiRenderer::cleanup() {
 }
 
 void ImGuiRenderer::setup_render_state(VkCommandBuffer command_buffer) {
-    ImDrawData* draw_data = ImGui::GetDrawData();
-    int fb_width = (int)(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
-    int fb_height = (int)(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
-
     // Setup desired Vulkan state
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphics_pipeline);
 
     VkDescriptorSet cur_texture_desc_set = _renderer->get_texture_descriptor_set().set_per_frame[_renderer->get_current_frame()];
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0, 1, &cur_texture_desc_set, 0, nullptr);
 
-    uint32_t cur_frame = _renderer->get_current_frame();
-
-    if (draw_data->TotalVtxCount > 0) {
-        vkuCmdBindSingleVertexBuffer(command_buffer, _vertex_buffer.buffer_per_frame[cur_frame].buffer);
-        vkCmdBindIndexBuffer(command_buffer, _index_buffer.buffer_per_frame[cur_frame].buffer, 
-            0, sizeof(ImDrawIdx) == 2? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+    if (_frame_has_vertices) {
+        vkCmdBindVertexBuffers(command_buffer, 0, 1, &_frame_vertices.buffer, &_frame_vertices.offset);
+        vkCmdBindIndexBuffer(command_buffer, _frame_indices.buffer, 
+            _frame_indices.offset, sizeof(ImDrawIdx) == 2? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
     }
 
     // Setup viewport
     VkViewport viewport = {
         .x = 0, .y = 0,
-        .width = (float)fb_width, .height = (float)fb_height,
+        .width = (float)_frame_fb_width, .height = (float)_frame_fb_height,
         .minDepth = 0.0f, .maxDepth = 1.0f
     };
     vkCmdSetViewport(command_buffer, 0, 1, &viewport);
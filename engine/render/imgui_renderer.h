@@ -16,13 +16,28 @@ public:
 
     void init();
     void new_frame();
+    void begin_frame() override;
     void render(VkCommandBuffer command_buffer) override;
     void cleanup();
 
     void setup_render_state(VkCommandBuffer command_buffer);
 
-    DynamicBuffer _vertex_buffer;
-    DynamicBuffer _index_buffer;
+    // Ranges of the renderer's transient buffer, bound at their offsets
+    TransientAllocation _frame_vertices;
+    TransientAllocation _frame_indices;
+
+    // Draw commands of ImGui::GetDrawData(), copied in begin_frame()
+    struct ImGuiFrameCommand {
+        VkRect2D scissor;
+        ImGuiPushConstants push_constants;
+        uint32_t elem_count;
+        uint32_t first_index;
+        int32_t vertex_offset;
+        bool reset_render_state = false;
+    };
+    Vector<ImGuiFrameCommand> _frame_commands;
+    int _frame_fb_width = 0, _frame_fb_height = 0;
+    bool _frame_has_vertices = false;
 
     bool _is_initialized = false;
     VkPipelineLayout _pipeline_layout = {};
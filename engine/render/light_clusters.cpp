@@ -0,0 +1,182 @@
+#include "light_clusters.h"
+
+#include <math.h>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+// Everything closer than this shares the first slice, otherwise the slices near the camera would be tiny
+constexpr float MIN_SLICE_NEAR = 1.0f;
+
+void LightClusters::build(const glm::mat4& view, const glm::mat4& proj, glm::vec2 viewport_size,
+        Span<const glm::vec4> lights, Pool* thread_pool) {
+    ZoneScoped;
+
+    // Near and far planes of a [0, 1] depth perspective projection
+    float near = proj[3][2] / proj[2][2];
+    float far = proj[3][2] / (proj[2][2] + 1.0f);
+    float slice_near = glm::max(near, MIN_SLICE_NEAR);
+    far = glm::max(far, 2.0f * slice_near);
+
+    _header.depth_plane = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    _header.clusters_per_pixel = glm::vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y) / viewport_size;
+    _header.slice_scale = (LIGHT_CLUSTERS_Z - 1) / logf(far / slice_near);
+    _header.slice_bias = -logf(slice_near) * _header.slice_scale;
+    _header.slice_near = slice_near;
+
+    _slice_depths[0] = 0.0f;
+    for (uint32_t z = 1; z < LIGHT_CLUSTERS_Z; z++) {
+        _slice_depths[z] = slice_near * powf(far / slice_near, (float)(z - 1) / (LIGHT_CLUSTERS_Z - 1));
+    }
+    _slice_depths[LIGHT_CLUSTERS_Z] = far;
+
+    // A view space point at depth d lands on NDC x = proj[0][0] * x / d, and the same for y
+    for (uint32_t z = 0; z < LIGHT_CLUSTERS_Z; z++) {
+        float d0 = _slice_depths[z], d1 = _slice_depths[z + 1];
+        for (uint32_t x = 0; x < LIGHT_CLUSTERS_X; x++) {
+            float e0 = 2.0f * x / LIGHT_CLUSTERS_X - 1.0f, e1 = 2.0f * (x + 1) / LIGHT_CLUSTERS_X - 1.0f;
+            float a = e0 * d0 / proj[0][0], b = e0 * d1 / proj[0][0], c = e1 * d0 / proj[0][0], d = e1 * d1 / proj[0][0];
+            _column_x[z][x][0] = glm::min(glm::min(a, b), glm::min(c, d));
+            _column_x[z][x][1] = glm::max(glm::max(a, b), glm::max(c, d));
+        }
+        for (uint32_t y = 0; y < LIGHT_CLUSTERS_Y; y++) {
+            float e0 = 2.0f * y / LIGHT_CLUSTERS_Y - 1.0f, e1 = 2.0f * (y + 1) / LIGHT_CLUSTERS_Y - 1.0f;
+            float a = e0 * d0 / proj[1][1], b = e0 * d1 / proj[1][1], c = e1 * d0 / proj[1][1], d = e1 * d1 / proj[1][1];
+            _row_y[z][y][0] = glm::min(glm::min(a, b), glm::min(c, d));
+            _row_y[z][y][1] = glm::max(glm::max(a, b), glm::max(c, d));
+        }
+    }
+
+    // (view x, view y, depth, radius)
+    _view_lights.truncate();
+    for (const auto& light : lights) {
+        glm::vec4 center = view * glm::vec4(glm::vec3(light), 1.0f);
+        _view_lights.push_back(glm::vec4(center.x, center.y, -center.z, light.w));
+    }
+
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, LIGHT_CLUSTERS_Z, 1), [&](auto range) {
+        for (uint32_t z : range) {
+            bin_slice(z);
+        }
+    }, thread_pool);
+
+    // The slices are concatenated, whatever doesn't fit any more is dropped
+    _clusters.resize(LIGHT_CLUSTER_COUNT);
+    _light_indices.truncate();
+    _num_dropped = 0;
+    for (uint32_t z = 0; z < LIGHT_CLUSTERS_Z; z++) {
+        const auto& bins = _slice_bins[z];
+        for (uint32_t i = 0; i < LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y; i++) {
+            glm::uvec2 bin = bins.clusters[i];
+            uint32_t count = glm::min(bin.y, MAX_LIGHT_CLUSTER_INDICES - _light_indices.size());
+            _clusters[z * LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y + i] = glm::uvec2(_light_indices.size(), count);
+            for (uint32_t k = 0; k < count; k++) {
+                _light_indices.push_back(bins.indices[bin.x + k]);
+            }
+            _num_dropped += bin.y - count;
+        }
+    }
+}
+
+// The column (or row) bounds of a slice are monotonic across the screen, increasing or decreasing depending on the
+// sign of the projection, so the ones overlapping [lo, hi] are a contiguous range that can be found by bisection
+static void tile_range(const float (*bounds)[2], uint32_t count, float lo, float hi, uint32_t& begin, uint32_t& end) {
+    bool ascending = bounds[0][0] <= bounds[count - 1][0];
+    auto before = [&](uint32_t i) { return ascending ? bounds[i][1] < lo : bounds[i][0] > hi; };
+    auto after = [&](uint32_t i) { return ascending ? bounds[i][0] > hi : bounds[i][1] < lo; };
+
+    begin = 0;
+    for (uint32_t n = count; n > 0; ) {
+        uint32_t half = n / 2;
+        if (before(begin + half)) {
+            begin += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    end = begin;
+    for (uint32_t n = count - begin; n > 0; ) {
+        uint32_t half = n / 2;
+        if (!after(end + half)) {
+            end += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+}
+
+// Counts the lights of every cluster of the slice first, then writes them out after the counts have been summed up
+void LightClusters::bin_slice(uint32_t z) {
+    ZoneScoped;
+
+    auto& bins = _slice_bins[z];
+    bins.clusters.resize(LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y);
+    for (auto& bin : bins.clusters) {
+        bin = glm::uvec2(0);
+    }
+
+    float d0 = _slice_depths[z], d1 = _slice_depths[z + 1];
+    auto visit = [&](auto&& fun) {
+        for (uint32_t light = 0; light < _view_lights.size(); light++) {
+            glm::vec4 sphere = _view_lights[light];
+            float r2 = sphere.w * sphere.w;
+            float dz = glm::max(glm::max(d0 - sphere.z, sphere.z - d1), 0.0f);
+            if (dz * dz > r2) continue;
+            uint32_t x_begin, x_end, y_begin, y_end;
+            tile_range(_column_x[z], LIGHT_CLUSTERS_X, sphere.x - sphere.w, sphere.x + sphere.w, x_begin, x_end);
+            tile_range(_row_y[z], LIGHT_CLUSTERS_Y, sphere.y - sphere.w, sphere.y + sphere.w, y_begin, y_end);
+            for (uint32_t x = x_begin; x < x_end; x++) {
+                float dx = glm::max(glm::max(_column_x[z][x][0] - sphere.x, sphere.x - _column_x[z][x][1]), 0.0f);
+                if (dx * dx + dz * dz > r2) continue;
+                for (uint32_t y = y_begin; y < y_end; y++) {
+                    float dy = glm::max(glm::max(_row_y[z][y][0] - sphere.y, sphere.y - _row_y[z][y][1]), 0.0f);
+                    if (dx * dx + dy * dy + dz * dz <= r2) {
+                        fun(y * LIGHT_CLUSTERS_X + x, light);
+                    }
+                }
+            }
+        }
+    };
+
+    visit([&](uint32_t cluster, uint32_t) {
+        bins.clusters[cluster].y++;
+    });
+    uint32_t offset = 0;
+    for (auto& bin : bins.clusters) {
+        bin.x = offset;
+        offset += bin.y;
+        bin.y = 0;
+    }
+    bins.indices.resize(offset);
+    visit([&](uint32_t cluster, uint32_t light) {
+        auto& bin = bins.clusters[cluster];
+        bins.indices[bin.x + bin.y++] = light;
+    });
+}
+
+uint32_t LightClusters::slice_of(float depth) const {
+    if (depth < _header.slice_near) return 0;
+    float slice = floorf(logf(depth) * _header.slice_scale + _header.slice_bias);
+    return glm::min(LIGHT_CLUSTERS_Z - 1, 1 + (uint32_t)glm::max(slice, 0.0f));
+}
+
+uint32_t LightClusters::cluster_at(glm::vec2 frag_coord, glm::vec3 world_position) const {
+    glm::vec2 tile = glm::floor(frag_coord * _header.clusters_per_pixel);
+    uint32_t x = glm::min(LIGHT_CLUSTERS_X - 1, (uint32_t)glm::max(tile.x, 0.0f));
+    uint32_t y = glm::min(LIGHT_CLUSTERS_Y - 1, (uint32_t)glm::max(tile.y, 0.0f));
+    float depth = glm::dot(glm::vec3(_header.depth_plane), world_position) + _header.depth_plane.w;
+    return cluster_index(x, y, slice_of(depth));
+}
+
+void LightClusters::cluster_bounds(uint32_t x, uint32_t y, uint32_t z, glm::vec3& aabb_min, glm::vec3& aabb_max) const {
+    aabb_min = glm::vec3(_column_x[z][x][0], _row_y[z][y][0], -_slice_depths[z + 1]);
+    aabb_max = glm::vec3(_column_x[z][x][1], _row_y[z][y][1], -_slice_depths[z]);
+}
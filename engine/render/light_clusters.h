@@ -0,0 +1,77 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+struct Pool;
+
+// Has to match lighting_common.glsl
+constexpr uint32_t LIGHT_CLUSTERS_X = 16;
+constexpr uint32_t LIGHT_CLUSTERS_Y = 9;
+constexpr uint32_t LIGHT_CLUSTERS_Z = 24;
+constexpr uint32_t LIGHT_CLUSTER_COUNT = LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z;
+// Capacity of the light index list, clusters past it get fewer lights than they touch
+constexpr uint32_t MAX_LIGHT_CLUSTER_INDICES = 64 * LIGHT_CLUSTER_COUNT;
+
+// What the fragment shaders need to find their cluster, the head of the cluster buffer
+struct alignas(16) LightClusterHeader {
+    glm::vec4 depth_plane;              // view depth = dot(depth_plane.xyz, world position) + depth_plane.w
+    glm::vec2 clusters_per_pixel;
+    float slice_scale;                  // slice = 1 + floor(log(depth) * slice_scale + slice_bias) past slice_near
+    float slice_bias;
+    float slice_near;
+    uint32_t _padding[3];
+};
+
+// Froxel light assignment on the CPU. The view frustum is split into tiles on the screen and exponential slices in
+// depth, slice 0 goes from the camera to slice_near. Every cluster gets the compact list of the point lights whose
+// spheres touch its view space bounding box, so the fragment shaders only go through the lights nearby.
+// The bounds of a cluster are separable in x, y and z, lights are binned by going through the slices in parallel
+// and only visiting the range of columns and rows that each light's sphere overlaps.
+class LightClusters {
+public:
+    // Lights are world space spheres (xyz, radius), the projection is a symmetric perspective one
+    void build(const glm::mat4& view, const glm::mat4& proj, glm::vec2 viewport_size, Span<const glm::vec4> lights,
+        Pool* thread_pool = nullptr);
+
+    uint32_t cluster_index(uint32_t x, uint32_t y, uint32_t z) const {
+        return (z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x;
+    }
+    // Same lookup as the fragment shaders do, from the framebuffer position and the world position
+    uint32_t cluster_at(glm::vec2 frag_coord, glm::vec3 world_position) const;
+    void cluster_bounds(uint32_t x, uint32_t y, uint32_t z, glm::vec3& aabb_min, glm::vec3& aabb_max) const;
+
+    const LightClusterHeader& header() const { return _header; }
+    // (first index, count) per cluster
+    const Vector<glm::uvec2>& clusters() const { return _clusters; }
+    const Vector<uint32_t>& light_indices() const { return _light_indices; }
+    uint32_t num_dropped() const { return _num_dropped; }
+
+    // Slice of a view space depth
+    uint32_t slice_of(float depth) const;
+
+private:
+    struct SliceBins {
+        Vector<glm::uvec2> clusters;        // within the slice's indices
+        Vector<uint32_t> indices;
+    };
+
+    void bin_slice(uint32_t z);
+
+    LightClusterHeader _header;
+    float _slice_depths[LIGHT_CLUSTERS_Z + 1];
+    // View space extents of the columns and rows of tiles in each slice
+    float _column_x[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_X][2];
+    float _row_y[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_Y][2];
+
+    Vector<glm::vec4> _view_lights;
+    SliceBins _slice_bins[LIGHT_CLUSTERS_Z];
+    Vector<glm::uvec2> _clusters;
+    Vector<uint32_t> _light_indices;
+    uint32_t _num_dropped = 0;
+};
@@ -9,7 +9,7 @@
 #include "Core/Backend.hpp"
 
 #define TRACY_ENABLE
-#include "tracy/TracyVulkan.hpp"
+#include "tracy/Tracy.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -171,32 +171,35 @@ void LinaVGRenderer::init() {
 	        .renderPass = nullptr,
 	        .subpass = 0
 	    };
-	    VK_CHECK(vkCreateGraphicsPipelines(_renderer->get_device(), VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &_pipelines[render_type]));
+	    _renderer->queue_graphics_pipeline(graphics_pipeline_create_info, &_pipelines[render_type]);
     }
-
-    _renderer->destroy_shader(shader_vs);
-    _renderer->destroy_shader(shader_fs_default);
-    _renderer->destroy_shader(shader_fs_textured);
-    _renderer->destroy_shader(shader_fs_simple_text);
-    _renderer->destroy_shader(shader_fs_sdf_text);
-    _renderer->destroy_shader(shader_fs_rounded_gradient);
-
-    constexpr int MAX_VERTICES = 1000000;
-    constexpr int MAX_INDICES = 1000000;
-    for (int render_type = 0; render_type < RenderTypeCount; render_type++) {
-	    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-			_renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, i, MAX_VERTICES * sizeof(LinaVG::Vertex), _vertex_buffers[render_type]);
-			_renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, i, MAX_INDICES * sizeof(LinaVG::Index), _index_buffers[render_type]);
-	    }
-	}
 }
 
 void LinaVGRenderer::begin_frame() {
 	using namespace LinaVG;
+	ZoneScoped;
+
 	if (Internal::g_rendererData.m_frameStarted) {
 		log_error("LinaVG: StartFrame was called, but EndFrame was skipped! Make sure you always call EndFrame() after calling StartFrame() for the second time!");
 	}
 	Internal::g_rendererData.m_frameStarted = true;
+
+	// end_frame() clears LinaVG's buffers while this frame is still being recorded, so the vertices are uploaded
+	// and the draws flattened here. Every buffer gets its own range of the frame's vertices and indices.
+	reserve_frame_buffers();
+	_frame_draws.truncate();
+	_frame_vertex_count = 0;
+	_frame_index_count = 0;
+
+	auto& arr = Internal::g_rendererData.m_drawOrders;
+	for (int i = 0; i < arr.m_size; i++)
+	{
+	    const int drawOrder = arr[i];
+	    extract_render_pass(drawOrder, DrawBufferShapeType::DropShadow);
+	    extract_render_pass(drawOrder, DrawBufferShapeType::Shape);
+	    extract_render_pass(drawOrder, DrawBufferShapeType::Outline);
+	    extract_render_pass(drawOrder, DrawBufferShapeType::AA);
+	}
 }
 
 void LinaVGRenderer::end_frame() {
@@ -242,77 +245,58 @@ void LinaVGRenderer::end_frame() {
 	}
 }
 
-void LinaVGRenderer::exec_render_pass(VkCommandBuffer command_buffer, int drawOrder, LinaVG::DrawBufferShapeType shapeType) {
-	using namespace LinaVG;
-
-    auto desc_sets = _renderer->get_descriptor_sets_for_current_frame();
 
-	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[(int)RenderType::Default]);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
-		1, desc_sets.data(), 0, nullptr);
+void LinaVGRenderer::extract_render_pass(int drawOrder, LinaVG::DrawBufferShapeType shapeType) {
+	using namespace LinaVG;
 
     for (int i = 0; i < Internal::g_rendererData.m_defaultBuffers.m_size; i++)
     {
         DrawBuffer& buf = Internal::g_rendererData.m_defaultBuffers[i];
 
         if (buf.m_drawOrder == drawOrder && buf.m_shapeType == shapeType) {
-        	render_default(command_buffer, buf);
+        	extract_default(buf);
         }
     }
 
-	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[(int)RenderType::RoundedGradient]);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
-		1, desc_sets.data(), 0, nullptr);
     for (int i = 0; i < Internal::g_rendererData.m_gradientBuffers.m_size; i++)
     {
         GradientDrawBuffer& buf = Internal::g_rendererData.m_gradientBuffers[i];
 
         if (buf.m_drawOrder == drawOrder && buf.m_shapeType == shapeType) {
-        	render_gradient(command_buffer, buf);
+        	extract_gradient(buf);
         }
     }
 
-	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[(int)RenderType::Textured]);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
-		2, desc_sets.data(), 0, nullptr);
     for (int i = 0; i < Internal::g_rendererData.m_textureBuffers.m_size; i++)
     {
         TextureDrawBuffer& buf = Internal::g_rendererData.m_textureBuffers[i];
 
         if (buf.m_drawOrder == drawOrder && buf.m_shapeType == shapeType) {
-        	render_texture(command_buffer, buf);
+        	extract_texture(buf);
         }
     }
 
-	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[(int)RenderType::SimpleText]);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
-		2, desc_sets.data(), 0, nullptr);
     for (int i = 0; i < Internal::g_rendererData.m_simpleTextBuffers.m_size; i++)
     {
         SimpleTextDrawBuffer& buf = Internal::g_rendererData.m_simpleTextBuffers[i];
 
         if (buf.m_drawOrder == drawOrder && buf.m_shapeType == shapeType) {
-        	render_simple_text(command_buffer, buf);
+        	extract_simple_text(buf);
         }
     }
 
-	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[(int)RenderType::SDFText]);
-	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
-		2, desc_sets.data(), 0, nullptr);
     for (int i = 0; i < Internal::g_rendererData.m_sdfTextBuffers.m_size; i++)
     {
         SDFTextDrawBuffer& buf = Internal::g_rendererData.m_sdfTextBuffers[i];
 
         if (buf.m_drawOrder == drawOrder && buf.m_shapeType == shapeType) {
-        	render_sdf_text(command_buffer, buf);
+        	extract_sdf_text(buf);
         }
     }
 }
 
 void LinaVGRenderer::render(VkCommandBuffer command_buffer) {
-	using namespace LinaVG;
-
-	TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "LinaVGRenderer");
+	ZoneScopedN("LinaVGRenderer");
 
 	auto window_extent = _renderer->get_window_extent();
     VkViewport viewport = {
@@ -325,37 +309,40 @@ void LinaVGRenderer::render(VkCommandBuffer command_buffer) {
     VkRect2D scissor = { { 0, 0 }, { (uint32_t)window_extent.x, (uint32_t)window_extent.y } };
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
-	auto res = Res::inst();
-
-	auto& arr = Internal::g_rendererData.m_drawOrders;
+    auto desc_sets = _renderer->get_descriptor_sets_for_current_frame();
 
-	for (int i = 0; i < arr.m_size; i++)
-	{
-	    const int drawOrder = arr[i];
-	    exec_render_pass(command_buffer, drawOrder, DrawBufferShapeType::DropShadow);
-	    exec_render_pass(command_buffer, drawOrder, DrawBufferShapeType::Shape);
-	    exec_render_pass(command_buffer, drawOrder, DrawBufferShapeType::Outline);
-	    exec_render_pass(command_buffer, drawOrder, DrawBufferShapeType::AA);
+	if (!_frame_draws.empty()) {
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, &_frame_vertices.buffer, &_frame_vertices.offset);
+		vkCmdBindIndexBuffer(command_buffer, _frame_indices.buffer, _frame_indices.offset,
+			sizeof(LinaVG::Index) == 2? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
 	}
-}
-
-void LinaVGRenderer::render_default(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf) {
-	if (buf.m_indexBuffer.m_size == 0) return;
 
-	copy_buffer_data_to_gpu(buf, RenderType::Default);
-	cmd_bind_buffers(command_buffer, buf, RenderType::Default);
-	cmd_set_scissors(command_buffer, buf);
+	// Rebind only when the render type changes
+	int bound_type = -1;
+	for (const auto& draw : _frame_draws) {
+		int type = (int)draw.render_type;
+		if (type != bound_type) {
+			// Textured and text shaders also sample from the bindless textures of set 1
+			uint32_t num_sets = (draw.render_type == RenderType::Default || draw.render_type == RenderType::RoundedGradient) ? 1 : 2;
+			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelines[type]);
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline_layout, 0,
+				num_sets, desc_sets.data(), 0, nullptr);
+			bound_type = type;
+		}
 
-	cmd_draw_indexed(command_buffer, buf);
+		vkCmdSetScissor(command_buffer, 0, 1, &draw.scissor);
+		if (draw.has_push_constants) {
+			vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LinaVGPushConstants), &draw.push_constants);
+		}
+		vkCmdDrawIndexed(command_buffer, draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
+	}
 }
 
-void LinaVGRenderer::render_gradient(VkCommandBuffer command_buffer, LinaVG::GradientDrawBuffer& buf) {
-	if (buf.m_indexBuffer.m_size == 0) return;
-
-	copy_buffer_data_to_gpu(buf, RenderType::RoundedGradient);
-	cmd_bind_buffers(command_buffer, buf, RenderType::RoundedGradient);
-	cmd_set_scissors(command_buffer, buf);
+void LinaVGRenderer::extract_default(LinaVG::DrawBuffer& buf) {
+	add_frame_draw(buf, RenderType::Default, nullptr);
+}
 
+void LinaVGRenderer::extract_gradient(LinaVG::GradientDrawBuffer& buf) {
 	LinaVGPushConstants pc;
 	pc.startColor = glm::make_vec4((const float*)&buf.m_color.start);
 	pc.endColor = glm::make_vec4((const float*)&buf.m_color.end);
@@ -363,18 +350,10 @@ void LinaVGRenderer::render_gradient(VkCommandBuffer command_buffer, LinaVG::Gra
 	pc.radialSize = buf.m_color.radialSize;
 	pc.isAABuffer = (int)buf.m_isAABuffer;
 
-	vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LinaVGPushConstants), &pc);
-
-	cmd_draw_indexed(command_buffer, buf);
+	add_frame_draw(buf, RenderType::RoundedGradient, &pc);
 }
 
-void LinaVGRenderer::render_texture(VkCommandBuffer command_buffer, LinaVG::TextureDrawBuffer& buf) {
-	if (buf.m_indexBuffer.m_size == 0) return;
-
-	copy_buffer_data_to_gpu(buf, RenderType::Textured);
-	cmd_bind_buffers(command_buffer, buf, RenderType::Textured);
-	cmd_set_scissors(command_buffer, buf);
-
+void LinaVGRenderer::extract_texture(LinaVG::TextureDrawBuffer& buf) {
 	glm::vec2 uv = LinaVG::Config.flipTextureUVs? 
 		glm::vec2(buf.m_textureUVTiling.x, -buf.m_textureUVTiling.y) : glm::vec2(buf.m_textureUVTiling.x, buf.m_textureUVTiling.y);
 
@@ -385,33 +364,17 @@ void LinaVGRenderer::render_texture(VkCommandBuffer command_buffer, LinaVG::Text
 	pc.tint = glm::make_vec4((const float*)&buf.m_tint);
 	pc.isAABuffer = (int)buf.m_isAABuffer;
 
-	vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LinaVGPushConstants), &pc);
-
-	cmd_draw_indexed(command_buffer, buf);
+	add_frame_draw(buf, RenderType::Textured, &pc);
 }
 
-void LinaVGRenderer::render_simple_text(VkCommandBuffer command_buffer, LinaVG::SimpleTextDrawBuffer& buf) {
-	if (buf.m_indexBuffer.m_size == 0) return;
-
-	copy_buffer_data_to_gpu(buf, RenderType::SimpleText);
-	cmd_bind_buffers(command_buffer, buf, RenderType::SimpleText);
-	cmd_set_scissors(command_buffer, buf);
-
+void LinaVGRenderer::extract_simple_text(LinaVG::SimpleTextDrawBuffer& buf) {
 	LinaVGPushConstants pc;
 	pc.diffuse = buf.m_textureHandle;
 
-	vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LinaVGPushConstants), &pc);
-
-	cmd_draw_indexed(command_buffer, buf);
+	add_frame_draw(buf, RenderType::SimpleText, &pc);
 }
 
-void LinaVGRenderer::render_sdf_text(VkCommandBuffer command_buffer, LinaVG::SDFTextDrawBuffer& buf) {
-	if (buf.m_indexBuffer.m_size == 0) return;
-
-	copy_buffer_data_to_gpu(buf, RenderType::SDFText);
-	cmd_bind_buffers(command_buffer, buf, RenderType::SDFText);
-	cmd_set_scissors(command_buffer, buf);
-
+void LinaVGRenderer::extract_sdf_text(LinaVG::SDFTextDrawBuffer& buf) {
 	LinaVGPushConstants pc;
 	pc.diffuse = buf.m_textureHandle;
 	pc.thickness = 1.0f - glm::clamp(buf.m_thickness, 0.0f, 1.0f);
@@ -421,35 +384,59 @@ void LinaVGRenderer::render_sdf_text(VkCommandBuffer command_buffer, LinaVG::SDF
 	pc.outlineEnabled = pc.outlineThickness != 0.0f ? 1 : 0;
 	pc.flipAlpha = buf.m_flipAlpha? 1 : 0;
 
-	vkCmdPushConstants(command_buffer, _pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LinaVGPushConstants), &pc);
-
-	cmd_draw_indexed(command_buffer, buf);
+	add_frame_draw(buf, RenderType::SDFText, &pc);
 }
 
-void LinaVGRenderer::copy_buffer_data_to_gpu(LinaVG::DrawBuffer& buf, RenderType render_type) {
-	uint32_t cur_frame = _renderer->get_current_frame();
-	size_t vertex_size = buf.m_vertexBuffer.m_size * sizeof(LinaVG::Vertex);
-	size_t index_size = buf.m_indexBuffer.m_size * sizeof(LinaVG::Index);
-	auto& vertex_buffer = _vertex_buffers[(int)render_type];
-	auto& index_buffer = _index_buffers[(int)render_type];
-	_renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cur_frame, vertex_size, vertex_buffer);
-	_renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, cur_frame, index_size, index_buffer);
-	auto vtx_dst = _renderer->get_mapped_pointer(vertex_buffer, cur_frame);
-	auto idx_dst = _renderer->get_mapped_pointer(index_buffer, cur_frame);
-	memcpy(vtx_dst, buf.m_vertexBuffer.m_data, vertex_size);
-	memcpy(idx_dst, buf.m_indexBuffer.m_data, index_size);
+void LinaVGRenderer::reserve_frame_buffers() {
+	using namespace LinaVG;
+
+	size_t vertex_count = 0, index_count = 0;
+	auto count = [&](auto& buffers) {
+		for (int i = 0; i < buffers.m_size; i++) {
+			vertex_count += buffers[i].m_vertexBuffer.m_size;
+			index_count += buffers[i].m_indexBuffer.m_size;
+		}
+	};
+	count(Internal::g_rendererData.m_defaultBuffers);
+	count(Internal::g_rendererData.m_gradientBuffers);
+	count(Internal::g_rendererData.m_textureBuffers);
+	count(Internal::g_rendererData.m_simpleTextBuffers);
+	count(Internal::g_rendererData.m_sdfTextBuffers);
+
+	if (index_count == 0) return;
+	_frame_vertices = _renderer->allocate_transient(vertex_count * sizeof(LinaVG::Vertex));
+	_frame_indices = _renderer->allocate_transient(index_count * sizeof(LinaVG::Index));
 }
 
-void LinaVGRenderer::cmd_bind_buffers(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf, RenderType render_type) {
-	uint32_t cur_frame = _renderer->get_current_frame();
-	auto& vertex_buffer = _vertex_buffers[(int)render_type];
-	auto& index_buffer = _index_buffers[(int)render_type];
-	vkuCmdBindSingleVertexBuffer(command_buffer, vertex_buffer.buffer_per_frame[cur_frame].buffer);
-	vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer_per_frame[cur_frame].buffer,
-		0, sizeof(LinaVG::Index) == 2? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+void LinaVGRenderer::add_frame_draw(LinaVG::DrawBuffer& buf, RenderType render_type, const LinaVGPushConstants* pc) {
+	if (buf.m_indexBuffer.m_size == 0) return;
+
+	auto vtx_dst = (LinaVG::Vertex*)_frame_vertices.data + _frame_vertex_count;
+	auto idx_dst = (LinaVG::Index*)_frame_indices.data + _frame_index_count;
+	memcpy(vtx_dst, buf.m_vertexBuffer.m_data, buf.m_vertexBuffer.m_size * sizeof(LinaVG::Vertex));
+	memcpy(idx_dst, buf.m_indexBuffer.m_data, buf.m_indexBuffer.m_size * sizeof(LinaVG::Index));
+
+	LinaVGFrameDraw draw;
+	draw.render_type = render_type;
+	draw.scissor = get_scissor(buf);
+	draw.has_push_constants = pc != nullptr;
+	if (pc) {
+		draw.push_constants = *pc;
+	}
+	draw.index_count = buf.m_indexBuffer.m_size;
+	draw.first_index = _frame_index_count;
+	draw.vertex_offset = _frame_vertex_count;
+	_frame_draws.push_back(draw);
+
+	_frame_vertex_count += buf.m_vertexBuffer.m_size;
+	_frame_index_count += buf.m_indexBuffer.m_size;
+
+	LinaVG::Config.debugCurrentDrawCalls++;
+	LinaVG::Config.debugCurrentTriangleCount += int((float)buf.m_indexBuffer.m_size / 3.0f);
+	LinaVG::Config.debugCurrentVertexCount += buf.m_vertexBuffer.m_size;
 }
 
-void LinaVGRenderer::cmd_set_scissors(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf) {
+VkRect2D LinaVGRenderer::get_scissor(LinaVG::DrawBuffer& buf) {
 	// TODO: recheck how scissor bounds are calculated (currently different from LinaVG's own renderer)
 	VkRect2D scissor;
 	if (buf.clipSizeX == 0 || buf.clipSizeY == 0) {
@@ -464,13 +451,5 @@ void LinaVGRenderer::cmd_set_scissors(VkCommandBuffer command_buffer, LinaVG::Dr
 		scissor.extent.width = (uint32_t)buf.clipSizeX;
 		scissor.extent.height = (uint32_t)buf.clipSizeY;
 	}
-	vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-}
-
-void LinaVGRenderer::cmd_draw_indexed(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf) {
-	vkCmdDrawIndexed(command_buffer, buf.m_indexBuffer.m_size, 1, 0, 0, 0);
-
-	LinaVG::Config.debugCurrentDrawCalls++;
-	LinaVG::Config.debugCurrentTriangleCount += int((float)buf.m_indexBuffer.m_size / 3.0f);
-	LinaVG::Config.debugCurrentVertexCount += buf.m_vertexBuffer.m_size;
+	return scissor;
 }
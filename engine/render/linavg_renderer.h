@@ -45,30 +45,44 @@ public:
 	void render(VkCommandBuffer command_buffer) override;
 	void cleanup();
 
-	void render_default(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf);
-	void render_gradient(VkCommandBuffer command_buffer, LinaVG::GradientDrawBuffer& buf);
-	void render_texture(VkCommandBuffer command_buffer, LinaVG::TextureDrawBuffer& buf);
-	void render_simple_text(VkCommandBuffer command_buffer, LinaVG::SimpleTextDrawBuffer& buf);
-	void render_sdf_text(VkCommandBuffer command_buffer, LinaVG::SDFTextDrawBuffer& buf);
-
 private:
+	// Draws of the frame being rendered, flattened from LinaVG's buffers in begin_frame()
+	struct LinaVGFrameDraw {
+		RenderType render_type;
+		VkRect2D scissor;
+		LinaVGPushConstants push_constants;
+		bool has_push_constants;
+		uint32_t index_count;
+		uint32_t first_index;
+		int32_t vertex_offset;
+	};
 
 	bool _is_initialized = false;
 
 	VkPipelineLayout _pipeline_layout;
 	Array<VkPipeline, RenderTypeCount> _pipelines;
 
-	Array<DynamicBuffer, RenderTypeCount> _vertex_buffers;
-	Array<DynamicBuffer, RenderTypeCount> _index_buffers;
+	// All render types share one range of vertices and one of indices in the renderer's transient buffer
+	TransientAllocation _frame_vertices;
+	TransientAllocation _frame_indices;
+
+	Vector<LinaVGFrameDraw> _frame_draws;
+	uint32_t _frame_vertex_count = 0;
+	uint32_t _frame_index_count = 0;
 
 	int _debug_current_draw_calls = 0;
 	int _debug_current_triangle_count = 0;
 	int _debug_current_vertex_count = 0;
 
-	void exec_render_pass(VkCommandBuffer command_buffer, int drawOrder, LinaVG::DrawBufferShapeType shapeType);
+	void extract_render_pass(int drawOrder, LinaVG::DrawBufferShapeType shapeType);
+
+	void extract_default(LinaVG::DrawBuffer& buf);
+	void extract_gradient(LinaVG::GradientDrawBuffer& buf);
+	void extract_texture(LinaVG::TextureDrawBuffer& buf);
+	void extract_simple_text(LinaVG::SimpleTextDrawBuffer& buf);
+	void extract_sdf_text(LinaVG::SDFTextDrawBuffer& buf);
 
-	void copy_buffer_data_to_gpu(LinaVG::DrawBuffer& buf, RenderType render_type);
-	void cmd_bind_buffers(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf, RenderType render_type);
-	void cmd_set_scissors(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf);
-	void cmd_draw_indexed(VkCommandBuffer command_buffer, LinaVG::DrawBuffer& buf);
+	void reserve_frame_buffers();
+	void add_frame_draw(LinaVG::DrawBuffer& buf, RenderType render_type, const LinaVGPushConstants* pc);
+	VkRect2D get_scissor(LinaVG::DrawBuffer& buf);
 };
\ No newline at end of file
@@ -4,15 +4,47 @@
 #include "vk_utils.h"
 
 #include "res.h"
+#include "engine.h"
+#include "nanothread/nanothread.h"
 #include "vulkan/vulkan_core.h"
 
+#include <atomic>
+
 #define TRACY_ENABLE
-#include "tracy/TracyVulkan.hpp"
+#include "tracy/Tracy.hpp"
 
 void MeshRenderer::init() {
+	create_instance_descriptors();
 	create_graphics_pipeline();
 }
 
+void MeshRenderer::create_instance_descriptors() {
+    VkDevice device = _renderer->get_device();
+
+    Array<VkDescriptorSetLayoutBinding, 1> bindings = {
+        VkDescriptorSetLayoutBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        }
+    };
+    vkuCreateDescriptorSetLayout(device, bindings, &_instance_descriptor_set_layout);
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = MAX_FRAMES_IN_FLIGHT
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size
+    };
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &_instance_descriptor_pool));
+    vkuCreateDescriptorSets(device, _instance_descriptor_pool, _instance_descriptor_set_layout, _instance_descriptor_set.set_per_frame);
+}
+
 void MeshRenderer::create_graphics_pipeline() {
 	Shader vert_shader = _renderer->load_shader_from_file("shaders/textured_mesh.vert.spv", ShaderType::Vertex);
     Shader frag_shader = _renderer->load_shader_from_file("shaders/textured_mesh.frag.spv", ShaderType::Fragment);
@@ -123,7 +155,11 @@ void MeshRenderer::create_graphics_pipeline() {
             .size = sizeof(MeshPushConstants),
     };
 
-    auto desc_set_layouts = _renderer->get_descriptor_set_layouts();
+    auto renderer_set_layouts = _renderer->get_descriptor_set_layouts();
+    Array<VkDescriptorSetLayout, 5> desc_set_layouts = {
+        renderer_set_layouts[0], renderer_set_layouts[1], renderer_set_layouts[2], renderer_set_layouts[3],
+        _instance_descriptor_set_layout
+    };
 
     VkPipelineLayoutCreateInfo pipeline_layout_info = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -159,55 +195,178 @@ void MeshRenderer::create_graphics_pipeline() {
             .subpass = 0,
     };
 
-    VK_CHECK(vkCreateGraphicsPipelines(_renderer->get_device(), VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, nullptr, &_graphics_pipeline));
+    _renderer->queue_graphics_pipeline(graphics_pipeline_create_info, &_graphics_pipeline);
+}
 
-    vkDestroyShaderModule(_renderer->get_device(), vert_shader.module, nullptr);
-    vkDestroyShaderModule(_renderer->get_device(), frag_shader.module, nullptr);
+void MeshRenderer::begin_frame() {
+    ZoneScoped;
+
+    const Camera& camera = _renderer->get_current_camera();
+    glm::vec3 cam_forward = camera.rotation[2];
+    auto res = Res::inst();
+    Pool* thread_pool = Engine::instance()->thread_pool;
+
+    bool occlusion = occlusion_culling && _occluders.res > 0;
+    if (occlusion) {
+        ZoneScopedN("RasterizeOccluders");
+        _occlusion.begin(camera.proj_mat * camera.get_view_matrix());
+        _occlusion.add_heightfield(_occluders);
+        drjit::parallel_for(drjit::blocked_range<uint32_t>(0, OcclusionBuffer::NUM_BANDS, 1), [&](auto range) {
+            for (uint32_t band : range) {
+                _occlusion.rasterize_band(band);
+            }
+        }, thread_pool);
+    }
+
+    std::atomic<uint32_t> num_occluded_meshes = 0;
+    _packets.begin(thread_pool);
+    // Entities outside of the frustum have already been culled with the renderer's entity BVH
+    const auto& entities = _renderer->get_visible_entities();
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, entities.size(), 64), [&](auto range) {
+        ZoneScopedN("ExtractMeshDrawPackets");
+        auto& arena = _packets.arena();
+        uint32_t range_occluded = 0;
+        for (uint32_t i : range) {
+            const Model& model = _ecs->get_component<Model>(entities[i]);
+            const Transform& transform = _ecs->get_component<Transform>(entities[i]);
+            glm::mat4 model_mat = transform.to_matrix();
+            float depth = glm::dot(transform.translation - camera.position, cam_forward);
+            // Only entities with a visible mesh take up a transform
+            uint32_t transform_idx = UINT32_MAX;
+            for (auto mesh_id : model.meshes) {
+                TexturedMesh* mesh = res->get(mesh_id);
+                if (occlusion && !_occlusion.is_visible(mesh->aabb_min, mesh->aabb_max, model_mat)) {
+                    range_occluded++;
+                    continue;
+                }
+                if (transform_idx == UINT32_MAX) {
+                    transform_idx = arena.add_transform(model_mat);
+                }
+                uint32_t material = res->_material_pool.get_item_idx(mesh->mat_id);
+                uint32_t mesh_idx = res->_textured_mesh_pool.get_item_idx(mesh_id);
+                arena.packets.push_back(DrawPacket {
+                    .sort_key = make_draw_sort_key(0, material, mesh_idx, depth),
+                    .mesh = mesh_id,
+                    .material = material,
+                    .transform = transform_idx
+                });
+            }
+        }
+        num_occluded_meshes.fetch_add(range_occluded, std::memory_order_relaxed);
+    }, thread_pool);
+    _packets.finish();
+    num_occluded = num_occluded_meshes.load();
+}
 
+void MeshRenderer::record_transfers(VkCommandBuffer command_buffer) {
+    auto model_matrices = _packets.instance_transforms();
+    if (model_matrices.size() == 0) {
+        return;
+    }
+
+    // The fence of this frame slot has been waited on, so its instance buffer is no longer read by the GPU
+    uint32_t cur_frame = _renderer->get_current_frame();
+    size_t size = sizeof(glm::mat4) * model_matrices.size();
+    size_t capacity = _instance_buffer.buffer_per_frame[cur_frame].size;
+    if (capacity < size) {
+        _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, cur_frame,
+            glm::max(size, 2 * capacity), _instance_buffer);
+        _instance_descriptor_set.is_dirty[cur_frame] = true;
+    }
+    memcpy(_renderer->get_mapped_pointer(_instance_buffer, cur_frame), model_matrices.data(), size);
+
+    if (_instance_descriptor_set.is_dirty[cur_frame]) {
+        VkDescriptorBufferInfo buffer_info = {
+            .buffer = _instance_buffer.buffer_per_frame[cur_frame].buffer,
+            .offset = 0,
+            .range = VK_WHOLE_SIZE
+        };
+        VkWriteDescriptorSet descriptor_write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = _instance_descriptor_set.set_per_frame[cur_frame],
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_info
+        };
+        vkUpdateDescriptorSets(_renderer->get_device(), 1, &descriptor_write, 0, nullptr);
+        _instance_descriptor_set.is_dirty[cur_frame] = false;
+    }
+}
+
+uint32_t MeshRenderer::get_render_slice_count() {
+    // Small slices aren't worth a secondary command buffer, and more slices than threads can't record in parallel
+    uint32_t num_batches = _packets.batches().size();
+    uint32_t max_slices = pool_size(Engine::instance()->thread_pool) + 1;
+    return glm::clamp((num_batches + MESH_BATCHES_PER_SLICE - 1) / MESH_BATCHES_PER_SLICE, 1u, max_slices);
 }
 
 void MeshRenderer::render(VkCommandBuffer command_buffer) {
-    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "MeshRenderer")
+    render_slice(command_buffer, 0, 1);
+}
+
+void MeshRenderer::render_slice(VkCommandBuffer command_buffer, uint32_t slice_idx, uint32_t slice_count) {
+    ZoneScopedN("MeshRenderer");
+
+    auto batches = _packets.batches();
+    uint32_t batch_begin = (uint64_t)batches.size() * slice_idx / slice_count;
+    uint32_t batch_end = (uint64_t)batches.size() * (slice_idx + 1) / slice_count;
+    if (batch_begin == batch_end) {
+        return;
+    }
+
+    uint32_t cur_frame = _renderer->get_current_frame();
 
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphics_pipeline);
 
     auto& camera = _renderer->get_current_camera();
 
-    auto descriptor_sets = _renderer->get_descriptor_sets_for_current_frame();
+    auto renderer_sets = _renderer->get_descriptor_sets_for_current_frame();
+    Array<VkDescriptorSet, 5> descriptor_sets = {
+        renderer_sets[0], renderer_sets[1], renderer_sets[2], renderer_sets[3],
+        _instance_descriptor_set.set_per_frame[cur_frame]
+    };
 
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphics_pipeline_layout, 0,
                             descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
 
     MeshPushConstants push_constants;
-    push_constants.cam_pos = glm::vec3(camera.get_view_matrix()[3]);
-    
-    _ecs->query<Model, Transform>().foreach([&](Entity entity, Model& model, const Transform& transform) {
-        auto res = Res::inst();
-
-        push_constants.view_model = camera.get_view_matrix() * transform.to_matrix();
-        push_constants.color = glm::vec4(1, 1, 1, 1);
-
-        for (int i = 0; i < model.meshes.size(); i++) {
-        	auto mesh_id = model.meshes[i];
-	        TexturedMesh* mesh = res->get(mesh_id);
-
-            push_constants.mat_id = res->_material_pool.get_item_idx(mesh->mat_id);
+    push_constants.view = camera.get_view_matrix();
+    push_constants.color = glm::vec4(1, 1, 1, 1);
+    push_constants.cam_pos = glm::vec3(push_constants.view[3]);
+
+    // Batches are sorted by material then mesh, so consecutive ones often share the material.
+    // Meshes are suballocated from the geometry arena, buffers are only rebound when the arena block changes.
+    auto res = Res::inst();
+    uint32_t bound_material = UINT32_MAX;
+    uint32_t bound_block = UINT32_MAX;
+    for (uint32_t batch_idx = batch_begin; batch_idx < batch_end; batch_idx++) {
+        const auto& batch = batches[batch_idx];
+        TexturedMesh* mesh = res->get(batch.mesh);
+
+        if (batch.material != bound_material) {
+            push_constants.mat_id = batch.material;
             vkCmdPushConstants(command_buffer, _graphics_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &push_constants);
-	        vkuCmdBindSingleVertexBuffer(command_buffer, mesh->vertex_buffer.buffer);
-	        if (mesh->index_count > 0) {
-	            vkCmdBindIndexBuffer(command_buffer, mesh->index_buffer.buffer, 0, VK_INDEX_TYPE_UINT16);
-	        }
-
-	        if (mesh->index_count > 0) {
-	            vkCmdDrawIndexed(command_buffer, mesh->index_count, 1, 0, 0, 0);
-	        }
-	        else {
-	            vkCmdDraw(command_buffer, mesh->vertex_count, 1, 0, 0);
-	        }
+            bound_material = batch.material;
+        }
+        if (mesh->geometry_block != bound_block) {
+            _renderer->bind_geometry_block(command_buffer, mesh->geometry_block);
+            bound_block = mesh->geometry_block;
         }
 
-    });
+        if (mesh->index_count > 0) {
+            vkCmdDrawIndexed(command_buffer, mesh->index_count, batch.instance_count,
+                             mesh->first_index, mesh->vertex_offset, batch.first_instance);
+        }
+        else {
+            vkCmdDraw(command_buffer, mesh->vertex_count, batch.instance_count, mesh->vertex_offset, batch.first_instance);
+        }
+    }
 }
 
 void MeshRenderer::cleanup() {
+    _renderer->destroy_dynamic_buffer(_instance_buffer);
+    _instance_buffer = {};
+    vkDestroyDescriptorPool(_renderer->get_device(), _instance_descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(_renderer->get_device(), _instance_descriptor_set_layout, nullptr);
 }
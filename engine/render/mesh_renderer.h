@@ -1,27 +1,51 @@
 #pragma once
 
 #include "render/renderer.h"
+#include "render/draw_packets.h"
+#include "render/occlusion.h"
 
 
+// Batches per secondary command buffer when recording in parallel
+constexpr uint32_t MESH_BATCHES_PER_SLICE = 256;
+
 class MeshRenderer : public RenderInterface {
 public:
 	MeshRenderer(Renderer* renderer, ECS* ecs) : RenderInterface(renderer), _ecs(ecs) {}
 
 	void init();
+	void begin_frame() override;
+	void record_transfers(VkCommandBuffer command_buffer) override;
 	void render(VkCommandBuffer command_buffer) override;
+	uint32_t get_render_slice_count() override;
+	void render_slice(VkCommandBuffer command_buffer, uint32_t slice_idx, uint32_t slice_count) override;
 	void cleanup();
 
+	// Terrain rasterized into the occlusion buffer in begin_frame(), has to be filled before it
+	OccluderHeightfield& occluders() { return _occluders; }
+
+	bool occlusion_culling = true;
+	uint32_t num_occluded = 0;		// meshes rejected by the last begin_frame()
+
 private:
 	void create_graphics_pipeline();
-
-	void create_descriptor_set_layout();
-	void create_descrtptor_sets();
+	void create_instance_descriptors();
 
     VkPipelineLayout _graphics_pipeline_layout;
     VkPipeline _graphics_pipeline;
 
-    VkDescriptorSetLayout _material_descriptor_set_layout;
-    DescriptorSet _material_descriptor_set;
+    // Draw packets extracted from the ECS in begin_frame(), record_transfers() uploads their instance transforms
+    // and each render slice walks a contiguous range of the sorted batches. The model matrices of the sorted packets
+    // are bound as set 4 and indexed with gl_InstanceIndex, each frame in flight has its own buffer and its
+    // descriptor is rewritten whenever the buffer is reallocated.
+    DrawPacketList _packets;
+
+    // Meshes behind the terrain are dropped before their draw packets are emitted
+    OccluderHeightfield _occluders;
+    OcclusionBuffer _occlusion;
+    DynamicBuffer _instance_buffer;
+    VkDescriptorPool _instance_descriptor_pool;
+    VkDescriptorSetLayout _instance_descriptor_set_layout;
+    DescriptorSet _instance_descriptor_set;
 
     ECS* _ecs;
 };
@@ -0,0 +1,290 @@
+#include "occlusion.h"
+
+#include "core/cpu.h"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+#include <glm/common.hpp>
+
+#include <immintrin.h>
+
+OcclusionBuffer::OcclusionBuffer()
+    : _depth(WIDTH * HEIGHT, 1.0f), _tile_max_depth(TILES_X * TILES_Y, 1.0f) {}
+
+void OcclusionBuffer::begin(const glm::mat4& view_proj) {
+    _view_proj = view_proj;
+    _triangles.truncate();
+}
+
+void OcclusionBuffer::add_triangles(Span<const glm::vec3> vertices, Span<const uint32_t> indices) {
+    _clip_vertices.truncate();
+    for (const auto& vertex : vertices) {
+        _clip_vertices.push_back(_view_proj * glm::vec4(vertex, 1.0f));
+    }
+    for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+        add_clipped_triangle(_clip_vertices[indices[i]], _clip_vertices[indices[i + 1]], _clip_vertices[indices[i + 2]]);
+    }
+}
+
+void OcclusionBuffer::add_heightfield(const OccluderHeightfield& heightfield) {
+    const uint32_t res = heightfield.res;
+    if (res == 0) return;
+
+    // Every corner takes the lowest bound of the cells around it, the triangles in between are then below all of
+    // the cells they cross
+    const uint32_t n = res + 1;
+    _clip_vertices.truncate();
+    for (uint32_t vz = 0; vz < n; vz++) {
+        for (uint32_t vx = 0; vx < n; vx++) {
+            float height = FLT_MAX;
+            for (uint32_t cz = vz > 0 ? vz - 1 : 0; cz <= vz && cz < res; cz++) {
+                for (uint32_t cx = vx > 0 ? vx - 1 : 0; cx <= vx && cx < res; cx++) {
+                    height = glm::min(height, heightfield.min_heights[cz * res + cx]);
+                }
+            }
+            glm::vec3 pos = glm::vec3(heightfield.origin.x + vx * heightfield.cell_size, height,
+                                      heightfield.origin.y + vz * heightfield.cell_size);
+            _clip_vertices.push_back(_view_proj * glm::vec4(pos, 1.0f));
+        }
+    }
+
+    for (uint32_t cz = 0; cz < res; cz++) {
+        for (uint32_t cx = 0; cx < res; cx++) {
+            uint32_t i = cz * n + cx;
+            add_clipped_triangle(_clip_vertices[i], _clip_vertices[i + 1], _clip_vertices[i + n + 1]);
+            add_clipped_triangle(_clip_vertices[i], _clip_vertices[i + n + 1], _clip_vertices[i + n]);
+        }
+    }
+}
+
+void OcclusionBuffer::add_clipped_triangle(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2) {
+    // Clip against the near plane (z >= 0), which leaves at most a quad
+    glm::vec4 in[3] = {v0, v1, v2};
+    glm::vec4 out[4];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 3; i++) {
+        const glm::vec4& a = in[i];
+        const glm::vec4& b = in[(i + 1) % 3];
+        if (a.z >= 0.0f) {
+            out[count++] = a;
+        }
+        if ((a.z >= 0.0f) != (b.z >= 0.0f)) {
+            out[count++] = a + (b - a) * (a.z / (a.z - b.z));
+        }
+    }
+    if (count < 3) return;
+
+    glm::vec3 screen[4];
+    for (uint32_t i = 0; i < count; i++) {
+        glm::vec3 ndc = glm::vec3(out[i]) / out[i].w;
+        screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z);
+    }
+    add_screen_triangle(screen[0], screen[1], screen[2]);
+    if (count == 4) {
+        add_screen_triangle(screen[0], screen[2], screen[3]);
+    }
+}
+
+void OcclusionBuffer::add_screen_triangle(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2) {
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+    if (fabsf(area) < 1e-6f) return;
+    if (area < 0.0f) {
+        std::swap(p1, p2);
+        area = -area;
+    }
+    if (glm::min(glm::min(p0.z, p1.z), p2.z) >= 1.0f) return;
+
+    // Pixels whose centers are in the bounding box
+    glm::vec2 box_min = glm::min(glm::min(glm::vec2(p0), glm::vec2(p1)), glm::vec2(p2));
+    glm::vec2 box_max = glm::max(glm::max(glm::vec2(p0), glm::vec2(p1)), glm::vec2(p2));
+    box_min = glm::clamp(glm::ceil(box_min - 0.5f), glm::vec2(0.0f), glm::vec2(WIDTH, HEIGHT));
+    box_max = glm::clamp(glm::floor(box_max - 0.5f), glm::vec2(-1.0f), glm::vec2(WIDTH - 1, HEIGHT - 1));
+    if (box_min.x > box_max.x || box_min.y > box_max.y) return;
+
+    Triangle tri;
+    auto edge = [](glm::vec3 a, glm::vec3 b) {
+        return glm::vec3(a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x);
+    };
+    tri.edges[0] = edge(p1, p2);
+    tri.edges[1] = edge(p2, p0);
+    tri.edges[2] = edge(p0, p1);
+    // The edge functions are the barycentric coordinates times the area
+    tri.depth = (tri.edges[0] * p0.z + tri.edges[1] * p1.z + tri.edges[2] * p2.z) / area;
+    tri.min_x = (int32_t)box_min.x;
+    tri.max_x = (int32_t)box_max.x;
+    tri.min_y = (int32_t)box_min.y;
+    tri.max_y = (int32_t)box_max.y;
+    _triangles.push_back(tri);
+}
+
+void OcclusionBuffer::rasterize_band(uint32_t band) {
+    if (cpu_supports_avx2()) {
+        rasterize_band_avx2(band);
+    }
+    else {
+        rasterize_band_scalar(band);
+    }
+}
+
+void OcclusionBuffer::rasterize_band_scalar(uint32_t band) {
+    const int32_t band_min_y = band * BAND_HEIGHT;
+    const int32_t band_max_y = band_min_y + BAND_HEIGHT - 1;
+    float* depth = _depth.data();
+    std::fill(depth + band_min_y * WIDTH, depth + (band_max_y + 1) * WIDTH, 1.0f);
+
+    for (const auto& tri : _triangles) {
+        int32_t min_y = glm::max(tri.min_y, band_min_y);
+        int32_t max_y = glm::min(tri.max_y, band_max_y);
+        for (int32_t y = min_y; y <= max_y; y++) {
+            float py = y + 0.5f;
+            float row_e0 = tri.edges[0].y * py + tri.edges[0].z;
+            float row_e1 = tri.edges[1].y * py + tri.edges[1].z;
+            float row_e2 = tri.edges[2].y * py + tri.edges[2].z;
+            float row_z = tri.depth.y * py + tri.depth.z;
+            float* row = depth + y * WIDTH;
+            for (int32_t x = tri.min_x; x <= tri.max_x; x++) {
+                float px = x + 0.5f;
+                float e0 = tri.edges[0].x * px + row_e0;
+                float e1 = tri.edges[1].x * px + row_e1;
+                float e2 = tri.edges[2].x * px + row_e2;
+                if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+                    row[x] = glm::min(row[x], tri.depth.x * px + row_z);
+                }
+            }
+        }
+    }
+    update_tiles(band);
+}
+
+// Same operations as the scalar version, 8 pixels of a row at a time. Rows start at a multiple of 8, lanes outside
+// of the triangle's bounding box are masked since the edge functions of huge triangles aren't precise enough there.
+CPU_TARGET_AVX2 void OcclusionBuffer::rasterize_band_avx2(uint32_t band) {
+    const int32_t band_min_y = band * BAND_HEIGHT;
+    const int32_t band_max_y = band_min_y + BAND_HEIGHT - 1;
+    float* depth = _depth.data();
+    std::fill(depth + band_min_y * WIDTH, depth + (band_max_y + 1) * WIDTH, 1.0f);
+
+    const __m256 lane_offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (const auto& tri : _triangles) {
+        int32_t min_y = glm::max(tri.min_y, band_min_y);
+        int32_t max_y = glm::min(tri.max_y, band_max_y);
+        int32_t min_x = tri.min_x & ~7;
+
+        __m256 e0_a = _mm256_set1_ps(tri.edges[0].x);
+        __m256 e1_a = _mm256_set1_ps(tri.edges[1].x);
+        __m256 e2_a = _mm256_set1_ps(tri.edges[2].x);
+        __m256 z_a = _mm256_set1_ps(tri.depth.x);
+        __m256 box_min_x = _mm256_set1_ps(tri.min_x + 0.5f);
+        __m256 box_max_x = _mm256_set1_ps(tri.max_x + 0.5f);
+
+        for (int32_t y = min_y; y <= max_y; y++) {
+            float py = y + 0.5f;
+            __m256 row_e0 = _mm256_set1_ps(tri.edges[0].y * py + tri.edges[0].z);
+            __m256 row_e1 = _mm256_set1_ps(tri.edges[1].y * py + tri.edges[1].z);
+            __m256 row_e2 = _mm256_set1_ps(tri.edges[2].y * py + tri.edges[2].z);
+            __m256 row_z = _mm256_set1_ps(tri.depth.y * py + tri.depth.z);
+            float* row = depth + y * WIDTH;
+
+            for (int32_t x = min_x; x <= tri.max_x; x += 8) {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane_offsets);
+                __m256 e0 = _mm256_add_ps(_mm256_mul_ps(e0_a, px), row_e0);
+                __m256 e1 = _mm256_add_ps(_mm256_mul_ps(e1_a, px), row_e1);
+                __m256 e2 = _mm256_add_ps(_mm256_mul_ps(e2_a, px), row_e2);
+                __m256 inside = _mm256_and_ps(_mm256_and_ps(
+                    _mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                    _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+                inside = _mm256_and_ps(inside, _mm256_and_ps(
+                    _mm256_cmp_ps(px, box_min_x, _CMP_GE_OQ), _mm256_cmp_ps(px, box_max_x, _CMP_LE_OQ)));
+                if (_mm256_movemask_ps(inside) == 0) continue;
+
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(z_a, px), row_z);
+                __m256 old_z = _mm256_loadu_ps(row + x);
+                _mm256_storeu_ps(row + x, _mm256_blendv_ps(old_z, _mm256_min_ps(old_z, z), inside));
+            }
+        }
+    }
+    update_tiles(band);
+}
+
+void OcclusionBuffer::update_tiles(uint32_t band) {
+    const uint32_t first_tile_y = band * BAND_HEIGHT / TILE_SIZE;
+    for (uint32_t tile_y = first_tile_y; tile_y < first_tile_y + BAND_HEIGHT / TILE_SIZE; tile_y++) {
+        for (uint32_t tile_x = 0; tile_x < TILES_X; tile_x++) {
+            float max_depth = 0.0f;
+            for (uint32_t y = tile_y * TILE_SIZE; y < (tile_y + 1) * TILE_SIZE; y++) {
+                const float* row = _depth.data() + y * WIDTH + tile_x * TILE_SIZE;
+                for (uint32_t x = 0; x < TILE_SIZE; x++) {
+                    max_depth = glm::max(max_depth, row[x]);
+                }
+            }
+            _tile_max_depth[tile_y * TILES_X + tile_x] = max_depth;
+        }
+    }
+}
+
+bool OcclusionBuffer::is_visible(glm::vec3 aabb_min, glm::vec3 aabb_max, const glm::mat4& model) const {
+    glm::mat4 mvp = _view_proj * model;
+
+    glm::vec2 rect_min = glm::vec2(FLT_MAX);
+    glm::vec2 rect_max = glm::vec2(-FLT_MAX);
+    float min_z = FLT_MAX;
+    uint32_t num_behind = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        glm::vec3 corner = glm::vec3(
+            i & 1 ? aabb_max.x : aabb_min.x,
+            i & 2 ? aabb_max.y : aabb_min.y,
+            i & 4 ? aabb_max.z : aabb_min.z);
+        glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+        if (clip.z < 0.0f || clip.w <= 0.0f) {
+            num_behind++;
+            continue;
+        }
+
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        glm::vec2 screen = glm::vec2((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT);
+        rect_min = glm::min(rect_min, screen);
+        rect_max = glm::max(rect_max, screen);
+        min_z = glm::min(min_z, ndc.z);
+    }
+
+    // Completely in front of the near plane, or crossing it
+    if (num_behind == 8) return false;
+    if (num_behind > 0) return true;
+
+    // Outside of the screen or beyond the far plane
+    if (rect_max.x < 0.0f || rect_max.y < 0.0f || rect_min.x > WIDTH || rect_min.y > HEIGHT || min_z > 1.0f) {
+        return false;
+    }
+
+    // Every pixel the rectangle touches, and the ones around them. Depth is only known at pixel centers, an occluder
+    // covering the center of a pixel may not cover the part of it the box is in, but its neighbor's center then
+    // isn't covered either.
+    int32_t min_x = glm::max((int32_t)floorf(rect_min.x) - 1, 0);
+    int32_t min_y = glm::max((int32_t)floorf(rect_min.y) - 1, 0);
+    int32_t max_x = glm::min((int32_t)floorf(rect_max.x) + 1, (int32_t)WIDTH - 1);
+    int32_t max_y = glm::min((int32_t)floorf(rect_max.y) + 1, (int32_t)HEIGHT - 1);
+
+    for (int32_t tile_y = min_y / TILE_SIZE; tile_y <= max_y / (int32_t)TILE_SIZE; tile_y++) {
+        for (int32_t tile_x = min_x / TILE_SIZE; tile_x <= max_x / (int32_t)TILE_SIZE; tile_x++) {
+            if (min_z > _tile_max_depth[tile_y * TILES_X + tile_x]) continue;
+
+            int32_t x0 = glm::max(min_x, tile_x * (int32_t)TILE_SIZE);
+            int32_t y0 = glm::max(min_y, tile_y * (int32_t)TILE_SIZE);
+            int32_t x1 = glm::min(max_x, (tile_x + 1) * (int32_t)TILE_SIZE - 1);
+            int32_t y1 = glm::min(max_y, (tile_y + 1) * (int32_t)TILE_SIZE - 1);
+            // The farthest pixel of the tile is inside of the rectangle if it covers the whole tile
+            if (x1 - x0 + 1 == TILE_SIZE && y1 - y0 + 1 == TILE_SIZE) return true;
+
+            for (int32_t y = y0; y <= y1; y++) {
+                for (int32_t x = x0; x <= x1; x++) {
+                    if (min_z <= _depth[y * WIDTH + x]) return true;
+                }
+            }
+        }
+    }
+    return false;
+}
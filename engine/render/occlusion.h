@@ -0,0 +1,79 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+// Terrain as an occluder: res x res cells of cell_size starting at origin (world x/z), each with a lower bound of
+// the surface height inside of it. Occluders must never be in front of what they stand for, so the rasterized
+// surface goes through the lowest bound around each corner and stays below the terrain.
+struct OccluderHeightfield {
+    glm::vec2 origin = glm::vec2(0.0f);
+    float cell_size = 0.0f;
+    uint32_t res = 0;
+    Vector<float> min_heights;      // res * res, rows along z
+};
+
+// Low resolution software depth buffer for occlusion culling on the CPU. Occluders are rasterized 8 pixels at a
+// time with AVX2 (with a scalar fallback), in bands of rows that don't share any pixels so that every band can be
+// rasterized on a different thread. Each 8x8 tile keeps the farthest depth in it, boxes behind that are rejected
+// without looking at the pixels.
+// Depth is the [0, 1] NDC depth of the view projection, the buffer is cleared to the far plane.
+// Usage: begin(), add occluders, rasterize_band() for every band, then is_visible() from any number of threads.
+class OcclusionBuffer {
+public:
+    static constexpr uint32_t WIDTH = 256;
+    static constexpr uint32_t HEIGHT = 128;
+    static constexpr uint32_t TILE_SIZE = 8;
+    static constexpr uint32_t TILES_X = WIDTH / TILE_SIZE;
+    static constexpr uint32_t TILES_Y = HEIGHT / TILE_SIZE;
+    static constexpr uint32_t BAND_HEIGHT = 16;
+    static constexpr uint32_t NUM_BANDS = HEIGHT / BAND_HEIGHT;
+
+    static_assert(WIDTH % 8 == 0 && BAND_HEIGHT % TILE_SIZE == 0 && HEIGHT % BAND_HEIGHT == 0);
+
+    OcclusionBuffer();
+
+    // Drops the occluders of the previous frame
+    void begin(const glm::mat4& view_proj);
+
+    // Triangles are clipped against the near plane, nothing is back face culled
+    void add_triangles(Span<const glm::vec3> vertices, Span<const uint32_t> indices);
+    void add_heightfield(const OccluderHeightfield& heightfield);
+
+    // Clears the band and rasterizes every occluder into it
+    void rasterize_band(uint32_t band);
+    void rasterize_band_scalar(uint32_t band);
+    void rasterize_band_avx2(uint32_t band);
+
+    // Conservative, false only if the box is outside of the screen or behind the occluders.
+    // Boxes crossing the near plane are always visible.
+    bool is_visible(glm::vec3 aabb_min, glm::vec3 aabb_max, const glm::mat4& model = glm::mat4(1.0f)) const;
+
+    uint32_t num_triangles() const { return _triangles.size(); }
+    float depth(uint32_t x, uint32_t y) const { return _depth[y * WIDTH + x]; }
+    float tile_max_depth(uint32_t tile_x, uint32_t tile_y) const { return _tile_max_depth[tile_y * TILES_X + tile_x]; }
+
+private:
+    // Edge functions and depth plane in pixel coordinates, evaluated at pixel centers.
+    // A pixel is covered when all three edge functions are >= 0.
+    struct Triangle {
+        glm::vec3 edges[3];     // (a, b, c) of a * x + b * y + c
+        glm::vec3 depth;        // (a, b, c) of the depth plane
+        int32_t min_x, max_x, min_y, max_y;
+    };
+
+    void add_clipped_triangle(glm::vec4 v0, glm::vec4 v1, glm::vec4 v2);
+    void add_screen_triangle(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2);
+    void update_tiles(uint32_t band);
+
+    glm::mat4 _view_proj = glm::mat4(1.0f);
+    Vector<Triangle> _triangles;
+    Vector<glm::vec4> _clip_vertices;
+    Vector<float> _depth;
+    Vector<float> _tile_max_depth;
+};
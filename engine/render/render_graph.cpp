@@ -0,0 +1,249 @@
+#include "render_graph.h"
+
+bool is_write_access(RenderAccess access) {
+    return access == RenderAccess::ColorAttachment || access == RenderAccess::DepthAttachment
+        || access == RenderAccess::StorageWrite;
+}
+
+bool is_attachment_access(RenderAccess access) {
+    return access == RenderAccess::ColorAttachment || access == RenderAccess::DepthAttachment
+        || access == RenderAccess::DepthRead;
+}
+
+// Reads after the same kind of read don't have to wait, and neither do attachment writes of consecutive passes
+// within one rendering scope since they're ordered by rasterization order. compile() adds the barriers for
+// attachment writes across scopes. Everything else is a hazard or a layout change.
+static bool needs_barrier(RenderAccess from, RenderAccess to) {
+    if (from != to) return true;
+    return is_write_access(to) && !is_attachment_access(to);
+}
+
+void RenderGraph::reset() {
+    _resources.truncate();
+    _passes.clear();
+    _schedule.truncate();
+    _barriers.truncate();
+    _final_barriers.truncate();
+    _physical_images.truncate();
+    _physical_formats.truncate();
+}
+
+uint32_t RenderGraph::add_transient_image(uint32_t format) {
+    _resources.push_back(RenderResourceDesc{RenderResourceKind::Image, format, true, RenderAccess::None, RenderAccess::None});
+    return _resources.size() - 1;
+}
+
+uint32_t RenderGraph::add_imported_image(uint32_t format, RenderAccess initial_access, RenderAccess final_access) {
+    _resources.push_back(RenderResourceDesc{RenderResourceKind::Image, format, false, initial_access, final_access});
+    return _resources.size() - 1;
+}
+
+uint32_t RenderGraph::add_imported_buffer(RenderAccess initial_access, RenderAccess final_access) {
+    _resources.push_back(RenderResourceDesc{RenderResourceKind::Buffer, 0, false, initial_access, final_access});
+    return _resources.size() - 1;
+}
+
+uint32_t RenderGraph::add_pass() {
+    _passes.push_empty() = Pass{};
+    return _passes.size() - 1;
+}
+
+void RenderGraph::use(uint32_t pass, uint32_t resource, RenderAccess access) {
+    _passes[pass].uses.push_back(Use{resource, access});
+}
+
+void RenderGraph::add_dependency(uint32_t pass, uint32_t dependency) {
+    if (pass == dependency) return;
+    _passes[pass].dependencies.push_back(dependency);
+}
+
+bool RenderGraph::visit(uint32_t pass, Vector<uint8_t>& marks) {
+    if (marks[pass] == 2) return true;
+    if (marks[pass] == 1) return false;
+    marks[pass] = 1;
+
+    for (uint32_t dependency : _passes[pass].dependencies) {
+        if (!visit(dependency, marks)) return false;
+    }
+
+    // Producers of everything the pass reads
+    for (const auto& use : _passes[pass].uses) {
+        if (is_write_access(use.access)) continue;
+        for (uint32_t other = 0; other < _passes.size(); other++) {
+            if (other == pass) continue;
+            bool writes = false;
+            for (const auto& other_use : _passes[other].uses) {
+                writes |= other_use.resource == use.resource && is_write_access(other_use.access);
+            }
+            if (writes && !visit(other, marks)) return false;
+        }
+    }
+
+    marks[pass] = 2;
+    _schedule.push_back(RenderGraphStep{pass, 0, 0, false, false});
+    return true;
+}
+
+bool RenderGraph::same_attachments(uint32_t pass, uint32_t other_pass) const {
+    uint32_t count = 0, other_count = 0;
+    for (const auto& use : _passes[pass].uses) {
+        if (!is_attachment_access(use.access)) continue;
+        count++;
+        bool found = false;
+        for (const auto& other_use : _passes[other_pass].uses) {
+            found |= other_use.resource == use.resource && other_use.access == use.access;
+        }
+        if (!found) return false;
+    }
+    for (const auto& other_use : _passes[other_pass].uses) {
+        if (is_attachment_access(other_use.access)) other_count++;
+    }
+    return count == other_count;
+}
+
+bool RenderGraph::compile() {
+    _schedule.truncate();
+    _barriers.truncate();
+    _final_barriers.truncate();
+    _physical_formats.truncate();
+
+    Vector<uint8_t> marks(_passes.size(), 0);
+    for (uint32_t pass = 0; pass < _passes.size(); pass++) {
+        if (!visit(pass, marks)) {
+            _schedule.truncate();
+            return false;
+        }
+    }
+
+    // Lifetimes in steps of the schedule
+    uint32_t num_resources = _resources.size();
+    Vector<uint32_t> first_step(num_resources, UINT32_MAX);
+    Vector<uint32_t> last_step(num_resources, UINT32_MAX);
+    Vector<RenderAccess> last_access(num_resources, RenderAccess::None);
+    for (uint32_t i = 0; i < _schedule.size(); i++) {
+        for (const auto& use : _passes[_schedule[i].pass].uses) {
+            if (first_step[use.resource] == UINT32_MAX) first_step[use.resource] = i;
+            last_step[use.resource] = i;
+            last_access[use.resource] = use.access;
+        }
+    }
+
+    // A transient image takes the first physical image of its format that's free again when it's first used.
+    // Its previous contents are whatever the previous user of the physical image left, for the first user that's
+    // the last one of the previous frame.
+    _physical_images = Vector<uint32_t>(num_resources, UINT32_MAX);
+    Vector<uint32_t> previous_alias(num_resources, UINT32_MAX);
+    Vector<uint32_t> physical_last_step;
+    Vector<uint32_t> physical_first_resource;
+    Vector<uint32_t> physical_last_resource;
+    for (uint32_t i = 0; i < _schedule.size(); i++) {
+        for (const auto& use : _passes[_schedule[i].pass].uses) {
+            uint32_t resource = use.resource;
+            if (!_resources[resource].transient || _physical_images[resource] != UINT32_MAX) continue;
+
+            uint32_t physical = UINT32_MAX;
+            for (uint32_t p = 0; p < _physical_formats.size(); p++) {
+                if (_physical_formats[p] == _resources[resource].format && physical_last_step[p] < i) {
+                    physical = p;
+                    break;
+                }
+            }
+            if (physical == UINT32_MAX) {
+                physical = _physical_formats.size();
+                _physical_formats.push_back(_resources[resource].format);
+                physical_last_step.push_back(0);
+                physical_first_resource.push_back(resource);
+                physical_last_resource.push_back(UINT32_MAX);
+            }
+            else {
+                previous_alias[resource] = physical_last_resource[physical];
+            }
+            _physical_images[resource] = physical;
+            physical_last_step[physical] = last_step[resource];
+            physical_last_resource[physical] = resource;
+        }
+    }
+    for (uint32_t p = 0; p < _physical_formats.size(); p++) {
+        previous_alias[physical_first_resource[p]] = physical_last_resource[p];
+    }
+
+    // Rasterization order doesn't hold across rendering scopes, so attachments written by an earlier scope need a
+    // barrier when a new scope starts with them. The scopes start at the other barriers, so they're decided first
+    // and the barriers are built a second time with the ones of the scopes.
+    Vector<RenderAccess> current;
+    Vector<uint8_t> used;
+    auto add_barriers = [&](bool scope_barriers) {
+        _barriers.truncate();
+        current = Vector<RenderAccess>(num_resources, RenderAccess::None);
+        used = Vector<uint8_t>(num_resources, 0);
+        for (auto& step : _schedule) {
+            step.first_barrier = _barriers.size();
+            for (const auto& use : _passes[step.pass].uses) {
+                uint32_t resource = use.resource;
+                const auto& desc = _resources[resource];
+                if (!used[resource]) {
+                    RenderGraphBarrier barrier = {resource, RenderAccess::None, use.access, true};
+                    if (desc.transient) {
+                        barrier.src = last_access[previous_alias[resource]];
+                    }
+                    else if (desc.initial_access != RenderAccess::None) {
+                        barrier.src = desc.initial_access;
+                        barrier.discard = false;
+                    }
+                    else {
+                        barrier.src = desc.final_access != RenderAccess::None ? desc.final_access : last_access[resource];
+                    }
+                    if (barrier.discard || needs_barrier(barrier.src, use.access)) {
+                        _barriers.push_back(barrier);
+                    }
+                    used[resource] = 1;
+                }
+                else if (needs_barrier(current[resource], use.access)
+                        || (scope_barriers && step.begins_scope && is_write_access(current[resource]))) {
+                    _barriers.push_back(RenderGraphBarrier{resource, current[resource], use.access, false});
+                }
+                current[resource] = use.access;
+            }
+            step.barrier_count = _barriers.size() - step.first_barrier;
+        }
+    };
+    add_barriers(false);
+
+    // Barriers can't be recorded inside of a rendering scope, so they start a new one
+    Vector<uint8_t> has_attachments(_schedule.size(), 0);
+    for (uint32_t i = 0; i < _schedule.size(); i++) {
+        for (const auto& use : _passes[_schedule[i].pass].uses) {
+            has_attachments[i] |= is_attachment_access(use.access);
+        }
+    }
+    for (uint32_t i = 0; i < _schedule.size(); i++) {
+        auto& step = _schedule[i];
+        if (!has_attachments[i]) continue;
+        step.begins_scope = i == 0 || step.barrier_count > 0 || !same_attachments(_schedule[i - 1].pass, step.pass);
+    }
+    add_barriers(true);
+
+    for (uint32_t resource = 0; resource < num_resources; resource++) {
+        const auto& desc = _resources[resource];
+        if (desc.transient || desc.final_access == RenderAccess::None) continue;
+        if (used[resource]) {
+            if (needs_barrier(current[resource], desc.final_access)) {
+                _final_barriers.push_back(RenderGraphBarrier{resource, current[resource], desc.final_access, false});
+            }
+        }
+        else if (desc.initial_access == RenderAccess::None) {
+            _final_barriers.push_back(RenderGraphBarrier{resource, desc.final_access, desc.final_access, true});
+        }
+        else if (desc.initial_access != desc.final_access) {
+            _final_barriers.push_back(RenderGraphBarrier{resource, desc.initial_access, desc.final_access, false});
+        }
+    }
+
+    for (uint32_t i = 0; i < _schedule.size(); i++) {
+        if (!has_attachments[i]) continue;
+        bool last = i + 1 == _schedule.size();
+        _schedule[i].ends_scope = last || !has_attachments[i + 1] || _schedule[i + 1].begins_scope;
+    }
+
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "core/vector.h"
+
+// How a pass uses a graph resource. The graph only needs to know which accesses write and which ones are
+// attachments, the renderer maps them to pipeline stages, access masks and image layouts.
+enum class RenderAccess : uint8_t {
+    None,               // not used, the contents are undefined
+    ColorAttachment,
+    DepthAttachment,    // depth test and write
+    DepthRead,          // depth test without writing
+    SampledRead,
+    StorageRead,
+    StorageWrite,
+    Present,
+};
+
+bool is_write_access(RenderAccess access);
+bool is_attachment_access(RenderAccess access);
+
+enum class RenderResourceKind : uint8_t {
+    Image, Buffer
+};
+
+struct RenderResourceDesc {
+    RenderResourceKind kind;
+    uint32_t format;                // VkFormat of images, transient images of the same format can share memory
+    bool transient;                 // only lives during the frame, the renderer creates it per physical image
+    RenderAccess initial_access;    // how imported resources are found, None if their contents are discarded
+    RenderAccess final_access;      // how imported resources have to be left, None if it doesn't matter
+};
+
+// Barrier recorded before a scheduled pass, or after the last one
+struct RenderGraphBarrier {
+    uint32_t resource;
+    RenderAccess src;
+    RenderAccess dst;
+    bool discard;           // the previous contents aren't needed, images transition from an undefined layout
+};
+
+struct RenderGraphStep {
+    uint32_t pass;
+    uint32_t first_barrier;
+    uint32_t barrier_count;
+    // Consecutive passes with the same attachments and no barriers in between share a dynamic rendering scope
+    bool begins_scope;
+    bool ends_scope;
+};
+
+// Passes declare the resources they use, compile() turns that into an ordered schedule with the barriers between
+// the passes and the assignment of transient images to physical ones. It only has to run again when the passes
+// change, recording a frame just walks the schedule. Doesn't know about Vulkan, resources and passes are indices.
+class RenderGraph {
+public:
+    struct Use {
+        uint32_t resource;
+        RenderAccess access;
+    };
+
+    // Drops all passes and resources
+    void reset();
+
+    uint32_t add_transient_image(uint32_t format);
+    uint32_t add_imported_image(uint32_t format, RenderAccess initial_access, RenderAccess final_access);
+    uint32_t add_imported_buffer(RenderAccess initial_access, RenderAccess final_access);
+
+    uint32_t add_pass();
+    void use(uint32_t pass, uint32_t resource, RenderAccess access);
+    // Explicit ordering between passes that don't read each other's results, like overlays drawn on top of the scene
+    void add_dependency(uint32_t pass, uint32_t dependency);
+
+    // Orders the passes with their dependencies first and otherwise in the order they were added.
+    // Passes reading a resource depend on all the passes writing it. Returns false if there is a cycle.
+    bool compile();
+
+    uint32_t num_passes() const { return _passes.size(); }
+    uint32_t num_resources() const { return _resources.size(); }
+    const RenderResourceDesc& resource(uint32_t resource) const { return _resources[resource]; }
+    const Vector<Use>& uses(uint32_t pass) const { return _passes[pass].uses; }
+
+    const Vector<RenderGraphStep>& schedule() const { return _schedule; }
+    const Vector<RenderGraphBarrier>& barriers() const { return _barriers; }
+    // Barriers to the final accesses of imported resources, after the last pass
+    const Vector<RenderGraphBarrier>& final_barriers() const { return _final_barriers; }
+
+    // Transient images whose lifetimes don't overlap share a physical image
+    uint32_t num_physical_images() const { return _physical_formats.size(); }
+    uint32_t physical_image_format(uint32_t physical_image) const { return _physical_formats[physical_image]; }
+    uint32_t physical_image(uint32_t resource) const { return _physical_images[resource]; }
+
+private:
+    struct Pass {
+        Vector<Use> uses;
+        Vector<uint32_t> dependencies;
+    };
+
+    Vector<RenderResourceDesc> _resources;
+    Vector<Pass> _passes;
+
+    Vector<RenderGraphStep> _schedule;
+    Vector<RenderGraphBarrier> _barriers;
+    Vector<RenderGraphBarrier> _final_barriers;
+    Vector<uint32_t> _physical_images;      // per resource, UINT32_MAX if it's imported or never used
+    Vector<uint32_t> _physical_formats;
+
+    bool visit(uint32_t pass, Vector<uint8_t>& marks);
+    bool same_attachments(uint32_t pass, uint32_t other_pass) const;
+};
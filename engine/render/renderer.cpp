@@ -1,6 +1,7 @@
 #include "renderer.h"
 
 #include <vector>
+#include <algorithm>
 #include <fstream>
 #include <set>
 
@@ -21,6 +22,7 @@
 
 #include "res.h"
 #include "mesh.h"
+#include "engine.h"
 #include "terrain.h"
 #include "core/log.h"
 #include "core/file.h"
@@ -30,6 +32,8 @@
 #include "render/wireframe_renderer.h"
 
 #define TRACY_ENABLE
+#include "nanothread/nanothread.h"
+
 #include "tracy/Tracy.hpp"
 #include "tracy/TracyVulkan.hpp"
 
@@ -138,6 +142,34 @@ void ImageCpuData::cleanup() {
 RenderInterface::RenderInterface(Renderer *renderer)
     : _renderer(renderer), _ecs(renderer->_ecs) {}
 
+void RenderInterface::declare_pass(RenderGraph& graph, uint32_t pass) {
+    graph.use(pass, _renderer->get_backbuffer_resource(), RenderAccess::ColorAttachment);
+    graph.use(pass, _renderer->get_depth_resource(), RenderAccess::DepthAttachment);
+}
+
+void RenderInterface::set_deps(std::initializer_list<RenderInterface*> deps) {
+    _deps = deps;
+    for (auto dep : deps) {
+        if (dep == this) {
+            log_warn("Cannot insert itself as dependency! Removing it.");
+            _deps.erase(dep);
+        }
+    }
+    _renderer->invalidate_render_graph();
+}
+
+void RenderInterface::add_deps(std::initializer_list<RenderInterface*> deps) {
+    for (auto dep : deps) {
+        if (dep == this) {
+            log_warn("Cannot insert itself as dependency! Removing it.");
+        }
+        else {
+            _deps.insert(dep);
+        }
+    }
+    _renderer->invalidate_render_graph();
+}
+
 void Renderer::init() {
     ZoneScoped;
 
@@ -151,22 +183,26 @@ void Renderer::init() {
             {
                 .position = {-5.0f, 5.0f, -5.0f},
                 .intensity = 1.0f,
-                .color = {1.0f, 0.0f, 0.0f}
+                .color = {1.0f, 0.0f, 0.0f},
+                .radius = 20.0f
             },
             {
                 .position = {5.0f, 5.0f, -5.0f},
                 .intensity = 1.0f,
-                .color = {0.0f, 1.0f, 0.0f}
+                .color = {0.0f, 1.0f, 0.0f},
+                .radius = 20.0f
             },
             {
                 .position = {-5.0f, 5.0f, 5.0f},
                 .intensity = 1.0f,
-                .color = {0.0f, 0.0f, 1.0f}
+                .color = {0.0f, 0.0f, 1.0f},
+                .radius = 20.0f
             },
             {
                 .position = {5.0f, 5.0f, 5.0f},
                 .intensity = 1.0f,
-                .color = {1.0f, 1.0f, 1.0f}
+                .color = {1.0f, 1.0f, 1.0f},
+                .radius = 20.0f
             }
         },
         .num_points = 4
@@ -183,7 +219,6 @@ void Renderer::init() {
     create_allocator();
     create_swapchain();
     create_descriptor_set_layout();
-    create_depth_resources();
 
     create_command_pool();
     create_uniform_buffers();
@@ -191,6 +226,9 @@ void Renderer::init() {
     create_descriptor_pool();
     create_descriptor_sets();
     create_command_buffers();
+    create_secondary_command_pools();
+    create_upload_resources();
+    create_pipeline_cache();
     create_sync_objects();
 
     _graphics_queue_tracy_ctx.resize(MAX_FRAMES_IN_FLIGHT);
@@ -210,7 +248,7 @@ void Renderer::init() {
 }
 
 Camera &Renderer::get_current_camera() {
-    return _ecs->get_component<Camera>(_camera_object);
+    return _frame_camera;
 }
 
 #ifndef NDEBUG
@@ -218,14 +256,70 @@ Camera &Renderer::get_current_camera() {
 #endif
 
 void Renderer::begin_frame() {
-    for (auto ri : _render_interfaces) {
-        ri->begin_frame();
+    ZoneScoped;
+
+    // The snapshot of this frame overwrites the one the previous frame is still being recorded from
+    wait_for_render();
+
+    if (_pending_window_resize) {
+        _window_extent = _pending_window_extent;
+        _framebuffer_resized = true;
+        _pending_window_resize = false;
+    }
+    if (_pending_window_minimize) {
+        _framebuffer_minimized = true;
+        _pending_window_minimize = false;
+    }
+
+    // SDL has to be called from the main thread, so the render thread only flags the swapchain
+    if (_swapchain_out_of_date || _framebuffer_resized) {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            _uniform_buffer.is_dirty[i] = true;
+        }
+        _swapchain_out_of_date = false;
+        _framebuffer_resized = false;
+        recreate_swapchain();
+    }
+
+    if (_render_graph_dirty) {
+        compile_render_graph();
+    }
+
+    _frame_camera = _ecs->get_component<Camera>(_camera_object);
+
+    // The render interfaces only go through the entities in view
+    _entity_bvh.update(_ecs, Engine::instance()->thread_pool);
+    _visible_entities.truncate();
+    _entity_bvh.query_frustum(Frustum::from_matrix(_frame_camera.proj_mat * _frame_camera.get_view_matrix()), _visible_entities);
+
+    vkWaitForFences(_device, 1, &_in_flight_fences[_current_frame], VK_TRUE, UINT64_MAX);
+
+    begin_frame_uploads();
+    release_geometry_frees();
+    begin_frame_transients();
+
+    if (_uniform_buffer.is_dirty[_current_frame]) {
+        update_uniform_buffer(_current_frame);
+        _uniform_buffer.is_dirty[_current_frame] = false;
+    }
+
+    update_texture_descriptor_sets(_current_frame);
+    update_material_buffer(_current_frame);
+
+    if (_lighting_descriptor_set.is_dirty[_current_frame]) {
+        update_lighting_buffer_descriptor_sets(_current_frame);
+        _lighting_descriptor_set.is_dirty[_current_frame] = false;
+    }
+    update_light_cluster_buffer(_current_frame);
+
+    for (auto& pass : _scheduled_passes) {
+        pass.render_interface->begin_frame();
     }
 }
 
 void Renderer::end_frame() {
-    for (auto ri : _render_interfaces) {
-        ri->end_frame();
+    for (auto& pass : _scheduled_passes) {
+        pass.render_interface->end_frame();
     }
 }
 
@@ -240,10 +334,10 @@ void Renderer::cleanup() {
             vkDestroyImageView(_device, texture.image_view, nullptr);
         });
 
-        res->_textured_mesh_pool.foreach([&](TexturedMesh& mesh) {
-            vmaDestroyBuffer(_vma_allocator, mesh.vertex_buffer.buffer, mesh.vertex_buffer.alloc_data);
-            vmaDestroyBuffer(_vma_allocator, mesh.index_buffer.buffer, mesh.index_buffer.alloc_data);
-        });
+        for (uint32_t i = 0; i < _geometry_arena.num_blocks(); i++) {
+            destroy_buffer(_geometry_blocks[i].vertex_buffer);
+            destroy_buffer(_geometry_blocks[i].index_buffer);
+        }
 
         res->_image_pool.foreach([&](Image& image) {
             vmaDestroyImage(_vma_allocator, image.image, image.alloc_data);
@@ -252,13 +346,29 @@ void Renderer::cleanup() {
         cleanup_swapchain();
 
         destroy_uniform_buffer(_uniform_buffer);
+        destroy_dynamic_buffer(_transient_buffer);
+        for (auto& overflow_buffers : _transient_overflow_buffers) {
+            for (const auto& buffer : overflow_buffers) {
+                destroy_buffer(buffer);
+            }
+        }
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            destroy_buffer(_light_cluster_buffer.buffer_per_frame[i]);
+        }
 
-        vkDestroyImageView(_device, _depth_imageview, nullptr);
-        vmaDestroyImage(_vma_allocator, _depth_image.image, _depth_image.alloc_data);
+        destroy_render_graph_images();
 
         vkDestroyDescriptorPool(_device, _descriptor_pool, nullptr);
         vkDestroyDescriptorSetLayout(_device, _main_descriptor_set_layout, nullptr);
 
+        destroy_buffer(_upload_buffer);
+        for (auto& staging_buffer : _pending_staging_buffers) {
+            destroy_buffer(staging_buffer);
+        }
+        for (auto& staging_buffer : _submitted_staging_buffers) {
+            destroy_buffer(staging_buffer.buffer);
+        }
+
         vmaDestroyAllocator(_vma_allocator);
 
         for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
@@ -270,7 +380,16 @@ void Renderer::cleanup() {
             vkDestroyFence(_device, _in_flight_fences[i], nullptr);
         }
 
+        for (auto& thread_pools : _secondary_command_pools) {
+            for (auto& pool : thread_pools) {
+                vkDestroyCommandPool(_device, pool.pool, nullptr);
+            }
+        }
         vkDestroyCommandPool(_device, _command_pool, nullptr);
+        vkDestroyCommandPool(_device, _transfer_command_pool, nullptr);
+        vkDestroySemaphore(_device, _upload_timeline, nullptr);
+        save_pipeline_cache();
+        vkDestroyPipelineCache(_device, _pipeline_cache, nullptr);
         vkDestroyDevice(_device, nullptr);
 #ifdef VULKAN_USE_VALIATION_LAYER
         vkDestroyDebugUtilsMessengerEXT(_instance, _debug_messenger, nullptr);
@@ -283,53 +402,52 @@ void Renderer::cleanup() {
 }
 
 void Renderer::render() {
+    // Only reads the snapshot taken in begin_frame(), so the next frame's update can run in the meantime
+    _render_task = drjit::do_async([this]() {
+        render_frame();
+    }, {}, Engine::instance()->thread_pool);
+}
+
+void Renderer::wait_for_render() {
     ZoneScoped;
 
-    toposort_render_interfaces();
+    task_wait_and_release(_render_task);
+    _render_task = nullptr;
+}
 
-    vkWaitForFences(_device, 1, &_in_flight_fences[_current_frame], VK_TRUE, UINT64_MAX);
+void Renderer::render_frame() {
+    ZoneScoped;
 
     uint32_t image_index;
     VkResult result = vkAcquireNextImageKHR(_device, _swapchain, UINT64_MAX, _image_available_semaphores[_current_frame], VK_NULL_HANDLE, &image_index);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        recreate_swapchain();
+        _swapchain_out_of_date = true;
         return;
     }
     else if (result != VK_SUBOPTIMAL_KHR){
         VK_CHECK(result);
     }
 
-    if (_uniform_buffer.is_dirty[_current_frame]) {
-        update_uniform_buffer(_current_frame);
-        _uniform_buffer.is_dirty[_current_frame] = false;
-    }
-
-    if (_texture_descriptor_set.is_dirty[_current_frame]) {
-        update_texture_descriptor_sets(_current_frame);
-        _texture_descriptor_set.is_dirty[_current_frame] = false;
-    }
-
-    if (_buffer_descriptor_set.is_dirty[_current_frame]) {
-        update_material_buffer_descriptor_sets(_current_frame);
-        _buffer_descriptor_set.is_dirty[_current_frame] = false;
-    }
-
-    if (_lighting_descriptor_set.is_dirty[_current_frame]) {
-        update_lighting_buffer_descriptor_sets(_current_frame);
-        _lighting_descriptor_set.is_dirty[_current_frame] = false;
-    }
-
     vkResetFences(_device, 1, &_in_flight_fences[_current_frame]);
 
     vkResetCommandBuffer(_command_buffers[_current_frame], 0);
     record_command_buffer(_command_buffers[_current_frame], image_index);
 
-    VkSemaphore wait_semaphores[] = {_image_available_semaphores[_current_frame]};
+    // Only wait for the upload ticket if this frame acquires uploads, the value is ignored for the binary semaphore
+    VkSemaphore wait_semaphores[] = {_image_available_semaphores[_current_frame], _upload_timeline};
     VkSemaphore signal_semaphores[] = {_render_finished_semaphores[_current_frame]};
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, UPLOAD_WAIT_STAGES};
+    uint64_t wait_values[] = {0, _frame_upload_ticket};
+    uint32_t wait_count = _frame_upload_ticket > 0 ? 2 : 1;
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = wait_count,
+            .pWaitSemaphoreValues = wait_values
+    };
     VkSubmitInfo submit_info = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
+            .pNext = &timeline_info,
+            .waitSemaphoreCount = wait_count,
             .pWaitSemaphores = wait_semaphores,
             .pWaitDstStageMask = wait_stages,
             .commandBufferCount = 1,
@@ -339,6 +457,10 @@ void Renderer::render() {
     };
     VK_CHECK(vkQueueSubmit(_graphics_queue, 1, &submit_info, _in_flight_fences[_current_frame]));
 
+    _frame_buffer_uploads.truncate();
+    _frame_image_uploads.truncate();
+    _frame_upload_ticket = 0;
+
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
@@ -349,12 +471,8 @@ void Renderer::render() {
         .pResults = nullptr
     };
     result = vkQueuePresentKHR(_present_queue, &present_info);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || _framebuffer_resized) {
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            _uniform_buffer.is_dirty[i] = true;
-        }
-        _framebuffer_resized = false;
-        recreate_swapchain();
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        _swapchain_out_of_date = true;
     }
     else{
         VK_CHECK(result);
@@ -366,22 +484,24 @@ void Renderer::render() {
 }
 
 void Renderer::respond_to_window_event(SDL_Event* e) {
+    // Applied in begin_frame(), the previous frame might still be recorded with the current extent
     if (e->window.event == SDL_WINDOWEVENT_SIZE_CHANGED || e->window.event == SDL_WINDOWEVENT_DISPLAY_CHANGED) {
         int w, h;
         SDL_GetWindowSize(_window, &w, &h);
-        _window_extent.width = w;
-        _window_extent.height = h;
+        _pending_window_extent.width = w;
+        _pending_window_extent.height = h;
 
         log_info("window changed: {} x {}", w, h);
 
-        _framebuffer_resized = true;
+        _pending_window_resize = true;
     }
     if (e->window.event == SDL_WINDOWEVENT_MINIMIZED) {
-        _framebuffer_minimized = true;
+        _pending_window_minimize = true;
     }
 }
 
 void Renderer::wait_until_device_idle() {
+    wait_for_render();
     vkDeviceWaitIdle(_device);
 }
 
@@ -501,9 +621,12 @@ void Renderer::create_device() {
 
         VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES};
+        VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+            .pNext = &indexing_features };
         VkPhysicalDeviceFeatures2 device_features2 = { 
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, 
-            .pNext = &indexing_features };
+            .pNext = &timeline_semaphore_features };
         vkGetPhysicalDeviceFeatures2(device, &device_features2);
         bool bindless_supported = indexing_features.descriptorBindingPartiallyBound && indexing_features.runtimeDescriptorArray;
 
@@ -514,7 +637,8 @@ void Renderer::create_device() {
             !device_features.samplerAnisotropy || 
             !device_features.wideLines || 
             !device_features.fillModeNonSolid ||
-            !bindless_supported) {
+            !bindless_supported ||
+            !timeline_semaphore_features.timelineSemaphore) {
             continue;
         }
 
@@ -572,6 +696,26 @@ void Renderer::create_device() {
         // Found our physical device!
         if (_queue_family_main_idx != -1) {
             _physical_device = device;
+
+            // Uploads go to a transfer-only family (the DMA engines) if there is one, then to an async compute
+            // family, and to the main queue as a last resort
+            _queue_family_transfer_idx = _queue_family_main_idx;
+            bool found_transfer_only = false;
+            for (int queue_family_idx = 0; queue_family_idx < queue_family_count; queue_family_idx++) {
+                VkQueueFlags flags = queue_families[queue_family_idx].queueFlags;
+                if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+                if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+                    _queue_family_transfer_idx = queue_family_idx;
+                    found_transfer_only = true;
+                    break;
+                }
+                if (_queue_family_transfer_idx == _queue_family_main_idx) {
+                    _queue_family_transfer_idx = queue_family_idx;
+                }
+            }
+            log_info("Uploading on queue family {} ({}), rendering on queue family {}", _queue_family_transfer_idx,
+                     found_transfer_only ? "transfer" : (_queue_family_transfer_idx != _queue_family_main_idx ? "compute" : "main"),
+                     _queue_family_main_idx);
             break;
         }
     }
@@ -583,11 +727,19 @@ void Renderer::create_device() {
     vkGetPhysicalDeviceProperties(_physical_device, &_physical_device_properties);
 
     Array<float, 1> queue_priorities = {1.0f};
-    VkDeviceQueueCreateInfo queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = (uint32_t)_queue_family_main_idx,
-        .queueCount = queue_priorities.size(),
-        .pQueuePriorities = queue_priorities.data()
+    Array<VkDeviceQueueCreateInfo, 2> queue_create_infos = {
+        VkDeviceQueueCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = (uint32_t)_queue_family_main_idx,
+            .queueCount = queue_priorities.size(),
+            .pQueuePriorities = queue_priorities.data()
+        },
+        VkDeviceQueueCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = (uint32_t)_queue_family_transfer_idx,
+            .queueCount = queue_priorities.size(),
+            .pQueuePriorities = queue_priorities.data()
+        }
     };
 
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {
@@ -597,10 +749,16 @@ void Renderer::create_device() {
         .shaderSampledImageArrayNonUniformIndexing = VK_TRUE
     };
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+        .pNext = &indexing_features,
+        .timelineSemaphore = VK_TRUE
+    };
+
     VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
         .dynamicRendering = VK_TRUE,
-        .pNext = &indexing_features
+        .pNext = &timeline_semaphore_features
     };
 
     VkPhysicalDeviceFeatures2 physical_features2 = { 
@@ -624,8 +782,8 @@ void Renderer::create_device() {
     VkDeviceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &physical_features2,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create_info,
+        .queueCreateInfoCount = _queue_family_transfer_idx != _queue_family_main_idx ? 2u : 1u,
+        .pQueueCreateInfos = queue_create_infos.data(),
     };
 
     create_info.enabledExtensionCount = 0;
@@ -642,6 +800,7 @@ void Renderer::create_device() {
     vkGetDeviceQueue(_device, _queue_family_main_idx, 0, &_graphics_queue);
     vkGetDeviceQueue(_device, _queue_family_main_idx, 0, &_compute_queue);
     vkGetDeviceQueue(_device, _queue_family_main_idx, 0, &_present_queue);
+    vkGetDeviceQueue(_device, _queue_family_transfer_idx, 0, &_transfer_queue);
 }
 
 void Renderer::create_swapchain() {
@@ -694,33 +853,6 @@ void Renderer::create_command_pool() {
     VK_CHECK(vkCreateCommandPool(_device, &pool_info, nullptr, &_command_pool));
 }
 
-void Renderer::create_depth_resources() {
-    // TODO: We just assume we have D32_SFLOAT support in our GPU for now.
-    VkFormat depth_format = VK_FORMAT_D32_SFLOAT;
-    VkImageCreateInfo image_info = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-            .imageType = VK_IMAGE_TYPE_2D,
-            .extent = {.width = _swapchain_settings.extent.width, .height = _swapchain_settings.extent.height, .depth = 1},
-            .mipLevels = 1,
-            .arrayLayers = 1,
-            .format = depth_format,
-            .tiling = VK_IMAGE_TILING_OPTIMAL,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-    };
-    VmaAllocationCreateInfo image_alloc_create_info = {
-            .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-            .priority = 1.0f
-    };
-    VmaAllocationInfo image_alloc_info;
-    VK_CHECK(vmaCreateImage(_vma_allocator, &image_info, &image_alloc_create_info,
-                            &_depth_image.image, &_depth_image.alloc_data, &image_alloc_info));
-    _depth_imageview = vkuCreateImageView(_device, _depth_image.image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT);
-}
-
 void Renderer::create_allocator() {
     VmaVulkanFunctions vulkan_functions = {
             .vkGetInstanceProcAddr = vkGetInstanceProcAddr,
@@ -801,12 +933,18 @@ void Renderer::create_descriptor_set_layout() {
     };
     vkuCreateDescriptorSetLayout(_device, buffer_bindings, &_buffer_descriptor_set_layout, &flag_info);
 
-    Array<VkDescriptorSetLayoutBinding, 1> lighting_bindings = {
+    Array<VkDescriptorSetLayoutBinding, 2> lighting_bindings = {
         VkDescriptorSetLayoutBinding {
             .binding = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             .descriptorCount = 1,
             .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+        VkDescriptorSetLayoutBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
         }
     };
     vkuCreateDescriptorSetLayout(_device, lighting_bindings, &_lighting_descriptor_set_layout, nullptr);
@@ -858,8 +996,44 @@ void Renderer::create_descriptor_sets() {
     vkuCreateDescriptorSets(_device, _descriptor_pool, _buffer_descriptor_set_layout, 
         _buffer_descriptor_set.set_per_frame, &buffer_count_info);
 
+    // The material buffers are written in place, so their descriptors never change
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorBufferInfo material_buffer_info = {
+            .buffer = _material_buffer.buffer_per_frame[i].buffer,
+            .offset = 0,
+            .range = _material_buffer.size
+        };
+        VkWriteDescriptorSet material_write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = _buffer_descriptor_set.set_per_frame[i],
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &material_buffer_info
+        };
+        vkUpdateDescriptorSets(_device, 1, &material_write, 0, nullptr);
+    }
+
     vkuCreateDescriptorSets(_device, _descriptor_pool, _lighting_descriptor_set_layout, 
         _lighting_descriptor_set.set_per_frame, nullptr);
+
+    // Like the material buffers, the light cluster buffers are rewritten in place
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorBufferInfo cluster_buffer_info = {
+            .buffer = _light_cluster_buffer.buffer_per_frame[i].buffer,
+            .offset = 0,
+            .range = _light_cluster_buffer.size
+        };
+        VkWriteDescriptorSet cluster_write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = _lighting_descriptor_set.set_per_frame[i],
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &cluster_buffer_info
+        };
+        vkUpdateDescriptorSets(_device, 1, &cluster_write, 0, nullptr);
+    }
 }
 
 void Renderer::create_uniform_buffers() {
@@ -869,6 +1043,8 @@ void Renderer::create_uniform_buffers() {
 void Renderer::create_storage_buffers() {
     _material_buffer = create_storage_buffer(sizeof(MaterialGpu) * MAX_MATERIALS);
     _lighting_buffer = create_storage_buffer(sizeof(LightingBuffer));
+    _light_cluster_buffer = create_storage_buffer(sizeof(LightClusterHeader)
+        + sizeof(glm::uvec2) * LIGHT_CLUSTER_COUNT + sizeof(uint32_t) * MAX_LIGHT_CLUSTER_INDICES);
 }
 
 void Renderer::create_descriptor_pool() {
@@ -887,7 +1063,7 @@ void Renderer::create_descriptor_pool() {
         },
         VkDescriptorPoolSize {
             .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            .descriptorCount = MAX_FRAMES_IN_FLIGHT * (MAX_BINDLESS_BUFFERS + 1),
+            .descriptorCount = MAX_FRAMES_IN_FLIGHT * (MAX_BINDLESS_BUFFERS + 2),
         },
 
     };
@@ -910,6 +1086,23 @@ void Renderer::create_command_buffers() {
     VK_CHECK(vkAllocateCommandBuffers(_device, &alloc_info, _command_buffers.data()));
 }
 
+void Renderer::create_secondary_command_pools() {
+    // Worker ids go from 1 to pool_size(), threads outside of the pool get 0
+    uint32_t num_threads = pool_size(Engine::instance()->thread_pool) + 1;
+
+    VkCommandPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = (uint32_t) _queue_family_main_idx
+    };
+    for (auto& thread_pools : _secondary_command_pools) {
+        thread_pools.resize(num_threads);
+        for (auto& pool : thread_pools) {
+            VK_CHECK(vkCreateCommandPool(_device, &pool_info, nullptr, &pool.pool));
+        }
+    }
+}
+
 void Renderer::create_sync_objects() {
     VkSemaphoreCreateInfo semaphore_info = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
     VkFenceCreateInfo fence_info = {
@@ -926,183 +1119,175 @@ void Renderer::create_sync_objects() {
     }
 }
 
-void Renderer::record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) {
+void Renderer::create_pipeline_cache() {
     ZoneScoped;
 
-    vkuBeginCommandBuffer(command_buffer);
+    // A missing or stale file just means the pipelines are compiled from scratch and the cache is rewritten on exit
+    Vector<uint8_t> initial_data;
+    std::ifstream file(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::ate);
+    if (file) {
+        size_t file_size = file.tellg();
+        file.seekg(0);
+        PipelineCacheFileHeader header;
+        if (file_size >= sizeof(header) && file.read((char*)&header, sizeof(header))) {
+            bool is_valid = header.magic == PIPELINE_CACHE_MAGIC
+                && header.data_size == file_size - sizeof(header)
+                && header.vendor_id == _physical_device_properties.vendorID
+                && header.device_id == _physical_device_properties.deviceID
+                && header.driver_version == _physical_device_properties.driverVersion
+                && memcmp(header.pipeline_cache_uuid, _physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+            if (is_valid) {
+                initial_data.resize(header.data_size);
+                if (!file.read((char*)initial_data.data(), header.data_size)) {
+                    initial_data.clear();
+                }
+            }
+            else {
+                log_info("Ignoring {}, it was written by another device or driver", PIPELINE_CACHE_FILE);
+            }
+        }
+    }
 
-    VkImageMemoryBarrier begin_color_image_memory_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .image = _swapchain_images[image_index],
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        },
-        // .srcQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-        // .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
+    VkPipelineCacheCreateInfo cache_info = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+            .initialDataSize = initial_data.size(),
+            .pInitialData = initial_data.data()
     };
+    VK_CHECK(vkCreatePipelineCache(_device, &cache_info, nullptr, &_pipeline_cache));
+    _pipeline_cache_loaded = !initial_data.empty();
+}
 
-    VkImageMemoryBarrier begin_depth_image_memory_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-        .image = _depth_image.image,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        },
-        // .srcQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-        // .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
+void Renderer::save_pipeline_cache() {
+    ZoneScoped;
+
+    size_t data_size = 0;
+    VK_CHECK(vkGetPipelineCacheData(_device, _pipeline_cache, &data_size, nullptr));
+    Vector<uint8_t> data(data_size);
+    VK_CHECK(vkGetPipelineCacheData(_device, _pipeline_cache, &data_size, data.data()));
+
+    PipelineCacheFileHeader header = {
+            .magic = PIPELINE_CACHE_MAGIC,
+            .data_size = (uint32_t)data_size,
+            .vendor_id = _physical_device_properties.vendorID,
+            .device_id = _physical_device_properties.deviceID,
+            .driver_version = _physical_device_properties.driverVersion,
     };
+    memcpy(header.pipeline_cache_uuid, _physical_device_properties.pipelineCacheUUID, VK_UUID_SIZE);
 
-    vkCmdPipelineBarrier(
-        command_buffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, // srcStageMask
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, // dstStageMask
-        0, 0, nullptr, 0, nullptr,
-        1, &begin_color_image_memory_barrier
-    );
+    std::ofstream file(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        log_warn("Failed to write {}", PIPELINE_CACHE_FILE);
+        return;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)data.data(), data_size);
+}
 
-    /*
-    vkCmdPipelineBarrier(
-        command_buffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-        0, 0, nullptr, 0, nullptr,
-        1, &begin_depth_image_memory_barrier
-    );
-*/
+void Renderer::record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) {
+    ZoneScoped;
+
+    vkuBeginCommandBuffer(command_buffer);
 
-    const auto& camera = get_current_camera();
+    record_upload_acquires(command_buffer);
 
-    VkRenderingAttachmentInfo color_attachment_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .imageView = _swapchain_imageviews[image_index],
-        .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .clearValue = {.color = {0.0f, 0.0f, 0.0f, 1.0f}}
-    };
-    VkRenderingAttachmentInfo depth_attachment_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .imageView = _depth_imageview,
-        .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .clearValue = {.depthStencil = {1.0f, 0}}
-    };
+    for (auto& pass : _scheduled_passes) {
+        pass.render_interface->record_transfers(command_buffer);
+    }
 
-    VkRenderingInfo render_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = {{0, 0}, _swapchain_settings.extent},
-        .layerCount = 1,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_attachment_info,
-        .pDepthAttachment = &depth_attachment_info
-    };
+    record_secondary_command_buffers();
 
     {
-        TracyVkZone(_graphics_queue_tracy_ctx[_current_frame], command_buffer, "MainRenderPass")
+        TracyVkZone(_graphics_queue_tracy_ctx[_current_frame], command_buffer, "RenderGraph")
 
-        vkCmdBeginRendering(command_buffer, &render_info);
+        const auto& schedule = _render_graph.schedule();
+        const auto& barriers = _render_graph.barriers();
+        for (uint32_t i = 0; i < schedule.size(); i++) {
+            const auto& step = schedule[i];
+            const auto& pass = _scheduled_passes[i];
 
-        for (auto* rp : _render_interfaces) {
-            rp->render(command_buffer);
+            if (step.barrier_count > 0) {
+                record_render_graph_barriers(command_buffer, &barriers[step.first_barrier], step.barrier_count, image_index);
+            }
+            if (step.begins_scope) {
+                begin_render_graph_scope(command_buffer, i, image_index);
+            }
+            if (pass.secondary_count > 0) {
+                vkCmdExecuteCommands(command_buffer, pass.secondary_count, &_secondary_command_buffers[pass.first_secondary]);
+            }
+            if (step.ends_scope) {
+                vkCmdEndRendering(command_buffer);
+            }
         }
 
-        vkCmdEndRendering(command_buffer);
+        const auto& final_barriers = _render_graph.final_barriers();
+        if (!final_barriers.empty()) {
+            record_render_graph_barriers(command_buffer, final_barriers.data(), final_barriers.size(), image_index);
+        }
     }
 
-    VkImageMemoryBarrier end_color_image_memory_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        .image = _swapchain_images[image_index],
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        },
-        // .srcQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-        // .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-    };
+    TracyVkCollect(_graphics_queue_tracy_ctx[_current_frame], command_buffer);
+    TracyVkCollect(_compute_queue_tracy_ctx[_current_frame], command_buffer);
 
-    VkImageMemoryBarrier end_depth_image_memory_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        .image = _depth_image.image,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        },
-        // .srcQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-        // .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
-    };
+    VK_CHECK(vkEndCommandBuffer(command_buffer));
+}
 
-    vkCmdPipelineBarrier(
-        command_buffer,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, // srcStageMask
-        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, // dstStageMask
-        0, 0, nullptr, 0, nullptr,
-        1, &end_color_image_memory_barrier
-    );
+void Renderer::record_secondary_command_buffers() {
+    ZoneScoped;
 
-    /*
-    vkCmdPipelineBarrier(
-        command_buffer,
-        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, // srcStageMask
-        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, // dstStageMask
-        0, 0, nullptr, 0, nullptr,
-        1, &end_depth_image_memory_barrier
-    );
-*/
+    // The fence of this frame slot has been waited on, so all of its secondary command buffers can be reset at once
+    auto& thread_pools = _secondary_command_pools[_current_frame];
+    for (auto& pool : thread_pools) {
+        VK_CHECK(vkResetCommandPool(_device, pool.pool, 0));
+        pool.used = 0;
+    }
 
-    TracyVkCollect(_graphics_queue_tracy_ctx[_current_frame], command_buffer);
-    TracyVkCollect(_compute_queue_tracy_ctx[_current_frame], command_buffer);
+    _secondary_jobs.truncate();
+    for (uint32_t i = 0; i < _scheduled_passes.size(); i++) {
+        auto& pass = _scheduled_passes[i];
+        uint32_t slice_count = pass.render_interface->get_render_slice_count();
+        pass.first_secondary = _secondary_jobs.size();
+        pass.secondary_count = slice_count;
+        for (uint32_t slice_idx = 0; slice_idx < slice_count; slice_idx++) {
+            _secondary_jobs.push_back(SecondaryRecordJob {pass.render_interface, i, slice_idx, slice_count});
+        }
+    }
+    if (_secondary_command_buffers.size() != _secondary_jobs.size()) {
+        _secondary_command_buffers.resize(_secondary_jobs.size());
+    }
 
-    VK_CHECK(vkEndCommandBuffer(command_buffer));
+    Pool* thread_pool = Engine::instance()->thread_pool;
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, _secondary_jobs.size(), 1), [&](auto range) {
+        ZoneScopedN("RecordSecondaryCommandBuffers");
+
+        // Command pools are externally synchronized, every thread only allocates and records from its own
+        auto& pool = thread_pools[pool_thread_id()];
+        for (uint32_t job_idx : range) {
+            const auto& job = _secondary_jobs[job_idx];
+            if (pool.used == pool.buffers.size()) {
+                VkCommandBufferAllocateInfo alloc_info = {
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                        .commandPool = pool.pool,
+                        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                        .commandBufferCount = 1
+                };
+                VkCommandBuffer new_buffer;
+                VK_CHECK(vkAllocateCommandBuffers(_device, &alloc_info, &new_buffer));
+                pool.buffers.push_back(new_buffer);
+            }
+            VkCommandBuffer secondary = pool.buffers[pool.used++];
+
+            VK_CHECK(vkBeginCommandBuffer(secondary, &_scheduled_passes[job.step].secondary_begin_info));
+            job.render_interface->render_slice(secondary, job.slice_idx, job.slice_count);
+            VK_CHECK(vkEndCommandBuffer(secondary));
+
+            _secondary_command_buffers[job_idx] = secondary;
+        }
+    }, thread_pool);
 }
 
 Buffer Renderer::create_static_render_buffer_from_cpu(VkBufferUsageFlags buffer_usage, const void* data, size_t size) {
     Buffer rb = {};
 
-    // Create staging buffer and copy CPU data into it
-    VkBuffer staging_buffer;
-    VkBufferCreateInfo staging_buffer_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    };
-    VmaAllocationCreateInfo staging_buffer_alloc_create_info = {
-            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
-            .usage = VMA_MEMORY_USAGE_AUTO,
-    };
-
-    VmaAllocation staging_buffer_alloc;
-    VmaAllocationInfo staging_buffer_alloc_info;
-    VK_CHECK(vmaCreateBuffer(_vma_allocator, &staging_buffer_info, &staging_buffer_alloc_create_info,
-                             &staging_buffer, &staging_buffer_alloc, &staging_buffer_alloc_info));
-    memcpy(staging_buffer_alloc_info.pMappedData, data, size);
-
-    // Create vertex buffer and copy from staging buffer
     VkBufferCreateInfo buffer_info = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .size = size,
@@ -1117,56 +1302,94 @@ Buffer Renderer::create_static_render_buffer_from_cpu(VkBufferUsageFlags buffer_
                              &rb.buffer, &rb.alloc_data, nullptr));
     rb.size = size;
 
-    VkCommandBuffer command_buffer = begin_single_time_commands();
+    queue_buffer_upload(rb.buffer, 0, data, size, false);
+
+    return rb;
+}
 
-    VkBufferCopy copy_region = {.size = size};
-    vkCmdCopyBuffer(command_buffer, staging_buffer, rb.buffer, 1, &copy_region);
+void Renderer::create_mesh_geometry(Mesh& mesh, const TexturedVertex* vertices, uint32_t vertex_count,
+                                    const uint16_t* indices, uint32_t index_count) {
+    GeometryAllocation allocation;
+    if (!_geometry_arena.allocate(vertex_count, index_count, allocation)) {
+        // Meshes larger than a block get a block of their own
+        add_geometry_block(std::max(vertex_count, GEOMETRY_BLOCK_VERTICES), std::max(index_count, GEOMETRY_BLOCK_INDICES));
+        _geometry_arena.allocate(vertex_count, index_count, allocation);
+    }
 
-    end_single_time_commands(command_buffer);
+    mesh.geometry_block = allocation.block;
+    mesh.vertex_offset = allocation.vertex_offset;
+    mesh.vertex_count = vertex_count;
+    mesh.first_index = allocation.first_index;
+    mesh.index_count = index_count;
+
+    const auto& block = _geometry_blocks[allocation.block];
+    queue_buffer_upload(block.vertex_buffer.buffer, sizeof(TexturedVertex) * allocation.vertex_offset,
+                        vertices, sizeof(TexturedVertex) * vertex_count, true);
+    if (index_count > 0) {
+        queue_buffer_upload(block.index_buffer.buffer, sizeof(uint16_t) * allocation.first_index,
+                            indices, sizeof(uint16_t) * index_count, true);
+    }
+}
 
-    vmaDestroyBuffer(_vma_allocator, staging_buffer, staging_buffer_alloc);
+void Renderer::destroy_mesh_geometry(const Mesh& mesh) {
+    GeometryAllocation allocation = {mesh.geometry_block, mesh.vertex_offset, mesh.first_index};
+    _pending_geometry_frees.push_back(GeometryFree{allocation, mesh.vertex_count, mesh.index_count});
+}
 
-    return rb;
+void Renderer::bind_geometry_block(VkCommandBuffer command_buffer, uint32_t block) {
+    vkuCmdBindSingleVertexBuffer(command_buffer, _geometry_blocks[block].vertex_buffer.buffer);
+    vkCmdBindIndexBuffer(command_buffer, _geometry_blocks[block].index_buffer.buffer, 0, VK_INDEX_TYPE_UINT16);
 }
 
-void Renderer::create_static_render_buffer_from_cpu(VkCommandBuffer cmd_buffer,
-    VkBufferUsageFlags buffer_usage, const void *data, size_t size,
-    Buffer& staging_buffer, Buffer& dest_buffer) {
+void Renderer::add_geometry_block(uint32_t vertex_capacity, uint32_t index_capacity) {
+    uint32_t block_idx = _geometry_arena.num_blocks();
+    if (block_idx >= MAX_GEOMETRY_BLOCKS) {
+        log_error("Out of geometry arena blocks!");
+        std::abort();
+    }
+    _geometry_arena.add_block(vertex_capacity, index_capacity);
 
-    // Create staging buffer and copy CPU data into it
-    VkBufferCreateInfo staging_buffer_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    };
-    VmaAllocationCreateInfo staging_buffer_alloc_create_info = {
-            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+    Array<uint32_t, 2> queue_families = {(uint32_t)_queue_family_main_idx, (uint32_t)_queue_family_transfer_idx};
+    bool shared = _queue_family_transfer_idx != _queue_family_main_idx;
+    VmaAllocationCreateInfo alloc_create_info = {
+            .flags = (VmaAllocationCreateFlags)VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
             .usage = VMA_MEMORY_USAGE_AUTO,
+            .priority = 1.0f
     };
 
-    VmaAllocationInfo staging_buffer_alloc_info;
-    VK_CHECK(vmaCreateBuffer(_vma_allocator, &staging_buffer_info, &staging_buffer_alloc_create_info,
-                             &staging_buffer.buffer, &staging_buffer.alloc_data, &staging_buffer_alloc_info));
-    staging_buffer.size = size;
-    memcpy(staging_buffer_alloc_info.pMappedData, data, size);
-
-    // Create vertex buffer and copy from staging buffer
+    auto& block = _geometry_blocks[block_idx];
     VkBufferCreateInfo buffer_info = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | buffer_usage,
+            .size = sizeof(TexturedVertex) * vertex_capacity,
+            .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            .sharingMode = shared ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = shared ? queue_families.size() : 0,
+            .pQueueFamilyIndices = shared ? queue_families.data() : nullptr,
     };
-    VmaAllocationCreateInfo buffer_alloc_create_info = {
-            .flags = (VmaAllocationCreateFlags)VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
-            .usage = VMA_MEMORY_USAGE_AUTO,
-            .priority = 1.0f
-    };
-    VK_CHECK(vmaCreateBuffer(_vma_allocator, &buffer_info, &buffer_alloc_create_info,
-                             &dest_buffer.buffer, &dest_buffer.alloc_data, nullptr));
-    dest_buffer.size = size;
+    VK_CHECK(vmaCreateBuffer(_vma_allocator, &buffer_info, &alloc_create_info,
+                             &block.vertex_buffer.buffer, &block.vertex_buffer.alloc_data, nullptr));
+    block.vertex_buffer.size = buffer_info.size;
 
-    VkBufferCopy copy_region = {.size = size};
-    vkCmdCopyBuffer(cmd_buffer, staging_buffer.buffer, dest_buffer.buffer, 1, &copy_region);
+    buffer_info.size = sizeof(uint16_t) * index_capacity;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VK_CHECK(vmaCreateBuffer(_vma_allocator, &buffer_info, &alloc_create_info,
+                             &block.index_buffer.buffer, &block.index_buffer.alloc_data, nullptr));
+    block.index_buffer.size = buffer_info.size;
+}
+
+void Renderer::release_geometry_frees() {
+    // The fence of this frame slot has been waited on, the ranges handed to it are no longer drawn from
+    for (const auto& geometry_free : _geometry_frees[_current_frame]) {
+        _geometry_arena.free(geometry_free.allocation, geometry_free.vertex_count, geometry_free.index_count);
+    }
+    _geometry_frees[_current_frame].truncate();
+
+    // Freed during this update, so the last frame that can still draw them is the one before this
+    auto& frees = _geometry_frees[(_current_frame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT];
+    for (const auto& geometry_free : _pending_geometry_frees) {
+        frees.push_back(geometry_free);
+    }
+    _pending_geometry_frees.truncate();
 }
 
 Buffer Renderer::create_dynamic_render_buffer(VkBufferUsageFlags buffer_usage, size_t initial_size) {
@@ -1281,6 +1504,44 @@ void* Renderer::get_mapped_pointer(const UniformBuffer& uniform_buffer, uint32_t
     return alloc_info.pMappedData;
 }
 
+// The frame's fence has been waited on, so its transient buffer can be reused and grown
+void Renderer::begin_frame_transients() {
+    auto& overflow_buffers = _transient_overflow_buffers[_current_frame];
+    for (const auto& buffer : overflow_buffers) {
+        destroy_buffer(buffer);
+    }
+    overflow_buffers.truncate();
+
+    auto& arena = _transient_arenas[_current_frame];
+    _transient_demand = glm::max(_transient_demand, arena.demand());
+    auto& buffer = _transient_buffer.buffer_per_frame[_current_frame];
+    if (buffer.size < _transient_demand || buffer.buffer == VK_NULL_HANDLE) {
+        // Some headroom so that a slowly growing UI doesn't recreate the buffers every few frames
+        size_t size = glm::max(_transient_demand + _transient_demand / 2, TRANSIENT_BUFFER_INITIAL_SIZE);
+        destroy_buffer(buffer);
+        buffer = create_dynamic_render_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size);
+    }
+    arena.reset(buffer.size);
+}
+
+TransientAllocation Renderer::allocate_transient(size_t size, size_t alignment) {
+    TransientAllocation allocation;
+    size_t offset;
+    if (_transient_arenas[_current_frame].allocate(size, alignment, offset)) {
+        const auto& buffer = _transient_buffer.buffer_per_frame[_current_frame];
+        allocation.buffer = buffer.buffer;
+        allocation.offset = offset;
+        allocation.data = (char*)get_mapped_pointer(buffer) + offset;
+    }
+    else {
+        Buffer buffer = create_dynamic_render_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size);
+        _transient_overflow_buffers[_current_frame].push_back(buffer);
+        allocation.buffer = buffer.buffer;
+        allocation.data = get_mapped_pointer(buffer);
+    }
+    return allocation;
+}
+
 void Renderer::destroy_buffer(const Buffer &buffer) {
     vmaDestroyBuffer(_vma_allocator, buffer.buffer, buffer.alloc_data);
 }
@@ -1319,7 +1580,9 @@ void Renderer::recreate_swapchain() {
     cleanup_swapchain();
 
     create_swapchain();
-    create_depth_resources();
+
+    // The transient images have the size of the swapchain
+    _render_graph_dirty = true;
 }
 
 uint32_t Renderer::find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties) {
@@ -1372,98 +1635,397 @@ void Renderer::update_uniform_buffer(uint32_t cur_image) {
     update_uniform_buffer(cur_image, _uniform_buffer, &ubo, sizeof(UniformBufferObject));
 }
 
+void Renderer::DirtySlots::mark(uint32_t slot) {
+    while (pending_frames.size() <= slot) {
+        pending_frames.push_back(0);
+    }
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (pending_frames[slot] & (1 << i)) continue;
+        pending_frames[slot] |= 1 << i;
+        slots_per_frame[i].push_back(slot);
+    }
+}
+
 void Renderer::update_texture_descriptor_sets(uint32_t cur_image) {
-    auto res = Res::inst();
+    auto& slots = _dirty_textures.slots_per_frame[cur_image];
+    if (slots.empty()) return;
+
+    ZoneScoped;
 
-    if (res->_texture_pool.size() == 0) return;
+    auto res = Res::inst();
+    const Texture* textures = res->_texture_pool.item_buf();
 
-    Array<VkWriteDescriptorSet, MAX_BINDLESS_TEXTURES> bindless_descriptor_writes;
-    Array<VkDescriptorImageInfo, MAX_BINDLESS_TEXTURES>  bindless_image_info;
+    Vector<VkDescriptorImageInfo> image_infos(slots.size());
+    Vector<VkWriteDescriptorSet> descriptor_writes(slots.size());
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        uint32_t slot = slots[i];
+        _dirty_textures.pending_frames[slot] &= ~(1 << cur_image);
 
-    uint32_t current_write_index = 0;
-    res->_texture_pool.foreach_with_ref([&](Ref<Texture> tex_id, Texture& tex) {
-        bindless_image_info[current_write_index] = VkDescriptorImageInfo {
-            .sampler = tex.sampler,
-            .imageView = tex.image_view,
+        image_infos[i] = VkDescriptorImageInfo {
+            .sampler = textures[slot].sampler,
+            .imageView = textures[slot].image_view,
             .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
         };
-
-        bindless_descriptor_writes[current_write_index] = VkWriteDescriptorSet {
+        descriptor_writes[i] = VkWriteDescriptorSet {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .descriptorCount = 1,
-            .dstArrayElement = current_write_index,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .dstSet = _texture_descriptor_set.set_per_frame[cur_image],
             .dstBinding = 0,
-            .pImageInfo = &bindless_image_info[current_write_index],
+            .dstArrayElement = slot,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &image_infos[i],
         };
+    }
 
-        current_write_index++;
-    });
-
-    vkUpdateDescriptorSets(_device, current_write_index, bindless_descriptor_writes.data(), 0, nullptr);
+    vkUpdateDescriptorSets(_device, descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
+    slots.truncate();
 }
 
-void Renderer::update_material_buffer_descriptor_sets(uint32_t cur_image) {
-    auto res = Res::inst();
+void Renderer::update_material_buffer(uint32_t cur_image) {
+    auto& slots = _dirty_materials.slots_per_frame[cur_image];
+    if (slots.empty()) return;
 
-    Material* material_buf = res->_material_pool.item_buf();
-    const uint32_t material_count = res->_material_pool.size();
-    if (material_count == 0) return;
+    ZoneScoped;
 
-    MaterialGpu* material_gpu_buf = new MaterialGpu[material_count];
-    for (uint32_t i = 0; i < material_count; i++) {
-        material_gpu_buf[i].albedo = material_buf[i].albedo;
-        material_gpu_buf[i].metallic = material_buf[i].metallic;
-        material_gpu_buf[i].roughness = material_buf[i].roughness;
-        material_gpu_buf[i].ao = material_buf[i].ao;
-        material_gpu_buf[i].albedo_tex_id = res->_texture_pool.get_item_idx(material_buf[i].albedo_tex_id);
-        material_gpu_buf[i].metallic_roughness_tex_id = res->_texture_pool.get_item_idx(material_buf[i].metallic_roughness_tex_id);
-        material_gpu_buf[i].ao_tex_id = res->_texture_pool.get_item_idx(material_buf[i].ao_tex_id);
+    auto res = Res::inst();
+    const Material* materials = res->_material_pool.item_buf();
+
+    // The frame's fence has been waited on, so its copy of the buffer can be written in place
+    auto* material_gpu_buf = (MaterialGpu*)get_mapped_pointer(_material_buffer.buffer_per_frame[cur_image]);
+    for (uint32_t slot : slots) {
+        _dirty_materials.pending_frames[slot] &= ~(1 << cur_image);
+
+        const Material& material = materials[slot];
+        material_gpu_buf[slot] = MaterialGpu {
+            .albedo = material.albedo,
+            .metallic = material.metallic,
+            .roughness = material.roughness,
+            .ao = material.ao,
+            .albedo_tex_id = res->_texture_pool.get_item_idx(material.albedo_tex_id),
+            .metallic_roughness_tex_id = res->_texture_pool.get_item_idx(material.metallic_roughness_tex_id),
+            .ao_tex_id = res->_texture_pool.get_item_idx(material.ao_tex_id),
+        };
     }
+    slots.truncate();
+}
 
-    update_storage_buffer(cur_image, _buffer_descriptor_set, _material_buffer, material_gpu_buf, sizeof(MaterialGpu) * material_count);
-
-    delete [] material_gpu_buf;
+void Renderer::set_material_dirty(Ref<Material> mat_id) {
+    uint32_t slot = Res::inst()->_material_pool.get_item_idx(mat_id);
+    if (slot >= MAX_MATERIALS) {
+        log_error("Material slot {} is out of the material buffer!", slot);
+        std::abort();
+    }
+    _dirty_materials.mark(slot);
 }
 
 void Renderer::update_lighting_buffer_descriptor_sets(uint32_t cur_image) {
     update_storage_buffer(cur_image, _lighting_descriptor_set, _lighting_buffer, &_lighting, sizeof(LightingBuffer));
 }
 
-VkCommandBuffer Renderer::begin_single_time_commands() {
-    VkCommandBufferAllocateInfo alloc_info = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandPool = _command_pool,
-            .commandBufferCount = 1
+// Bins the point lights into the clusters of the frame's camera, then writes them into the frame's copy of the
+// buffer, whose fence has been waited on
+void Renderer::update_light_cluster_buffer(uint32_t cur_image) {
+    ZoneScoped;
+
+    Vector<glm::vec4> lights;
+    for (uint32_t i = 0; i < _lighting.num_points; i++) {
+        lights.push_back(glm::vec4(_lighting.point[i].position, _lighting.point[i].radius));
+    }
+    glm::vec2 viewport_size = {(float)_window_extent.width, (float)_window_extent.height};
+    _light_clusters.build(_frame_camera.get_view_matrix(), _frame_camera.proj_mat, viewport_size,
+        Span<const glm::vec4>(lights.data(), lights.size()), Engine::instance()->thread_pool);
+
+    char* dst = (char*)get_mapped_pointer(_light_cluster_buffer.buffer_per_frame[cur_image]);
+    const auto& clusters = _light_clusters.clusters();
+    const auto& light_indices = _light_clusters.light_indices();
+    memcpy(dst, &_light_clusters.header(), sizeof(LightClusterHeader));
+    dst += sizeof(LightClusterHeader);
+    memcpy(dst, clusters.data(), sizeof(glm::uvec2) * clusters.size());
+    dst += sizeof(glm::uvec2) * LIGHT_CLUSTER_COUNT;
+    memcpy(dst, light_indices.data(), sizeof(uint32_t) * light_indices.size());
+}
+
+void Renderer::create_upload_resources() {
+    VkBufferCreateInfo buffer_info = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = UPLOAD_RING_SIZE,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    };
+    VmaAllocationCreateInfo alloc_create_info = {
+            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO,
+    };
+    VK_CHECK(vmaCreateBuffer(_vma_allocator, &buffer_info, &alloc_create_info,
+                             &_upload_buffer.buffer, &_upload_buffer.alloc_data, nullptr));
+    _upload_buffer.size = UPLOAD_RING_SIZE;
+    _upload_ring.init(UPLOAD_RING_SIZE);
+
+    VkSemaphoreTypeCreateInfo timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0
     };
+    VkSemaphoreCreateInfo semaphore_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &timeline_info
+    };
+    VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &_upload_timeline));
 
-    VkCommandBuffer command_buffer;
-    vkAllocateCommandBuffers(_device, &alloc_info, &command_buffer);
+    VkCommandPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = (uint32_t)_queue_family_transfer_idx
+    };
+    VK_CHECK(vkCreateCommandPool(_device, &pool_info, nullptr, &_transfer_command_pool));
+}
+
+Renderer::StagingAllocation Renderer::stage_upload(const void* data, size_t size, size_t alignment) {
+    size_t offset;
+    if (_upload_ring.allocate(size, alignment, offset)) {
+        memcpy((uint8_t*)get_mapped_pointer(_upload_buffer) + offset, data, size);
+        return StagingAllocation{_upload_buffer.buffer, offset};
+    }
+
+    // The ring is full (or the upload is larger than the whole ring), happens when loading a lot at once
+    Buffer& staging_buffer = _pending_staging_buffers.push_empty();
+    staging_buffer = create_dynamic_render_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+    memcpy(get_mapped_pointer(staging_buffer), data, size);
+    return StagingAllocation{staging_buffer.buffer, 0};
+}
+
+void Renderer::queue_buffer_upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, size_t size, bool concurrent) {
+    StagingAllocation staging = stage_upload(data, size, 16);
+    _pending_buffer_uploads.push_back(BufferUpload{staging.buffer, staging.offset, dst_buffer, dst_offset, size, concurrent});
+}
+
+UploadTicket Renderer::get_upload_ticket() const {
+    // Everything queued since the last submission goes out with the open ring batch
+    bool has_pending = !_pending_buffer_uploads.empty() || !_pending_image_uploads.empty();
+    return has_pending ? _upload_ring.next_serial() : _last_upload_ticket;
+}
+
+bool Renderer::is_upload_complete(UploadTicket ticket) {
+    uint64_t completed;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _upload_timeline, &completed));
+    return completed >= ticket;
+}
+
+void Renderer::begin_frame_uploads() {
+    ZoneScoped;
+
+    // Nothing here waits, whatever the transfer queue has finished by now is released
+    uint64_t completed;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _upload_timeline, &completed));
+    _upload_ring.release(completed);
+    uint32_t num_kept = 0;
+    for (const auto& staging_buffer : _submitted_staging_buffers) {
+        if (staging_buffer.ticket <= completed) {
+            destroy_buffer(staging_buffer.buffer);
+        }
+        else {
+            _submitted_staging_buffers[num_kept++] = staging_buffer;
+        }
+    }
+    _submitted_staging_buffers.truncate(num_kept);
+
+    if (_pending_buffer_uploads.empty() && _pending_image_uploads.empty()) {
+        return;
+    }
+
+    UploadTicket ticket = _upload_ring.close_batch();
+    submit_uploads(ticket);
+
+    for (const auto& staging_buffer : _pending_staging_buffers) {
+        _submitted_staging_buffers.push_back(SubmittedStagingBuffer{staging_buffer, ticket});
+    }
+    // Appended, if the last frame was skipped (out of date swapchain) its acquires go out with this one
+    if (_queue_family_transfer_idx != _queue_family_main_idx) {
+        for (const auto& upload : _pending_buffer_uploads) {
+            if (!upload.concurrent) {
+                _frame_buffer_uploads.push_back(upload);
+            }
+        }
+        for (const auto& upload : _pending_image_uploads) {
+            _frame_image_uploads.push_back(upload);
+        }
+    }
+    _pending_buffer_uploads.truncate();
+    _pending_image_uploads.truncate();
+    _pending_staging_buffers.truncate();
+    _frame_upload_ticket = ticket;
+    _last_upload_ticket = ticket;
+}
+
+void Renderer::submit_uploads(UploadTicket ticket) {
+    ZoneScoped;
+
+    uint64_t completed;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _upload_timeline, &completed));
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    for (auto& transfer : _transfer_command_buffers) {
+        if (transfer.ticket <= completed) {
+            transfer.ticket = ticket;
+            command_buffer = transfer.command_buffer;
+            vkResetCommandBuffer(command_buffer, 0);
+            break;
+        }
+    }
+    if (command_buffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = _transfer_command_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1
+        };
+        VK_CHECK(vkAllocateCommandBuffers(_device, &alloc_info, &command_buffer));
+        _transfer_command_buffers.push_back(TransferCommandBuffer{command_buffer, ticket});
+    }
 
     VkCommandBufferBeginInfo begin_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
             .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
-    vkBeginCommandBuffer(command_buffer, &begin_info);
+    VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
 
-    return command_buffer;
-}
+    VkImageSubresourceRange color_range = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+    };
+    Vector<VkImageMemoryBarrier> image_barriers;
+    image_barriers.reserve(_pending_image_uploads.size());
+    for (const auto& upload : _pending_image_uploads) {
+        image_barriers.push_back(VkImageMemoryBarrier {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = upload.image,
+                .subresourceRange = color_range
+        });
+    }
+    if (!image_barriers.empty()) {
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, image_barriers.size(), image_barriers.data());
+    }
+
+    for (const auto& upload : _pending_buffer_uploads) {
+        VkBufferCopy copy_region = {.srcOffset = upload.src_offset, .dstOffset = upload.dst_offset, .size = upload.size};
+        vkCmdCopyBuffer(command_buffer, upload.src_buffer, upload.dst_buffer, 1, &copy_region);
+    }
+    for (const auto& upload : _pending_image_uploads) {
+        copy_buffer_to_image(command_buffer, upload.src_buffer, upload.src_offset, upload.image, upload.width, upload.height);
+    }
+
+    // Release to the graphics queue family, which acquires with the same barriers in record_upload_acquires().
+    // On the same family only the images need their final layout, the semaphore takes care of the rest.
+    bool transfer_ownership = _queue_family_transfer_idx != _queue_family_main_idx;
+    uint32_t src_family = transfer_ownership ? (uint32_t)_queue_family_transfer_idx : VK_QUEUE_FAMILY_IGNORED;
+    uint32_t dst_family = transfer_ownership ? (uint32_t)_queue_family_main_idx : VK_QUEUE_FAMILY_IGNORED;
+    Vector<VkBufferMemoryBarrier> buffer_barriers;
+    if (transfer_ownership) {
+        buffer_barriers.reserve(_pending_buffer_uploads.size());
+        for (const auto& upload : _pending_buffer_uploads) {
+            if (upload.concurrent) continue;
+            buffer_barriers.push_back(VkBufferMemoryBarrier {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = 0,
+                    .srcQueueFamilyIndex = src_family,
+                    .dstQueueFamilyIndex = dst_family,
+                    .buffer = upload.dst_buffer,
+                    .offset = 0,
+                    .size = VK_WHOLE_SIZE
+            });
+        }
+    }
+    for (auto& barrier : image_barriers) {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = src_family;
+        barrier.dstQueueFamilyIndex = dst_family;
+    }
+    if (!buffer_barriers.empty() || !image_barriers.empty()) {
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr,
+                             buffer_barriers.size(), buffer_barriers.data(),
+                             image_barriers.size(), image_barriers.data());
+    }
 
-void Renderer::end_single_time_commands(VkCommandBuffer command_buffer) {
-    vkEndCommandBuffer(command_buffer);
+    VK_CHECK(vkEndCommandBuffer(command_buffer));
 
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &ticket
+    };
     VkSubmitInfo submit_info = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timeline_info,
             .commandBufferCount = 1,
-            .pCommandBuffers = &command_buffer
+            .pCommandBuffers = &command_buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &_upload_timeline
     };
+    VK_CHECK(vkQueueSubmit(_transfer_queue, 1, &submit_info, VK_NULL_HANDLE));
+}
 
-    vkQueueSubmit(_graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(_graphics_queue);
+void Renderer::record_upload_acquires(VkCommandBuffer command_buffer) {
+    ZoneScoped;
 
-    vkFreeCommandBuffers(_device, _command_pool, 1, &command_buffer);
+    if (_frame_buffer_uploads.empty() && _frame_image_uploads.empty()) {
+        return;
+    }
+
+    // Matches the release in submit_uploads(). The submit waits for the ticket at UPLOAD_WAIT_STAGES,
+    // so only the draws that read uploads wait for the transfer queue.
+    Vector<VkBufferMemoryBarrier> buffer_barriers;
+    buffer_barriers.reserve(_frame_buffer_uploads.size());
+    for (const auto& upload : _frame_buffer_uploads) {
+        buffer_barriers.push_back(VkBufferMemoryBarrier {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+                               | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+                .srcQueueFamilyIndex = (uint32_t)_queue_family_transfer_idx,
+                .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
+                .buffer = upload.dst_buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE
+        });
+    }
+    Vector<VkImageMemoryBarrier> image_barriers;
+    image_barriers.reserve(_frame_image_uploads.size());
+    for (const auto& upload : _frame_image_uploads) {
+        image_barriers.push_back(VkImageMemoryBarrier {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .srcQueueFamilyIndex = (uint32_t)_queue_family_transfer_idx,
+                .dstQueueFamilyIndex = (uint32_t)_queue_family_main_idx,
+                .image = upload.image,
+                .subresourceRange = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1
+                }
+        });
+    }
+    vkCmdPipelineBarrier(command_buffer, UPLOAD_WAIT_STAGES, UPLOAD_WAIT_STAGES, 0,
+                         0, nullptr,
+                         buffer_barriers.size(), buffer_barriers.data(),
+                         image_barriers.size(), image_barriers.data());
 }
 
 void Renderer::copy_buffer(VkCommandBuffer cmd_buffer, VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
@@ -1516,9 +2078,9 @@ Renderer::transition_image_layout(VkCommandBuffer cmd_buffer, VkImage image, VkF
                          1, &barrier);
 }
 
-void Renderer::copy_buffer_to_image(VkCommandBuffer cmd_buffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+void Renderer::copy_buffer_to_image(VkCommandBuffer cmd_buffer, VkBuffer buffer, VkDeviceSize buffer_offset, VkImage image, uint32_t width, uint32_t height) {
     VkBufferImageCopy region = {
-            .bufferOffset = 0,
+            .bufferOffset = buffer_offset,
             .bufferRowLength = 0,
             .bufferImageHeight = 0,
             .imageSubresource = {
@@ -1534,32 +2096,9 @@ void Renderer::copy_buffer_to_image(VkCommandBuffer cmd_buffer, VkBuffer buffer,
     vkCmdCopyBufferToImage(cmd_buffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
-void Renderer::upload_to_gpu(const ImageCpuData &image_cpu, VkFormat format, Image& image) {
-    VkCommandBuffer cmd_buffer = begin_single_time_commands();
-    Buffer staging_buffer;
-    upload_to_gpu(cmd_buffer, image_cpu, format, image, staging_buffer);
-    end_single_time_commands(cmd_buffer);
-    destroy_buffer(staging_buffer);
-}
-
-void Renderer::upload_to_gpu(VkCommandBuffer cmd_buffer, const ImageCpuData& image_cpu, VkFormat format, Image& image, Buffer& staging_buffer) {
+void Renderer::upload_to_gpu(const ImageCpuData& image_cpu, VkFormat format, Image& image) {
     VkDeviceSize image_size = image_cpu.width * image_cpu.height * image_cpu.data_channels;
 
-    VkBufferCreateInfo staging_buffer_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = image_size,
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    };
-    VmaAllocationCreateInfo staging_buffer_alloc_create_info = {
-            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
-            .usage = VMA_MEMORY_USAGE_AUTO,
-    };
-
-    VmaAllocationInfo staging_buffer_alloc_info;
-    VK_CHECK(vmaCreateBuffer(_vma_allocator, &staging_buffer_info, &staging_buffer_alloc_create_info,
-                             &staging_buffer.buffer, &staging_buffer.alloc_data, &staging_buffer_alloc_info));
-    memcpy(staging_buffer_alloc_info.pMappedData, image_cpu.pixels, image_size);
-
     image = {.extents = {(uint32_t)image_cpu.width, (uint32_t)image_cpu.height}, .format = format};
 
     VkImageCreateInfo image_info = {
@@ -1584,9 +2123,10 @@ void Renderer::upload_to_gpu(VkCommandBuffer cmd_buffer, const ImageCpuData& ima
     VK_CHECK(vmaCreateImage(_vma_allocator, &image_info, &image_alloc_create_info,
                             &image.image, &image.alloc_data, &image_alloc_info));
 
-    transition_image_layout(cmd_buffer, image.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copy_buffer_to_image(cmd_buffer, staging_buffer.buffer, image.image, image_cpu.width, image_cpu.height);
-    transition_image_layout(cmd_buffer, image.image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    size_t alignment = std::max<size_t>(16, _physical_device_properties.limits.optimalBufferCopyOffsetAlignment);
+    StagingAllocation staging = stage_upload(image_cpu.pixels, image_size, alignment);
+    _pending_image_uploads.push_back(ImageUpload{staging.buffer, staging.offset, image.image, format,
+                                                 (uint32_t)image_cpu.width, (uint32_t)image_cpu.height});
 }
 
 Shader Renderer::load_shader_from_file(const std::string& filename, ShaderType type) {
@@ -1605,6 +2145,119 @@ void Renderer::destroy_shader(const Shader &shader) {
     vkDestroyShaderModule(_device, shader.module, nullptr);
 }
 
+template <class T>
+static Vector<T> copy_to_vector(const T* data, uint32_t count) {
+    Vector<T> result(count);
+    for (uint32_t i = 0; i < count; i++) {
+        result[i] = data[i];
+    }
+    return result;
+}
+
+void Renderer::queue_graphics_pipeline(const VkGraphicsPipelineCreateInfo& create_info, VkPipeline* pipeline) {
+    auto& job = _pipeline_jobs.push_empty();
+    job.create_info = create_info;
+    job.pipeline = pipeline;
+
+    job.stages = copy_to_vector(create_info.pStages, create_info.stageCount);
+    if (create_info.pNext) {
+        auto* rendering = (const VkPipelineRenderingCreateInfo*)create_info.pNext;
+        if (rendering->sType != VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO || rendering->pNext) {
+            log_error("Only VkPipelineRenderingCreateInfo can be chained to a queued pipeline!");
+            std::abort();
+        }
+        job.rendering = *rendering;
+        job.color_formats = copy_to_vector(rendering->pColorAttachmentFormats, rendering->colorAttachmentCount);
+    }
+    if (create_info.pVertexInputState) {
+        job.vertex_input = *create_info.pVertexInputState;
+        job.vertex_bindings = copy_to_vector(job.vertex_input.pVertexBindingDescriptions, job.vertex_input.vertexBindingDescriptionCount);
+        job.vertex_attributes = copy_to_vector(job.vertex_input.pVertexAttributeDescriptions, job.vertex_input.vertexAttributeDescriptionCount);
+    }
+    if (create_info.pInputAssemblyState) job.input_assembly = *create_info.pInputAssemblyState;
+    if (create_info.pViewportState) {
+        job.viewport_state = *create_info.pViewportState;
+        job.viewports = copy_to_vector(job.viewport_state.pViewports, job.viewport_state.pViewports ? job.viewport_state.viewportCount : 0);
+        job.scissors = copy_to_vector(job.viewport_state.pScissors, job.viewport_state.pScissors ? job.viewport_state.scissorCount : 0);
+    }
+    if (create_info.pRasterizationState) job.rasterization = *create_info.pRasterizationState;
+    if (create_info.pMultisampleState) job.multisample = *create_info.pMultisampleState;
+    if (create_info.pDepthStencilState) job.depth_stencil = *create_info.pDepthStencilState;
+    if (create_info.pColorBlendState) {
+        job.color_blend = *create_info.pColorBlendState;
+        job.blend_attachments = copy_to_vector(job.color_blend.pAttachments, job.color_blend.attachmentCount);
+    }
+    if (create_info.pDynamicState) {
+        job.dynamic_state = *create_info.pDynamicState;
+        job.dynamic_states = copy_to_vector(job.dynamic_state.pDynamicStates, job.dynamic_state.dynamicStateCount);
+    }
+}
+
+void Renderer::build_pipelines() {
+    ZoneScoped;
+
+    if (_pipeline_jobs.empty()) return;
+
+    uint64_t start_counter = SDL_GetPerformanceCounter();
+
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, _pipeline_jobs.size(), 1), [&](auto range) {
+        ZoneScopedN("BuildPipeline");
+        for (uint32_t i : range) {
+            auto& job = _pipeline_jobs[i];
+            auto& info = job.create_info;
+
+            // Point the copied create info at the copies, the queue can't be resized anymore at this point
+            info.pStages = job.stages.data();
+            if (info.pNext) {
+                job.rendering.pColorAttachmentFormats = job.color_formats.data();
+                info.pNext = &job.rendering;
+            }
+            if (info.pVertexInputState) {
+                job.vertex_input.pVertexBindingDescriptions = job.vertex_bindings.data();
+                job.vertex_input.pVertexAttributeDescriptions = job.vertex_attributes.data();
+                info.pVertexInputState = &job.vertex_input;
+            }
+            if (info.pInputAssemblyState) info.pInputAssemblyState = &job.input_assembly;
+            if (info.pViewportState) {
+                job.viewport_state.pViewports = job.viewports.data();
+                job.viewport_state.pScissors = job.scissors.data();
+                info.pViewportState = &job.viewport_state;
+            }
+            if (info.pRasterizationState) info.pRasterizationState = &job.rasterization;
+            if (info.pMultisampleState) info.pMultisampleState = &job.multisample;
+            if (info.pDepthStencilState) info.pDepthStencilState = &job.depth_stencil;
+            if (info.pColorBlendState) {
+                job.color_blend.pAttachments = job.blend_attachments.data();
+                info.pColorBlendState = &job.color_blend;
+            }
+            if (info.pDynamicState) {
+                job.dynamic_state.pDynamicStates = job.dynamic_states.data();
+                info.pDynamicState = &job.dynamic_state;
+            }
+
+            // Pipeline caches are internally synchronized, all threads compile against the same one
+            VK_CHECK(vkCreateGraphicsPipelines(_device, _pipeline_cache, 1, &info, nullptr, job.pipeline));
+        }
+    }, Engine::instance()->thread_pool);
+
+    double elapsed_ms = (double)(SDL_GetPerformanceCounter() - start_counter) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    log_info("Built {} pipelines in {:.2f} ms ({} pipeline cache)", _pipeline_jobs.size(), elapsed_ms,
+             _pipeline_cache_loaded ? "warm" : "cold");
+
+    // Pipelines of the same renderer often share a stage
+    Vector<VkShaderModule> shader_modules;
+    for (const auto& job : _pipeline_jobs) {
+        for (const auto& stage : job.stages) {
+            if (!shader_modules.find(stage.module)) shader_modules.push_back(stage.module);
+        }
+    }
+    for (VkShaderModule module : shader_modules) {
+        vkDestroyShaderModule(_device, module, nullptr);
+    }
+
+    _pipeline_jobs.clear();
+}
+
 Ref<Image> Renderer::load_image_from_file(const std::string &filename, VkFormat format) {
     auto res = Res::inst();
     auto [image_id, image] = res->_image_pool.emplace();
@@ -1641,6 +2294,13 @@ Ref<Texture> Renderer::create_texture(const Image& image, VkFormat format, VkSam
     auto [tex_id, tex] = res->_texture_pool.emplace();
     tex->image_view = vkuCreateImageView(_device, image.image, format);
     VK_CHECK(vkCreateSampler(_device, &sampler_info, nullptr, &tex->sampler));
+
+    uint32_t slot = res->_texture_pool.get_item_idx(tex_id);
+    if (slot >= MAX_BINDLESS_TEXTURES) {
+        log_error("Texture slot {} is out of the bindless texture array!", slot);
+        std::abort();
+    }
+    _dirty_textures.mark(slot);
     return tex_id;
 }
 
@@ -1662,36 +2322,343 @@ VkRect2D Renderer::default_scissor() {
     };
 }
 
-void Renderer::_toposort_visit(RenderInterface* ri, Vector<RenderInterface*>& sorted) {
-    if (ri->_marked) return;
+struct VulkanAccess {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+};
+
+static VulkanAccess vulkan_access(RenderAccess access) {
+    constexpr VkPipelineStageFlags SHADER_STAGES = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+        | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    constexpr VkPipelineStageFlags DEPTH_STAGES = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+    switch (access) {
+        case RenderAccess::ColorAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+        case RenderAccess::DepthAttachment:
+            return {DEPTH_STAGES,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+        case RenderAccess::DepthRead:
+            return {DEPTH_STAGES, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+        case RenderAccess::SampledRead:
+            return {SHADER_STAGES, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        case RenderAccess::StorageRead:
+            // Storage buffers can also be the arguments of indirect draws
+            return {SHADER_STAGES | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL};
+        case RenderAccess::StorageWrite:
+            return {SHADER_STAGES, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL};
+        case RenderAccess::Present:
+            // The stage the acquire semaphore is waited on in, presenting waits on the render finished semaphore
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+        case RenderAccess::None:
+        default:
+            return {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+    }
+}
+
+static VkImageUsageFlags vulkan_image_usage(RenderAccess access) {
+    switch (access) {
+        case RenderAccess::ColorAttachment: return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        case RenderAccess::DepthAttachment:
+        case RenderAccess::DepthRead: return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        case RenderAccess::SampledRead: return VK_IMAGE_USAGE_SAMPLED_BIT;
+        case RenderAccess::StorageRead:
+        case RenderAccess::StorageWrite: return VK_IMAGE_USAGE_STORAGE_BIT;
+        default: return 0;
+    }
+}
 
-    for (auto dep : ri->_deps) {
-        _toposort_visit(dep, sorted);
+static VkImageAspectFlags vulkan_image_aspect(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
     }
+}
 
-    ri->_marked = true;
-    sorted.push_back(ri);
-};
+void Renderer::compile_render_graph() {
+    ZoneScoped;
+
+    // Frames in flight may still be using the transient images
+    if (!_render_graph_images.empty()) {
+        VK_CHECK(vkDeviceWaitIdle(_device));
+        destroy_render_graph_images();
+    }
+
+    _render_graph.reset();
+    _backbuffer_resource = _render_graph.add_imported_image(_swapchain_settings.surface_format.format,
+                                                            RenderAccess::None, RenderAccess::Present);
+    // TODO: We just assume we have D32_SFLOAT support in our GPU for now.
+    _depth_resource = _render_graph.add_transient_image(VK_FORMAT_D32_SFLOAT);
 
-void Renderer::toposort_render_interfaces() {
-    Set<RenderInterface*> ri_set(_render_interfaces.begin(), _render_interfaces.end());
-    for (auto ri : _render_interfaces) {
+    for (uint32_t i = 0; i < _render_interfaces.size(); i++) {
+        _render_graph.add_pass();
+    }
+    for (uint32_t i = 0; i < _render_interfaces.size(); i++) {
+        auto* ri = _render_interfaces[i];
         for (auto dep : ri->_deps) {
-            if (ri_set.find(dep) == ri_set.end()) {
-                log_warn("Dependency not added to render interface list! Removing it from dependency...");
-                ri->_deps.erase(dep);
+            auto* found = _render_interfaces.find(dep);
+            if (!found) {
+                log_warn("Dependency not added to render interface list! Ignoring it...");
+                continue;
+            }
+            _render_graph.add_dependency(i, found - _render_interfaces.data());
+        }
+        ri->declare_pass(_render_graph, i);
+    }
+
+    if (!_render_graph.compile()) {
+        log_error("Render interfaces have cyclic dependencies!");
+        std::abort();
+    }
+
+    const auto& schedule = _render_graph.schedule();
+    _scheduled_passes.truncate();
+    uint32_t scope_step = UINT32_MAX;
+    for (uint32_t i = 0; i < schedule.size(); i++) {
+        const auto& step = schedule[i];
+        auto& pass = _scheduled_passes.push_empty();
+        pass = ScheduledPass{};
+        pass.render_interface = _render_interfaces[step.pass];
+        pass.depth_resource = UINT32_MAX;
+        pass.depth_format = VK_FORMAT_UNDEFINED;
+
+        for (const auto& use : _render_graph.uses(step.pass)) {
+            VkFormat format = (VkFormat)_render_graph.resource(use.resource).format;
+            if (use.access == RenderAccess::ColorAttachment) {
+                if (pass.color_count == MAX_PASS_COLOR_ATTACHMENTS) {
+                    log_error("Render pass has more than {} color attachments!", MAX_PASS_COLOR_ATTACHMENTS);
+                    std::abort();
+                }
+                pass.color_resources[pass.color_count] = use.resource;
+                pass.color_formats[pass.color_count] = format;
+                pass.color_count++;
+            }
+            else if (use.access == RenderAccess::DepthAttachment || use.access == RenderAccess::DepthRead) {
+                pass.depth_resource = use.resource;
+                pass.depth_format = format;
+                pass.depth_read_only = use.access == RenderAccess::DepthRead;
+            }
+        }
+
+        bool has_attachments = pass.color_count > 0 || pass.depth_resource != UINT32_MAX;
+        if (step.begins_scope) {
+            scope_step = i;
+        }
+        pass.scope_step = has_attachments ? scope_step : UINT32_MAX;
+    }
+
+    // The vector doesn't grow anymore, so the begin infos can point into it
+    for (auto& pass : _scheduled_passes) {
+        VkCommandBufferUsageFlags flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        pass.inheritance_info = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+        if (pass.scope_step != UINT32_MAX) {
+            const auto& scope = _scheduled_passes[pass.scope_step];
+            pass.inheritance_rendering_info = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+                    .colorAttachmentCount = scope.color_count,
+                    .pColorAttachmentFormats = scope.color_formats.data(),
+                    .depthAttachmentFormat = scope.depth_format,
+                    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+            };
+            pass.inheritance_info.pNext = &pass.inheritance_rendering_info;
+            flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        }
+        pass.secondary_begin_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .flags = flags,
+                .pInheritanceInfo = &pass.inheritance_info
+        };
+    }
+
+    create_render_graph_images();
+    _render_graph_dirty = false;
+
+    log_info("Compiled render graph with {} passes and {} transient images", schedule.size(),
+             _render_graph.num_physical_images());
+}
+
+void Renderer::create_render_graph_images() {
+    // Usage of everything that ends up in a physical image
+    Vector<VkImageUsageFlags> usages(_render_graph.num_physical_images(), 0);
+    for (uint32_t pass = 0; pass < _render_graph.num_passes(); pass++) {
+        for (const auto& use : _render_graph.uses(pass)) {
+            uint32_t physical = _render_graph.physical_image(use.resource);
+            if (physical != UINT32_MAX) {
+                usages[physical] |= vulkan_image_usage(use.access);
             }
         }
-        ri->_marked = false;
     }
 
-    Vector<RenderInterface*> sorted;
+    for (uint32_t p = 0; p < _render_graph.num_physical_images(); p++) {
+        VkFormat format = (VkFormat)_render_graph.physical_image_format(p);
+        VkImageCreateInfo image_info = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .imageType = VK_IMAGE_TYPE_2D,
+                .format = format,
+                .extent = {.width = _swapchain_settings.extent.width, .height = _swapchain_settings.extent.height, .depth = 1},
+                .mipLevels = 1,
+                .arrayLayers = 1,
+                .samples = VK_SAMPLE_COUNT_1_BIT,
+                .tiling = VK_IMAGE_TILING_OPTIMAL,
+                .usage = usages[p],
+                .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        VmaAllocationCreateInfo image_alloc_create_info = {
+                .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+                .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+                .priority = 1.0f
+        };
+
+        auto& graph_image = _render_graph_images.push_empty();
+        graph_image.image.extents = _swapchain_settings.extent;
+        graph_image.image.format = format;
+        VK_CHECK(vmaCreateImage(_vma_allocator, &image_info, &image_alloc_create_info,
+                                &graph_image.image.image, &graph_image.image.alloc_data, nullptr));
+        graph_image.view = vkuCreateImageView(_device, graph_image.image.image, format, vulkan_image_aspect(format));
+    }
+}
+
+void Renderer::destroy_render_graph_images() {
+    for (auto& graph_image : _render_graph_images) {
+        vkDestroyImageView(_device, graph_image.view, nullptr);
+        vmaDestroyImage(_vma_allocator, graph_image.image.image, graph_image.image.alloc_data);
+    }
+    _render_graph_images.truncate();
+}
+
+VkImage Renderer::get_render_graph_image(uint32_t resource, uint32_t image_index) {
+    if (resource == _backbuffer_resource) {
+        return _swapchain_images[image_index];
+    }
+    return _render_graph_images[_render_graph.physical_image(resource)].image.image;
+}
+
+VkImageView Renderer::get_render_graph_image_view(uint32_t resource, uint32_t image_index) {
+    if (resource == _backbuffer_resource) {
+        return _swapchain_imageviews[image_index];
+    }
+    return _render_graph_images[_render_graph.physical_image(resource)].view;
+}
+
+void Renderer::record_render_graph_barriers(VkCommandBuffer command_buffer, const RenderGraphBarrier* barriers,
+                                            uint32_t count, uint32_t image_index) {
+    VkPipelineStageFlags src_stages = 0, dst_stages = 0;
+    // Buffers are whole and only used on the graphics queue, a global barrier covers all of them
+    VkMemoryBarrier memory_barrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    bool has_memory_barrier = false;
+    _render_graph_image_barriers.truncate();
+
+    for (uint32_t i = 0; i < count; i++) {
+        const auto& barrier = barriers[i];
+        const auto& desc = _render_graph.resource(barrier.resource);
+        VulkanAccess src = vulkan_access(barrier.src);
+        VulkanAccess dst = vulkan_access(barrier.dst);
+        src_stages |= src.stage;
+        dst_stages |= dst.stage;
+
+        if (desc.kind == RenderResourceKind::Buffer) {
+            memory_barrier.srcAccessMask |= src.access;
+            memory_barrier.dstAccessMask |= dst.access;
+            has_memory_barrier = true;
+            continue;
+        }
+
+        VkFormat format = (VkFormat)desc.format;
+        _render_graph_image_barriers.push_back(VkImageMemoryBarrier {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = src.access,
+                .dstAccessMask = dst.access,
+                .oldLayout = barrier.discard ? VK_IMAGE_LAYOUT_UNDEFINED : src.layout,
+                .newLayout = dst.layout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = get_render_graph_image(barrier.resource, image_index),
+                .subresourceRange = {
+                        .aspectMask = vulkan_image_aspect(format),
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1
+                }
+        });
+    }
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        src_stages,
+        dst_stages,
+        0,
+        has_memory_barrier ? 1 : 0, has_memory_barrier ? &memory_barrier : nullptr,
+        0, nullptr,
+        _render_graph_image_barriers.size(), _render_graph_image_barriers.data()
+    );
+}
+
+void Renderer::begin_render_graph_scope(VkCommandBuffer command_buffer, uint32_t step_idx, uint32_t image_index) {
+    const auto& step = _render_graph.schedule()[step_idx];
+    const auto& pass = _scheduled_passes[step_idx];
+    const auto& barriers = _render_graph.barriers();
 
-    for (auto ri : _render_interfaces) {
-        _toposort_visit(ri, sorted);
+    // Attachments whose previous contents were discarded right before the scope are cleared instead of loaded
+    auto load_op = [&](uint32_t resource) {
+        for (uint32_t i = 0; i < step.barrier_count; i++) {
+            const auto& barrier = barriers[step.first_barrier + i];
+            if (barrier.resource == resource && barrier.discard) return VK_ATTACHMENT_LOAD_OP_CLEAR;
+        }
+        return VK_ATTACHMENT_LOAD_OP_LOAD;
+    };
+
+    Array<VkRenderingAttachmentInfo, MAX_PASS_COLOR_ATTACHMENTS> color_attachment_infos;
+    for (uint32_t i = 0; i < pass.color_count; i++) {
+        color_attachment_infos[i] = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = get_render_graph_image_view(pass.color_resources[i], image_index),
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .loadOp = load_op(pass.color_resources[i]),
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue = {.color = {0.0f, 0.0f, 0.0f, 1.0f}}
+        };
+    }
+    VkRenderingAttachmentInfo depth_attachment_info = {};
+    if (pass.depth_resource != UINT32_MAX) {
+        depth_attachment_info = {
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = get_render_graph_image_view(pass.depth_resource, image_index),
+            .imageLayout = pass.depth_read_only ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                                                : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .loadOp = load_op(pass.depth_resource),
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue = {.depthStencil = {1.0f, 0}}
+        };
     }
 
-    _render_interfaces = sorted;
+    VkRenderingInfo render_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT,
+        .renderArea = {{0, 0}, _swapchain_settings.extent},
+        .layerCount = 1,
+        .colorAttachmentCount = pass.color_count,
+        .pColorAttachments = color_attachment_infos.data(),
+        .pDepthAttachment = pass.depth_resource != UINT32_MAX ? &depth_attachment_info : nullptr
+    };
+    vkCmdBeginRendering(command_buffer, &render_info);
 }
 
 void Renderer::render_imgui() {
@@ -1712,6 +2679,7 @@ void Renderer::render_imgui() {
                 lighting_dirty |= ImGui::DragFloat3("Position", (float*)&lighting.point[i].position);
                 lighting_dirty |= ImGui::ColorEdit3("Color", (float*)&lighting.point[i].color);
                 lighting_dirty |= ImGui::DragFloat("Intensity", &lighting.point[i].intensity, 0.1f, 0.0f, 100.0f);
+                lighting_dirty |= ImGui::DragFloat("Radius", &lighting.point[i].radius, 0.1f, 0.1f, 500.0f);
                 ImGui::TreePop();
             }
         }
@@ -1721,8 +2689,8 @@ void Renderer::render_imgui() {
         }
     }
     if (ImGui::CollapsingHeader("Material")) {
-        bool material_dirty = false;
         res->_material_pool.foreach_with_ref([&](Ref<Material> mat_id, Material& mat) {
+            bool material_dirty = false;
             const int img_size = 200;
             uint32_t idx = mat_id.index;
             uint32_t gen = mat_id.generation;
@@ -1740,6 +2708,9 @@ void Renderer::render_imgui() {
                 ImGui::Image(mat.ao_tex_id.to_userpointer(), ImVec2(img_size, img_size));
                 ImGui::TreePop();
             }
+            if (material_dirty) {
+                set_material_dirty(mat_id);
+            }
         });
     }
     if (ImGui::CollapsingHeader("Texture")) {
@@ -14,6 +14,13 @@
 #include "core/vector.h"
 #include "core/storage.h"
 
+#include "render/upload_ring.h"
+#include "render/transient_arena.h"
+#include "render/geometry_arena.h"
+#include "render/render_graph.h"
+#include "render/entity_bvh.h"
+#include "render/light_clusters.h"
+
 #include "vk_mem_alloc.h"
 #include "SDL_events.h"
 
@@ -21,6 +28,7 @@
 #include "vulkan/vulkan_core.h"
 
 struct SDL_Window;
+struct Task;
 
 struct ImageCpuData;
 struct TexturedMeshCpuData;
@@ -61,10 +69,20 @@ struct Buffer {
     size_t size = 0;
 };
 
+// Value of the upload timeline semaphore that signals once an upload has landed on the GPU
+using UploadTicket = uint64_t;
+
 struct DynamicBuffer { 
     Array<Buffer, MAX_FRAMES_IN_FLIGHT> buffer_per_frame;
 };
 
+// Range of the frame's transient buffer, valid until the frame slot comes around again
+struct TransientAllocation {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void* data = nullptr;
+};
+
 struct Image {
     VkImage image = VK_NULL_HANDLE;
     VkExtent2D extents = {0, 0};
@@ -170,7 +188,7 @@ struct alignas(16) UniformBufferObject {
 };
 
 struct alignas(16) MeshPushConstants {
-    alignas(16) glm::mat4 view_model;
+    alignas(16) glm::mat4 view;             // model matrices come from the instance buffer
     alignas(16) glm::vec4 color;
     glm::vec3 cam_pos;
     uint32_t mat_id;
@@ -212,7 +230,7 @@ struct alignas(16) PointLight {
     glm::vec3 position;
     float intensity;
     glm::vec3 color;
-    float _padding2;
+    float radius;           // the light fades out towards it, and only the clusters within it see the light
 };
 
 struct alignas(16) LightingBuffer {
@@ -222,9 +240,11 @@ struct alignas(16) LightingBuffer {
 };
 
 struct Mesh {
-    Buffer vertex_buffer;
-    Buffer index_buffer;
+    // Range in the renderer's geometry arena, drawn after Renderer::bind_geometry_block(geometry_block)
+    uint32_t geometry_block;
+    uint32_t vertex_offset;
     uint32_t vertex_count;
+    uint32_t first_index;
     uint32_t index_count;
 
     glm::vec3 aabb_min;
@@ -244,39 +264,42 @@ public:
 
     RenderInterface(Renderer *renderer);
 
+    // Frames are pipelined: begin_frame() runs on the main thread after the update and takes a snapshot of
+    // everything render() needs, then render() runs on the thread pool while the next frame is being updated.
+    // begin_frame() is also the only place where it's safe to read the ECS or other state changed by the update.
     virtual void begin_frame() {};
+    // Recorded serially before the main render pass starts, for uploads, copies and layout transitions
+    // that can't be done inside of it.
+    virtual void record_transfers(VkCommandBuffer command_buffer) {}
+
+    // Declares what the interface's pass reads and writes in the render graph, which orders the passes and
+    // synchronizes them. By default the pass draws into the backbuffer and the depth buffer.
+    virtual void declare_pass(RenderGraph& graph, uint32_t pass);
+
+    // Recorded on the thread pool into secondary command buffers, executed in the order of the render graph.
+    // Interfaces are recorded concurrently, so render() must only touch the interface's own state.
+    // Tracy's Vulkan contexts aren't thread safe either, use CPU zones in here.
     virtual void render(VkCommandBuffer command_buffer) = 0;
-    virtual void end_frame() {}
 
-    void set_deps(std::initializer_list<RenderInterface*> deps) {
-        _deps = deps;
-        for (auto dep : deps) {
-            if (dep == this) {
-                log_warn("Cannot insert itself as dependency! Removing it.");
-                _deps.erase(dep);
-            }
-        }
+    // Interfaces with a lot of draws can split them into slices, each one is recorded into its own secondary
+    // command buffer in parallel. Every slice has to bind its own state, anything shared goes into record_transfers().
+    virtual uint32_t get_render_slice_count() { return 1; }
+    virtual void render_slice(VkCommandBuffer command_buffer, uint32_t slice_idx, uint32_t slice_count) {
+        render(command_buffer);
     }
 
-    void add_deps(std::initializer_list<RenderInterface*> deps) {
-        for (auto dep : deps) {
-            if (dep == this) {
-                log_warn("Cannot insert itself as dependency! Removing it.");
-            }
-            else {
-                _deps.insert(dep);
-            }
-        }
-    }
+    // Runs on the main thread while the frame is still being recorded, mustn't touch the snapshot
+    virtual void end_frame() {}
+
+    // Interfaces whose passes are recorded before this one's, like the scene before an overlay
+    void set_deps(std::initializer_list<RenderInterface*> deps);
+    void add_deps(std::initializer_list<RenderInterface*> deps);
 
 protected:
     Renderer* _renderer;
     ECS* _ecs;
 
     Set<RenderInterface*> _deps;
-
-    // Used for toposort
-    bool _marked = false;
 };
 
 class Renderer {
@@ -291,20 +314,34 @@ public:
 
     void add_render_interface(RenderInterface* main_render_pass) {
         _render_interfaces.push_back(main_render_pass);
+        _render_graph_dirty = true;
     }
 
+    // Recompiles the render graph in the next begin_frame()
+    void invalidate_render_graph() { _render_graph_dirty = true; }
+    uint32_t get_backbuffer_resource() const { return _backbuffer_resource; }
+    uint32_t get_depth_resource() const { return _depth_resource; }
+
     void set_camera_object(Entity camera_object) {
         this->_camera_object = camera_object;
     }
 
+    // Snapshot of the camera taken in begin_frame()
     Camera& get_current_camera();
 
+    // Bounds of the renderable entities, brought up to date in begin_frame(). Also usable for picking.
+    const EntityBvh& get_entity_bvh() const { return _entity_bvh; }
+    // Entities whose bounds touch the frustum of the frame's camera, in no particular order
+    const Vector<Entity>& get_visible_entities() const { return _visible_entities; }
+
     LightingBuffer& get_lighting_data() { return _lighting; }
     void set_lighting_dirty() { 
         for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             _lighting_descriptor_set.is_dirty[i] = true;
         }
     }
+    // Only the material's slot of the material buffer is rewritten, in each frame in flight as it begins
+    void set_material_dirty(Ref<Material> mat_id);
 
     VkDevice get_device() { return _device; }
     const SwapchainSupport& get_swapchain_support() const { return _swapchain_support; }
@@ -352,7 +389,10 @@ public:
 
     void init();
     void cleanup();
+
+    // Waits until the previous frame has been recorded, then takes the snapshot of this one
     void begin_frame();
+    // Records, submits and presents the frame asynchronously on the engine's thread pool
     void render();
     void end_frame();
 
@@ -375,12 +415,29 @@ public:
     void* get_mapped_pointer(const DynamicBuffer& dynamic_buffer, uint32_t cur_frame);
     void* get_mapped_pointer(const UniformBuffer& uniform_buffer, uint32_t cur_frame);
 
+    /// Vertices and indices that only live for the current frame, from the render interfaces' begin_frame().
+    /// They're suballocated from one persistently mapped buffer per frame, which is grown between frames to what
+    /// the last frames asked for. Until then allocations that don't fit get a buffer of their own.
+    TransientAllocation allocate_transient(size_t size, size_t alignment = 16);
+
+    /// Create an image and queue the upload of its pixels, it's ready to be sampled from the next frame on.
     void upload_to_gpu(const ImageCpuData& image_cpu, VkFormat format, Image& image);
-    void upload_to_gpu(VkCommandBuffer cmd_buffer, const ImageCpuData& image_cpu, VkFormat format, Image& image, Buffer& staging_buffer);
+
+    /// Ticket of everything uploaded so far. Streaming code can poll it instead of waiting for anything.
+    UploadTicket get_upload_ticket() const;
+    bool is_upload_complete(UploadTicket ticket);
 
     Shader load_shader_from_file(const std::string& filename, ShaderType type);
     void destroy_shader(const Shader& shader);
 
+    /// Queue a graphics pipeline to be compiled by build_pipelines(), *pipeline is written then.
+    /// The create info and the state it points to are copied, so they can go out of scope right away.
+    /// The shader modules of the stages are owned by the renderer from here on and destroyed after the build.
+    /// Only the dynamic rendering info is supported in the pNext chain, and no specialization constants.
+    void queue_graphics_pipeline(const VkGraphicsPipelineCreateInfo& create_info, VkPipeline* pipeline);
+    /// Compile all queued pipelines concurrently on the engine's thread pool, against the persistent pipeline cache.
+    void build_pipelines();
+
     Ref<Image> load_image_from_file(const std::string& filename, VkFormat format);
     Ref<Texture> create_texture(const Image& image, VkFormat format);
     Ref<Texture> create_texture(const Image& image, VkFormat format, VkSamplerCreateInfo sampler_info);
@@ -388,19 +445,20 @@ public:
     VkViewport default_viewport();
     VkRect2D default_scissor();
 
-    VkCommandBuffer begin_single_time_commands();
-    void end_single_time_commands(VkCommandBuffer command_buffer);
+    /// Allocate the mesh's vertices and indices from the geometry arena and queue their upload.
+    /// Like the other uploads, the mesh can be drawn from the next frame on. Call from the main thread.
+    void create_mesh_geometry(Mesh& mesh, const TexturedVertex* vertices, uint32_t vertex_count,
+                              const uint16_t* indices, uint32_t index_count);
+    /// The range is reused once the frames in flight that might still draw the mesh are done.
+    void destroy_mesh_geometry(const Mesh& mesh);
+    /// Binds the vertex and index buffer of a geometry arena block, meshes in it draw with their offsets.
+    void bind_geometry_block(VkCommandBuffer command_buffer, uint32_t block);
 
     /// Create a static buffer to be uploaded on the GPU.
-    /// Uses single-time commands and auto-deletes staging buffer, don't use this for performance.
+    /// The data is copied into the staging ring right away, the copy itself is submitted to the transfer queue
+    /// in the next begin_frame(), so the buffer can be used by draws from that frame on. Call from the main thread.
     Buffer create_static_render_buffer_from_cpu(VkBufferUsageFlags buffer_usage, const void* data, size_t size);
 
-    /// Create a static buffer to be uploaded on the GPU.
-    /// Uses given command buffer and also gives you the staging buffer (which you need to delete later).
-    void create_static_render_buffer_from_cpu(VkCommandBuffer command_buffer,
-        VkBufferUsageFlags buffer_usage, const void* data, size_t size,
-        Buffer& staging_buffer, Buffer& dest_buffer);
-
     void update_uniform_buffer(uint32_t cur_frame, const UniformBuffer& buffer, void* data, size_t size);
     void update_storage_buffer(uint32_t cur_frame, const DescriptorSet& descriptor_set, const StorageBuffer& buffer, void* data, size_t size);
 
@@ -413,6 +471,18 @@ private:
 
     Vector<RenderInterface*> _render_interfaces;
 
+    // Render stage of the frame pipeline, only one frame is recorded at a time
+    Task* _render_task = nullptr;
+    Camera _frame_camera;
+    EntityBvh _entity_bvh;
+    Vector<Entity> _visible_entities;
+    bool _swapchain_out_of_date = false;
+
+    // Window events arrive while the previous frame is being recorded, begin_frame() applies them
+    VkExtent2D _pending_window_extent = { 1920, 1080 };
+    bool _pending_window_resize = false;
+    bool _pending_window_minimize = false;
+
     TerrainRenderer* _terrain_renderer;
 
     LightingBuffer _lighting;
@@ -429,6 +499,7 @@ private:
     VkSurfaceKHR _surface{};
     VkQueue _graphics_queue{};
     VkQueue _compute_queue{};
+    VkQueue _transfer_queue{};
     VkQueue _present_queue{};
     VkSwapchainKHR _swapchain{};
     Vector<VkImage> _swapchain_images;
@@ -449,6 +520,183 @@ private:
     VkCommandPool _command_pool;
     Vector<VkCommandBuffer> _command_buffers;
 
+    // Secondary command buffers of the main pass. Each frame in flight has one transient command pool per thread
+    // of the engine's thread pool (indexed by pool_thread_id()), they're reset as a whole after the frame's fence.
+    struct SecondaryCommandPool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        Vector<VkCommandBuffer> buffers;
+        uint32_t used = 0;
+    };
+    struct SecondaryRecordJob {
+        RenderInterface* render_interface;
+        uint32_t step;
+        uint32_t slice_idx;
+        uint32_t slice_count;
+    };
+    Array<Vector<SecondaryCommandPool>, MAX_FRAMES_IN_FLIGHT> _secondary_command_pools;
+    Vector<SecondaryRecordJob> _secondary_jobs;
+    Vector<VkCommandBuffer> _secondary_command_buffers;     // in the order of _secondary_jobs
+
+    // One pass per render interface, with the same index. The graph is compiled in begin_frame() when the
+    // interfaces, their dependencies or the swapchain changed, recording a frame only walks the schedule.
+    static constexpr uint32_t MAX_PASS_COLOR_ATTACHMENTS = 4;
+    struct ScheduledPass {
+        RenderInterface* render_interface;
+        uint32_t scope_step;            // step that begins the rendering scope the pass is recorded in
+        uint32_t color_count;
+        Array<uint32_t, MAX_PASS_COLOR_ATTACHMENTS> color_resources;
+        Array<VkFormat, MAX_PASS_COLOR_ATTACHMENTS> color_formats;
+        uint32_t depth_resource;        // UINT32_MAX without a depth attachment
+        VkFormat depth_format;
+        bool depth_read_only;
+        // Secondary command buffers of the pass, and how they're begun for the attachments of its scope
+        uint32_t first_secondary;
+        uint32_t secondary_count;
+        VkCommandBufferInheritanceRenderingInfo inheritance_rendering_info;
+        VkCommandBufferInheritanceInfo inheritance_info;
+        VkCommandBufferBeginInfo secondary_begin_info;
+    };
+    struct RenderGraphImage {
+        Image image;
+        VkImageView view;
+    };
+    RenderGraph _render_graph;
+    bool _render_graph_dirty = true;
+    uint32_t _backbuffer_resource = 0;
+    uint32_t _depth_resource = 0;
+    Vector<ScheduledPass> _scheduled_passes;        // in the order of the schedule
+    Vector<RenderGraphImage> _render_graph_images;  // per physical image of the transient resources
+    Vector<VkImageMemoryBarrier> _render_graph_image_barriers;
+
+    // Slots of the bindless texture array and the material buffer that changed. Every frame in flight has its own
+    // descriptor set and material buffer, a change is applied to each of them when that frame begins, so updates
+    // cost as much as the number of changes. Slots are the dense indices of Res' pools, like the shaders use.
+    struct DirtySlots {
+        Vector<uint8_t> pending_frames;     // per slot, bit i is set until frame i has applied the change
+        Array<Vector<uint32_t>, MAX_FRAMES_IN_FLIGHT> slots_per_frame;
+
+        void mark(uint32_t slot);
+    };
+    DirtySlots _dirty_textures;
+    DirtySlots _dirty_materials;
+
+    // Pipeline cache shared by all pipelines, loaded from and saved to PIPELINE_CACHE_FILE. The file starts with
+    // a header identifying the device and driver that wrote it, a mismatch means a cold start with an empty cache.
+    static constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+    static constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43503346;     // "F3PC"
+    struct PipelineCacheFileHeader {
+        uint32_t magic;
+        uint32_t data_size;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint32_t driver_version;
+        uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    };
+    // Deep copy of a queued VkGraphicsPipelineCreateInfo. The copied create infos still hold the caller's
+    // pointers, they only tell which optional states were set and are patched to the copies when building.
+    struct PipelineBuildJob {
+        VkGraphicsPipelineCreateInfo create_info;
+        VkPipelineRenderingCreateInfo rendering;
+        Vector<VkFormat> color_formats;
+        Vector<VkPipelineShaderStageCreateInfo> stages;
+        VkPipelineVertexInputStateCreateInfo vertex_input;
+        Vector<VkVertexInputBindingDescription> vertex_bindings;
+        Vector<VkVertexInputAttributeDescription> vertex_attributes;
+        VkPipelineInputAssemblyStateCreateInfo input_assembly;
+        VkPipelineViewportStateCreateInfo viewport_state;
+        Vector<VkViewport> viewports;
+        Vector<VkRect2D> scissors;
+        VkPipelineRasterizationStateCreateInfo rasterization;
+        VkPipelineMultisampleStateCreateInfo multisample;
+        VkPipelineDepthStencilStateCreateInfo depth_stencil;
+        VkPipelineColorBlendStateCreateInfo color_blend;
+        Vector<VkPipelineColorBlendAttachmentState> blend_attachments;
+        VkPipelineDynamicStateCreateInfo dynamic_state;
+        Vector<VkDynamicState> dynamic_states;
+        VkPipeline* pipeline;
+    };
+    VkPipelineCache _pipeline_cache = VK_NULL_HANDLE;
+    bool _pipeline_cache_loaded = false;
+    Vector<PipelineBuildJob> _pipeline_jobs;
+
+    // Staging memory for uploads, one persistently mapped buffer suballocated as a ring. Uploads queued during
+    // a frame's update are submitted together to the transfer queue in the next begin_frame(), signaling the
+    // upload timeline semaphore with the ring batch serial as their ticket. The graphics submit of that frame
+    // waits for the ticket and acquires the resources from the transfer queue family. Ring space (and the
+    // dedicated staging buffers of uploads that don't fit) is released once the timeline has passed the ticket.
+    static constexpr size_t UPLOAD_RING_SIZE = 64 * 1024 * 1024;
+    static constexpr VkPipelineStageFlags UPLOAD_WAIT_STAGES = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+        | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    struct BufferUpload {
+        VkBuffer src_buffer;
+        VkDeviceSize src_offset;
+        VkBuffer dst_buffer;
+        VkDeviceSize dst_offset;
+        VkDeviceSize size;
+        bool concurrent;            // dst_buffer is shared by the queue families, no ownership transfer
+    };
+    struct ImageUpload {
+        VkBuffer src_buffer;
+        VkDeviceSize src_offset;
+        VkImage image;
+        VkFormat format;
+        uint32_t width, height;
+    };
+    struct StagingAllocation {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+    };
+    struct SubmittedStagingBuffer {
+        Buffer buffer;
+        UploadTicket ticket;
+    };
+    struct TransferCommandBuffer {
+        VkCommandBuffer command_buffer;
+        UploadTicket ticket;        // free to reuse once the timeline has passed it
+    };
+    Buffer _upload_buffer;
+    UploadRing _upload_ring;
+
+    // Per frame geometry of the immediate mode UIs, see allocate_transient()
+    static constexpr size_t TRANSIENT_BUFFER_INITIAL_SIZE = 4 * 1024 * 1024;
+    DynamicBuffer _transient_buffer;
+    Array<TransientArena, MAX_FRAMES_IN_FLIGHT> _transient_arenas;
+    Array<Vector<Buffer>, MAX_FRAMES_IN_FLIGHT> _transient_overflow_buffers;
+    size_t _transient_demand = 0;       // most any frame has asked for
+    VkSemaphore _upload_timeline = VK_NULL_HANDLE;
+    VkCommandPool _transfer_command_pool = VK_NULL_HANDLE;
+    Vector<TransferCommandBuffer> _transfer_command_buffers;
+    Vector<BufferUpload> _pending_buffer_uploads;
+    Vector<ImageUpload> _pending_image_uploads;
+    Vector<Buffer> _pending_staging_buffers;
+    Vector<SubmittedStagingBuffer> _submitted_staging_buffers;
+    UploadTicket _last_upload_ticket = 0;
+    // Uploads the next graphics submit acquires from the transfer queue family, and the ticket it waits for
+    Vector<BufferUpload> _frame_buffer_uploads;
+    Vector<ImageUpload> _frame_image_uploads;
+    UploadTicket _frame_upload_ticket = 0;
+
+    // Vertex and index buffers of the geometry arena blocks. The blocks are read while recording, so they live in a
+    // fixed array that doesn't move when the main thread adds one. The buffers are shared by the graphics and the
+    // transfer queue family, so that uploading a mesh doesn't need an ownership transfer of the whole block.
+    static constexpr uint32_t MAX_GEOMETRY_BLOCKS = 16;
+    static constexpr uint32_t GEOMETRY_BLOCK_VERTICES = 1024 * 1024;
+    static constexpr uint32_t GEOMETRY_BLOCK_INDICES = 4 * 1024 * 1024;
+    struct GeometryBlock {
+        Buffer vertex_buffer;
+        Buffer index_buffer;
+    };
+    struct GeometryFree {
+        GeometryAllocation allocation;
+        uint32_t vertex_count;
+        uint32_t index_count;
+    };
+    GeometryArena _geometry_arena;
+    Array<GeometryBlock, MAX_GEOMETRY_BLOCKS> _geometry_blocks;
+    // Freed during the update, and per frame slot the ranges that are free once its fence is signaled again
+    Vector<GeometryFree> _pending_geometry_frees;
+    Array<Vector<GeometryFree>, MAX_FRAMES_IN_FLIGHT> _geometry_frees;
+
     VkDescriptorPool _descriptor_pool;
 
     Vector<VkSemaphore> _image_available_semaphores;
@@ -459,6 +707,7 @@ private:
     uint32_t _current_frame = 0;
 
     int _queue_family_main_idx;
+    int _queue_family_transfer_idx;
     SwapchainSupport _swapchain_support{};
     SwapchainSettings _swapchain_settings{};
 
@@ -466,9 +715,9 @@ private:
 
     UniformBuffer _uniform_buffer;
     StorageBuffer _material_buffer, _lighting_buffer;
-
-    Image _depth_image;
-    VkImageView _depth_imageview{};
+    // Header, clusters and light indices of the light clusters, rebuilt for every frame and bound next to the lights
+    StorageBuffer _light_cluster_buffer;
+    LightClusters _light_clusters;
 
     Vector<tracy::VkCtx*> _graphics_queue_tracy_ctx;
     Vector<tracy::VkCtx*> _compute_queue_tracy_ctx;
@@ -480,18 +729,41 @@ private:
     void create_descriptor_set_layout();
     void create_graphics_pipeline();
     void create_command_pool();
-    void create_depth_resources();
     void create_allocator();
     void create_uniform_buffers();
     void create_storage_buffers();
     void create_descriptor_pool();
     void create_descriptor_sets();
     void create_command_buffers();
+    void create_secondary_command_pools();
+    void create_upload_resources();
+    void create_pipeline_cache();
+    void save_pipeline_cache();
     void create_sync_objects();
 
     void cleanup_swapchain();
 
+    void render_frame();
+    void wait_for_render();
     void record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index);
+    void record_secondary_command_buffers();
+
+    void compile_render_graph();
+    void create_render_graph_images();
+    void destroy_render_graph_images();
+    VkImage get_render_graph_image(uint32_t resource, uint32_t image_index);
+    VkImageView get_render_graph_image_view(uint32_t resource, uint32_t image_index);
+    void record_render_graph_barriers(VkCommandBuffer command_buffer, const RenderGraphBarrier* barriers, uint32_t count, uint32_t image_index);
+    void begin_render_graph_scope(VkCommandBuffer command_buffer, uint32_t step_idx, uint32_t image_index);
+
+    StagingAllocation stage_upload(const void* data, size_t size, size_t alignment);
+    void queue_buffer_upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, const void* data, size_t size, bool concurrent);
+    void add_geometry_block(uint32_t vertex_capacity, uint32_t index_capacity);
+    void release_geometry_frees();
+    void begin_frame_uploads();
+    void begin_frame_transients();
+    void submit_uploads(UploadTicket ticket);
+    void record_upload_acquires(VkCommandBuffer command_buffer);
 
     VkImageView create_imageview(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags = VK_IMAGE_ASPECT_COLOR_BIT);
 
@@ -501,13 +773,11 @@ private:
 
     void update_uniform_buffer(uint32_t cur_image);
     void update_texture_descriptor_sets(uint32_t cur_image);
-    void update_material_buffer_descriptor_sets(uint32_t cur_image);
+    void update_material_buffer(uint32_t cur_image);
     void update_lighting_buffer_descriptor_sets(uint32_t cur_image);
+    void update_light_cluster_buffer(uint32_t cur_image);
 
     void copy_buffer(VkCommandBuffer cmd_buffer, VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
     void transition_image_layout(VkCommandBuffer cmd_buffer, VkImage image, VkFormat format, VkImageLayout old_layout, VkImageLayout new_layout);
-    void copy_buffer_to_image(VkCommandBuffer cmd_buffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-
-    void _toposort_visit(RenderInterface* ri, Vector<RenderInterface*>& sorted);
-    void toposort_render_interfaces();
+    void copy_buffer_to_image(VkCommandBuffer cmd_buffer, VkBuffer buffer, VkDeviceSize buffer_offset, VkImage image, uint32_t width, uint32_t height);
 };
\ No newline at end of file
@@ -0,0 +1,18 @@
+#include "transient_arena.h"
+
+void TransientArena::reset(size_t capacity) {
+    _capacity = capacity;
+    _head = 0;
+    _demand = 0;
+}
+
+bool TransientArena::allocate(size_t size, size_t alignment, size_t& offset) {
+    _demand = (_demand + alignment - 1) / alignment * alignment + size;
+
+    size_t start = (_head + alignment - 1) / alignment * alignment;
+    if (start + size > _capacity) return false;
+
+    offset = start;
+    _head = start + size;
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Linear suballocator of the memory that only lives for one frame, like the geometry of the immediate mode UIs.
+// Only deals with offsets so it doesn't know about Vulkan. Everything is freed at once by reset() when the
+// frame's fence has been waited on, and what was asked for is remembered so the memory can be grown to fit.
+class TransientArena {
+public:
+    void reset(size_t capacity);
+
+    // Returns false if there isn't enough space left, the caller has to fall back to something else
+    bool allocate(size_t size, size_t alignment, size_t& offset);
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _head; }
+    // Bytes asked for since reset(), including alignment and the allocations that didn't fit
+    size_t demand() const { return _demand; }
+
+private:
+    size_t _capacity = 0;
+    size_t _head = 0;
+    size_t _demand = 0;
+};
@@ -0,0 +1,60 @@
+#include "upload_ring.h"
+
+void UploadRing::init(size_t capacity) {
+    _capacity = capacity;
+    _head = 0;
+    _used = 0;
+    _open_bytes = 0;
+    _batches.truncate();
+}
+
+bool UploadRing::allocate(size_t size, size_t alignment, size_t& offset) {
+    if (size > _capacity) return false;
+
+    // Nothing in flight, start over at the beginning so that large allocations don't have to wrap
+    if (_used == 0) {
+        _head = 0;
+    }
+
+    size_t start = (_head + alignment - 1) / alignment * alignment;
+    size_t bytes;
+    if (start + size <= _capacity) {
+        bytes = start - _head + size;
+    }
+    else {
+        // Doesn't fit before the end, skip the rest of the ring and wrap around
+        start = 0;
+        bytes = _capacity - _head + size;
+    }
+    // The free space is the contiguous range from the head up to the oldest batch in flight
+    if (_used + bytes > _capacity) return false;
+
+    offset = start;
+    _head = start + size;
+    _used += bytes;
+    _open_bytes += bytes;
+    return true;
+}
+
+uint64_t UploadRing::close_batch() {
+    uint64_t serial = _next_serial++;
+    if (_open_bytes > 0) {
+        _batches.push_back(Batch{serial, _open_bytes});
+        _open_bytes = 0;
+    }
+    return serial;
+}
+
+void UploadRing::release(uint64_t serial) {
+    uint32_t num_released = 0;
+    while (num_released < _batches.size() && _batches[num_released].serial <= serial) {
+        _used -= _batches[num_released].bytes;
+        num_released++;
+    }
+    if (num_released == 0) return;
+
+    for (uint32_t i = num_released; i < _batches.size(); i++) {
+        _batches[i - num_released] = _batches[i];
+    }
+    _batches.truncate(_batches.size() - num_released);
+}
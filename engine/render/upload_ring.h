@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "core/vector.h"
+
+// Linear suballocator of a ring of staging memory, only deals with offsets so it doesn't know about Vulkan.
+// Allocations are grouped into batches, a batch is closed when its copies get submitted and released once
+// the GPU is done with them. Memory is freed in the order it was allocated, so it's a simple head/tail ring.
+// Not thread safe, the renderer only uses it from the main thread.
+class UploadRing {
+public:
+    void init(size_t capacity);
+
+    // Returns false if there isn't enough free space left, the caller has to fall back to something else
+    bool allocate(size_t size, size_t alignment, size_t& offset);
+
+    // Closes the batch of all allocations since the last call, returns its serial (starting from 1)
+    uint64_t close_batch();
+
+    // Serial the open batch will get from close_batch()
+    uint64_t next_serial() const { return _next_serial; }
+
+    // Frees all closed batches up to and including serial
+    void release(uint64_t serial);
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _used; }
+
+private:
+    struct Batch {
+        uint64_t serial;
+        size_t bytes;       // including alignment padding and the skipped end of the ring when wrapping
+    };
+
+    size_t _capacity = 0;
+    size_t _head = 0;
+    size_t _used = 0;
+    size_t _open_bytes = 0;
+    uint64_t _next_serial = 1;
+    Vector<Batch> _batches;         // closed but not released, oldest first
+};
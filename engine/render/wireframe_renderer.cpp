@@ -8,7 +8,7 @@
 #include "res.h"
 
 #define TRACY_ENABLE
-#include "tracy/TracyVulkan.hpp"
+#include "tracy/Tracy.hpp"
 
 void WireframeRenderer::init() {
     create_graphics_pipelines();
@@ -156,50 +156,61 @@ void WireframeRenderer::create_graphics_pipelines() {
             .subpass = 0,
     };
 
-    VK_CHECK(vkCreateGraphicsPipelines(_renderer->get_device(), VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &_pipeline));
-
-    vkDestroyShaderModule(_renderer->get_device(), vs_shader.module, nullptr);
-    vkDestroyShaderModule(_renderer->get_device(), fs_shader.module, nullptr);
+    _renderer->queue_graphics_pipeline(pipeline_info, &_pipeline);
 }
 
-void WireframeRenderer::render(VkCommandBuffer command_buffer) {
-    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "WireframeRenderer")
-    const Camera& camera = _renderer->get_current_camera();
+void WireframeRenderer::begin_frame() {
+    ZoneScoped;
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+    const Camera& camera = _renderer->get_current_camera();
+    glm::mat4 projview = camera.proj_mat * camera.get_view_matrix();
 
-    _ecs->query<Model, Transform, WireframeDebugRenderComp>().foreach([&](Entity entity,
-        Model& model, const Transform& transform, const WireframeDebugRenderComp& wireframe) {
+    _frame_draws.truncate();
+    for (Entity entity : _renderer->get_visible_entities()) {
+        const WireframeDebugRenderComp* wireframe = _ecs->try_get_component<WireframeDebugRenderComp>(entity);
+        if (!wireframe) continue;
+        const Model& model = _ecs->get_component<Model>(entity);
+        const Transform& transform = _ecs->get_component<Transform>(entity);
 
         Im3dPushConstants push_constants;
-        push_constants.projview = camera.proj_mat * camera.get_view_matrix() * transform.to_matrix();
+        push_constants.projview = projview * transform.to_matrix();
         push_constants.viewport_size = _renderer->get_window_extent();
-        push_constants.color = wireframe.color;
-        push_constants.prim_width = wireframe.width;
-        push_constants.blend_factor = wireframe.blend_factor;
-        vkCmdPushConstants(command_buffer, _pipeline_layout,
-            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Im3dPushConstants), &push_constants);
-        vkCmdSetLineWidth(command_buffer, wireframe.width);
-
-        auto res = Res::inst();
+        push_constants.color = wireframe->color;
+        push_constants.prim_width = wireframe->width;
+        push_constants.blend_factor = wireframe->blend_factor;
 
         for (int i = 0; i < model.meshes.size(); i++) {
-            auto mesh_id = model.meshes[i];
+            _frame_draws.push_back(WireframeDraw {push_constants, model.meshes[i]});
+        }
+    }
+}
 
-            TexturedMesh* mesh = res->get(mesh_id);
+void WireframeRenderer::render(VkCommandBuffer command_buffer) {
+    ZoneScopedN("WireframeRenderer");
 
-            vkuCmdBindSingleVertexBuffer(command_buffer, mesh->vertex_buffer.buffer);
-            if (mesh->index_count > 0) {
-                vkCmdBindIndexBuffer(command_buffer, mesh->index_buffer.buffer, 0, VK_INDEX_TYPE_UINT16);
-            }
-            if (mesh->index_count > 0) {
-                vkCmdDrawIndexed(command_buffer, mesh->index_count, 1, 0, 0, 0);
-            }
-            else {
-                vkCmdDraw(command_buffer, mesh->vertex_count, 1, 0, 0);
-            }
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+
+    auto res = Res::inst();
+    uint32_t bound_block = UINT32_MAX;
+
+    for (const auto& draw : _frame_draws) {
+        vkCmdPushConstants(command_buffer, _pipeline_layout,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Im3dPushConstants), &draw.push_constants);
+        vkCmdSetLineWidth(command_buffer, draw.push_constants.prim_width);
+
+        TexturedMesh* mesh = res->get(draw.mesh);
+
+        if (mesh->geometry_block != bound_block) {
+            _renderer->bind_geometry_block(command_buffer, mesh->geometry_block);
+            bound_block = mesh->geometry_block;
+        }
+        if (mesh->index_count > 0) {
+            vkCmdDrawIndexed(command_buffer, mesh->index_count, 1, mesh->first_index, mesh->vertex_offset, 0);
+        }
+        else {
+            vkCmdDraw(command_buffer, mesh->vertex_count, 1, mesh->vertex_offset, 0);
         }
-    });
+    }
 }
 
 void WireframeRenderer::cleanup() {
@@ -1,18 +1,27 @@
 #pragma once
 
 #include "renderer.h"
+#include "im3d_renderer.h"
 
 class WireframeRenderer : public RenderInterface {
 public:
     WireframeRenderer(Renderer* renderer) : RenderInterface(renderer) {}
 
     void init();
+    void begin_frame() override;
     void render(VkCommandBuffer command_buffer) override;
     void cleanup();
 
 private:
     void create_graphics_pipelines();
 
+    // Wireframe meshes collected from the ECS in begin_frame()
+    struct WireframeDraw {
+        Im3dPushConstants push_constants;
+        Ref<TexturedMesh> mesh;
+    };
+    Vector<WireframeDraw> _frame_draws;
+
     VkPipelineLayout _pipeline_layout;
     VkPipeline _pipeline;
 };
\ No newline at end of file
@@ -26,7 +26,7 @@ struct PointLight {
     vec3 position;
     float _padding1;
     vec3 color;
-    float _padding2;
+    float radius;
 };
 
 layout(set = 1, binding = 0) uniform sampler2D textures[];
@@ -2,7 +2,7 @@
 #define CAMERA_COMMON_GLSL
 
 layout(push_constant) uniform PushConstants {
-    mat4 view_model;
+    mat4 view;
     vec4 color;
     vec3 cam_pos;
     uint mat_id;
@@ -7,6 +7,23 @@ const float PI = 3.14159265359;
 
 #include "bindless_common.glsl"
 
+// Has to match light_clusters.h
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+layout(set = 3, binding = 1) readonly buffer LightClusterBuffer {
+    vec4 depth_plane;
+    vec2 clusters_per_pixel;
+    float slice_scale;
+    float slice_bias;
+    float slice_near;
+    uint _padding[3];
+    uvec2 clusters[LIGHT_CLUSTER_COUNT];    // (first index, count)
+    uint light_indices[];
+} light_clusters;
+
 struct PBRMaterial {
     vec3 albedo;
     float metallic;
@@ -111,9 +128,35 @@ vec3 calc_point_light(PointLight light, PBRMaterial mat, vec2 uv, vec3 pos, vec3
     float NoL = clamp(dot(n, l), 0.0, 1.0);
     vec3 f = BSDF(mat, uv, l, n, v);
     float distance = length(light.position - pos);
-    float attenuation = 1.0 / (distance * distance);
+    // Windowed to reach zero at the radius, past which the clusters don't list the light
+    float falloff = distance / light.radius;
+    float window = clamp(1.0 - falloff * falloff * falloff * falloff, 0.0, 1.0);
+    float attenuation = window * window / (distance * distance);
     vec3 radiance = light.color * attenuation;
     return f * radiance * NoL;
 }
 
+uint light_cluster_index(vec3 pos) {
+    uvec2 tile = uvec2(clamp(gl_FragCoord.xy * light_clusters.clusters_per_pixel,
+        vec2(0.0), vec2(LIGHT_CLUSTERS_X - 1, LIGHT_CLUSTERS_Y - 1)));
+    float depth = dot(light_clusters.depth_plane.xyz, pos) + light_clusters.depth_plane.w;
+    uint slice = 0;
+    if (depth >= light_clusters.slice_near) {
+        float s = floor(log(depth) * light_clusters.slice_scale + light_clusters.slice_bias);
+        slice = min(LIGHT_CLUSTERS_Z - 1, 1 + uint(max(s, 0.0)));
+    }
+    return (slice * LIGHT_CLUSTERS_Y + tile.y) * LIGHT_CLUSTERS_X + tile.x;
+}
+
+// Only goes through the point lights of the fragment's cluster
+vec3 calc_point_lights(PBRMaterial mat, vec2 uv, vec3 pos, vec3 n, vec3 v) {
+    uvec2 cluster = light_clusters.clusters[light_cluster_index(pos)];
+    vec3 color = vec3(0.0);
+    for (uint i = 0; i < cluster.y; i++) {
+        uint light = light_clusters.light_indices[cluster.x + i];
+        color += calc_point_light(lighting.point[light], mat, uv, pos, n, v);
+    }
+    return color;
+}
+
 #endif
\ No newline at end of file
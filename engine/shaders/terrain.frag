@@ -25,9 +25,7 @@ void main()
 
     vec3 color = vec3(0.0);
     color += calc_directional_light(lighting.dir, pbr_mat, frag_uv, n, v);
-    for (int i = 0; i < lighting.num_points; i++) {
-        color += calc_point_light(lighting.point[i], pbr_mat, frag_uv, frag_position, n, v);
-    }
+    color += calc_point_lights(pbr_mat, frag_uv, frag_position, n, v);
     color += vec3(0.03) * pbr_mat.albedo * pbr_mat.reflectance;
     // out_color = vec4(color, albedo.a);
     out_color = vec4(color, 1.0);
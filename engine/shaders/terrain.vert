@@ -1,8 +1,5 @@
 #version 450
 
-#define GLSL
-#include "../terrain_algo.cpp"
-
 #include "terrain_common.glsl"
 
 layout (set = 0, binding = 0) uniform UniformBufferObject {
@@ -10,26 +7,95 @@ layout (set = 0, binding = 0) uniform UniformBufferObject {
     vec2 viewport_size;
 } ubo;
 
-#define MAX_OCTAVES 4
+// Matches TerrainClipmapLevelGpu, see terrain_clipmap.h
+struct ClipmapLevel {
+    ivec2 origin;       // first texel of the window
+    float spacing;      // world units per texel
+    int valid;
+};
+
+layout (set = 4, binding = 0) readonly buffer ClipmapLevels {
+    ClipmapLevel levels[];
+} clipmap;
+
+// One layer per level of (height, grad.x, grad.y, 0), texel t of a level is stored at t mod res
+layout (set = 4, binding = 1) uniform sampler2DArray clipmap_tex;
 
 layout (location = 0) in vec2 in_uv;
-layout (location = 1) in vec2 in_offset;
+layout (location = 1) in vec3 in_offset;   // node origin (xy) and width (z), in chunk units
 
 layout (location = 0) out vec3 frag_position;
 layout (location = 1) out vec3 frag_normal;
 layout (location = 2) out vec2 frag_uv;
 
+vec3 fetch_clipmap(int level, ivec2 t, int mask) {
+    return texelFetch(clipmap_tex, ivec3(t & mask, level), 0).xyz;
+}
+
+// Bilinear filtering over the wrapped texel coordinates, which the sampler can't do across the wrap seam
+vec3 sample_clipmap(int level, vec2 t, int mask) {
+    vec2 t0 = floor(t);
+    vec2 f = t - t0;
+    ivec2 i = ivec2(t0);
+    vec3 a = mix(fetch_clipmap(level, i, mask), fetch_clipmap(level, i + ivec2(1, 0), mask), f.x);
+    vec3 b = mix(fetch_clipmap(level, i + ivec2(0, 1), mask), fetch_clipmap(level, i + ivec2(1, 1), mask), f.x);
+    return mix(a, b, f.y);
+}
+
+// Texels at the edge of a level's window over which it fades into the next coarser level
+#define CLIPMAP_BLEND_TEXELS 16.0
+
+bool clipmap_level_contains(int level, vec2 pos, int res, out vec2 t) {
+    t = pos / clipmap.levels[level].spacing - vec2(clipmap.levels[level].origin);
+    return all(greaterThanEqual(t, vec2(0.0))) && all(lessThan(t, vec2(res - 1)));
+}
+
+vec3 sample_terrain(vec2 pos) {
+    int num_levels = textureSize(clipmap_tex, 0).z;
+    int res = textureSize(clipmap_tex, 0).x;
+    int mask = res - 1;
+
+    // Finest level whose window contains pos, otherwise clamp to the coarsest one that is ready
+    int coarsest = -1;
+    for (int k = 0; k < num_levels; k++) {
+        if (clipmap.levels[k].valid == 0) continue;
+        vec2 t;
+        if (clipmap_level_contains(k, pos, res, t)) {
+            vec3 fine = sample_clipmap(k, t + vec2(clipmap.levels[k].origin), mask);
+
+            // Like CDLOD's geomorphing, fade into the parent level across the outer band of the window so that
+            // the heights match on both sides of the level boundary
+            vec2 edge = min(t, vec2(res - 1) - t);
+            float blend = clamp(1.0 - min(edge.x, edge.y) / CLIPMAP_BLEND_TEXELS, 0.0, 1.0);
+            if (blend > 0.0) {
+                for (int j = k + 1; j < num_levels; j++) {
+                    vec2 tj;
+                    if (clipmap.levels[j].valid != 0 && clipmap_level_contains(j, pos, res, tj)) {
+                        vec3 coarse = sample_clipmap(j, tj + vec2(clipmap.levels[j].origin), mask);
+                        return mix(fine, coarse, blend);
+                    }
+                }
+            }
+            return fine;
+        }
+        coarsest = k;
+    }
+    if (coarsest < 0) {
+        return vec3(0.0);
+    }
+    vec2 t = clamp(pos / clipmap.levels[coarsest].spacing - vec2(clipmap.levels[coarsest].origin), vec2(0.0), vec2(res - 1));
+    return sample_clipmap(coarsest, t + vec2(clipmap.levels[coarsest].origin), mask);
+}
+
 void main() {
-    frag_uv = in_offset + in_uv;
+    frag_uv = in_offset.xy + in_offset.z * in_uv;
     vec2 pos = pc.out_scale_width * frag_uv;
 
-    vec3 res = calc_terrain_with_gradient(pos,
-        pc.in_scale, pc.octaves, pc.seed, pc.persistance, pc.lacunarity,
-        pc.out_scale_width, pc.out_scale_height);
+    vec3 res = sample_terrain(pos);
 
     vec4 world_position = vec4(pos.x, res.x, pos.y, 1.0);
     gl_Position = ubo.proj * (pc.view * world_position);
 
     frag_position = vec3(world_position);
     frag_normal = normalize(vec3(-res.y, 1, -res.z));
-}
\ No newline at end of file
+}
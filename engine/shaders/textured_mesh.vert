@@ -2,6 +2,10 @@
 
 #include "camera_common.glsl"
 
+layout (set = 4, binding = 0) readonly buffer InstanceBuffer {
+    mat4 models[];
+} instances;
+
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoord;
@@ -11,7 +15,7 @@ layout (location = 1) out vec3 frag_normal;
 layout (location = 2) out vec2 frag_texcoord;
 
 void main() {
-    gl_Position = ubo.proj * pc.view_model * vec4(in_position, 1);
+    gl_Position = ubo.proj * pc.view * (instances.models[gl_InstanceIndex] * vec4(in_position, 1));
     frag_position = in_position;
     frag_normal = in_normal;
     frag_texcoord = in_texcoord;
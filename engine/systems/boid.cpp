@@ -38,163 +38,157 @@ inline glm::quat quat_exp(glm::vec3 w) {
 BoidSystem::BoidSystem(ECS* ecs, Pool* thread_pool, BoidConfig cfg)
 	: ecs(ecs), thread_pool(thread_pool), cfg(cfg) {
 
+	recorder = UniquePtr(new BoidRecorder(thread_pool));
+	player = UniquePtr(new BoidPlayer());
 }
 
-void BoidSystem::update(float dt) {
-	ZoneScoped;
+bool BoidSystem::start_recording(const char* filename) {
+	return recorder->start(filename, cfg.cell_size, cfg.vel_limit);
+}
 
-	auto boids = ecs->get_component_array<Boid>();
-	const int num_boids = boids.ssize();
+void BoidSystem::stop_recording() {
+	recorder->stop();
+}
 
-	auto& camera = ecs->get_component<Camera>(target);
-	auto target_pos = camera.position;
+bool BoidSystem::start_playback(const char* filename) {
+	stop_recording();
+	playback_frame = 0;
+	return player->open(filename);
+}
 
-// #define BOID_PROXIMITY_NAIVE
+void BoidSystem::stop_playback() {
+	player->close();
+}
 
-	{
-		ZoneScopedN("BoidProximityDetection");
-		const float nearby_dist_sq = cfg.nearby_dist * cfg.nearby_dist;
-		const float avoid_dist_sq = cfg.avoid_dist * cfg.avoid_dist;
+template <class Pipeline>
+void BoidSystem::apply_rules(Span<Boid> boids, const BoidRuleContext& ctx) {
+	const int num_boids = boids.ssize();
 
-		for (int i = 0; i < num_boids; i++) {
-			boids[i].nearby_boids.clear();
-			boids[i].avoid_boids.clear();
-		}
+	// Single fused neighbor pass: every enabled rule accumulates over the same neighbor set,
+	// new velocities are written to a separate buffer so the pass can run in parallel.
+	drjit::parallel_for(drjit::blocked_range<int>(0, num_boids, 8), [&](auto range) {
+		ZoneScopedN("BoidRulesBlock");
+		for (int i : range) {
+			const auto& boid = boids[i];
+			typename Pipeline::State state = {};
+
+			auto visit = [&](int j) {
+				BoidNeighbor n;
+				n.pos = boids[j].pos;
+				n.vel = boids[j].vel;
+				n.dx = boid.pos - n.pos;
+				n.dist_sq = glm::length2(n.dx);
+				if (j != i && n.dist_sq < ctx.nearby_dist_sq) {
+					Pipeline::accumulate(state, ctx, n);
+				}
+			};
 
 #ifdef BOID_PROXIMITY_NAIVE
-		for (int i = 0; i < num_boids; i++) {
-			for (int j = i + 1; j < num_boids; j++) {
-				float dist_sq = glm::length2(boids[i].pos - boids[j].pos);
-				if (dist_sq < nearby_dist_sq) {
-					boids[i].nearby_boids.push_back(j);
-					boids[j].nearby_boids.push_back(i);
-				}
-				if (dist_sq < avoid_dist_sq) {
-					boids[i].avoid_boids.push_back(j);
-					boids[j].avoid_boids.push_back(i);
-				}
+			for (int j = 0; j < num_boids; j++) {
+				visit(j);
 			}
-		}
 #else
-		cell_map.clear();
-		{
-			ZoneScopedN("InsertBoids");
-			for (int i = 0; i < num_boids; i++) {
-				auto& boid = boids[i];
-
-				// Find current cell that this boid reside in
-				auto coords = glm::ivec3(glm::floor(boid.pos / cfg.cell_size));
-				auto [it, inserted] = cell_map.insert({coords, {}});
-				it->second.boid_indices.push_back(i);
-			}
-		}
-
-		{
-			ZoneScopedN("GatherBoidProximity");
-			drjit::parallel_for(drjit::blocked_range<int>(0, num_boids, 8), [&](auto range) {
-				ZoneScopedN("GatherBoidProximityBlock");
-				for (int i : range) {
-					auto& boid = boids[i];
-					auto coords_center = glm::ivec3(glm::floor(boid.pos / cfg.cell_size));
-
-					auto nearby_coords_min = glm::ivec3(glm::floor((boid.pos - cfg.nearby_dist) / cfg.cell_size));
-					auto nearby_coords_max = glm::ivec3(glm::floor((boid.pos + cfg.nearby_dist) / cfg.cell_size));
-					for (int a = nearby_coords_min.x; a <= nearby_coords_max.x; a++) {
-						for (int b = nearby_coords_min.y; b <= nearby_coords_max.y; b++) {
-							for (int c = nearby_coords_min.z; c <= nearby_coords_max.z; c++) {
-								auto coord = glm::ivec3(a, b, c);
-								glm::vec3 cell_dist = glm::max(
-									glm::abs(glm::vec3(coord) - boid.pos), 
-									glm::abs(glm::vec3(coord + 1) - boid.pos));
-								if (glm::length2(cell_dist) > nearby_dist_sq) {
-									continue;
-								}
-								auto it = cell_map.find(coord);
-								if (it == cell_map.end()) continue;
-								for (int j : it->second.boid_indices) {
-									if (j == i) continue;
-									float dist_sq = glm::length2(boid.pos - boids[j].pos);
-									if (dist_sq < avoid_dist_sq) {
-										boid.nearby_boids.push_back(j);
-									}					
-								}
-							}
+			auto nearby_coords_min = glm::ivec3(glm::floor((boid.pos - cfg.nearby_dist) / cfg.cell_size));
+			auto nearby_coords_max = glm::ivec3(glm::floor((boid.pos + cfg.nearby_dist) / cfg.cell_size));
+			for (int a = nearby_coords_min.x; a <= nearby_coords_max.x; a++) {
+				for (int b = nearby_coords_min.y; b <= nearby_coords_max.y; b++) {
+					for (int c = nearby_coords_min.z; c <= nearby_coords_max.z; c++) {
+						auto coord = glm::ivec3(a, b, c);
+						// Skip cells whose closest point is out of range
+						glm::vec3 cell_min = glm::vec3(coord) * cfg.cell_size;
+						glm::vec3 closest = glm::clamp(boid.pos, cell_min, cell_min + cfg.cell_size);
+						if (glm::length2(closest - boid.pos) > ctx.nearby_dist_sq) {
+							continue;
 						}
-					}
-
-					auto avoid_coords_min = glm::ivec3(glm::floor((boid.pos - cfg.avoid_dist) / cfg.cell_size));
-					auto avoid_coords_max = glm::ivec3(glm::floor((boid.pos + cfg.avoid_dist) / cfg.cell_size));
-					for (int a = avoid_coords_min.x; a <= avoid_coords_max.x; a++) {
-						for (int b = avoid_coords_min.y; b <= avoid_coords_max.y; b++) {
-							for (int c = avoid_coords_min.z; c <= avoid_coords_max.z; c++) {
-								auto coord = glm::ivec3(a, b, c);
-								glm::vec3 cell_dist = glm::max(
-									glm::abs(glm::vec3(coord) - boid.pos), 
-									glm::abs(glm::vec3(coord + 1) - boid.pos));
-								if (glm::length2(cell_dist) > avoid_dist_sq) {
-									continue;
-								}
-								auto it = cell_map.find(coord);
-								if (it == cell_map.end()) continue;
-								for (int j : it->second.boid_indices) {
-									if (j == i) continue;
-									float dist_sq = glm::length2(boid.pos - boids[j].pos);
-									if (dist_sq < avoid_dist_sq) {
-										boid.avoid_boids.push_back(j);
-									}					
-								}
-							}
+						auto it = cell_map.find(coord);
+						if (it == cell_map.end()) continue;
+						for (int j : it->second.boid_indices) {
+							visit(j);
 						}
 					}
 				}
-			}, thread_pool);
+			}
+#endif
+
+			glm::vec3 new_vel = boid.vel;
+			Pipeline::finalize(state, ctx, boid.pos, boid.vel, new_vel);
+			new_vels[i] = new_vel;
 		}
-	#endif
+	}, thread_pool);
+}
+
+void BoidSystem::update(float dt) {
+	ZoneScoped;
+
+	auto boids = ecs->get_component_array<Boid>();
+	const int num_boids = boids.ssize();
+
+	if (player->is_open()) {
+		// Playback replaces the simulation
+		if (player->read_frame(playback_frame, boids) && !playback_paused
+			&& playback_frame + 1 < player->num_frames()) {
+			playback_frame++;
+		}
+		apply_transforms(dt);
+		return;
 	}
 
+	auto& camera = ecs->get_component<Camera>(target);
+
+	BoidRuleContext ctx;
+	ctx.target_pos = camera.position;
+	ctx.nearby_dist_sq = cfg.nearby_dist * cfg.nearby_dist;
+	ctx.avoid_dist = glm::min(cfg.avoid_dist, cfg.nearby_dist);
+	ctx.avoid_dist_sq = ctx.avoid_dist * ctx.avoid_dist;
+	ctx.pos_match_factor = cfg.pos_match_factor;
+	ctx.vel_match_factor = cfg.vel_match_factor;
+	ctx.avoid_factor = cfg.avoid_factor;
+	ctx.target_follow_factor = cfg.target_follow_factor;
+	ctx.vel_limit = cfg.vel_limit;
+
+// #define BOID_PROXIMITY_NAIVE
+
+#ifndef BOID_PROXIMITY_NAIVE
 	{
-		ZoneScopedN("BoidApplyForces");
+		ZoneScopedN("InsertBoids");
+		cell_map.clear();
 		for (int i = 0; i < num_boids; i++) {
 			auto& boid = boids[i];
 
-			if (!boid.nearby_boids.empty()) {
-				// adjust velocity towards the average pos/vel of the other nearby birds
-				auto com = glm::vec3(0);
-				auto avg_vel = glm::vec3(0);
-				const int num_nearby_boids = boid.nearby_boids.ssize();
-				for (int j = 0; j < num_nearby_boids; j++) {
-					auto& other_boid = boids[boid.nearby_boids[j]];
-					com += other_boid.pos;
-					avg_vel += other_boid.vel;
-				}
-				com /= num_nearby_boids;
-				avg_vel /= num_nearby_boids;
-				boid.vel += (cfg.pos_match_factor * (com - boid.pos) + cfg.vel_match_factor * (avg_vel - boid.vel));
-			}
-
-			if (!boid.avoid_boids.empty()) {
-				// move away from other boids that are too close
-				for (int j = 0; j < boid.avoid_boids.ssize(); j++) {
-					auto& other_boid = boids[boid.avoid_boids[j]];
-					glm::vec3 dx = boid.pos - other_boid.pos;
-					float dist = glm::length(dx);
-					float dl = cfg.avoid_dist - dist;
-					boid.vel += (cfg.avoid_factor * dl / dist) * dx;
-				}
-			}
-
-			boid.vel += cfg.target_follow_factor * (target_pos - boid.pos);
+			// Find current cell that this boid reside in
+			auto coords = glm::ivec3(glm::floor(boid.pos / cfg.cell_size));
+			auto [it, inserted] = cell_map.insert({coords, {}});
+			it->second.boid_indices.push_back(i);
+		}
+	}
+#endif
 
-			float cur_vel_sq = glm::length2(boid.vel);
-			if (cur_vel_sq > cfg.vel_limit * cfg.vel_limit) {
-				boid.vel *= (cfg.vel_limit / glm::sqrt(cur_vel_sq));
-			}
+	{
+		ZoneScopedN("BoidApplyRules");
+		if (new_vels.ssize() != num_boids) {
+			new_vels.resize(num_boids);
+		}
+		boid_dispatch_rules(cfg.rules, BoidRules{}, [&]<class Pipeline>() {
+			apply_rules<Pipeline>(boids, ctx);
+		});
+	}
 
-			boid.pos += dt * boid.vel;
+	{
+		ZoneScopedN("BoidIntegrate");
+		for (int i = 0; i < num_boids; i++) {
+			boids[i].vel = new_vels[i];
+			boids[i].pos += dt * boids[i].vel;
 		}
-			
 	}
 
+	if (recorder->is_recording()) {
+		recorder->record(Span<const Boid>(boids.data(), boids.size()));
+	}
+
+	apply_transforms(dt);
+}
+
+void BoidSystem::apply_transforms(float dt) {
 	{
 		ZoneScopedN("BoidApplyTransforms");
 		ecs->query<Boid, Transform>().foreach([&](Entity entity, Boid& boid, Transform& transform) {
@@ -2,7 +2,11 @@
 
 #include "ecs.h"
 #include "core/vector.h"
+#include "core/span.h"
 #include "core/map.h"
+#include "core/unique_ptr.h"
+#include "systems/boid_rules.h"
+#include "systems/boid_recorder.h"
 
 #include <parallel_hashmap/phmap.h>
 
@@ -12,7 +16,7 @@ struct Pool;
 
 struct BoidConfig {
 	float nearby_dist = 25.0f;
-	float avoid_dist = 5.0f;
+	float avoid_dist = 5.0f;		// clamped to nearby_dist, separation only sees the nearby boids
 	float pos_match_factor = 1.0f;
 	float vel_match_factor = 0.1f;
 	float avoid_factor = 5.0f;
@@ -21,6 +25,8 @@ struct BoidConfig {
 	float angvel_limit = 2.0f;
 
 	float cell_size = 10.0f;
+
+	uint32_t rules = BOID_RULE_ALL;		// BoidRuleFlags
 };
 
 struct BoidCell {
@@ -41,10 +47,30 @@ public:
 	Pool* thread_pool;
 	BoidConfig cfg;
 	ParallelMap<glm::ivec3, BoidCell, BoidCellHash> cell_map;
+	Vector<glm::vec3> new_vels;
 
 	Entity target;
 
+	UniquePtr<BoidRecorder> recorder;
+	UniquePtr<BoidPlayer> player;
+	uint32_t playback_frame = 0;
+	bool playback_paused = false;
+
 	void update(float dt);
 
 	void set_target(Entity target) { this->target = target; }
+
+	bool start_recording(const char* filename);
+	void stop_recording();
+	bool is_recording() const { return recorder->is_recording(); }
+
+	bool start_playback(const char* filename);
+	void stop_playback();
+	bool is_playing() const { return player->is_open(); }
+
+private:
+	void apply_transforms(float dt);
+
+	template <class Pipeline>
+	void apply_rules(Span<Boid> boids, const BoidRuleContext& ctx);
 };
\ No newline at end of file
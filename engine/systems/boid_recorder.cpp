@@ -0,0 +1,349 @@
+#include "boid_recorder.h"
+
+#include "components/boid.h"
+#include "core/lz.h"
+#include "core/log.h"
+
+#include <glm/glm.hpp>
+
+#include <string.h>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+#ifdef _WIN32
+#define boid_fseek _fseeki64
+#else
+#define boid_fseek fseeko
+#endif
+
+static constexpr char BOID_RECORDING_MAGIC[4] = {'B', 'R', 'E', 'C'};
+static constexpr char BOID_RECORDING_INDEX_MAGIC[4] = {'B', 'I', 'D', 'X'};
+static constexpr uint32_t BOID_RECORDING_VERSION = 1;
+
+static inline uint32_t zigzag_encode(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v) {
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline void write_varint(Vector<uint8_t>& out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static inline bool read_varint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (p >= end) return false;
+		uint8_t b = *p++;
+		v |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+// Positions are stored as (cell index * 2^pos_bits + offset inside the cell),
+// so that dequantization stays exact far away from the origin.
+static inline glm::ivec3 quantize_pos(glm::vec3 pos, const BoidRecordingHeader& header) {
+	const float scale = (float)(1 << header.pos_bits);
+	glm::vec3 p = pos / header.cell_size;
+	glm::vec3 cell = glm::floor(p);
+	glm::ivec3 sub = glm::ivec3(glm::floor((p - cell) * scale + 0.5f));
+	return glm::ivec3(cell) * (1 << header.pos_bits) + sub;
+}
+
+static inline glm::vec3 dequantize_pos(glm::ivec3 q, const BoidRecordingHeader& header) {
+	const float scale = (float)(1 << header.pos_bits);
+	glm::ivec3 cell = q >> (int)header.pos_bits;
+	glm::ivec3 sub = q & ((1 << header.pos_bits) - 1);
+	return (glm::vec3(cell) + glm::vec3(sub) / scale) * header.cell_size;
+}
+
+void boid_encode_frame(Span<const glm::vec3> pos, Span<const glm::vec3> vel, const BoidRecordingHeader& header,
+	BoidQuantState& prev, bool keyframe, Vector<uint8_t>& out) {
+
+	const uint32_t num_boids = pos.size();
+	if (keyframe) {
+		if (prev.pos.size() != num_boids) {
+			prev.pos.resize(num_boids);
+			prev.vel.resize(num_boids);
+		}
+		for (uint32_t i = 0; i < num_boids; i++) {
+			prev.pos[i] = glm::ivec3(0);
+			prev.vel[i] = glm::ivec3(0);
+		}
+	}
+
+	// Quantize and compute deltas in place, prev ends up holding this frame's quantized values
+	Vector<glm::ivec3> dpos(num_boids), dvel(num_boids);
+	for (uint32_t i = 0; i < num_boids; i++) {
+		glm::ivec3 qp = quantize_pos(pos[i], header);
+		glm::ivec3 qv = glm::ivec3(glm::round(vel[i] / header.vel_step));
+		dpos[i] = glm::ivec3(glm::uvec3(qp) - glm::uvec3(prev.pos[i]));
+		dvel[i] = glm::ivec3(glm::uvec3(qv) - glm::uvec3(prev.vel[i]));
+		prev.pos[i] = qp;
+		prev.vel[i] = qv;
+	}
+
+	// Channel-major layout keeps similar bytes together for the LZ stage
+	out.reserve(num_boids * 6 * 2);
+	for (int c = 0; c < 3; c++) {
+		for (uint32_t i = 0; i < num_boids; i++) write_varint(out, zigzag_encode(dpos[i][c]));
+	}
+	for (int c = 0; c < 3; c++) {
+		for (uint32_t i = 0; i < num_boids; i++) write_varint(out, zigzag_encode(dvel[i][c]));
+	}
+}
+
+bool boid_decode_frame(Span<const uint8_t> data, uint32_t num_boids, bool keyframe, BoidQuantState& state) {
+	if (keyframe) {
+		if (state.pos.size() != num_boids) {
+			state.pos.resize(num_boids);
+			state.vel.resize(num_boids);
+		}
+		for (uint32_t i = 0; i < num_boids; i++) {
+			state.pos[i] = glm::ivec3(0);
+			state.vel[i] = glm::ivec3(0);
+		}
+	}
+	else if (state.pos.size() != num_boids) {
+		return false;
+	}
+
+	const uint8_t* p = data.data();
+	const uint8_t* end = p + data.size();
+	for (int k = 0; k < 6; k++) {
+		auto& channel = k < 3 ? state.pos : state.vel;
+		int c = k % 3;
+		for (uint32_t i = 0; i < num_boids; i++) {
+			uint32_t v;
+			if (!read_varint(p, end, v)) return false;
+			channel[i][c] = (int32_t)((uint32_t)channel[i][c] + (uint32_t)zigzag_decode(v));
+		}
+	}
+	return p == end;
+}
+
+void boid_dequantize(const BoidRecordingHeader& header, const BoidQuantState& state, Span<Boid> boids) {
+	uint32_t n = state.pos.size() < boids.size() ? state.pos.size() : boids.size();
+	for (uint32_t i = 0; i < n; i++) {
+		boids[i].pos = dequantize_pos(state.pos[i], header);
+		boids[i].vel = glm::vec3(state.vel[i]) * header.vel_step;
+	}
+}
+
+bool BoidRecorder::start(const char* filename, float cell_size, float vel_limit) {
+	stop();
+
+	if (fopen_s(&_file, filename, "wb") != 0) {
+		log_error("Failed to open boid recording {}!", filename);
+		_file = nullptr;
+		return false;
+	}
+
+	memcpy(_header.magic, BOID_RECORDING_MAGIC, 4);
+	_header.version = BOID_RECORDING_VERSION;
+	_header.cell_size = cell_size;
+	_header.pos_bits = 10;
+	_header.vel_step = (vel_limit > 0.0f ? vel_limit : 1.0f) / 1024.0f;
+	_header.keyframe_interval = 60;
+	if (fwrite(&_header, sizeof(BoidRecordingHeader), 1, _file) != 1) {
+		log_error("Failed to write boid recording {}!", filename);
+		fclose(_file);
+		_file = nullptr;
+		return false;
+	}
+	_write_offset = sizeof(BoidRecordingHeader);
+	_write_failed = false;
+
+	_num_frames_submitted = 0;
+	_last_num_boids = 0;
+	log_info("Started boid recording {}", filename);
+	return true;
+}
+
+void BoidRecorder::record(Span<const Boid> boids) {
+	ZoneScoped;
+
+	if (!_file) return;
+
+	// A writer task failed, the recording can't be completed anymore
+	if (_write_failed.load()) {
+		stop();
+		return;
+	}
+
+	if (_frames_in_flight.load() >= MAX_FRAMES_IN_FLIGHT) {
+		ZoneScopedN("BoidRecorderStall");
+		task_wait(_last_task);
+	}
+
+	const uint32_t num_boids = boids.size();
+	auto frame = new PendingFrame();
+	frame->pos.resize(num_boids);
+	frame->vel.resize(num_boids);
+	for (uint32_t i = 0; i < num_boids; i++) {
+		frame->pos[i] = boids[i].pos;
+		frame->vel[i] = boids[i].vel;
+	}
+	frame->keyframe = (_num_frames_submitted % _header.keyframe_interval == 0) || num_boids != _last_num_boids;
+	_last_num_boids = num_boids;
+	_num_frames_submitted++;
+
+	// Chaining on the previous task keeps the writes ordered
+	_frames_in_flight++;
+	Task* task = drjit::do_async([this, frame]() {
+		write_frame(frame);
+		delete frame;
+		_frames_in_flight--;
+	}, {_last_task}, _thread_pool);
+	if (_last_task) {
+		task_release(_last_task);
+	}
+	_last_task = task;
+}
+
+void BoidRecorder::write_frame(PendingFrame* frame) {
+	ZoneScoped;
+
+	if (_write_failed.load()) return;
+
+	const uint32_t num_boids = frame->pos.size();
+	Vector<uint8_t> raw;
+	boid_encode_frame(
+		Span<const glm::vec3>(frame->pos.data(), num_boids),
+		Span<const glm::vec3>(frame->vel.data(), num_boids),
+		_header, _prev, frame->keyframe, raw);
+
+	auto compressed = lz_compress(Span<const uint8_t>(raw.data(), raw.size()));
+	if (fwrite(compressed.data(), 1, compressed.size(), _file) != compressed.size()) {
+		log_error("Failed to write boid recording frame {}!", _index.size());
+		_write_failed = true;
+		return;
+	}
+
+	BoidRecordingFrameEntry entry;
+	entry.offset = _write_offset;
+	entry.compressed_size = compressed.size();
+	entry.raw_size = raw.size();
+	entry.num_boids = num_boids;
+	entry.is_keyframe = frame->keyframe;
+	_index.push_back(entry);
+	_write_offset += compressed.size();
+}
+
+void BoidRecorder::stop() {
+	if (!_file) return;
+
+	if (_last_task) {
+		task_wait_and_release(_last_task);
+		_last_task = nullptr;
+	}
+
+	BoidRecordingFooter footer;
+	footer.index_offset = _write_offset;
+	footer.num_frames = _index.size();
+	memcpy(footer.magic, BOID_RECORDING_INDEX_MAGIC, 4);
+	bool written = !_write_failed.load()
+		&& fwrite(_index.data(), sizeof(BoidRecordingFrameEntry), _index.size(), _file) == _index.size()
+		&& fwrite(&footer, sizeof(BoidRecordingFooter), 1, _file) == 1;
+	fclose(_file);
+	_file = nullptr;
+
+	if (written) {
+		log_info("Stopped boid recording ({} frames, {} bytes)", footer.num_frames, _write_offset);
+	}
+	else {
+		log_error("Stopped boid recording, the file is incomplete!");
+	}
+	_index.clear();
+	_prev.pos.clear();
+	_prev.vel.clear();
+}
+
+bool BoidPlayer::open(const char* filename) {
+	close();
+
+	if (fopen_s(&_file, filename, "rb") != 0) {
+		log_error("Failed to open boid recording {}!", filename);
+		_file = nullptr;
+		return false;
+	}
+
+	BoidRecordingFooter footer;
+	bool valid = fread(&_header, sizeof(BoidRecordingHeader), 1, _file) == 1
+		&& memcmp(_header.magic, BOID_RECORDING_MAGIC, 4) == 0
+		&& _header.version == BOID_RECORDING_VERSION
+		&& boid_fseek(_file, -(int64_t)sizeof(BoidRecordingFooter), SEEK_END) == 0
+		&& fread(&footer, sizeof(BoidRecordingFooter), 1, _file) == 1
+		&& memcmp(footer.magic, BOID_RECORDING_INDEX_MAGIC, 4) == 0;
+	if (valid) {
+		_index.resize(footer.num_frames);
+		valid = boid_fseek(_file, footer.index_offset, SEEK_SET) == 0
+			&& fread(_index.data(), sizeof(BoidRecordingFrameEntry), footer.num_frames, _file) == footer.num_frames
+			&& (footer.num_frames == 0 || _index[0].is_keyframe);
+	}
+	if (!valid) {
+		log_error("Invalid boid recording {}!", filename);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void BoidPlayer::close() {
+	if (_file) {
+		fclose(_file);
+		_file = nullptr;
+	}
+	_index.clear();
+	_state.pos.clear();
+	_state.vel.clear();
+	_decoded_frame = -1;
+}
+
+bool BoidPlayer::decode_frame(uint32_t frame) {
+	const auto& entry = _index[frame];
+	if (_compressed.size() < entry.compressed_size) _compressed.resize(entry.compressed_size);
+	if (_raw.size() < entry.raw_size) _raw.resize(entry.raw_size);
+
+	if (boid_fseek(_file, entry.offset, SEEK_SET) != 0
+		|| fread(_compressed.data(), 1, entry.compressed_size, _file) != entry.compressed_size) {
+		return false;
+	}
+	if (!lz_decompress(Span<const uint8_t>(_compressed.data(), entry.compressed_size), Span<uint8_t>(_raw.data(), entry.raw_size))) {
+		return false;
+	}
+	return boid_decode_frame(Span<const uint8_t>(_raw.data(), entry.raw_size), entry.num_boids, entry.is_keyframe, _state);
+}
+
+bool BoidPlayer::read_frame(uint32_t frame, Span<Boid> boids) {
+	ZoneScoped;
+
+	if (!_file || frame >= _index.size()) return false;
+
+	if ((int64_t)frame != _decoded_frame) {
+		// Continue from the last decoded frame when moving forward, otherwise restart at the nearest keyframe
+		uint32_t keyframe = frame;
+		while (!_index[keyframe].is_keyframe) keyframe--;
+		uint32_t start = (_decoded_frame >= (int64_t)keyframe && _decoded_frame < (int64_t)frame) ? (uint32_t)_decoded_frame + 1 : keyframe;
+		for (uint32_t f = start; f <= frame; f++) {
+			if (!decode_frame(f)) {
+				log_error("Failed to decode boid recording frame {}!", f);
+				_decoded_frame = -1;
+				return false;
+			}
+		}
+		_decoded_frame = frame;
+	}
+
+	boid_dequantize(_header, _state, boids);
+	return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "core/vector.h"
+#include "core/span.h"
+
+#include <glm/vec3.hpp>
+
+#include <atomic>
+#include <stdio.h>
+
+struct Pool;
+struct Task;
+struct Boid;
+
+// Boid recording file layout:
+//   BoidRecordingHeader
+//   frame blobs (LZ-compressed, variable size)
+//   BoidRecordingFrameEntry[num_frames]
+//   BoidRecordingFooter
+//
+// A frame blob decompresses to six channels (pos.xyz, vel.xyz) of zigzag varints, one value per boid.
+// Positions are quantized to 1/2^pos_bits of a grid cell, velocities to vel_step.
+// Keyframes store the quantized values, the other frames store deltas against the previous tick.
+
+struct BoidRecordingHeader {
+	char magic[4];
+	uint32_t version;
+	float cell_size;
+	float vel_step;
+	uint32_t pos_bits;
+	uint32_t keyframe_interval;
+};
+
+struct BoidRecordingFrameEntry {
+	uint64_t offset;
+	uint32_t compressed_size;
+	uint32_t raw_size;
+	uint32_t num_boids;
+	uint32_t is_keyframe;
+};
+
+struct BoidRecordingFooter {
+	uint64_t index_offset;
+	uint32_t num_frames;
+	char magic[4];
+};
+
+struct BoidQuantState {
+	Vector<glm::ivec3> pos;
+	Vector<glm::ivec3> vel;
+};
+
+void boid_encode_frame(Span<const glm::vec3> pos, Span<const glm::vec3> vel, const BoidRecordingHeader& header,
+	BoidQuantState& prev, bool keyframe, Vector<uint8_t>& out);
+
+bool boid_decode_frame(Span<const uint8_t> data, uint32_t num_boids, bool keyframe, BoidQuantState& state);
+
+void boid_dequantize(const BoidRecordingHeader& header, const BoidQuantState& state, Span<Boid> boids);
+
+// Streams boid states to disk. Encoding, compression and file writes happen on the thread pool,
+// chained so that frames are written in order.
+class BoidRecorder {
+public:
+	BoidRecorder(Pool* thread_pool) : _thread_pool(thread_pool) {}
+	~BoidRecorder() { stop(); }
+
+	bool start(const char* filename, float cell_size, float vel_limit);
+	void record(Span<const Boid> boids);
+	void stop();
+
+	bool is_recording() const { return _file != nullptr; }
+	uint32_t num_frames() const { return _num_frames_submitted; }
+
+private:
+	struct PendingFrame {
+		Vector<glm::vec3> pos;
+		Vector<glm::vec3> vel;
+		bool keyframe;
+	};
+	void write_frame(PendingFrame* frame);
+
+	static constexpr int MAX_FRAMES_IN_FLIGHT = 8;
+
+	Pool* _thread_pool;
+	FILE* _file = nullptr;
+	BoidRecordingHeader _header;
+	uint64_t _write_offset = 0;
+
+	// Only touched by the (serialized) writer tasks
+	BoidQuantState _prev;
+	Vector<BoidRecordingFrameEntry> _index;
+	std::atomic<bool> _write_failed = false;
+
+	Task* _last_task = nullptr;
+	std::atomic<int> _frames_in_flight = 0;
+	uint32_t _num_frames_submitted = 0;
+	uint32_t _last_num_boids = 0;
+};
+
+// Seekable playback of a boid recording, frames are streamed from disk on demand.
+class BoidPlayer {
+public:
+	~BoidPlayer() { close(); }
+
+	bool open(const char* filename);
+	void close();
+
+	// Decodes the given frame into boids (starting from the nearest keyframe if needed).
+	bool read_frame(uint32_t frame, Span<Boid> boids);
+
+	uint32_t num_frames() const { return _index.size(); }
+	bool is_open() const { return _file != nullptr; }
+
+private:
+	bool decode_frame(uint32_t frame);
+
+	FILE* _file = nullptr;
+	BoidRecordingHeader _header;
+	Vector<BoidRecordingFrameEntry> _index;
+	BoidQuantState _state;
+	int64_t _decoded_frame = -1;
+	Vector<uint8_t> _compressed;
+	Vector<uint8_t> _raw;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <cstdint>
+#include <tuple>
+
+struct Boid;
+struct BoidConfig;
+
+// Boid rule kernels. Every rule is a small stateless struct with:
+//   - State: per-boid accumulator, zero-initialized before the neighbor pass
+//   - accumulate(): called once for every neighbor within BoidConfig::nearby_dist
+//   - finalize(): called once per boid after the neighbor pass, adds to the new velocity
+// Rules that only depend on the boid itself (target follow, speed limit, wind ...) leave
+// accumulate() empty, so they get folded into the same pass for free.
+// Finalize order is the order of the BoidRules list below (speed limit must stay last).
+
+enum BoidRuleFlags : uint32_t {
+	BOID_RULE_COHESION = 0x1,
+	BOID_RULE_ALIGNMENT = 0x2,
+	BOID_RULE_SEPARATION = 0x4,
+	BOID_RULE_TARGET_FOLLOW = 0x8,
+	BOID_RULE_SPEED_LIMIT = 0x10,
+	BOID_RULE_ALL = 0x1F
+};
+
+struct BoidRuleContext {
+	glm::vec3 target_pos;
+	float nearby_dist_sq;
+	float avoid_dist;
+	float avoid_dist_sq;
+	float pos_match_factor;
+	float vel_match_factor;
+	float avoid_factor;
+	float target_follow_factor;
+	float vel_limit;
+};
+
+struct BoidNeighbor {
+	glm::vec3 pos;
+	glm::vec3 vel;
+	glm::vec3 dx;		// self.pos - other.pos
+	float dist_sq;
+};
+
+struct BoidCohesionRule {
+	static constexpr uint32_t flag = BOID_RULE_COHESION;
+	struct State { glm::vec3 com = glm::vec3(0); float count = 0; };
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {
+		s.com += n.pos;
+		s.count += 1.0f;
+	}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		if (s.count > 0) {
+			new_vel += ctx.pos_match_factor * (s.com / s.count - pos);
+		}
+	}
+};
+
+struct BoidAlignmentRule {
+	static constexpr uint32_t flag = BOID_RULE_ALIGNMENT;
+	struct State { glm::vec3 avg_vel = glm::vec3(0); float count = 0; };
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {
+		s.avg_vel += n.vel;
+		s.count += 1.0f;
+	}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		if (s.count > 0) {
+			new_vel += ctx.vel_match_factor * (s.avg_vel / s.count - vel);
+		}
+	}
+};
+
+struct BoidSeparationRule {
+	static constexpr uint32_t flag = BOID_RULE_SEPARATION;
+	struct State { glm::vec3 push = glm::vec3(0); };
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {
+		// Branchless: neighbors outside avoid_dist contribute zero
+		float dist = glm::sqrt(n.dist_sq);
+		float w = n.dist_sq < ctx.avoid_dist_sq && dist > 0.0f ? (ctx.avoid_dist - dist) / dist : 0.0f;
+		s.push += w * n.dx;
+	}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		new_vel += ctx.avoid_factor * s.push;
+	}
+};
+
+struct BoidTargetFollowRule {
+	static constexpr uint32_t flag = BOID_RULE_TARGET_FOLLOW;
+	struct State {};
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		new_vel += ctx.target_follow_factor * (ctx.target_pos - pos);
+	}
+};
+
+struct BoidSpeedLimitRule {
+	static constexpr uint32_t flag = BOID_RULE_SPEED_LIMIT;
+	struct State {};
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		float cur_vel_sq = glm::length2(new_vel);
+		if (cur_vel_sq > ctx.vel_limit * ctx.vel_limit) {
+			new_vel *= (ctx.vel_limit / glm::sqrt(cur_vel_sq));
+		}
+	}
+};
+
+template <class... Rules>
+struct BoidRuleList {};
+
+// Registry of every available rule, in finalize order.
+// To add a new rule, define a kernel struct above, give it a flag and append it here.
+using BoidRules = BoidRuleList<
+	BoidCohesionRule,
+	BoidAlignmentRule,
+	BoidSeparationRule,
+	BoidTargetFollowRule,
+	BoidSpeedLimitRule>;
+
+// A fused pipeline of the enabled rules. All per-rule loops are unrolled with fold expressions,
+// so the inner neighbor loop contains no per-rule branches.
+template <class... Rules>
+struct BoidRulePipeline {
+	using State = std::tuple<typename Rules::State...>;
+
+	static void accumulate(State& s, const BoidRuleContext& ctx, const BoidNeighbor& n) {
+		(Rules::accumulate(std::get<typename Rules::State>(s), ctx, n), ...);
+	}
+	static void finalize(const State& s, const BoidRuleContext& ctx, glm::vec3 pos, glm::vec3 vel, glm::vec3& new_vel) {
+		(Rules::finalize(std::get<typename Rules::State>(s), ctx, pos, vel, new_vel), ...);
+	}
+};
+
+// Picks the pipeline instantiation matching the runtime flag mask (once per update),
+// then calls func.template operator()<Pipeline>().
+template <class... Enabled, class Func>
+void boid_dispatch_rules(uint32_t flags, BoidRuleList<>, Func&& func) {
+	func.template operator()<BoidRulePipeline<Enabled...>>();
+}
+
+template <class... Enabled, class Rule, class... Rest, class Func>
+void boid_dispatch_rules(uint32_t flags, BoidRuleList<Rule, Rest...>, Func&& func) {
+	if (flags & Rule::flag) {
+		boid_dispatch_rules<Enabled..., Rule>(flags, BoidRuleList<Rest...>{}, func);
+	}
+	else {
+		boid_dispatch_rules<Enabled...>(flags, BoidRuleList<Rest...>{}, func);
+	}
+}
@@ -2,8 +2,7 @@
 
 #include "observer.h"
 
-#include "terrain.h"
-#include "terrain_algo.h"
+#include "terrain_cache.h"
 
 #include "ecs.h"
 
@@ -21,7 +20,7 @@ Entity create_player(ECS* ecs) {
     return it;
 }
 
-void update_player(ECS* ecs, const Terrain& terrain, 
+void update_player(ECS* ecs, const TerrainHeightCache& terrain_cache, 
     uint32_t pressed_keys, glm::ivec2 screen_extent, glm::ivec2 mouse_offset, float dt) {
     ecs->query<Player, FPSControls, Camera>().foreach([&](Entity entity, Player& player, FPSControls& controls, Camera& camera) {
         update_fps_controls_direction(controls, mouse_offset);
@@ -49,13 +48,13 @@ void update_player(ECS* ecs, const Terrain& terrain,
 
         // TODO: Calculate actual next position using terrain
         glm::vec2 player_pos_plane = glm::vec2(player.pos.x, player.pos.z);
-        glm::vec3 res = calc_terrain_with_gradient(terrain, player_pos_plane);
+        glm::vec3 res = terrain_cache.sample(player_pos_plane);
         glm::vec2 cur_grad = glm::vec2(res.y, res.z);
         float cos_slope = glm::inversesqrt(1.0f + cur_grad.x * cur_grad.x + cur_grad.y * cur_grad.y);
 
         glm::vec2 new_pos = player_pos_plane + plane_offset * cos_slope;
 
-        res = calc_terrain_with_gradient(terrain, new_pos);
+        res = terrain_cache.sample(new_pos);
         player.pos.x = new_pos.x;
         player.pos.y = player.camera_height + res.x;
         player.pos.z = new_pos.y;
@@ -5,10 +5,10 @@
 
 #include "ecs.h"
 
-struct Terrain;
+class TerrainHeightCache;
 
 Entity create_player(ECS* ecs);
 
-void update_player(ECS* ecs, const Terrain& terrain, 
+void update_player(ECS* ecs, const TerrainHeightCache& terrain_cache, 
     uint32_t pressed_keys, glm::ivec2 screen_extent, glm::ivec2 mouse_offset, float dt);
 
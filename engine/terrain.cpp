@@ -15,14 +15,15 @@
 #include "engine.h"
 
 #define TRACY_ENABLE
+#include "tracy/Tracy.hpp"
 #include "tracy/TracyVulkan.hpp"
 
-constexpr int MAX_CHUNKS_PER_TEMPLATE = 1000;
-
 TerrainRenderer::TerrainRenderer(Renderer *renderer, Terrain* terrain) 
     : RenderInterface(renderer), _terrain(terrain) {}
 
 void TerrainRenderer::init() {
+    _quadtree = UniquePtr(new TerrainQuadtree(Engine::instance()->thread_pool, _terrain));
+
     _chunk_templates.resize(_terrain->chunk_sizes.size());
 
     for (int k = 0; k < _terrain->chunk_sizes.size(); k++) {
@@ -48,28 +49,126 @@ void TerrainRenderer::init() {
         }
     }
     for (auto& chunk : _chunk_templates) {
-        chunk.vbo_inst = _renderer->create_dynamic_render_buffer(
-                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, sizeof(glm::vec2) * MAX_CHUNKS_PER_TEMPLATE);
-    }
-
-    auto command_buffer = _renderer->begin_single_time_commands();
-    for (auto& chunk : _chunk_templates) {
-        _renderer->create_static_render_buffer_from_cpu(command_buffer,
-                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, chunk.uvs.data(), sizeof(glm::vec2) * chunk.uvs.size(),
-                chunk.vbo_staging_buffer, chunk.vbo);
-        _renderer->create_static_render_buffer_from_cpu(command_buffer,
-                VK_BUFFER_USAGE_INDEX_BUFFER_BIT, chunk.triangles.data(), sizeof(glm::u16vec3) * chunk.triangles.size(),
-                chunk.ibo_staging_buffer, chunk.ibo);
-    }
-    _renderer->end_single_time_commands(command_buffer);
-    for (auto& chunk : _chunk_templates) {
-        _renderer->destroy_buffer(chunk.vbo_staging_buffer);
-        _renderer->destroy_buffer(chunk.ibo_staging_buffer);
+        chunk.vbo = _renderer->create_vertex_buffer(chunk.uvs.data(), sizeof(glm::vec2) * chunk.uvs.size());
+        chunk.ibo = _renderer->create_index_buffer(chunk.triangles.data(), sizeof(glm::u16vec3) * chunk.triangles.size());
     }
 
+    create_clipmap_resources();
     create_graphics_pipeline();
 }
 
+void TerrainRenderer::create_clipmap_resources() {
+    VkDevice device = _renderer->get_device();
+    _clipmap = UniquePtr(new TerrainClipmap(Engine::instance()->thread_pool, _terrain));
+    uint32_t res = _clipmap->res();
+    uint32_t num_levels = _clipmap->num_levels();
+
+    VkImageCreateInfo image_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .extent = {.width = res, .height = res, .depth = 1},
+        .mipLevels = 1,
+        .arrayLayers = num_levels,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VmaAllocationCreateInfo image_alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+        .priority = 1.0f
+    };
+    VK_CHECK(vmaCreateImage(_renderer->_vma_allocator, &image_info, &image_alloc_create_info,
+                            &_clipmap_image.image, &_clipmap_image.alloc_data, nullptr));
+    _clipmap_image.extents = {res, res};
+    _clipmap_image.format = image_info.format;
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = _clipmap_image.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = image_info.format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = num_levels
+        }
+    };
+    VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &_clipmap_image_view));
+
+    // Only read with texelFetch, the shader does the wrapping and filtering itself
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .maxLod = 0.0f,
+    };
+    VK_CHECK(vkCreateSampler(device, &sampler_info, nullptr, &_clipmap_sampler));
+
+    Array<VkDescriptorSetLayoutBinding, 2> bindings = {
+        VkDescriptorSetLayoutBinding {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        },
+        VkDescriptorSetLayoutBinding {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        }
+    };
+    vkuCreateDescriptorSetLayout(device, bindings, &_clipmap_descriptor_set_layout);
+
+    Array<VkDescriptorPoolSize, 2> pool_sizes = {
+        VkDescriptorPoolSize {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = MAX_FRAMES_IN_FLIGHT
+        },
+        VkDescriptorPoolSize {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = MAX_FRAMES_IN_FLIGHT
+        }
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = pool_sizes.size(),
+        .pPoolSizes = pool_sizes.data()
+    };
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &_clipmap_descriptor_pool));
+    vkuCreateDescriptorSets(device, _clipmap_descriptor_pool, _clipmap_descriptor_set_layout, _clipmap_descriptor_set.set_per_frame);
+
+    _clipmap_levels_buffer = _renderer->create_storage_buffer(sizeof(TerrainClipmapLevelGpu) * TerrainClipmap::MAX_LEVELS);
+
+    VkDescriptorImageInfo image_desc_info = {
+        .sampler = _clipmap_sampler,
+        .imageView = _clipmap_image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = _clipmap_descriptor_set.set_per_frame[i],
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &image_desc_info
+        };
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    }
+}
+
 void TerrainRenderer::create_graphics_pipeline() {
     Shader vs_shader = _renderer->load_shader_from_file("shaders/terrain.vert.spv", ShaderType::Vertex);
     Shader fs_shader = _renderer->load_shader_from_file("shaders/terrain.frag.spv", ShaderType::Fragment);
@@ -84,7 +183,7 @@ void TerrainRenderer::create_graphics_pipeline() {
         },
         VkVertexInputBindingDescription {
             .binding = 1,
-            .stride = sizeof(glm::vec2),
+            .stride = sizeof(glm::vec3),
             .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
         }
     };
@@ -98,7 +197,7 @@ void TerrainRenderer::create_graphics_pipeline() {
         VkVertexInputAttributeDescription {
             .location = 1,
             .binding = 1,
-            .format = VK_FORMAT_R32G32_SFLOAT,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
             .offset = 0
         }
     };
@@ -179,7 +278,11 @@ void TerrainRenderer::create_graphics_pipeline() {
             .size = sizeof(TerrainPushConstants),
     };
 
-    auto desc_set_layouts = _renderer->get_descriptor_set_layouts();
+    auto renderer_set_layouts = _renderer->get_descriptor_set_layouts();
+    Array<VkDescriptorSetLayout, 5> desc_set_layouts = {
+        renderer_set_layouts[0], renderer_set_layouts[1], renderer_set_layouts[2], renderer_set_layouts[3],
+        _clipmap_descriptor_set_layout
+    };
 
     VkPipelineLayoutCreateInfo pipeline_layout_info = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -215,49 +318,218 @@ void TerrainRenderer::create_graphics_pipeline() {
             .subpass = 0,
     };
 
-    VK_CHECK(vkCreateGraphicsPipelines(_renderer->_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &_graphics_pipeline));
-
-    vkDestroyShaderModule(_renderer->_device, vs_shader.module, nullptr);
-    vkDestroyShaderModule(_renderer->_device, fs_shader.module, nullptr);
+    _renderer->queue_graphics_pipeline(pipeline_info, &_graphics_pipeline);
 }
 
 void TerrainRenderer::begin_frame() {
-    auto engine = Engine::instance();
-    auto im3d = engine->im3d.get();
+    ZoneScoped;
 
     const Camera& camera = _renderer->get_current_camera();
+    glm::mat4 view_proj = camera.proj_mat * camera.get_view_matrix();
+
+    SelectionKey key = {
+        .camera_cell = glm::ivec3(glm::floor(camera.position / _terrain->chunk_width)),
+        .max_level = _quadtree->max_level,
+        .root_radius = _quadtree->root_radius,
+        .lod_distance = _quadtree->lod_distance,
+        .params = TerrainNoiseParams::from(*_terrain)
+    };
+
+    // The terrain settings can be edited during the next frame's update while this one is still being recorded
+    _frame_push_constants.set_config(*_terrain);
+    _frame_push_constants.view = camera.get_view_matrix();
 
-    auto pos_xy = glm::vec2(camera.position.x, camera.position.z);
-    auto ipos = glm::ivec2(glm::floor(pos_xy / _terrain->chunk_width));
-
-    // test
-    _chunks.clear();
-    for (int j = -10; j <= 10; j++) {
-        for (int i = -10; i <= 10; i++) {
-            int detail_level;
-            if (i * i + j * j < 2 * 2) detail_level = 2;
-            else if (i * i + j * j < 6 * 6) detail_level = 1;
-            else detail_level = 0;
-            glm::ivec2 coords = ipos + glm::ivec2(i, j);
-            _chunks.push_back({coords, detail_level});
+    // Collected here rather than in record_transfers(), the levels are only touched from the main thread
+    _clipmap_uploads.clear();
+    _clipmap->collect_uploads(_clipmap_uploads);
+    _clipmap->update(glm::vec2(camera.position.x, camera.position.z));
+
+    // Keep reselecting while some node bounds are still being computed, so the culling tightens once they're ready
+    if (!_has_selection || !(key == _selection_key) || _quadtree->num_pending != 0) {
+        _selection_key = key;
+        _has_selection = true;
+
+        // Select from the center of the camera's cell, so that the result doesn't depend on where inside the cell it is
+        glm::vec3 select_pos = (glm::vec3(key.camera_cell) + 0.5f) * _terrain->chunk_width;
+
+        _chunks.truncate();
+        _quadtree->select(select_pos, _chunks);
+    }
+
+    // Culling is cheap next to the selection, but the instances are only uploaded again when the visible set changes
+    _culled_chunks.truncate();
+    _quadtree->cull(Frustum::from_matrix(view_proj), Span<const TerrainChunk>(_chunks.data(), _chunks.size()), _culled_chunks);
+    bool changed = _culled_chunks.size() != _visible_chunks.size();
+    for (uint32_t i = 0; !changed && i < _culled_chunks.size(); i++) {
+        changed = !(_culled_chunks[i] == _visible_chunks[i]);
+    }
+    if (changed) {
+        swap(_culled_chunks, _visible_chunks);
+        update_instances();
+    }
+}
+
+void TerrainRenderer::update_instances() {
+    ZoneScoped;
+
+    // Counting sort by template, so each template draws a contiguous range of instances
+    for (auto& tmpl : _chunk_templates) {
+        tmpl.instance_count = 0;
+    }
+    for (auto& chunk : _visible_chunks) {
+        _chunk_templates[chunk.tmpl_idx].instance_count++;
+    }
+    uint32_t first_instance = 0;
+    for (auto& tmpl : _chunk_templates) {
+        tmpl.first_instance = first_instance;
+        first_instance += tmpl.instance_count;
+    }
+
+    if (_instances.size() != _visible_chunks.size()) {
+        _instances.resize(_visible_chunks.size());
+    }
+    for (auto& tmpl : _chunk_templates) {
+        tmpl.instance_count = 0;
+    }
+    for (auto& chunk : _visible_chunks) {
+        auto& tmpl = _chunk_templates[chunk.tmpl_idx];
+        _instances[tmpl.first_instance + tmpl.instance_count++] = glm::vec3(chunk.pos, (float)(1 << chunk.level));
+    }
+
+    _instances_version++;
+}
+
+void TerrainRenderer::record_transfers(VkCommandBuffer command_buffer) {
+    ZoneScoped;
+
+    // Nothing is shown from a level before its first upload, but the layout has to be valid for sampling
+    if (!_clipmap_layout_initialized) {
+        VkImageMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = _clipmap_image.image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = (uint32_t)_clipmap->num_levels()
+            }
+        };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &barrier);
+        _clipmap_layout_initialized = true;
+    }
+
+    if (_clipmap_uploads.empty()) {
+        return;
+    }
+    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "TerrainClipmapUpload")
+
+    // The fence of this frame slot has been waited on, so its staging buffer is free to overwrite
+    uint32_t cur_frame = _renderer->get_current_frame();
+    auto texels = _clipmap->upload_data();
+    size_t size = sizeof(glm::vec4) * texels.size();
+    size_t capacity = _clipmap_staging_buffer.buffer_per_frame[cur_frame].size;
+    if (capacity < size) {
+        _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, cur_frame,
+            glm::max(size, 2 * capacity), _clipmap_staging_buffer);
+    }
+    memcpy(_renderer->get_mapped_pointer(_clipmap_staging_buffer, cur_frame), texels.data(), size);
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = _clipmap_image.image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = (uint32_t)_clipmap->num_levels()
         }
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Regions never cross a multiple of res, so each one is a single rectangle of its texture layer
+    int mask = _clipmap->res() - 1;
+    Vector<VkBufferImageCopy> copies;
+    copies.reserve(_clipmap_uploads.size());
+    for (const auto& upload : _clipmap_uploads) {
+        copies.push_back(VkBufferImageCopy {
+            .bufferOffset = sizeof(glm::vec4) * upload.first_texel,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = (uint32_t)upload.level,
+                .layerCount = 1
+            },
+            .imageOffset = {upload.region.texel.x & mask, upload.region.texel.y & mask, 0},
+            .imageExtent = {(uint32_t)upload.region.size.x, (uint32_t)upload.region.size.y, 1}
+        });
+    }
+    vkCmdCopyBufferToImage(command_buffer, _clipmap_staging_buffer.buffer_per_frame[cur_frame].buffer, _clipmap_image.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copies.size(), copies.data());
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // The level windows moved along with the texture contents, every frame slot needs the new ones
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        _clipmap_descriptor_set.is_dirty[i] = true;
     }
 }
 
 void TerrainRenderer::render(VkCommandBuffer command_buffer) {
-    TracyVkZone(_renderer->get_current_tracy_graphics_context(), command_buffer, "TerrainRenderer")
-    const Camera& camera = _renderer->get_current_camera();
+    ZoneScopedN("TerrainRenderer");
+
+    if (_instances.empty()) {
+        return;
+    }
 
-    TerrainPushConstants push_constants;
-    push_constants.set_config(*_terrain);
-    push_constants.view = camera.get_view_matrix();
+    // The fence of this frame slot has been waited on, so its instance buffer is no longer read by the GPU
+    uint32_t cur_frame = _renderer->get_current_frame();
+    if (_uploaded_version[cur_frame] != _instances_version) {
+        size_t size = sizeof(glm::vec3) * _instances.size();
+        size_t capacity = _instance_buffer.buffer_per_frame[cur_frame].size;
+        if (capacity < size) {
+            // Grow geometrically so that a slowly increasing chunk count doesn't reallocate every time
+            _renderer->create_or_resize_dynamic_buffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cur_frame,
+                glm::max(size, 2 * capacity), _instance_buffer);
+        }
+        memcpy(_renderer->get_mapped_pointer(_instance_buffer, cur_frame), _instances.data(), size);
+        _uploaded_version[cur_frame] = _instances_version;
+    }
 
-    Vector<Vector<glm::vec2>> chunk_groups(_chunk_templates.size());
-    for (auto& chunk : _chunks) {
-        chunk_groups[chunk.tmpl_idx].push_back(chunk.pos);
+    if (_clipmap_descriptor_set.is_dirty[cur_frame]) {
+        const auto& levels = _clipmap->levels();
+        _renderer->update_storage_buffer(cur_frame, _clipmap_descriptor_set, _clipmap_levels_buffer,
+            (void*)levels.data(), sizeof(TerrainClipmapLevelGpu) * levels.size());
+        _clipmap_descriptor_set.is_dirty[cur_frame] = false;
     }
 
-    auto descriptor_sets = _renderer->get_descriptor_sets_for_current_frame();
+    auto renderer_sets = _renderer->get_descriptor_sets_for_current_frame();
+    Array<VkDescriptorSet, 5> descriptor_sets = {
+        renderer_sets[0], renderer_sets[1], renderer_sets[2], renderer_sets[3],
+        _clipmap_descriptor_set.set_per_frame[cur_frame]
+    };
 
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphics_pipeline);
 
@@ -265,28 +537,37 @@ void TerrainRenderer::render(VkCommandBuffer command_buffer) {
                             descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
 
     vkCmdPushConstants(command_buffer, _graphics_pipeline_layout,
-                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TerrainPushConstants), &push_constants);
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(TerrainPushConstants), &_frame_push_constants);
 
-    for (int tmpl_idx = 0; tmpl_idx < _chunk_templates.size(); tmpl_idx++) {
-        auto& chunk_tmpl = _chunk_templates[tmpl_idx];
-        auto& chunk_positions = chunk_groups[tmpl_idx];
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(command_buffer, 1, 1, &_instance_buffer.buffer_per_frame[cur_frame].buffer, offsets);
 
-        // Update offset buffer for instancing
-        void* p_chunk_vbo = _renderer->get_mapped_pointer(chunk_tmpl.vbo_inst);
-        memcpy(p_chunk_vbo, chunk_positions.data(), sizeof(glm::vec2) * chunk_positions.size());
+    for (auto& chunk_tmpl : _chunk_templates) {
+        if (chunk_tmpl.instance_count == 0) continue;
 
-        VkDeviceSize offsets[] = {0};
         vkCmdBindVertexBuffers(command_buffer, 0, 1, &chunk_tmpl.vbo.buffer, offsets);
-        vkCmdBindVertexBuffers(command_buffer, 1, 1, &chunk_tmpl.vbo_inst.buffer, offsets);
         vkCmdBindIndexBuffer(command_buffer, chunk_tmpl.ibo.buffer, 0, VK_INDEX_TYPE_UINT16);
-        vkCmdDrawIndexed(command_buffer, 3 * chunk_tmpl.triangles.size(), chunk_positions.size(), 0, 0, 0);
+        vkCmdDrawIndexed(command_buffer, 3 * chunk_tmpl.triangles.size(), chunk_tmpl.instance_count, 0, 0, chunk_tmpl.first_instance);
     }
 }
 
 void TerrainRenderer::cleanup() {
+    _quadtree.reset();
+    _renderer->destroy_dynamic_buffer(_instance_buffer);
+    _instance_buffer = {};
+    _clipmap.reset();
+    for (auto& buffer : _clipmap_levels_buffer.buffer_per_frame) {
+        _renderer->destroy_buffer(buffer);
+    }
+    _renderer->destroy_dynamic_buffer(_clipmap_staging_buffer);
+    _clipmap_staging_buffer = {};
+    vkDestroySampler(_renderer->get_device(), _clipmap_sampler, nullptr);
+    vkDestroyImageView(_renderer->get_device(), _clipmap_image_view, nullptr);
+    vmaDestroyImage(_renderer->_vma_allocator, _clipmap_image.image, _clipmap_image.alloc_data);
+    vkDestroyDescriptorPool(_renderer->get_device(), _clipmap_descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(_renderer->get_device(), _clipmap_descriptor_set_layout, nullptr);
     for (auto& chunk_tmpl : _chunk_templates) {
         _renderer->destroy_buffer(chunk_tmpl.vbo);
-        _renderer->destroy_buffer(chunk_tmpl.vbo_inst);
         _renderer->destroy_buffer(chunk_tmpl.ibo);
         chunk_tmpl.uvs.clear();
         chunk_tmpl.triangles.clear();
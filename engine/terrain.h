@@ -6,62 +6,35 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include "render/renderer.h"
+#include "terrain_algo.h"
+#include "terrain_quadtree.h"
+#include "terrain_cache.h"
+#include "terrain_clipmap.h"
+#include "core/unique_ptr.h"
 
 class Renderer;
 
-struct Terrain {
-    float scale = 4.0f;
-
-    int32_t octaves = 4;
-    int32_t seed = 0;
-    float persistance = 0.25f;
-    float lacunarity = 2.0f;
-
-    float chunk_width = 10.0f;
-    float height_multiplier = 20.0f;
-
-    Vector<int> chunk_sizes = {31, 63, 127};
-};
-
+// The heights come from the clipmap, the shaders only need to place the chunks
 struct TerrainPushConstants {
     glm::mat4 view;
 
-    float in_scale;
-    int32_t octaves;
-    uint32_t seed;
-    int _padding;
-
-    float persistance;
-    float lacunarity;
-
     float out_scale_width;
-    float out_scale_height;
 
     void set_config(const Terrain& cfg) {
-        in_scale = cfg.scale;
-
-        octaves = cfg.octaves;
-        seed = cfg.seed;
-        persistance = cfg.persistance;
-        lacunarity = cfg.lacunarity;
-
         out_scale_width = cfg.chunk_width;
-        out_scale_height = cfg.height_multiplier;
     }
 };
 
 struct TerrainChunkTemplate {
     int grid_size;
-    Buffer vbo, vbo_inst, ibo;
+    Buffer vbo, ibo;
+
+    // Range of this template's instances in TerrainRenderer::_instances
+    uint32_t first_instance = 0;
+    uint32_t instance_count = 0;
 
     Vector<glm::vec2> uvs;
     Vector<glm::u16vec3> triangles;
-    Buffer vbo_staging_buffer, ibo_staging_buffer;
-};
-
-struct TerrainChunk {
-    glm::ivec2 pos;
-    int tmpl_idx;
 };
 
 class TerrainRenderer : public RenderInterface {
@@ -72,16 +45,66 @@ public:
 
     void create_graphics_pipeline();
     void begin_frame() override;
+    void record_transfers(VkCommandBuffer command_buffer) override;
     void render(VkCommandBuffer command_buffer) override;
     void cleanup();
 
+    TerrainQuadtree* quadtree() { return _quadtree.get(); }
+    TerrainClipmap* clipmap() { return _clipmap.get(); }
+
 private:
+    // Everything the chunk selection depends on; it's only redone when this changes.
+    // The view direction isn't part of it, the selection is culled against the frustum every frame.
+    struct SelectionKey {
+        glm::ivec3 camera_cell;
+        int max_level;
+        int root_radius;
+        float lod_distance;
+        TerrainNoiseParams params;
+
+        bool operator==(const SelectionKey& other) const = default;
+    };
+
+    void update_instances();
+    void create_clipmap_resources();
+
     Terrain* _terrain;
     Entity _camera_object;
 
-    Vector<TerrainChunk> _chunks;
+    UniquePtr<TerrainQuadtree> _quadtree;
+    Vector<TerrainChunk> _chunks;            // selected around the camera
+    Vector<TerrainChunk> _visible_chunks;    // the ones in the frustum, what _instances holds
+    Vector<TerrainChunk> _culled_chunks;     // scratch for the next _visible_chunks
     Vector<TerrainChunkTemplate> _chunk_templates;
 
+    SelectionKey _selection_key = {};
+    bool _has_selection = false;
+
+    // Camera and noise settings of the frame being rendered, taken in begin_frame()
+    TerrainPushConstants _frame_push_constants = {};
+
+    // Instance data (node origin and width in chunk units) grouped by template.
+    // Each frame in flight has its own copy on the GPU, refreshed only when _instances_version moves past it.
+    Vector<glm::vec3> _instances;
+    uint64_t _instances_version = 0;
+    DynamicBuffer _instance_buffer;
+    Array<uint64_t, MAX_FRAMES_IN_FLIGHT> _uploaded_version = {};
+
+    // Height clipmap sampled by the vertex shader, bound as set 4 of the terrain pipeline
+    // (binding 0: level windows, binding 1: one texture layer per level).
+    // Finished regions are copied from a per frame staging buffer before the main render pass.
+    UniquePtr<TerrainClipmap> _clipmap;
+    Vector<TerrainClipmapUpload> _clipmap_uploads;
+    Image _clipmap_image;
+    bool _clipmap_layout_initialized = false;      // transitioned in the first record_transfers()
+    VkImageView _clipmap_image_view;
+    VkSampler _clipmap_sampler;
+    DynamicBuffer _clipmap_staging_buffer;
+    StorageBuffer _clipmap_levels_buffer;
+    VkDescriptorPool _clipmap_descriptor_pool;
+    VkDescriptorSetLayout _clipmap_descriptor_set_layout;
+    DescriptorSet _clipmap_descriptor_set;
+
     VkPipelineLayout _graphics_pipeline_layout;
     VkPipeline _graphics_pipeline;
 };
@@ -8,9 +8,22 @@
 #include <glm/trigonometric.hpp>
 #include <glm/exponential.hpp>
 
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
 using namespace glm;
 using uint = uint32_t;
 
+// The table noise takes the table as a parameter in C++, while GLSL reads it from the NoiseTable buffer
+// (see terrain.vert). The octave loop is a template parameter in C++ and a runtime loop in GLSL.
+#define NOISE_TABLE_PARAM const TerrainNoiseTable& table,
+#define NOISE_TABLE_ARG table,
+#define NOISE_PERM(i) table.perm[i]
+#define NOISE_GRAD(i) table.grad[i]
+#define TERRAIN_OCTAVES_TEMPLATE template <int OCTAVES>
+#define TERRAIN_OCTAVES(octaves) (OCTAVES > 0 ? OCTAVES : octaves)
+
 #endif
 
 float rand(float x) {
@@ -48,6 +61,34 @@ vec2 random_unit_vec2(int x, int y) {
     return vec2(f1, f2);
 }
 
+// Interpolation part of perlin2d_with_deriv, shared by the hash and table variants.
+// Pf_Pfmin1 is the position relative to the 4 cell corners, grad_x/grad_y are their (unit length) gradients.
+vec3 perlin2d_blend_with_deriv(vec4 Pf_Pfmin1, vec4 grad_x, vec4 grad_y)
+{
+    vec4 dotval = ( grad_x * Pf_Pfmin1.xzxz + grad_y * Pf_Pfmin1.yyww );
+
+    //  C2 Interpolation
+    vec4 blend = Pf_Pfmin1.xyxy * Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * vec2( 6.0, 0.0 ).xxyy + vec2( -15.0, 30.0 ).xxyy ) + vec2( 10.0, -60.0 ).xxyy ) + vec2( 0.0, 30.0 ).xxyy );
+
+    //  Convert our data to a more parallel format
+    vec3 dotval0_grad0 = vec3( dotval.x, grad_x.x, grad_y.x );
+    vec3 dotval1_grad1 = vec3( dotval.y, grad_x.y, grad_y.y );
+    vec3 dotval2_grad2 = vec3( dotval.z, grad_x.z, grad_y.z );
+    vec3 dotval3_grad3 = vec3( dotval.w, grad_x.w, grad_y.w );
+
+    //  evaluate common constants
+    vec3 k0_gk0 = dotval1_grad1 - dotval0_grad0;
+    vec3 k1_gk1 = dotval2_grad2 - dotval0_grad0;
+    vec3 k2_gk2 = dotval3_grad3 - dotval2_grad2 - k0_gk0;
+
+    //  calculate final noise + deriv
+    vec3 results = dotval0_grad0
+                    + blend.x * k0_gk0
+                    + blend.y * ( k1_gk1 + blend.x * k2_gk2 );
+    results.yz += blend.zw * ( vec2( k0_gk0.x, k1_gk1.x ) + blend.yx * k2_gk2.xx );
+    return results * float(1.4142135623730950488016887242097);  // scale things to a strict -1.0->1.0 range  *= 1.0/sqrt(0.5)
+}
+
 // From https://github.com/BrianSharpe/Wombat/blob/master/Perlin2D_Deriv.glsl
 vec3 perlin2d_with_deriv(vec2 P)
 {
@@ -78,28 +119,50 @@ vec3 perlin2d_with_deriv(vec2 P)
     vec4 norm = inversesqrt( grad_x * grad_x + grad_y * grad_y );
     grad_x *= norm;
     grad_y *= norm;
-    vec4 dotval = ( grad_x * Pf_Pfmin1.xzxz + grad_y * Pf_Pfmin1.yyww );
+    return perlin2d_blend_with_deriv(Pf_Pfmin1, grad_x, grad_y);
+}
 
-    //  C2 Interpolation
-    vec4 blend = Pf_Pfmin1.xyxy * Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * ( Pf_Pfmin1.xyxy * vec2( 6.0, 0.0 ).xxyy + vec2( -15.0, 30.0 ).xxyy ) + vec2( 10.0, -60.0 ).xxyy ) + vec2( 0.0, 30.0 ).xxyy );
+// Same as perlin2d_with_deriv, but the corner gradients come from the permutation table instead of 12 hashes.
+vec3 perlin2d_table_with_deriv(NOISE_TABLE_PARAM vec2 P)
+{
+    vec2 Pi_f = floor(P);
+    vec4 Pf_Pfmin1 = P.xyxy - vec4( Pi_f, Pi_f + vec2(1.0) );
 
-    //  Convert our data to a more parallel format
-    vec3 dotval0_grad0 = vec3( dotval.x, grad_x.x, grad_y.x );
-    vec3 dotval1_grad1 = vec3( dotval.y, grad_x.y, grad_y.y );
-    vec3 dotval2_grad2 = vec3( dotval.z, grad_x.z, grad_y.z );
-    vec3 dotval3_grad3 = vec3( dotval.w, grad_x.w, grad_y.w );
+    // The lattice repeats every 256 cells
+    ivec2 Pi = ivec2(Pi_f) & 255;
+    uint px0 = NOISE_PERM(Pi.x);
+    uint px1 = NOISE_PERM(Pi.x + 1);
+    vec2 g0 = NOISE_GRAD(NOISE_PERM(px0 + Pi.y));
+    vec2 g1 = NOISE_GRAD(NOISE_PERM(px1 + Pi.y));
+    vec2 g2 = NOISE_GRAD(NOISE_PERM(px0 + Pi.y + 1));
+    vec2 g3 = NOISE_GRAD(NOISE_PERM(px1 + Pi.y + 1));
+    vec4 grad_x = vec4(g0.x, g1.x, g2.x, g3.x);
+    vec4 grad_y = vec4(g0.y, g1.y, g2.y, g3.y);
+    return perlin2d_blend_with_deriv(Pf_Pfmin1, grad_x, grad_y);
+}
 
-    //  evaluate common constants
-    vec3 k0_gk0 = dotval1_grad1 - dotval0_grad0;
-    vec3 k1_gk1 = dotval2_grad2 - dotval0_grad0;
-    vec3 k2_gk2 = dotval3_grad3 - dotval2_grad2 - k0_gk0;
+TERRAIN_OCTAVES_TEMPLATE
+vec3 calc_terrain_with_gradient_table(NOISE_TABLE_PARAM vec2 pos,
+    float in_scale, int octaves, float persistance, float lacunarity,
+    float out_scale_width, float out_scale_height) {
 
-    //  calculate final noise + deriv
-    vec3 results = dotval0_grad0
-                    + blend.x * k0_gk0
-                    + blend.y * ( k1_gk1 + blend.x * k2_gk2 );
-    results.yz += blend.zw * ( vec2( k0_gk0.x, k1_gk1.x ) + blend.yx * k2_gk2.xx );
-    return results * float(1.4142135623730950488016887242097);  // scale things to a strict -1.0->1.0 range  *= 1.0/sqrt(0.5)
+    vec2 in_uv = pos / out_scale_width;
+
+    float amplitude = 1.0;
+    float frequency = float(1.0) / in_scale;
+    float noise_height = 0;
+    vec2 grad = vec2(0);
+    for (int k = 0; k < TERRAIN_OCTAVES(octaves); k++) {
+        vec2 perlin_in = frequency * in_uv;
+        vec3 perlin_out = amplitude * perlin2d_table_with_deriv(NOISE_TABLE_ARG perlin_in);
+        noise_height += perlin_out.x;
+        grad += frequency * perlin_out.yz;
+        amplitude *= persistance;
+        frequency *= lacunarity;
+    }
+    noise_height *= out_scale_height;
+    grad *= (out_scale_height / out_scale_width);
+    return vec3(noise_height, grad.x, grad.y);
 }
 
 vec3 calc_terrain_with_gradient(vec2 pos, 
@@ -126,3 +189,88 @@ vec3 calc_terrain_with_gradient(vec2 pos,
     grad *= (out_scale_height / out_scale_width);
     return vec3(noise_height, grad.x, grad.y);
 }
+
+#ifndef GLSL
+
+template vec3 calc_terrain_with_gradient_table<0>(const TerrainNoiseTable&, vec2, float, int, float, float, float, float);
+template vec3 calc_terrain_with_gradient_table<1>(const TerrainNoiseTable&, vec2, float, int, float, float, float, float);
+template vec3 calc_terrain_with_gradient_table<2>(const TerrainNoiseTable&, vec2, float, int, float, float, float, float);
+template vec3 calc_terrain_with_gradient_table<3>(const TerrainNoiseTable&, vec2, float, int, float, float, float, float);
+template vec3 calc_terrain_with_gradient_table<4>(const TerrainNoiseTable&, vec2, float, int, float, float, float, float);
+
+void TerrainNoiseTable::build(uint32_t seed) {
+    for (uint32_t i = 0; i < 256; i++) {
+        perm[i] = i;
+    }
+    // Fisher-Yates shuffle driven by pcg_hash, so the table only depends on the seed
+    uint32_t state = pcg_hash(seed);
+    for (uint32_t i = 255; i > 0; i--) {
+        state = pcg_hash(state);
+        uint32_t j = state % (i + 1);
+        uint32_t tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        perm[256 + i] = perm[i];
+    }
+
+    // Evenly spaced directions with a seeded rotation, then scattered through the table by the permutation
+    float rotation = conv_float(pcg_hash(seed ^ 0x9e3779b9u)) * 6.28318530718f;
+    for (uint32_t i = 0; i < 256; i++) {
+        float angle = rotation + 6.28318530718f * (float)perm[i] / 256.0f;
+        grad[i] = vec2(cos(angle), sin(angle));
+    }
+}
+
+const TerrainNoiseTable& terrain_noise_table(uint32_t seed) {
+    // Most lookups are for the same seed as the previous one, so avoid the lock for those
+    thread_local uint32_t last_seed = 0;
+    thread_local const TerrainNoiseTable* last_table = nullptr;
+    if (last_table && last_seed == seed) {
+        return *last_table;
+    }
+
+    static std::mutex mutex;
+    static std::unordered_map<uint32_t, std::unique_ptr<TerrainNoiseTable>> tables;
+    std::lock_guard lock(mutex);
+    auto& table = tables[seed];
+    if (!table) {
+        table = std::make_unique<TerrainNoiseTable>();
+        table->build(seed);
+    }
+    last_seed = seed;
+    last_table = table.get();
+    return *table;
+}
+
+vec3 calc_terrain_with_gradient_table(const TerrainNoiseTable& table, const Terrain& terrain, vec2 pos) {
+    switch (terrain.octaves) {
+    case 1: return calc_terrain_with_gradient_table<1>(table, pos, terrain.scale, 1, terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    case 2: return calc_terrain_with_gradient_table<2>(table, pos, terrain.scale, 2, terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    case 3: return calc_terrain_with_gradient_table<3>(table, pos, terrain.scale, 3, terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    case 4: return calc_terrain_with_gradient_table<4>(table, pos, terrain.scale, 4, terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    default: return calc_terrain_with_gradient_table<0>(table, pos, terrain.scale, terrain.octaves, terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    }
+}
+
+template <int OCTAVES>
+static void calc_terrain_with_gradient_table_batch_impl(const TerrainNoiseTable& table, Span<const vec2> pos, Span<vec3> out, const Terrain& terrain) {
+    for (uint32_t i = 0; i < pos.size(); i++) {
+        out[i] = calc_terrain_with_gradient_table<OCTAVES>(table, pos[i], terrain.scale, terrain.octaves,
+            terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+    }
+}
+
+void calc_terrain_with_gradient_table_batch(const TerrainNoiseTable& table, Span<const vec2> pos, Span<vec3> out, const Terrain& terrain) {
+    // Dispatch once per batch instead of once per point
+    switch (terrain.octaves) {
+    case 1: calc_terrain_with_gradient_table_batch_impl<1>(table, pos, out, terrain); break;
+    case 2: calc_terrain_with_gradient_table_batch_impl<2>(table, pos, out, terrain); break;
+    case 3: calc_terrain_with_gradient_table_batch_impl<3>(table, pos, out, terrain); break;
+    case 4: calc_terrain_with_gradient_table_batch_impl<4>(table, pos, out, terrain); break;
+    default: calc_terrain_with_gradient_table_batch_impl<0>(table, pos, out, terrain); break;
+    }
+}
+
+#endif
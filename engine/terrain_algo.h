@@ -4,14 +4,86 @@
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 
-#include "terrain.h"
+#include "core/vector.h"
+#include "core/span.h"
+
+enum class TerrainNoise : int32_t {
+    Hash = 0,   // gradients from pcg_hash of the lattice coordinates
+    Table = 1   // gradients from a seeded permutation table (TerrainNoiseTable)
+};
+
+struct Terrain {
+    TerrainNoise noise = TerrainNoise::Hash;
+
+    float scale = 4.0f;
+
+    int32_t octaves = 4;
+    int32_t seed = 0;
+    float persistance = 0.25f;
+    float lacunarity = 2.0f;
+
+    float chunk_width = 10.0f;
+    float height_multiplier = 20.0f;
+
+    Vector<int> chunk_sizes = {31, 63, 127};
+};
+
+// Classic Perlin permutation table, doubled so that perm[perm[x] + y] never needs wrapping,
+// plus one random unit gradient per entry. The layout matches the std430 NoiseTable buffer in terrain.vert.
+struct TerrainNoiseTable {
+    uint32_t perm[512];
+    glm::vec2 grad[256];
+
+    void build(uint32_t seed);
+};
+
+// Returns the table for a seed, building it on first use. Tables are never freed, so the reference stays valid.
+const TerrainNoiseTable& terrain_noise_table(uint32_t seed);
 
 glm::vec3 calc_terrain_with_gradient(glm::vec2 pos, 
     float in_scale, int octaves, uint32_t seed, float persistance, float lacunarity,
     float out_scale_width, float out_scale_height);
 
-inline glm::vec3 calc_terrain_with_gradient(const Terrain& terrain, glm::vec2 pos) {
+// Same as calc_terrain_with_gradient but with the table noise.
+// OCTAVES = 1..4 unrolls the octave loop at compile time, OCTAVES = 0 uses the runtime octave count.
+template <int OCTAVES>
+glm::vec3 calc_terrain_with_gradient_table(const TerrainNoiseTable& table, glm::vec2 pos,
+    float in_scale, int octaves, float persistance, float lacunarity,
+    float out_scale_width, float out_scale_height);
+
+// Picks the specialization for terrain.octaves
+glm::vec3 calc_terrain_with_gradient_table(const TerrainNoiseTable& table, const Terrain& terrain, glm::vec2 pos);
+
+inline glm::vec3 calc_terrain_with_gradient_hash(const Terrain& terrain, glm::vec2 pos) {
     return calc_terrain_with_gradient(pos,
         terrain.scale, terrain.octaves, terrain.seed, terrain.persistance, terrain.lacunarity,
         terrain.chunk_width, terrain.height_multiplier);
 }
+
+inline glm::vec3 calc_terrain_with_gradient(const Terrain& terrain, glm::vec2 pos) {
+    if (terrain.noise == TerrainNoise::Table) {
+        return calc_terrain_with_gradient_table(terrain_noise_table(terrain.seed), terrain, pos);
+    }
+    return calc_terrain_with_gradient_hash(terrain, pos);
+}
+
+// Conservative height range of the whole terrain (each octave of the noise is in [-1, 1]).
+inline void calc_terrain_height_bounds(const Terrain& terrain, float& min_height, float& max_height) {
+    float amplitude = 1.0f, total = 0.0f;
+    for (int k = 0; k < terrain.octaves; k++) {
+        total += amplitude;
+        amplitude *= terrain.persistance;
+    }
+    max_height = total * terrain.height_multiplier;
+    min_height = -max_height;
+}
+
+// Evaluates calc_terrain_with_gradient for every point in pos (out must be the same size).
+// The hash noise uses 8-wide AVX2 when the CPU supports it, otherwise falls back to the scalar version.
+void calc_terrain_with_gradient_batch(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain);
+
+// These always use the hash noise, regardless of terrain.noise
+void calc_terrain_with_gradient_batch_scalar(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain);
+void calc_terrain_with_gradient_batch_avx2(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain);
+
+void calc_terrain_with_gradient_table_batch(const TerrainNoiseTable& table, Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain);
@@ -0,0 +1,170 @@
+#include "terrain_algo.h"
+
+#include "core/cpu.h"
+
+#include <immintrin.h>
+
+void calc_terrain_with_gradient_batch_scalar(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain) {
+    for (uint32_t i = 0; i < pos.size(); i++) {
+        out[i] = calc_terrain_with_gradient_hash(terrain, pos[i]);
+    }
+}
+
+// 8-wide port of pcg_hash/conv_float/perlin2d_with_deriv in terrain_algo.cpp.
+// Keep the operation order in sync with the scalar/GLSL version so that results match.
+
+CPU_TARGET_AVX2 static inline __m256i pcg_hash_8(__m256i value) {
+    __m256i state = _mm256_add_epi32(_mm256_mullo_epi32(value, _mm256_set1_epi32(747796405u)), _mm256_set1_epi32(2891336453u));
+    __m256i shift = _mm256_add_epi32(_mm256_srli_epi32(state, 28), _mm256_set1_epi32(4));
+    __m256i word = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_srlv_epi32(state, shift), state), _mm256_set1_epi32(277803737u));
+    return _mm256_xor_si256(_mm256_srli_epi32(word, 22), word);
+}
+
+CPU_TARGET_AVX2 static inline __m256 conv_float_8(__m256i n) {
+    n = _mm256_and_si256(n, _mm256_set1_epi32(0x007FFFFF));
+    n = _mm256_or_si256(n, _mm256_set1_epi32(0x3F800000));
+    return _mm256_sub_ps(_mm256_castsi256_ps(n), _mm256_set1_ps(1.0f));
+}
+
+// Gradient of one lattice corner, from its seed
+CPU_TARGET_AVX2 static inline void corner_grad_8(__m256i seed, __m256& grad_x, __m256& grad_y) {
+    __m256i sx = _mm256_xor_si256(seed, pcg_hash_8(seed));
+    __m256i sy = _mm256_xor_si256(sx, pcg_hash_8(sx));
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 gx = _mm256_sub_ps(conv_float_8(sx), half);
+    __m256 gy = _mm256_sub_ps(conv_float_8(sy), half);
+    __m256 norm = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy))));
+    grad_x = _mm256_mul_ps(gx, norm);
+    grad_y = _mm256_mul_ps(gy, norm);
+}
+
+// C2 interpolation: blend.xy = f^3 (f (6f - 15) + 10), blend.zw = f^2 (f (30f - 60) + 30)
+CPU_TARGET_AVX2 static inline __m256 blend_val_8(__m256 f) {
+    __m256 t = _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(6.0f)), _mm256_set1_ps(-15.0f));
+    t = _mm256_add_ps(_mm256_mul_ps(f, t), _mm256_set1_ps(10.0f));
+    t = _mm256_mul_ps(f, t);
+    return _mm256_mul_ps(_mm256_mul_ps(f, f), t);
+}
+
+CPU_TARGET_AVX2 static inline __m256 blend_deriv_8(__m256 f) {
+    __m256 t = _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(30.0f)), _mm256_set1_ps(-60.0f));
+    t = _mm256_add_ps(_mm256_mul_ps(f, t), _mm256_set1_ps(30.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(f, f), t);
+}
+
+// One component of the (dotval, grad_x, grad_y) vec3 arithmetic in the scalar version
+CPU_TARGET_AVX2 static inline __m256 combine_corners_8(__m256 v0, __m256 v1, __m256 v2, __m256 v3, __m256 bx, __m256 by,
+                                                       __m256& k0, __m256& k1, __m256& k2) {
+    k0 = _mm256_sub_ps(v1, v0);
+    k1 = _mm256_sub_ps(v2, v0);
+    k2 = _mm256_sub_ps(_mm256_sub_ps(v3, v2), k0);
+    return _mm256_add_ps(_mm256_add_ps(v0, _mm256_mul_ps(bx, k0)),
+        _mm256_mul_ps(by, _mm256_add_ps(k1, _mm256_mul_ps(bx, k2))));
+}
+
+CPU_TARGET_AVX2 static inline void perlin2d_with_deriv_8(__m256 px, __m256 py, __m256& out_n, __m256& out_dx, __m256& out_dy) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 pix_f = _mm256_floor_ps(px);
+    __m256 piy_f = _mm256_floor_ps(py);
+    __m256 fx0 = _mm256_sub_ps(px, pix_f);
+    __m256 fy0 = _mm256_sub_ps(py, piy_f);
+    __m256 fx1 = _mm256_sub_ps(px, _mm256_add_ps(pix_f, one));
+    __m256 fy1 = _mm256_sub_ps(py, _mm256_add_ps(piy_f, one));
+
+    __m256i pix = _mm256_cvttps_epi32(pix_f);
+    __m256i piy = _mm256_cvttps_epi32(piy_f);
+    __m256i pix1 = _mm256_add_epi32(pix, _mm256_set1_epi32(1));
+    __m256i piy1 = _mm256_add_epi32(piy, _mm256_set1_epi32(1));
+
+    __m256i seed_tmp1 = pcg_hash_8(pix);
+    __m256i seed_tmp2 = pcg_hash_8(pix1);
+    __m256i seed1 = pcg_hash_8(_mm256_xor_si256(piy, seed_tmp1));
+    __m256i seed2 = pcg_hash_8(_mm256_xor_si256(piy, seed_tmp2));
+    __m256i seed3 = pcg_hash_8(_mm256_xor_si256(piy1, seed_tmp1));
+    __m256i seed4 = pcg_hash_8(_mm256_xor_si256(piy1, seed_tmp2));
+
+    __m256 gx0, gy0, gx1, gy1, gx2, gy2, gx3, gy3;
+    corner_grad_8(seed1, gx0, gy0);
+    corner_grad_8(seed2, gx1, gy1);
+    corner_grad_8(seed3, gx2, gy2);
+    corner_grad_8(seed4, gx3, gy3);
+
+    __m256 d0 = _mm256_add_ps(_mm256_mul_ps(gx0, fx0), _mm256_mul_ps(gy0, fy0));
+    __m256 d1 = _mm256_add_ps(_mm256_mul_ps(gx1, fx1), _mm256_mul_ps(gy1, fy0));
+    __m256 d2 = _mm256_add_ps(_mm256_mul_ps(gx2, fx0), _mm256_mul_ps(gy2, fy1));
+    __m256 d3 = _mm256_add_ps(_mm256_mul_ps(gx3, fx1), _mm256_mul_ps(gy3, fy1));
+
+    __m256 bx = blend_val_8(fx0);
+    __m256 by = blend_val_8(fy0);
+    __m256 bz = blend_deriv_8(fx0);
+    __m256 bw = blend_deriv_8(fy0);
+
+    __m256 k0n, k1n, k2n, k0x, k1x, k2x, k0y, k1y, k2y;
+    __m256 rn = combine_corners_8(d0, d1, d2, d3, bx, by, k0n, k1n, k2n);
+    __m256 rx = combine_corners_8(gx0, gx1, gx2, gx3, bx, by, k0x, k1x, k2x);
+    __m256 ry = combine_corners_8(gy0, gy1, gy2, gy3, bx, by, k0y, k1y, k2y);
+    rx = _mm256_add_ps(rx, _mm256_mul_ps(bz, _mm256_add_ps(k0n, _mm256_mul_ps(by, k2n))));
+    ry = _mm256_add_ps(ry, _mm256_mul_ps(bw, _mm256_add_ps(k1n, _mm256_mul_ps(bx, k2n))));
+
+    const __m256 sqrt2 = _mm256_set1_ps(1.4142135623730950488016887242097f);
+    out_n = _mm256_mul_ps(rn, sqrt2);
+    out_dx = _mm256_mul_ps(rx, sqrt2);
+    out_dy = _mm256_mul_ps(ry, sqrt2);
+}
+
+CPU_TARGET_AVX2 void calc_terrain_with_gradient_batch_avx2(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain) {
+    const uint32_t n = pos.size();
+    const __m256 out_width = _mm256_set1_ps(terrain.chunk_width);
+    const float grad_scale = terrain.height_multiplier / terrain.chunk_width;
+
+    for (uint32_t base = 0; base < n; base += 8) {
+        const uint32_t count = n - base < 8 ? n - base : 8;
+
+        alignas(32) float xs[8] = {};
+        alignas(32) float ys[8] = {};
+        for (uint32_t l = 0; l < count; l++) {
+            xs[l] = pos[base + l].x;
+            ys[l] = pos[base + l].y;
+        }
+        __m256 uv_x = _mm256_div_ps(_mm256_load_ps(xs), out_width);
+        __m256 uv_y = _mm256_div_ps(_mm256_load_ps(ys), out_width);
+
+        __m256 height = _mm256_setzero_ps();
+        __m256 grad_x = _mm256_setzero_ps();
+        __m256 grad_y = _mm256_setzero_ps();
+        float amplitude = 1.0f;
+        float frequency = 1.0f / terrain.scale;
+        for (int k = 0; k < terrain.octaves; k++) {
+            __m256 freq = _mm256_set1_ps(frequency);
+            __m256 amp = _mm256_set1_ps(amplitude);
+            __m256 pn, pdx, pdy;
+            perlin2d_with_deriv_8(_mm256_mul_ps(freq, uv_x), _mm256_mul_ps(freq, uv_y), pn, pdx, pdy);
+            height = _mm256_add_ps(height, _mm256_mul_ps(amp, pn));
+            grad_x = _mm256_add_ps(grad_x, _mm256_mul_ps(freq, _mm256_mul_ps(amp, pdx)));
+            grad_y = _mm256_add_ps(grad_y, _mm256_mul_ps(freq, _mm256_mul_ps(amp, pdy)));
+            amplitude *= terrain.persistance;
+            frequency *= terrain.lacunarity;
+        }
+
+        alignas(32) float hs[8], gxs[8], gys[8];
+        _mm256_store_ps(hs, _mm256_mul_ps(height, _mm256_set1_ps(terrain.height_multiplier)));
+        _mm256_store_ps(gxs, _mm256_mul_ps(grad_x, _mm256_set1_ps(grad_scale)));
+        _mm256_store_ps(gys, _mm256_mul_ps(grad_y, _mm256_set1_ps(grad_scale)));
+        for (uint32_t l = 0; l < count; l++) {
+            out[base + l] = glm::vec3(hs[l], gxs[l], gys[l]);
+        }
+    }
+}
+
+void calc_terrain_with_gradient_batch(Span<const glm::vec2> pos, Span<glm::vec3> out, const Terrain& terrain) {
+    if (terrain.noise == TerrainNoise::Table) {
+        calc_terrain_with_gradient_table_batch(terrain_noise_table(terrain.seed), pos, out, terrain);
+    }
+    else if (cpu_supports_avx2()) {
+        calc_terrain_with_gradient_batch_avx2(pos, out, terrain);
+    }
+    else {
+        calc_terrain_with_gradient_batch_scalar(pos, out, terrain);
+    }
+}
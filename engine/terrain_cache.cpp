@@ -0,0 +1,203 @@
+#include "terrain_cache.h"
+
+#include <glm/common.hpp>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+TerrainHeightCache::TerrainHeightCache(Pool* thread_pool, const Terrain* terrain, float tile_size, int ring_radius)
+    : _thread_pool(thread_pool), _terrain(terrain), _params(TerrainNoiseParams::from(*terrain)),
+    _tile_size(tile_size), _ring_radius(ring_radius), _ring_width(2 * ring_radius + 1) {
+
+    _tiles = new TerrainHeightTile[_ring_width * _ring_width];
+}
+
+TerrainHeightCache::~TerrainHeightCache() {
+    wait_all();
+    delete[] _tiles;
+}
+
+void TerrainHeightCache::wait_all() {
+    for (int i = 0; i < _ring_width * _ring_width; i++) {
+        if (_tiles[i].task) {
+            task_wait_and_release(_tiles[i].task);
+            _tiles[i].task = nullptr;
+        }
+    }
+}
+
+glm::ivec2 TerrainHeightCache::tile_coord(glm::vec2 pos) const {
+    return glm::ivec2(glm::floor(pos / _tile_size));
+}
+
+TerrainHeightTile& TerrainHeightCache::slot(glm::ivec2 coord) {
+    int x = ((coord.x % _ring_width) + _ring_width) % _ring_width;
+    int y = ((coord.y % _ring_width) + _ring_width) % _ring_width;
+    return _tiles[y * _ring_width + x];
+}
+
+const TerrainHeightTile& TerrainHeightCache::slot(glm::ivec2 coord) const {
+    return const_cast<TerrainHeightCache*>(this)->slot(coord);
+}
+
+void TerrainHeightCache::update(glm::vec2 center) {
+    ZoneScoped;
+
+    auto params = TerrainNoiseParams::from(*_terrain);
+    if (!(params == _params)) {
+        _params = params;
+        invalidate();
+    }
+
+    // Walk the ring from the center outwards, so that the closest tiles get scheduled first
+    glm::ivec2 center_coord = tile_coord(center);
+    for (int k = 0; k <= _ring_radius; k++) {
+        for (int dy = -k; dy <= k; dy++) {
+            for (int dx = -k; dx <= k; dx++) {
+                if (glm::max(glm::abs(dx), glm::abs(dy)) != k) continue;
+
+                glm::ivec2 coord = center_coord + glm::ivec2(dx, dy);
+                auto& tile = slot(coord);
+                if (tile.pending.load(std::memory_order_acquire)) continue;
+                if (tile.task) {
+                    task_release(tile.task);
+                    tile.task = nullptr;
+                }
+                if (tile.coord != coord || tile.generation != _generation) {
+                    schedule_tile(tile, coord);
+                }
+            }
+        }
+    }
+}
+
+static void build_height_pyramid(TerrainHeightTile& tile) {
+    constexpr int N = TerrainHeightCache::TILE_RES + 1;
+    const glm::vec3* s = tile.samples.data();
+    glm::vec2* bounds = tile.height_bounds.data();
+
+    for (int y = 0; y < TerrainHeightCache::TILE_RES; y++) {
+        for (int x = 0; x < TerrainHeightCache::TILE_RES; x++) {
+            int i = y * N + x;
+            float h00 = s[i].x, h10 = s[i + 1].x, h01 = s[i + N].x, h11 = s[i + N + 1].x;
+            bounds[y * TerrainHeightCache::TILE_RES + x] = glm::vec2(
+                glm::min(glm::min(h00, h10), glm::min(h01, h11)),
+                glm::max(glm::max(h00, h10), glm::max(h01, h11)));
+        }
+    }
+
+    for (int level = 1; level < TerrainHeightCache::PYRAMID_LEVELS; level++) {
+        const glm::vec2* src = bounds + TerrainHeightCache::pyramid_offset(level - 1);
+        glm::vec2* dst = bounds + TerrainHeightCache::pyramid_offset(level);
+        int src_res = TerrainHeightCache::TILE_RES >> (level - 1);
+        int res = src_res / 2;
+        for (int y = 0; y < res; y++) {
+            for (int x = 0; x < res; x++) {
+                glm::vec2 b00 = src[(2 * y) * src_res + 2 * x], b10 = src[(2 * y) * src_res + 2 * x + 1];
+                glm::vec2 b01 = src[(2 * y + 1) * src_res + 2 * x], b11 = src[(2 * y + 1) * src_res + 2 * x + 1];
+                dst[y * res + x] = glm::vec2(
+                    glm::min(glm::min(b00.x, b10.x), glm::min(b01.x, b11.x)),
+                    glm::max(glm::max(b00.y, b10.y), glm::max(b01.y, b11.y)));
+            }
+        }
+    }
+}
+
+void TerrainHeightCache::schedule_tile(TerrainHeightTile& tile, glm::ivec2 coord) {
+    constexpr int N = TILE_RES + 1;
+    if (tile.samples.size() != N * N) {
+        tile.samples.resize(N * N);
+    }
+    if (tile.height_bounds.size() != pyramid_offset(PYRAMID_LEVELS)) {
+        tile.height_bounds.resize(pyramid_offset(PYRAMID_LEVELS));
+    }
+    tile.coord = coord;
+    tile.generation = 0;
+    tile.pending.store(true, std::memory_order_relaxed);
+
+    TerrainHeightTile* tile_ptr = &tile;
+    TerrainNoiseParams params = _params;
+    uint32_t generation = _generation;
+    float tile_size = _tile_size;
+    tile.task = drjit::do_async([tile_ptr, coord, params, generation, tile_size]() {
+        ZoneScopedN("GenerateTerrainTile");
+        Terrain terrain;
+        params.apply_to(terrain);
+
+        glm::vec2 row_pos[N];
+        glm::vec2 origin = glm::vec2(coord) * tile_size;
+        for (int y = 0; y < N; y++) {
+            for (int x = 0; x < N; x++) {
+                row_pos[x] = origin + glm::vec2(x, y) * (tile_size / TILE_RES);
+            }
+            calc_terrain_with_gradient_batch(Span<const glm::vec2>(row_pos, N),
+                Span<glm::vec3>(tile_ptr->samples.data() + y * N, N), terrain);
+        }
+        build_height_pyramid(*tile_ptr);
+        tile_ptr->generation = generation;
+        tile_ptr->pending.store(false, std::memory_order_release);
+    }, {}, _thread_pool);
+}
+
+const TerrainHeightTile* TerrainHeightCache::find_ready_tile(glm::ivec2 coord) const {
+    const auto& tile = slot(coord);
+    if (tile.pending.load(std::memory_order_acquire)) return nullptr;
+    if (tile.coord != coord || tile.generation != _generation) return nullptr;
+    return &tile;
+}
+
+void TerrainHeightCache::min_heights(int level, glm::ivec2 first_cell, int res, Span<float> out) const {
+    const int cells_per_tile = TILE_RES >> level;
+    const glm::vec2* level_bounds = nullptr;
+    glm::ivec2 cached_coord = glm::ivec2(INT32_MIN);
+    const TerrainHeightTile* tile = nullptr;
+
+    float terrain_min_height, terrain_max_height;
+    calc_terrain_height_bounds(*_terrain, terrain_min_height, terrain_max_height);
+
+    for (int y = 0; y < res; y++) {
+        for (int x = 0; x < res; x++) {
+            glm::ivec2 cell = first_cell + glm::ivec2(x, y);
+            glm::ivec2 coord = glm::ivec2(glm::floor(glm::vec2(cell) / (float)cells_per_tile));
+            if (coord != cached_coord) {
+                cached_coord = coord;
+                tile = find_ready_tile(coord);
+                level_bounds = tile ? tile->height_bounds.data() + pyramid_offset(level) : nullptr;
+            }
+            if (!tile) {
+                out[y * res + x] = terrain_min_height;
+                continue;
+            }
+            glm::ivec2 local = cell - coord * cells_per_tile;
+            out[y * res + x] = level_bounds[local.y * cells_per_tile + local.x].x;
+        }
+    }
+}
+
+bool TerrainHeightCache::try_sample(glm::vec2 pos, glm::vec3& out) const {
+    constexpr int N = TILE_RES + 1;
+
+    glm::vec2 t = pos / _tile_size;
+    glm::ivec2 coord = glm::ivec2(glm::floor(t));
+    const TerrainHeightTile* tile = find_ready_tile(coord);
+    if (!tile) return false;
+
+    glm::vec2 local = (t - glm::vec2(coord)) * (float)TILE_RES;
+    glm::ivec2 i = glm::clamp(glm::ivec2(local), glm::ivec2(0), glm::ivec2(TILE_RES - 1));
+    glm::vec2 f = local - glm::vec2(i);
+
+    const glm::vec3* s = tile->samples.data() + i.y * N + i.x;
+    glm::vec3 top = glm::mix(s[0], s[1], f.x);
+    glm::vec3 bottom = glm::mix(s[N], s[N + 1], f.x);
+    out = glm::mix(top, bottom, f.y);
+    return true;
+}
+
+glm::vec3 TerrainHeightCache::sample(glm::vec2 pos) const {
+    glm::vec3 res;
+    if (try_sample(pos, res)) {
+        return res;
+    }
+    return calc_terrain_with_gradient(*_terrain, pos);
+}
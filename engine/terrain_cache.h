@@ -0,0 +1,118 @@
+#pragma once
+
+#include "terrain_algo.h"
+
+#include "core/vector.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <atomic>
+
+struct Pool;
+struct Task;
+
+// Noise parameters that affect the generated heights (chunk_sizes only matter for rendering).
+struct TerrainNoiseParams {
+    TerrainNoise noise;
+    float scale;
+    int32_t octaves;
+    int32_t seed;
+    float persistance;
+    float lacunarity;
+    float chunk_width;
+    float height_multiplier;
+
+    static TerrainNoiseParams from(const Terrain& terrain) {
+        return {terrain.noise, terrain.scale, terrain.octaves, terrain.seed, terrain.persistance, terrain.lacunarity,
+            terrain.chunk_width, terrain.height_multiplier};
+    }
+    void apply_to(Terrain& terrain) const {
+        terrain.noise = noise;
+        terrain.scale = scale;
+        terrain.octaves = octaves;
+        terrain.seed = seed;
+        terrain.persistance = persistance;
+        terrain.lacunarity = lacunarity;
+        terrain.chunk_width = chunk_width;
+        terrain.height_multiplier = height_multiplier;
+    }
+    bool operator==(const TerrainNoiseParams& other) const = default;
+};
+
+struct TerrainHeightTile {
+    glm::ivec2 coord = glm::ivec2(INT32_MIN);
+    // (TILE_RES+1)^2 samples of (height, grad.x, grad.y), edges are shared with the neighboring tiles
+    Vector<glm::vec3> samples;
+    // Min/max height pyramid over the cells between the samples: level 0 has TILE_RES^2 cells,
+    // each level halves the resolution down to a single cell covering the whole tile.
+    // Since the cells are bilinearly interpolated, the bounds are exact for the cached surface.
+    Vector<glm::vec2> height_bounds;
+    uint32_t generation = 0;
+
+    std::atomic<bool> pending = false;
+    Task* task = nullptr;
+};
+
+// Caches precomputed terrain height+gradient tiles in a square ring around a center point.
+// Tiles are generated asynchronously on the thread pool and live in a toroidal array,
+// so finding the tile for a position is O(1).
+// sample() may be called from multiple threads at once, but not concurrently with update().
+class TerrainHeightCache {
+public:
+    static constexpr int TILE_RES = 64;
+    static constexpr int PYRAMID_LEVELS = 7;    // log2(TILE_RES) + 1
+
+    static_assert((1 << (PYRAMID_LEVELS - 1)) == TILE_RES);
+
+    // Index of the first cell of a level in TerrainHeightTile::height_bounds
+    static constexpr int pyramid_offset(int level) {
+        int offset = 0;
+        for (int k = 0; k < level; k++) {
+            offset += (TILE_RES >> k) * (TILE_RES >> k);
+        }
+        return offset;
+    }
+
+    TerrainHeightCache(Pool* thread_pool, const Terrain* terrain, float tile_size = 64.0f, int ring_radius = 2);
+    ~TerrainHeightCache();
+
+    // Re-centers the ring, schedules missing tiles and invalidates everything if the terrain changed.
+    void update(glm::vec2 center);
+
+    // Returns (height, grad.x, grad.y), bilinearly interpolated from the cache.
+    // Falls back to evaluating the noise directly if the tile isn't ready yet.
+    glm::vec3 sample(glm::vec2 pos) const;
+    bool try_sample(glm::vec2 pos, glm::vec3& out) const;
+
+    void invalidate() { _generation++; }
+    void wait_all();
+
+    const Terrain& terrain() const { return *_terrain; }
+    float tile_size() const { return _tile_size; }
+    int ring_radius() const { return _ring_radius; }
+    uint32_t generation() const { return _generation; }
+
+    const TerrainHeightTile* find_ready_tile(glm::ivec2 coord) const;
+
+    // Lower bounds of the cached surface on res x res cells of a pyramid level, starting at first_cell (counted in
+    // cells of that level from the world origin, rows along z). Cells of tiles that aren't ready get the bound of
+    // the whole terrain.
+    void min_heights(int level, glm::ivec2 first_cell, int res, Span<float> out) const;
+    glm::ivec2 tile_coord(glm::vec2 pos) const;
+
+private:
+    TerrainHeightTile& slot(glm::ivec2 coord);
+    const TerrainHeightTile& slot(glm::ivec2 coord) const;
+    void schedule_tile(TerrainHeightTile& tile, glm::ivec2 coord);
+
+    Pool* _thread_pool;
+    const Terrain* _terrain;
+    TerrainNoiseParams _params;
+
+    float _tile_size;
+    int _ring_radius;
+    int _ring_width;
+    TerrainHeightTile* _tiles;
+    uint32_t _generation = 1;
+};
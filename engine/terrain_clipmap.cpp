@@ -0,0 +1,209 @@
+#include "terrain_clipmap.h"
+
+#include "core/log.h"
+
+#include <glm/common.hpp>
+
+#include <string.h>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+// World units per finest texel, relative to the chunk width
+static constexpr float TEXELS_PER_CHUNK = 64.0f;
+
+static inline int floor_mod(int x, int m) {
+    return ((x % m) + m) % m;
+}
+
+// Splits a rectangle (at most res wide in each direction) at the multiples of res
+static void add_split_region(glm::ivec2 texel, glm::ivec2 size, int res, Vector<TerrainClipmapRegion>& out) {
+    if (size.x <= 0 || size.y <= 0) return;
+
+    int split_x = glm::min(size.x, res - floor_mod(texel.x, res));
+    int split_y = glm::min(size.y, res - floor_mod(texel.y, res));
+    const int x0[2] = {0, split_x}, widths[2] = {split_x, size.x - split_x};
+    const int y0[2] = {0, split_y}, heights[2] = {split_y, size.y - split_y};
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            if (widths[i] > 0 && heights[j] > 0) {
+                out.push_back(TerrainClipmapRegion{texel + glm::ivec2(x0[i], y0[j]), glm::ivec2(widths[i], heights[j])});
+            }
+        }
+    }
+}
+
+void TerrainClipmap::dirty_regions(glm::ivec2 old_origin, glm::ivec2 new_origin, int res, bool full, Vector<TerrainClipmapRegion>& out) {
+    glm::ivec2 delta = new_origin - old_origin;
+    if (full || glm::abs(delta.x) >= res || glm::abs(delta.y) >= res) {
+        add_split_region(new_origin, glm::ivec2(res), res, out);
+        return;
+    }
+
+    // Newly exposed columns over the full height of the window
+    if (delta.x > 0) {
+        add_split_region(glm::ivec2(old_origin.x + res, new_origin.y), glm::ivec2(delta.x, res), res, out);
+    }
+    else if (delta.x < 0) {
+        add_split_region(new_origin, glm::ivec2(-delta.x, res), res, out);
+    }
+
+    // Newly exposed rows, minus the columns above
+    int x0 = glm::max(old_origin.x, new_origin.x);
+    int width = res - glm::abs(delta.x);
+    if (delta.y > 0) {
+        add_split_region(glm::ivec2(x0, old_origin.y + res), glm::ivec2(width, delta.y), res, out);
+    }
+    else if (delta.y < 0) {
+        add_split_region(glm::ivec2(x0, new_origin.y), glm::ivec2(width, -delta.y), res, out);
+    }
+}
+
+TerrainClipmap::TerrainClipmap(Pool* thread_pool, const Terrain* terrain, int num_levels, int res)
+    : _thread_pool(thread_pool), _terrain(terrain), _params(TerrainNoiseParams::from(*terrain)),
+      _num_levels(num_levels), _res(res), _base_spacing(terrain->chunk_width / TEXELS_PER_CHUNK) {
+
+    log_assert(_num_levels <= MAX_LEVELS && (_res & (_res - 1)) == 0, "Invalid terrain clipmap size!");
+    _levels = new Level[_num_levels];
+    _levels_gpu.resize(_num_levels);
+    _level_generation.resize(_num_levels);
+    for (int k = 0; k < _num_levels; k++) {
+        _levels_gpu[k] = {glm::ivec2(0), spacing(k), 0};
+        _level_generation[k] = 0;
+    }
+}
+
+TerrainClipmap::~TerrainClipmap() {
+    wait_all();
+    delete[] _levels;
+}
+
+void TerrainClipmap::wait_all() {
+    for (int k = 0; k < _num_levels; k++) {
+        if (_levels[k].task) {
+            task_wait(_levels[k].task);
+        }
+    }
+}
+
+uint32_t TerrainClipmap::num_pending() const {
+    uint32_t count = 0;
+    for (int k = 0; k < _num_levels; k++) {
+        if (_levels[k].task) count++;
+    }
+    return count;
+}
+
+glm::ivec2 TerrainClipmap::window_origin(int level, glm::vec2 center) const {
+    return glm::ivec2(glm::floor(center / spacing(level))) - _res / 2;
+}
+
+void TerrainClipmap::schedule_level(int level_idx, glm::ivec2 origin, bool full) {
+    auto& level = _levels[level_idx];
+    level.target_origin = origin;
+    level.target_generation = _generation;
+    level.regions.clear();
+    dirty_regions(_levels_gpu[level_idx].origin, origin, _res, full, level.regions);
+
+    level.pending.store(true, std::memory_order_relaxed);
+    Level* level_ptr = &level;
+    TerrainNoiseParams params = _params;
+    float spacing = this->spacing(level_idx);
+    level.task = drjit::do_async([level_ptr, params, spacing]() {
+        ZoneScopedN("GenerateTerrainClipmapLevel");
+
+        Terrain terrain;
+        params.apply_to(terrain);
+
+        uint32_t num_texels = 0;
+        for (const auto& region : level_ptr->regions) {
+            num_texels += region.size.x * region.size.y;
+        }
+        if (level_ptr->texels.size() != num_texels) {
+            level_ptr->texels.resize(num_texels);
+        }
+
+        Vector<glm::vec2> pos;
+        Vector<glm::vec3> samples;
+        uint32_t offset = 0;
+        for (const auto& region : level_ptr->regions) {
+            uint32_t count = region.size.x * region.size.y;
+            if (pos.size() < count) {
+                pos.resize(count);
+                samples.resize(count);
+            }
+            for (int y = 0; y < region.size.y; y++) {
+                for (int x = 0; x < region.size.x; x++) {
+                    pos[y * region.size.x + x] = spacing * glm::vec2(region.texel + glm::ivec2(x, y));
+                }
+            }
+            calc_terrain_with_gradient_batch(Span<const glm::vec2>(pos.data(), count), Span<glm::vec3>(samples.data(), count), terrain);
+            for (uint32_t i = 0; i < count; i++) {
+                level_ptr->texels[offset + i] = glm::vec4(samples[i], 0.0f);
+            }
+            offset += count;
+        }
+
+        level_ptr->pending.store(false, std::memory_order_release);
+    }, {}, _thread_pool);
+}
+
+void TerrainClipmap::update(glm::vec2 center) {
+    ZoneScoped;
+
+    auto params = TerrainNoiseParams::from(*_terrain);
+    if (!(params == _params)) {
+        _params = params;
+        _generation++;
+        _base_spacing = _terrain->chunk_width / TEXELS_PER_CHUNK;
+    }
+
+    for (int k = 0; k < _num_levels; k++) {
+        // One job per level at a time, the next one is diffed against the result of the previous one
+        if (_levels[k].task) continue;
+
+        bool full = _level_generation[k] != _generation;
+        glm::ivec2 origin = window_origin(k, center);
+        if (!full && origin == _levels_gpu[k].origin) continue;
+
+        schedule_level(k, origin, full);
+    }
+}
+
+void TerrainClipmap::collect_uploads(Vector<TerrainClipmapUpload>& uploads) {
+    ZoneScoped;
+
+    int finished[MAX_LEVELS];
+    int num_finished = 0;
+    uint32_t num_texels = 0;
+    for (int k = 0; k < _num_levels; k++) {
+        auto& level = _levels[k];
+        if (!level.task || level.pending.load(std::memory_order_acquire)) continue;
+
+        task_release(level.task);
+        level.task = nullptr;
+
+        // The terrain changed while this was generated, update() schedules it again
+        if (level.target_generation != _generation) continue;
+
+        for (const auto& region : level.regions) {
+            uploads.push_back({k, region, num_texels});
+            num_texels += region.size.x * region.size.y;
+        }
+        finished[num_finished++] = k;
+        _levels_gpu[k] = {level.target_origin, spacing(k), 1};
+        _level_generation[k] = level.target_generation;
+    }
+
+    // Regions of a level are laid out back to back, same as in Level::texels
+    if (_upload_data.size() != num_texels) {
+        _upload_data.resize(num_texels);
+    }
+    uint32_t offset = 0;
+    for (int i = 0; i < num_finished; i++) {
+        const auto& texels = _levels[finished[i]].texels;
+        memcpy(_upload_data.data() + offset, texels.data(), texels.size() * sizeof(glm::vec4));
+        offset += texels.size();
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "terrain_algo.h"
+#include "terrain_cache.h"
+
+#include "core/vector.h"
+#include "core/span.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <atomic>
+
+struct Pool;
+struct Task;
+
+// A rectangle of texels of one clipmap level, in texel coordinates of that level (texel * spacing = world position).
+// Regions never cross a multiple of the clipmap resolution, so they map to a contiguous rectangle of the texture.
+struct TerrainClipmapRegion {
+    glm::ivec2 texel;
+    glm::ivec2 size;
+};
+
+// A region whose texels are ready to be copied into the clipmap texture.
+struct TerrainClipmapUpload {
+    int level;
+    TerrainClipmapRegion region;
+    uint32_t first_texel;       // offset into TerrainClipmap::upload_data(), texels are row-major
+};
+
+// Per level state as seen by the GPU, matches the ClipmapLevels buffer in terrain.vert (std430).
+struct TerrainClipmapLevelGpu {
+    glm::ivec2 origin;          // first texel of the window, in texels of the level
+    float spacing;              // world units per texel
+    int32_t valid;
+};
+
+// Height clipmap around a moving center: num_levels nested windows of res x res texels of (height, grad.x, grad.y, 0),
+// level k has a texel spacing of base_spacing * 2^k. The windows are toroidally addressed, texel t of a level lives at
+// t mod res in the texture, so when the center moves only the newly exposed strips have to be generated and uploaded.
+// Generation runs on the thread pool, one job per level. A level keeps showing its old window until its job is done,
+// so the GPU state always matches the texture contents.
+class TerrainClipmap {
+public:
+    static constexpr int MAX_LEVELS = 16;
+
+    // res has to be a power of two
+    TerrainClipmap(Pool* thread_pool, const Terrain* terrain, int num_levels = 6, int res = 256);
+    ~TerrainClipmap();
+
+    // Schedules jobs for the levels whose window moved (or all levels if the terrain changed).
+    void update(glm::vec2 center);
+
+    // Appends the regions of the finished jobs. Their texels have to be copied into the texture before the next call,
+    // levels() already describes the windows after the copy.
+    void collect_uploads(Vector<TerrainClipmapUpload>& uploads);
+    Span<const glm::vec4> upload_data() const { return Span<const glm::vec4>(_upload_data.data(), _upload_data.size()); }
+
+    const Vector<TerrainClipmapLevelGpu>& levels() const { return _levels_gpu; }
+
+    void wait_all();
+
+    int num_levels() const { return _num_levels; }
+    int res() const { return _res; }
+    float spacing(int level) const { return _base_spacing * (float)(1 << level); }
+    glm::ivec2 window_origin(int level, glm::vec2 center) const;
+    uint32_t num_pending() const;
+
+    // Appends the parts of the window at new_origin that aren't covered by the window at old_origin, split at
+    // multiples of res. With full set (or if the windows don't overlap) the whole new window is returned.
+    static void dirty_regions(glm::ivec2 old_origin, glm::ivec2 new_origin, int res, bool full, Vector<TerrainClipmapRegion>& out);
+
+private:
+    struct Level {
+        std::atomic<bool> pending = false;
+        Task* task = nullptr;
+
+        glm::ivec2 target_origin = glm::ivec2(0);
+        uint32_t target_generation = 0;
+        Vector<TerrainClipmapRegion> regions;
+        Vector<glm::vec4> texels;
+    };
+
+    void schedule_level(int level, glm::ivec2 origin, bool full);
+
+    Pool* _thread_pool;
+    const Terrain* _terrain;
+    TerrainNoiseParams _params;
+    uint32_t _generation = 1;
+
+    int _num_levels;
+    int _res;
+    float _base_spacing;
+
+    Level* _levels;
+    Vector<TerrainClipmapLevelGpu> _levels_gpu;
+    Vector<uint32_t> _level_generation;
+    Vector<glm::vec4> _upload_data;
+};
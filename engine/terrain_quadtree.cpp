@@ -0,0 +1,193 @@
+#include "terrain_quadtree.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+TerrainQuadtree::TerrainQuadtree(Pool* thread_pool, const Terrain* terrain)
+    : _thread_pool(thread_pool), _terrain(terrain), _params(TerrainNoiseParams::from(*terrain)) {
+
+    calc_terrain_height_bounds(*_terrain, _global_min_height, _global_max_height);
+}
+
+TerrainQuadtree::~TerrainQuadtree() {
+    wait_all();
+}
+
+void TerrainQuadtree::wait_all() {
+    for (auto& [key, bounds] : _bounds) {
+        if (bounds.task) {
+            task_wait_and_release(bounds.task);
+            bounds.task = nullptr;
+        }
+    }
+}
+
+void TerrainQuadtree::schedule_bounds(TerrainNodeBounds& bounds, int level, glm::ivec2 pos) {
+    bounds.generation = 0;
+    bounds.pending.store(true, std::memory_order_relaxed);
+
+    TerrainNodeBounds* bounds_ptr = &bounds;
+    TerrainNoiseParams params = _params;
+    uint32_t generation = _generation;
+    bounds.task = drjit::do_async([bounds_ptr, level, pos, params, generation]() {
+        ZoneScopedN("ComputeTerrainNodeBounds");
+        constexpr int N = BOUNDS_RES + 1;
+
+        Terrain terrain;
+        params.apply_to(terrain);
+
+        const float node_width = (float)(1 << level) * terrain.chunk_width;
+        const float spacing = node_width / BOUNDS_RES;
+        const glm::vec2 origin = glm::vec2(pos) * terrain.chunk_width;
+
+        glm::vec2 sample_pos[N * N];
+        glm::vec3 samples[N * N];
+        for (int y = 0; y < N; y++) {
+            for (int x = 0; x < N; x++) {
+                sample_pos[y * N + x] = origin + spacing * glm::vec2(x, y);
+            }
+        }
+        calc_terrain_with_gradient_batch(Span<const glm::vec2>(sample_pos, N * N), Span<glm::vec3>(samples, N * N), terrain);
+
+        float min_h = samples[0].x, max_h = samples[0].x, max_slope = 0.0f;
+        for (int i = 0; i < N * N; i++) {
+            min_h = glm::min(min_h, samples[i].x);
+            max_h = glm::max(max_h, samples[i].x);
+            max_slope = glm::max(max_slope, glm::length(glm::vec2(samples[i].y, samples[i].z)));
+        }
+
+        // Peaks between samples: bound them with the steepest slope over half a diagonal,
+        // plus the full amplitude of the octaves too fine for the sampling rate
+        float margin = max_slope * spacing * 0.7072f;
+        float amplitude = 1.0f;
+        float wavelength = terrain.scale * terrain.chunk_width;
+        for (int k = 0; k < terrain.octaves; k++) {
+            if (wavelength < 4.0f * spacing) {
+                margin += amplitude * terrain.height_multiplier;
+            }
+            amplitude *= terrain.persistance;
+            wavelength /= terrain.lacunarity;
+        }
+
+        bounds_ptr->min_height = min_h - margin;
+        bounds_ptr->max_height = max_h + margin;
+        bounds_ptr->generation = generation;
+        bounds_ptr->pending.store(false, std::memory_order_release);
+    }, {}, _thread_pool);
+}
+
+const TerrainNodeBounds* TerrainQuadtree::get_bounds(int level, glm::ivec2 pos) {
+    auto [it, inserted] = _bounds.try_emplace(node_key(level, pos));
+    auto& bounds = it->second;
+    bounds.last_used_frame = _frame;
+
+    if (bounds.pending.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    if (bounds.task) {
+        task_release(bounds.task);
+        bounds.task = nullptr;
+    }
+    if (bounds.generation != _generation) {
+        schedule_bounds(bounds, level, pos);
+        return nullptr;
+    }
+    return &bounds;
+}
+
+void TerrainQuadtree::visit(int level, glm::ivec2 pos, glm::vec3 camera_pos, Vector<TerrainChunk>& out) {
+    const int size = 1 << level;
+    const float cw = _terrain->chunk_width;
+
+    float min_h = _global_min_height, max_h = _global_max_height;
+    if (auto bounds = get_bounds(level, pos)) {
+        min_h = bounds->min_height;
+        max_h = bounds->max_height;
+    }
+    else {
+        num_pending++;
+    }
+    glm::vec3 aabb_min = glm::vec3(pos.x * cw, min_h, pos.y * cw);
+    glm::vec3 aabb_max = glm::vec3((pos.x + size) * cw, max_h, (pos.y + size) * cw);
+
+    float dist = glm::length(glm::max(glm::max(aabb_min - camera_pos, camera_pos - aabb_max), glm::vec3(0)));
+    if (level > 0 && dist < lod_distance * size * cw) {
+        const int half = size / 2;
+        visit(level - 1, pos, camera_pos, out);
+        visit(level - 1, pos + glm::ivec2(half, 0), camera_pos, out);
+        visit(level - 1, pos + glm::ivec2(0, half), camera_pos, out);
+        visit(level - 1, pos + glm::ivec2(half, half), camera_pos, out);
+        return;
+    }
+
+    // Finest grid for the leaves, then one step coarser per level until the coarsest template
+    const int num_templates = _terrain->chunk_sizes.ssize();
+    int tmpl_idx = glm::clamp(num_templates - 1 - level, 0, num_templates - 1);
+    out.push_back({pos, level, tmpl_idx, min_h, max_h});
+}
+
+void TerrainQuadtree::evict_unused() {
+    constexpr uint32_t MAX_UNUSED_FRAMES = 120;
+    for (auto it = _bounds.begin(); it != _bounds.end(); ) {
+        auto& bounds = it->second;
+        if (_frame - bounds.last_used_frame > MAX_UNUSED_FRAMES && !bounds.pending.load(std::memory_order_acquire)) {
+            if (bounds.task) {
+                task_release(bounds.task);
+            }
+            _bounds.erase(it++);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void TerrainQuadtree::select(glm::vec3 camera_pos, Vector<TerrainChunk>& out) {
+    ZoneScoped;
+
+    _frame++;
+    num_pending = 0;
+
+    auto params = TerrainNoiseParams::from(*_terrain);
+    if (!(params == _params)) {
+        _params = params;
+        _generation++;
+        calc_terrain_height_bounds(*_terrain, _global_min_height, _global_max_height);
+    }
+
+    const int root_size = 1 << max_level;
+    glm::ivec2 root_center = glm::ivec2(glm::floor(glm::vec2(camera_pos.x, camera_pos.z) / (_terrain->chunk_width * root_size)));
+    for (int j = -root_radius; j <= root_radius; j++) {
+        for (int i = -root_radius; i <= root_radius; i++) {
+            visit(max_level, (root_center + glm::ivec2(i, j)) * root_size, camera_pos, out);
+        }
+    }
+
+    if (_frame % 60 == 0) {
+        evict_unused();
+    }
+}
+
+void TerrainQuadtree::cull(const Frustum& frustum, Span<const TerrainChunk> chunks, Vector<TerrainChunk>& out) {
+    ZoneScoped;
+
+    num_selected = 0;
+    num_culled = 0;
+
+    const float cw = _terrain->chunk_width;
+    for (const auto& chunk : chunks) {
+        const int size = 1 << chunk.level;
+        glm::vec3 aabb_min = glm::vec3(chunk.pos.x * cw, chunk.min_height, chunk.pos.y * cw);
+        glm::vec3 aabb_max = glm::vec3((chunk.pos.x + size) * cw, chunk.max_height, (chunk.pos.y + size) * cw);
+        if (frustum_culling && !frustum.intersects_aabb(aabb_min, aabb_max)) {
+            num_culled++;
+            continue;
+        }
+        out.push_back(chunk);
+        num_selected++;
+    }
+}
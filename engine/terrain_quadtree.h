@@ -0,0 +1,91 @@
+#pragma once
+
+#include "terrain_algo.h"
+#include "terrain_cache.h"
+
+#include "core/vector.h"
+#include "core/span.h"
+#include "core/map.h"
+#include "core/frustum.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <atomic>
+
+struct Pool;
+struct Task;
+
+// A selected quadtree node. pos and size are in chunk units (multiply by Terrain::chunk_width for world units).
+struct TerrainChunk {
+    glm::ivec2 pos;
+    int level;          // node covers 2^level x 2^level chunks
+    int tmpl_idx;       // index into Terrain::chunk_sizes
+    float min_height;   // height bounds of the node when it was selected, for culling
+    float max_height;
+
+    bool operator==(const TerrainChunk& other) const = default;
+};
+
+struct TerrainNodeBounds {
+    float min_height = 0.0f;
+    float max_height = 0.0f;
+    uint32_t generation = 0;
+    uint32_t last_used_frame = 0;
+
+    std::atomic<bool> pending = false;
+    Task* task = nullptr;
+};
+
+// CDLOD-style chunk selection: a quadtree over chunk space whose nodes are subdivided by camera distance.
+// The selection only depends on the camera's position, it's culled against the view frustum separately
+// using per-node min/max height bounds so that it can be kept while the camera turns.
+// The bounds are computed on the thread pool from the noise function and cached across frames.
+class TerrainQuadtree {
+public:
+    TerrainQuadtree(Pool* thread_pool, const Terrain* terrain);
+    ~TerrainQuadtree();
+
+    void select(glm::vec3 camera_pos, Vector<TerrainChunk>& out);
+    // Appends the chunks intersecting the frustum to out (all of them without frustum_culling)
+    void cull(const Frustum& frustum, Span<const TerrainChunk> chunks, Vector<TerrainChunk>& out);
+
+    void wait_all();
+
+    // Root nodes are 2^max_level chunks wide
+    int max_level = 5;
+    // Number of root nodes around the camera in each direction
+    int root_radius = 1;
+    // A node is subdivided while the camera is closer than lod_distance * (node width)
+    float lod_distance = 2.0f;
+    bool frustum_culling = true;
+
+    uint32_t num_selected = 0;
+    uint32_t num_culled = 0;
+    // Nodes visited with the conservative global bounds because theirs weren't computed yet.
+    // While this is nonzero the selection is provisional and should be redone on a later frame.
+    uint32_t num_pending = 0;
+
+    static constexpr int BOUNDS_RES = 16;
+
+private:
+    const TerrainNodeBounds* get_bounds(int level, glm::ivec2 pos);
+    void schedule_bounds(TerrainNodeBounds& bounds, int level, glm::ivec2 pos);
+    void visit(int level, glm::ivec2 pos, glm::vec3 camera_pos, Vector<TerrainChunk>& out);
+    void evict_unused();
+
+    static uint64_t node_key(int level, glm::ivec2 pos) {
+        return ((uint64_t)level << 56) | ((uint64_t)(pos.x & 0xFFFFFFF) << 28) | (uint64_t)(pos.y & 0xFFFFFFF);
+    }
+
+    Pool* _thread_pool;
+    const Terrain* _terrain;
+    TerrainNoiseParams _params;
+    uint32_t _generation = 1;
+    uint32_t _frame = 0;
+
+    // Conservative bound used while a node's bounds are still being computed
+    float _global_min_height, _global_max_height;
+
+    StableMap<uint64_t, TerrainNodeBounds> _bounds;
+};
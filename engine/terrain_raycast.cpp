@@ -0,0 +1,288 @@
+#include "terrain_raycast.h"
+#include "terrain_cache.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <cmath>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+// Clips [t0, t1] to the part of the ray inside the box, returns false if nothing is left.
+static bool clip_ray_to_box(glm::vec3 origin, glm::vec3 dir, glm::vec3 box_min, glm::vec3 box_max, float& t0, float& t1) {
+    for (int k = 0; k < 3; k++) {
+        if (dir[k] == 0.0f) {
+            if (origin[k] < box_min[k] || origin[k] > box_max[k]) return false;
+            continue;
+        }
+        float inv = 1.0f / dir[k];
+        float ta = (box_min[k] - origin[k]) * inv;
+        float tb = (box_max[k] - origin[k]) * inv;
+        t0 = glm::max(t0, glm::min(ta, tb));
+        t1 = glm::min(t1, glm::max(ta, tb));
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+static glm::vec3 normal_from_gradient(glm::vec2 grad) {
+    return glm::normalize(glm::vec3(-grad.x, 1.0f, -grad.y));
+}
+
+// Intersects the ray with one bilinear cell of a tile within [t0, t1].
+// Along the ray the height of the cell is a quadratic in t, so the intersection can be solved for directly.
+static bool intersect_cell(const TerrainHeightTile& tile, glm::vec2 tile_origin, float spacing, glm::ivec2 cell,
+        glm::vec3 origin, glm::vec3 dir, float t0, float t1, float& t_hit) {
+
+    constexpr int N = TerrainHeightCache::TILE_RES + 1;
+    const glm::vec3* s = tile.samples.data() + cell.y * N + cell.x;
+    float h00 = s[0].x, h10 = s[1].x, h01 = s[N].x, h11 = s[N + 1].x;
+    float a = h10 - h00, b = h01 - h00, c = h00 - h10 - h01 + h11;
+
+    glm::vec2 cell_origin = tile_origin + spacing * glm::vec2(cell);
+    float u0 = (origin.x - cell_origin.x) / spacing, du = dir.x / spacing;
+    float v0 = (origin.z - cell_origin.y) / spacing, dv = dir.z / spacing;
+
+    // f(t) = ray height - surface height = A t^2 + B t + C
+    float A = -c * du * dv;
+    float B = dir.y - (a * du + b * dv + c * (u0 * dv + v0 * du));
+    float C = origin.y - (h00 + a * u0 + b * v0 + c * u0 * v0);
+
+    auto f = [&](float t) { return (A * t + B) * t + C; };
+    if (f(t0) <= 0.0f) {
+        t_hit = t0;
+        return true;
+    }
+
+    float roots[2];
+    int num_roots = 0;
+    if (glm::abs(A) < 1e-8f * (glm::abs(B) + glm::abs(C))) {
+        if (B != 0.0f) {
+            roots[num_roots++] = -C / B;
+        }
+    }
+    else {
+        float disc = B * B - 4.0f * A * C;
+        if (disc < 0.0f) return false;
+        // Numerically stable form of the quadratic formula
+        float q = -0.5f * (B + std::copysign(glm::sqrt(disc), B));
+        roots[num_roots++] = q / A;
+        if (q != 0.0f) {
+            roots[num_roots++] = C / q;
+        }
+    }
+
+    bool found = false;
+    for (int k = 0; k < num_roots; k++) {
+        if (roots[k] >= t0 && roots[k] <= t1 && (!found || roots[k] < t_hit)) {
+            t_hit = roots[k];
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Front to back traversal of a tile's min/max pyramid.
+static bool raycast_tile(const TerrainHeightTile& tile, float tile_size, glm::vec3 origin, glm::vec3 dir,
+        float t_enter, float t_exit, TerrainRayHit* hit) {
+
+    constexpr int TILE_RES = TerrainHeightCache::TILE_RES;
+    constexpr int LEVELS = TerrainHeightCache::PYRAMID_LEVELS;
+
+    const glm::vec2 tile_origin = glm::vec2(tile.coord) * tile_size;
+    const float spacing = tile_size / TILE_RES;
+
+    // Visiting the child closest to the ray origin first means the first hit found is the nearest one
+    const int near_x = dir.x >= 0.0f ? 0 : 1;
+    const int near_y = dir.z >= 0.0f ? 0 : 1;
+    const glm::ivec2 child_order[4] = {
+        {near_x, near_y}, {1 - near_x, near_y}, {near_x, 1 - near_y}, {1 - near_x, 1 - near_y}
+    };
+
+    struct Node { int level; glm::ivec2 pos; };
+    Node stack[3 * LEVELS + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {LEVELS - 1, glm::ivec2(0)};
+
+    while (stack_size > 0) {
+        Node node = stack[--stack_size];
+        int res = TILE_RES >> node.level;
+        glm::vec2 bounds = tile.height_bounds[TerrainHeightCache::pyramid_offset(node.level) + node.pos.y * res + node.pos.x];
+
+        float node_width = spacing * (float)(1 << node.level);
+        glm::vec2 node_min = tile_origin + node_width * glm::vec2(node.pos);
+        float t0 = t_enter, t1 = t_exit;
+        if (!clip_ray_to_box(origin, dir,
+                glm::vec3(node_min.x, bounds.x, node_min.y),
+                glm::vec3(node_min.x + node_width, bounds.y, node_min.y + node_width), t0, t1)) {
+            continue;
+        }
+
+        if (node.level == 0) {
+            float t_hit;
+            if (intersect_cell(tile, tile_origin, spacing, node.pos, origin, dir, t0, t1, t_hit)) {
+                if (hit) {
+                    hit->valid = true;
+                    hit->t = t_hit;
+                    hit->pos = origin + t_hit * dir;
+
+                    // Bilinearly interpolated gradient, same as TerrainHeightCache::try_sample()
+                    constexpr int N = TILE_RES + 1;
+                    glm::vec2 f = glm::clamp((glm::vec2(hit->pos.x, hit->pos.z) - node_min) / spacing, glm::vec2(0), glm::vec2(1));
+                    const glm::vec3* s = tile.samples.data() + node.pos.y * N + node.pos.x;
+                    glm::vec3 sample = glm::mix(glm::mix(s[0], s[1], f.x), glm::mix(s[N], s[N + 1], f.x), f.y);
+                    hit->normal = normal_from_gradient(glm::vec2(sample.y, sample.z));
+                }
+                return true;
+            }
+            continue;
+        }
+
+        // Push in reverse so that the nearest child is popped first
+        for (int k = 3; k >= 0; k--) {
+            stack[stack_size++] = {node.level - 1, 2 * node.pos + child_order[k]};
+        }
+    }
+    return false;
+}
+
+// Marches the noise function for the parts of the ray that aren't covered by the cache.
+static bool raycast_noise(const Terrain& terrain, float step, float max_height,
+        glm::vec3 origin, glm::vec3 dir, float t_enter, float t_exit, TerrainRayHit* hit) {
+
+    float y0 = origin.y + t_enter * dir.y, y1 = origin.y + t_exit * dir.y;
+    if (glm::min(y0, y1) > max_height) return false;
+
+    auto f = [&](float t) {
+        return origin.y + t * dir.y - calc_terrain_with_gradient(terrain, glm::vec2(origin.x + t * dir.x, origin.z + t * dir.z)).x;
+    };
+
+    // Vertical rays see a constant height, so a single interval is enough for the bisection to find the crossing
+    float dir_xz = glm::length(glm::vec2(dir.x, dir.z));
+    float dt = dir_xz > 0.0f ? step / dir_xz : t_exit - t_enter;
+
+    float t_prev = t_enter;
+    bool found = f(t_enter) <= 0.0f;
+    float t_hit = t_enter;
+    while (!found && t_prev < t_exit) {
+        float t = glm::min(t_prev + dt, t_exit);
+        if (f(t) <= 0.0f) {
+            // Refine the crossing by bisection
+            float lo = t_prev, hi = t;
+            for (int k = 0; k < 16; k++) {
+                float mid = 0.5f * (lo + hi);
+                if (f(mid) <= 0.0f) hi = mid; else lo = mid;
+            }
+            t_hit = hi;
+            found = true;
+        }
+        t_prev = t;
+    }
+
+    if (found && hit) {
+        hit->valid = true;
+        hit->t = t_hit;
+        hit->pos = origin + t_hit * dir;
+        glm::vec3 res = calc_terrain_with_gradient(terrain, glm::vec2(hit->pos.x, hit->pos.z));
+        hit->normal = normal_from_gradient(glm::vec2(res.y, res.z));
+    }
+    return found;
+}
+
+bool terrain_raycast(const TerrainHeightCache& cache, glm::vec3 origin, glm::vec3 dir, float max_t, TerrainRayHit* hit) {
+    if (hit) {
+        *hit = {};
+    }
+    if (max_t < 0.0f) return false;
+
+    const Terrain& terrain = cache.terrain();
+    const float tile_size = cache.tile_size();
+    float min_height, max_height;
+    calc_terrain_height_bounds(terrain, min_height, max_height);
+
+    // Below the lowest possible point of the terrain, so the origin is underground
+    if (origin.y < min_height) {
+        if (hit) {
+            hit->valid = true;
+            hit->pos = origin;
+            glm::vec3 res = cache.sample(glm::vec2(origin.x, origin.z));
+            hit->normal = normal_from_gradient(glm::vec2(res.y, res.z));
+        }
+        return true;
+    }
+
+    // Only the part of the ray within the terrain's height range can hit anything
+    float t_begin = 0.0f, t_end = max_t;
+    if (dir.y != 0.0f) {
+        t_end = glm::min(t_end, (dir.y > 0.0f ? max_height - origin.y : min_height - origin.y) / dir.y);
+        if (origin.y > max_height) {
+            t_begin = (max_height - origin.y) / dir.y;
+        }
+    }
+    if (origin.y > max_height && dir.y >= 0.0f) return false;
+    if (t_begin > t_end) return false;
+
+    // Walk the tiles along the ray (2D DDA over the tile grid)
+    glm::vec2 p = glm::vec2(origin.x + t_begin * dir.x, origin.z + t_begin * dir.z) / tile_size;
+    glm::ivec2 coord = glm::ivec2(glm::floor(p));
+    glm::ivec2 step = glm::ivec2(dir.x >= 0.0f ? 1 : -1, dir.z >= 0.0f ? 1 : -1);
+    glm::vec2 t_delta, t_next;
+    for (int k = 0; k < 2; k++) {
+        float d = (k == 0 ? dir.x : dir.z) / tile_size;
+        if (d == 0.0f) {
+            t_delta[k] = INFINITY;
+            t_next[k] = INFINITY;
+        }
+        else {
+            float boundary = step[k] > 0 ? (float)(coord[k] + 1) : (float)coord[k];
+            t_delta[k] = glm::abs(1.0f / d);
+            t_next[k] = t_begin + (boundary - p[k]) / d;
+        }
+    }
+
+    float t_enter = t_begin;
+    while (t_enter <= t_end) {
+        float t_exit = glm::min(glm::min(t_next.x, t_next.y), t_end);
+
+        bool found;
+        if (auto tile = cache.find_ready_tile(coord)) {
+            found = raycast_tile(*tile, tile_size, origin, dir, t_enter, t_exit, hit);
+        }
+        else {
+            found = raycast_noise(terrain, tile_size / TerrainHeightCache::TILE_RES, max_height,
+                origin, dir, t_enter, t_exit, hit);
+        }
+        if (found) return true;
+
+        if (t_exit >= t_end) break;
+        if (t_next.x < t_next.y) {
+            coord.x += step.x;
+            t_next.x += t_delta.x;
+        }
+        else {
+            coord.y += step.y;
+            t_next.y += t_delta.y;
+        }
+        t_enter = t_exit;
+    }
+    return false;
+}
+
+void terrain_raycast_batch(const TerrainHeightCache& cache, Span<const TerrainRay> rays, Span<TerrainRayHit> hits) {
+    ZoneScoped;
+    for (uint32_t i = 0; i < rays.size(); i++) {
+        terrain_raycast(cache, rays[i].origin, rays[i].dir, rays[i].max_t, &hits[i]);
+    }
+}
+
+void terrain_raycast_parallel(Pool* thread_pool, const TerrainHeightCache& cache, Span<const TerrainRay> rays, Span<TerrainRayHit> hits) {
+    ZoneScoped;
+    drjit::parallel_for(drjit::blocked_range<uint32_t>(0, rays.size(), 64), [&](auto range) {
+        ZoneScopedN("TerrainRaycastBlock");
+        for (uint32_t i : range) {
+            terrain_raycast(cache, rays[i].origin, rays[i].dir, rays[i].max_t, &hits[i]);
+        }
+    }, thread_pool);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "core/span.h"
+
+#include <glm/vec3.hpp>
+
+struct Pool;
+class TerrainHeightCache;
+
+struct TerrainRay {
+    glm::vec3 origin;
+    glm::vec3 dir;      // doesn't need to be normalized, t is measured in units of dir
+    float max_t;
+};
+
+struct TerrainRayHit {
+    bool valid = false;
+    float t = 0.0f;
+    glm::vec3 pos = glm::vec3(0);
+    glm::vec3 normal = glm::vec3(0, 1, 0);
+};
+
+// Finds the first intersection of origin + t * dir (0 <= t <= max_t) with the terrain.
+// Inside the cached ring the ray is traced against the bilinear surface of the cache, walking each tile's
+// min/max pyramid front to back; outside of it (or for tiles that aren't ready yet) it falls back to
+// marching the noise function directly.
+// Like TerrainHeightCache::sample(), this may run on multiple threads but not concurrently with update().
+bool terrain_raycast(const TerrainHeightCache& cache, glm::vec3 origin, glm::vec3 dir, float max_t, TerrainRayHit* hit = nullptr);
+
+// Line of sight check between two points.
+inline bool terrain_segment_intersects(const TerrainHeightCache& cache, glm::vec3 from, glm::vec3 to, TerrainRayHit* hit = nullptr) {
+    return terrain_raycast(cache, from, to - from, 1.0f, hit);
+}
+
+// hits must be the same size as rays.
+void terrain_raycast_batch(const TerrainHeightCache& cache, Span<const TerrainRay> rays, Span<TerrainRayHit> hits);
+void terrain_raycast_parallel(Pool* thread_pool, const TerrainHeightCache& cache, Span<const TerrainRay> rays, Span<TerrainRayHit> hits);
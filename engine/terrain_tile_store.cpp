@@ -0,0 +1,413 @@
+#include "terrain_tile_store.h"
+
+#include "core/lz.h"
+#include "core/log.h"
+
+#include <glm/common.hpp>
+#include <glm/ext/vector_int2_sized.hpp>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nanothread/nanothread.h"
+
+#include "tracy/Tracy.hpp"
+
+// The index is read straight out of the mapped file, so the layout has to stay fixed
+static_assert(sizeof(TerrainTileStoreHeader) == 48);
+static_assert(sizeof(TerrainTileStoreEntry) == 24);
+
+static inline uint32_t tile_samples(uint32_t tile_res) {
+    return (tile_res + 1) * (tile_res + 1);
+}
+
+static inline uint32_t tile_blob_size(uint32_t tile_res) {
+    return 2 * sizeof(float) + 4 * tile_samples(tile_res);
+}
+
+static inline glm::ivec2 mip_tiles(glm::ivec2 num_tiles, uint32_t mip) {
+    return (num_tiles + glm::ivec2((1 << mip) - 1)) >> (int)mip;
+}
+
+static inline uint16_t zigzag_encode16(uint16_t v) {
+    return (uint16_t)((v << 1) ^ (uint16_t)((int16_t)v >> 15));
+}
+
+static inline uint16_t zigzag_decode16(uint16_t v) {
+    return (uint16_t)((v >> 1) ^ (uint16_t)-(int16_t)(v & 1));
+}
+
+// Gradient predictor, exact for planar patches of the heightfield
+static inline int32_t predict_height(const uint16_t* q, uint32_t n, uint32_t x, uint32_t y) {
+    if (x > 0 && y > 0) return (int32_t)q[y * n + x - 1] + (int32_t)q[(y - 1) * n + x] - (int32_t)q[(y - 1) * n + x - 1];
+    if (x > 0) return q[y * n + x - 1];
+    if (y > 0) return q[(y - 1) * n + x];
+    return 0;
+}
+
+// The normal of a heightfield is normalize(-grad.x, 1, -grad.y), which always lies in the upper hemisphere,
+// so the octahedral mapping doesn't need the fold for the lower half.
+static inline void encode_normal(glm::vec2 grad, int8_t& nx, int8_t& nz) {
+    float inv_l1 = 1.0f / (glm::abs(grad.x) + 1.0f + glm::abs(grad.y));
+    nx = (int8_t)glm::round(-grad.x * inv_l1 * 127.0f);
+    nz = (int8_t)glm::round(-grad.y * inv_l1 * 127.0f);
+}
+
+static inline glm::vec2 decode_normal(int8_t nx, int8_t nz) {
+    float px = (float)nx / 127.0f, pz = (float)nz / 127.0f;
+    float py = glm::max(1.0f - glm::abs(px) - glm::abs(pz), 1e-3f);
+    return glm::vec2(-px / py, -pz / py);
+}
+
+static void encode_tile(Span<const glm::vec3> samples, uint32_t tile_res, float min_height, float max_height, Vector<uint8_t>& out) {
+    const uint32_t n = tile_res + 1;
+    const uint32_t num_samples = n * n;
+
+    const float base = min_height;
+    const float step = (max_height - min_height) / 65535.0f;
+    const float inv_step = step > 0.0f ? 1.0f / step : 0.0f;
+
+    Vector<uint16_t> q(num_samples);
+    for (uint32_t i = 0; i < num_samples; i++) {
+        q[i] = (uint16_t)glm::clamp(glm::round((samples[i].x - base) * inv_step), 0.0f, 65535.0f);
+    }
+
+    out.resize(tile_blob_size(tile_res));
+    memcpy(out.data(), &base, sizeof(float));
+    memcpy(out.data() + sizeof(float), &step, sizeof(float));
+    uint8_t* height_lo = out.data() + 2 * sizeof(float);
+    uint8_t* height_hi = height_lo + num_samples;
+    int8_t* normal_x = (int8_t*)(height_hi + num_samples);
+    int8_t* normal_z = normal_x + num_samples;
+
+    for (uint32_t y = 0; y < n; y++) {
+        for (uint32_t x = 0; x < n; x++) {
+            uint32_t i = y * n + x;
+            uint16_t residual = zigzag_encode16((uint16_t)((int32_t)q[i] - predict_height(q.data(), n, x, y)));
+            height_lo[i] = (uint8_t)residual;
+            height_hi[i] = (uint8_t)(residual >> 8);
+            encode_normal(glm::vec2(samples[i].y, samples[i].z), normal_x[i], normal_z[i]);
+        }
+    }
+}
+
+static bool decode_tile_blob(Span<const uint8_t> blob, uint32_t tile_res, Vector<glm::vec3>& samples) {
+    const uint32_t n = tile_res + 1;
+    const uint32_t num_samples = n * n;
+    if (blob.size() != tile_blob_size(tile_res)) return false;
+
+    float base, step;
+    memcpy(&base, blob.data(), sizeof(float));
+    memcpy(&step, blob.data() + sizeof(float), sizeof(float));
+    const uint8_t* height_lo = blob.data() + 2 * sizeof(float);
+    const uint8_t* height_hi = height_lo + num_samples;
+    const int8_t* normal_x = (const int8_t*)(height_hi + num_samples);
+    const int8_t* normal_z = normal_x + num_samples;
+
+    if (samples.size() != num_samples) {
+        samples.resize(num_samples);
+    }
+    Vector<uint16_t> q(num_samples);
+    for (uint32_t y = 0; y < n; y++) {
+        for (uint32_t x = 0; x < n; x++) {
+            uint32_t i = y * n + x;
+            uint16_t residual = zigzag_decode16((uint16_t)(height_lo[i] | (height_hi[i] << 8)));
+            q[i] = (uint16_t)(predict_height(q.data(), n, x, y) + (int32_t)residual);
+            glm::vec2 grad = decode_normal(normal_x[i], normal_z[i]);
+            samples[i] = glm::vec3(base + (float)q[i] * step, grad.x, grad.y);
+        }
+    }
+    return true;
+}
+
+bool bake_terrain_tiles(const char* filename, const TerrainBakeParams& params, TerrainBakeSampler sampler, void* user,
+        Pool* thread_pool) {
+    ZoneScoped;
+
+    if (params.tile_res == 0 || params.num_mips == 0 || params.num_mips > 24
+            || params.num_tiles.x <= 0 || params.num_tiles.y <= 0) {
+        log_error("Invalid terrain bake parameters for {}!", filename);
+        return false;
+    }
+
+    Vector<uint32_t> mip_first_entry(params.num_mips);
+    uint32_t num_entries = 0;
+    for (uint32_t mip = 0; mip < params.num_mips; mip++) {
+        glm::ivec2 tiles = mip_tiles(params.num_tiles, mip);
+        mip_first_entry[mip] = num_entries;
+        num_entries += tiles.x * tiles.y;
+    }
+
+    FILE* file;
+    if (fopen_s(&file, filename, "wb") != 0) {
+        log_error("Failed to open terrain tile store {}!", filename);
+        return false;
+    }
+
+    TerrainTileStoreHeader header = {};
+    memcpy(header.magic, TERRAIN_TILE_STORE_MAGIC, sizeof(header.magic));
+    header.version = TERRAIN_TILE_STORE_VERSION;
+    header.tile_res = params.tile_res;
+    header.num_mips = params.num_mips;
+    header.tile_size = params.tile_size;
+    header.origin_tile = params.origin_tile;
+    header.num_tiles = params.num_tiles;
+    header.num_entries = num_entries;
+
+    // The index is rewritten with the real offsets once all tiles are written
+    Vector<TerrainTileStoreEntry> entries(num_entries);
+    memset(entries.data(), 0, entries.size() * sizeof(TerrainTileStoreEntry));
+    bool ok = fwrite(&header, sizeof(TerrainTileStoreHeader), 1, file) == 1
+        && fwrite(entries.data(), sizeof(TerrainTileStoreEntry), num_entries, file) == num_entries;
+    uint64_t offset = sizeof(TerrainTileStoreHeader) + (uint64_t)num_entries * sizeof(TerrainTileStoreEntry);
+
+    const uint32_t n = params.tile_res + 1;
+    const double spacing0 = (double)params.tile_size / params.tile_res;
+    uint64_t sample_data_size = 0;
+
+    for (uint32_t mip = 0; ok && mip < params.num_mips; mip++) {
+        ZoneScopedN("BakeTerrainMip");
+        const glm::ivec2 tiles = mip_tiles(params.num_tiles, mip);
+        const int mip_scale = 1 << mip;
+
+        Vector<Vector<uint8_t>> blobs(tiles.x);
+        Vector<glm::vec2> bounds(tiles.x);
+        for (int j = 0; ok && j < tiles.y; j++) {
+            drjit::parallel_for(drjit::blocked_range<uint32_t>(0, tiles.x, 1), [&](auto range) {
+                ZoneScopedN("BakeTerrainTile");
+                Vector<glm::vec2> pos(n * n);
+                Vector<glm::vec3> samples(n * n);
+                Vector<uint8_t> raw;
+                for (uint32_t i : range) {
+                    // Positions are computed from integer mip 0 sample coordinates, so that samples
+                    // shared between neighboring tiles and between mips are bit-identical
+                    glm::i64vec2 first = (glm::i64vec2(params.origin_tile) + glm::i64vec2((int)i, j) * (int64_t)mip_scale)
+                        * (int64_t)params.tile_res;
+                    for (uint32_t y = 0; y < n; y++) {
+                        for (uint32_t x = 0; x < n; x++) {
+                            pos[y * n + x] = glm::vec2(
+                                (double)(first.x + (int64_t)x * mip_scale) * spacing0,
+                                (double)(first.y + (int64_t)y * mip_scale) * spacing0);
+                        }
+                    }
+                    sampler(user, Span<const glm::vec2>(pos.data(), pos.size()), samples);
+
+                    float min_h = samples[0].x, max_h = samples[0].x;
+                    for (const auto& s : samples) {
+                        min_h = glm::min(min_h, s.x);
+                        max_h = glm::max(max_h, s.x);
+                    }
+                    encode_tile(Span<const glm::vec3>(samples.data(), samples.size()), params.tile_res, min_h, max_h, raw);
+                    blobs[i] = lz_compress(Span<const uint8_t>(raw.data(), raw.size()));
+                    // Noisy tiles don't get smaller, those are stored as is
+                    if (blobs[i].size() >= raw.size()) {
+                        blobs[i] = raw;
+                    }
+                    bounds[i] = glm::vec2(min_h, max_h);
+                }
+            }, thread_pool);
+
+            for (int i = 0; ok && i < tiles.x; i++) {
+                auto& entry = entries[mip_first_entry[mip] + j * tiles.x + i];
+                entry.offset = offset;
+                entry.compressed_size = blobs[i].size();
+                entry.min_height = bounds[i].x;
+                entry.max_height = bounds[i].y;
+
+                // Include the finer tiles under this one
+                if (mip > 0) {
+                    glm::ivec2 child_tiles = mip_tiles(params.num_tiles, mip - 1);
+                    for (int cy = 2 * j; cy < glm::min(2 * j + 2, child_tiles.y); cy++) {
+                        for (int cx = 2 * i; cx < glm::min(2 * i + 2, child_tiles.x); cx++) {
+                            const auto& child = entries[mip_first_entry[mip - 1] + cy * child_tiles.x + cx];
+                            entry.min_height = glm::min(entry.min_height, child.min_height);
+                            entry.max_height = glm::max(entry.max_height, child.max_height);
+                        }
+                    }
+                }
+
+                ok = fwrite(blobs[i].data(), 1, blobs[i].size(), file) == blobs[i].size();
+                offset += blobs[i].size();
+                sample_data_size += (uint64_t)n * n * sizeof(glm::vec3);
+            }
+        }
+    }
+
+    if (ok) {
+        header.min_height = entries[0].min_height;
+        header.max_height = entries[0].max_height;
+        for (const auto& entry : entries) {
+            header.min_height = glm::min(header.min_height, entry.min_height);
+            header.max_height = glm::max(header.max_height, entry.max_height);
+        }
+        ok = fseek(file, 0, SEEK_SET) == 0
+            && fwrite(&header, sizeof(TerrainTileStoreHeader), 1, file) == 1
+            && fwrite(entries.data(), sizeof(TerrainTileStoreEntry), num_entries, file) == num_entries;
+    }
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok) {
+        log_error("Failed to write terrain tile store {}!", filename);
+        return false;
+    }
+    log_info("Baked terrain tile store {} ({} tiles, {} bytes, {} bytes as float samples)", filename, num_entries, offset, sample_data_size);
+    return true;
+}
+
+bool bake_terrain_tiles(const char* filename, const TerrainBakeParams& params, const Terrain& terrain, Pool* thread_pool) {
+    auto sampler = [](void* user, Span<const glm::vec2> pos, Span<glm::vec3> out) {
+        calc_terrain_with_gradient_batch(pos, out, *(const Terrain*)user);
+    };
+    return bake_terrain_tiles(filename, params, sampler, (void*)&terrain, thread_pool);
+}
+
+bool TerrainTileStore::open(const char* filename, uint32_t cache_capacity) {
+    ZoneScoped;
+
+    close();
+    if (!_file.open(filename)) return false;
+
+    // Only the header and the index are validated here, the tiles themselves are checked when they're decoded
+    auto header_data = _file.range(0, sizeof(TerrainTileStoreHeader));
+    auto header = (const TerrainTileStoreHeader*)header_data.data();
+    bool valid = header
+        && memcmp(header->magic, TERRAIN_TILE_STORE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == TERRAIN_TILE_STORE_VERSION
+        && header->tile_res > 0 && header->tile_res <= 4096
+        && header->num_mips > 0 && header->num_mips <= 24
+        && header->num_tiles.x > 0 && header->num_tiles.y > 0;
+
+    if (valid) {
+        _mip_first_entry.resize(header->num_mips);
+        uint64_t num_entries = 0;
+        for (uint32_t mip = 0; mip < header->num_mips; mip++) {
+            glm::ivec2 tiles = mip_tiles(header->num_tiles, mip);
+            _mip_first_entry[mip] = (uint32_t)num_entries;
+            num_entries += (uint64_t)tiles.x * tiles.y;
+        }
+        auto index_data = _file.range(sizeof(TerrainTileStoreHeader), num_entries * sizeof(TerrainTileStoreEntry));
+        valid = num_entries == header->num_entries && index_data.data() != nullptr;
+        _entries = (const TerrainTileStoreEntry*)index_data.data();
+    }
+
+    if (!valid) {
+        log_error("Invalid terrain tile store {}!", filename);
+        close();
+        return false;
+    }
+    _header = header;
+
+    if (_cache.size() != cache_capacity) {
+        _cache.resize(cache_capacity);
+    }
+    return true;
+}
+
+void TerrainTileStore::close() {
+    _file.close();
+    _header = nullptr;
+    _entries = nullptr;
+    _mip_first_entry.clear();
+    _cache.clear();
+    _cache_lookup.clear();
+    _use_counter = 0;
+}
+
+glm::ivec2 TerrainTileStore::tile_index(int mip, glm::vec2 pos) const {
+    glm::vec2 local = pos / tile_size(mip) - glm::vec2(_header->origin_tile) / (float)(1 << mip);
+    return glm::ivec2(glm::floor(local));
+}
+
+const TerrainTileStoreEntry* TerrainTileStore::find_entry(int mip, glm::ivec2 index) const {
+    if (mip < 0 || mip >= num_mips()) return nullptr;
+    glm::ivec2 tiles = num_tiles(mip);
+    if (index.x < 0 || index.y < 0 || index.x >= tiles.x || index.y >= tiles.y) return nullptr;
+    return &_entries[_mip_first_entry[mip] + index.y * tiles.x + index.x];
+}
+
+bool TerrainTileStore::decode_tile(int mip, glm::ivec2 index, TerrainStoreTile& out) const {
+    ZoneScoped;
+
+    out.mip = -1;
+    auto entry = find_entry(mip, index);
+    if (!entry) return false;
+
+    // First touch of the compressed data is what pages it in
+    auto compressed = _file.range(entry->offset, entry->compressed_size);
+    const uint32_t blob_size = tile_blob_size(_header->tile_res);
+    bool ok = compressed.data() != nullptr;
+    if (ok && compressed.size() == blob_size) {
+        // Stored uncompressed
+        ok = decode_tile_blob(compressed, _header->tile_res, out.samples);
+    }
+    else if (ok) {
+        Vector<uint8_t> raw(blob_size);
+        ok = lz_decompress(compressed, raw)
+            && decode_tile_blob(Span<const uint8_t>(raw.data(), raw.size()), _header->tile_res, out.samples);
+    }
+    if (!ok) {
+        log_error("Failed to decode terrain tile {} ({}, {})!", mip, index.x, index.y);
+        return false;
+    }
+    out.mip = mip;
+    out.index = index;
+    return true;
+}
+
+const TerrainStoreTile* TerrainTileStore::get_tile(int mip, glm::ivec2 index) {
+    if (!find_entry(mip, index) || _cache.empty()) return nullptr;
+
+    _use_counter++;
+    uint64_t key = tile_key(mip, index);
+    if (auto it = _cache_lookup.find(key); it != _cache_lookup.end()) {
+        auto& tile = _cache[it->second];
+        tile.last_used = _use_counter;
+        num_cache_hits++;
+        return &tile;
+    }
+
+    // Evict the least recently used tile (unused slots have last_used = 0)
+    uint32_t slot = 0;
+    for (uint32_t i = 1; i < _cache.size(); i++) {
+        if (_cache[i].last_used < _cache[slot].last_used) {
+            slot = i;
+        }
+    }
+    auto& tile = _cache[slot];
+    if (tile.mip >= 0) {
+        _cache_lookup.erase(tile_key(tile.mip, tile.index));
+    }
+    tile.last_used = 0;
+    if (!decode_tile(mip, index, tile)) return nullptr;
+
+    tile.last_used = _use_counter;
+    _cache_lookup[key] = slot;
+    num_decoded++;
+    return &tile;
+}
+
+bool TerrainTileStore::sample(glm::vec2 pos, int mip, glm::vec3& out) {
+    if (mip < 0 || mip >= num_mips()) return false;
+
+    // Position in mip 0 tiles relative to the start of the baked region
+    glm::vec2 local = pos / _header->tile_size - glm::vec2(_header->origin_tile);
+    if (local.x < 0.0f || local.y < 0.0f
+            || local.x > (float)_header->num_tiles.x || local.y > (float)_header->num_tiles.y) {
+        return false;
+    }
+
+    glm::vec2 local_mip = local / (float)(1 << mip);
+    glm::ivec2 index = glm::min(glm::ivec2(glm::floor(local_mip)), num_tiles(mip) - 1);
+    auto tile = get_tile(mip, index);
+    if (!tile) return false;
+
+    const int res = tile_res();
+    const int n = res + 1;
+    glm::vec2 f = (local_mip - glm::vec2(index)) * (float)res;
+    glm::ivec2 cell = glm::clamp(glm::ivec2(glm::floor(f)), glm::ivec2(0), glm::ivec2(res - 1));
+    f = glm::clamp(f - glm::vec2(cell), glm::vec2(0), glm::vec2(1));
+
+    const glm::vec3* s = tile->samples.data() + cell.y * n + cell.x;
+    out = glm::mix(glm::mix(s[0], s[1], f.x), glm::mix(s[n], s[n + 1], f.x), f.y);
+    return true;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "terrain_algo.h"
+
+#include "core/vector.h"
+#include "core/span.h"
+#include "core/map.h"
+#include "core/mapped_file.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+struct Pool;
+
+// Offline-baked terrain tiles, see bake_terrain_tiles() and TerrainTileStore.
+//
+// File layout:
+//   TerrainTileStoreHeader
+//   TerrainTileStoreEntry[num_entries]     all tiles of mip 0 (row-major), then mip 1, ...
+//   compressed tile blobs (stored uncompressed if LZ doesn't make them smaller, then compressed_size is the raw size)
+//
+// A tile at mip m covers tile_size * 2^m world units with (tile_res+1)^2 samples, edges are shared with the
+// neighboring tiles. Tile (i, j) of mip m starts at mip 0 tile origin_tile + (i, j) * 2^m, so each mip has
+// half the tiles of the previous one (rounded up) and the coarser samples are a subset of the finer ones.
+//
+// Uncompressed tile blob:
+//   float height_base, height_step        height = height_base + q * height_step
+//   uint8_t height_lo[N], height_hi[N]    zigzagged residuals of q after the (left + up - up_left) predictor
+//   int8_t normal_x[N], normal_z[N]       octahedral normals (upper hemisphere only, normals always point up)
+struct TerrainTileStoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t tile_res;          // cells per tile side
+    uint32_t num_mips;
+    float tile_size;            // world size of a mip 0 tile
+    glm::ivec2 origin_tile;     // first mip 0 tile, in units of tile_size
+    glm::ivec2 num_tiles;       // mip 0 tile count
+    float min_height;
+    float max_height;
+    uint32_t num_entries;
+};
+
+struct TerrainTileStoreEntry {
+    uint64_t offset;
+    uint32_t compressed_size;
+    uint32_t _padding;
+    // Bounds of the tile including the finer mips below it, so that culling against a coarse tile stays conservative
+    float min_height;
+    float max_height;
+};
+
+static constexpr char TERRAIN_TILE_STORE_MAGIC[4] = {'T', 'T', 'S', 'F'};
+static constexpr uint32_t TERRAIN_TILE_STORE_VERSION = 1;
+
+struct TerrainBakeParams {
+    glm::ivec2 origin_tile = glm::ivec2(0);
+    glm::ivec2 num_tiles = glm::ivec2(16);
+    float tile_size = 64.0f;
+    uint32_t tile_res = 64;
+    uint32_t num_mips = 5;
+};
+
+// Writes (height, grad.x, grad.y) for each position, same contract as calc_terrain_with_gradient_batch().
+// May be called from multiple threads at once. Coarse mip tiles can reach past the baked region,
+// so the sampler has to handle positions outside of it (e.g. by clamping).
+using TerrainBakeSampler = void (*)(void* user, Span<const glm::vec2> pos, Span<glm::vec3> out);
+
+// Tiles are sampled and compressed on the thread pool, a row of tiles at a time.
+bool bake_terrain_tiles(const char* filename, const TerrainBakeParams& params, TerrainBakeSampler sampler, void* user,
+    Pool* thread_pool = nullptr);
+bool bake_terrain_tiles(const char* filename, const TerrainBakeParams& params, const Terrain& terrain,
+    Pool* thread_pool = nullptr);
+
+struct TerrainStoreTile {
+    int mip = -1;
+    glm::ivec2 index = glm::ivec2(-1);
+    // (tile_res+1)^2 samples of (height, grad.x, grad.y), same layout as TerrainHeightTile::samples
+    Vector<glm::vec3> samples;
+    uint32_t last_used = 0;
+};
+
+// Memory-maps a baked tile file. Opening only validates the header and the index,
+// tile data is paged in by the OS and decoded when a tile is first requested.
+// get_tile() and sample() go through an LRU cache of decoded tiles and must be called from one thread at a time,
+// decode_tile() doesn't touch the cache and can be called from any thread.
+class TerrainTileStore {
+public:
+    TerrainTileStore() = default;
+    TerrainTileStore(const TerrainTileStore&) = delete;
+    TerrainTileStore& operator=(const TerrainTileStore&) = delete;
+
+    bool open(const char* filename, uint32_t cache_capacity = 64);
+    void close();
+    bool is_open() const { return _header != nullptr; }
+
+    const TerrainTileStoreHeader& header() const { return *_header; }
+    int num_mips() const { return (int)_header->num_mips; }
+    int tile_res() const { return (int)_header->tile_res; }
+    float tile_size(int mip) const { return _header->tile_size * (float)(1 << mip); }
+    glm::ivec2 num_tiles(int mip) const {
+        return (_header->num_tiles + glm::ivec2((1 << mip) - 1)) >> mip;
+    }
+
+    // Tile containing pos, may be out of range
+    glm::ivec2 tile_index(int mip, glm::vec2 pos) const;
+    // Returns nullptr for tiles outside of the baked region
+    const TerrainTileStoreEntry* find_entry(int mip, glm::ivec2 index) const;
+
+    bool decode_tile(int mip, glm::ivec2 index, TerrainStoreTile& out) const;
+
+    // The returned tile stays valid until cache_capacity other tiles have been requested.
+    const TerrainStoreTile* get_tile(int mip, glm::ivec2 index);
+
+    // Returns (height, grad.x, grad.y) bilinearly interpolated from the tiles of a mip,
+    // false if pos is outside of the baked region.
+    bool sample(glm::vec2 pos, int mip, glm::vec3& out);
+
+    uint32_t num_decoded = 0;
+    uint32_t num_cache_hits = 0;
+
+private:
+    static uint64_t tile_key(int mip, glm::ivec2 index) {
+        return ((uint64_t)mip << 56) | ((uint64_t)(index.x & 0xFFFFFFF) << 28) | (uint64_t)(index.y & 0xFFFFFFF);
+    }
+
+    MappedFile _file;
+    const TerrainTileStoreHeader* _header = nullptr;
+    const TerrainTileStoreEntry* _entries = nullptr;
+    Vector<uint32_t> _mip_first_entry;
+
+    Vector<TerrainStoreTile> _cache;
+    Map<uint64_t, uint32_t> _cache_lookup;
+    uint32_t _use_counter = 0;
+};
@@ -0,0 +1,159 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "core/lz.h"
+#include "components/boid.h"
+#include "systems/boid_recorder.h"
+
+#include "nanothread/nanothread.h"
+
+#include <glm/glm.hpp>
+
+#include <stdio.h>
+
+static bool lz_round_trip(const Vector<uint8_t>& data) {
+	auto compressed = lz_compress(Span<const uint8_t>(data.data(), data.size()));
+	Vector<uint8_t> decompressed(data.size());
+	if (!lz_decompress(Span<const uint8_t>(compressed.data(), compressed.size()), Span<uint8_t>(decompressed.data(), decompressed.size()))) {
+		return false;
+	}
+	for (uint32_t i = 0; i < data.size(); i++) {
+		if (decompressed[i] != data[i]) return false;
+	}
+	return true;
+}
+
+TEST_CASE("LZ round trips") {
+	Vector<uint8_t> data;
+	CHECK(lz_round_trip(data));
+
+	// Shorter than a match
+	for (uint8_t i = 0; i < 3; i++) data.push_back(i);
+	CHECK(lz_round_trip(data));
+
+	// Long runs, overlapping matches and literals longer than the token can hold
+	data.truncate();
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < 100000; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		uint32_t block = i / 1000;
+		data.push_back(block % 3 == 0 ? (uint8_t)(seed >> 24) : block % 3 == 1 ? (uint8_t)7 : (uint8_t)(i % 13));
+	}
+	CHECK(lz_round_trip(data));
+
+	auto compressed = lz_compress(Span<const uint8_t>(data.data(), data.size()));
+	CHECK(compressed.size() < data.size() / 2);
+
+	// Truncated input or the wrong size is rejected
+	Vector<uint8_t> decompressed(data.size());
+	CHECK(!lz_decompress(Span<const uint8_t>(compressed.data(), compressed.size() / 2), Span<uint8_t>(decompressed.data(), decompressed.size())));
+	CHECK(!lz_decompress(Span<const uint8_t>(compressed.data(), compressed.size()), Span<uint8_t>(decompressed.data(), decompressed.size() - 1)));
+}
+
+TEST_CASE("LZ compresses large buffers in linear time") {
+	// Mostly incompressible, so the output grows by many short sequences
+	Vector<uint8_t> data;
+	uint32_t seed = 7;
+	for (uint32_t i = 0; i < 4 * 1024 * 1024; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		data.push_back((i & 63) < 48 ? (uint8_t)(seed >> 24) : (uint8_t)(i >> 6));
+	}
+	CHECK(lz_round_trip(data));
+}
+
+static BoidRecordingHeader test_header() {
+	BoidRecordingHeader header = {};
+	header.cell_size = 10.0f;
+	header.pos_bits = 10;
+	header.vel_step = 1.0f / 1024.0f;
+	header.keyframe_interval = 4;
+	return header;
+}
+
+static void test_boids(uint32_t frame, Vector<glm::vec3>& pos, Vector<glm::vec3>& vel) {
+	for (uint32_t i = 0; i < pos.size(); i++) {
+		float t = (float)frame * 0.1f + (float)i;
+		pos[i] = glm::vec3(cosf(t) * 100.0f, (float)i * 0.5f - 40.0f, sinf(t) * 1000.0f + 5000.0f);
+		vel[i] = glm::vec3(-sinf(t), 0.0f, cosf(t));
+	}
+}
+
+TEST_CASE("Boid frames round trip through keyframes and deltas") {
+	const BoidRecordingHeader header = test_header();
+	constexpr uint32_t NUM_BOIDS = 200;
+	Vector<glm::vec3> pos(NUM_BOIDS), vel(NUM_BOIDS);
+	Vector<Boid> boids(NUM_BOIDS);
+	BoidQuantState encoder, decoder;
+
+	for (uint32_t frame = 0; frame < 10; frame++) {
+		test_boids(frame, pos, vel);
+		bool keyframe = frame % header.keyframe_interval == 0;
+
+		Vector<uint8_t> data;
+		boid_encode_frame(Span<const glm::vec3>(pos.data(), NUM_BOIDS), Span<const glm::vec3>(vel.data(), NUM_BOIDS),
+			header, encoder, keyframe, data);
+		REQUIRE(boid_decode_frame(Span<const uint8_t>(data.data(), data.size()), NUM_BOIDS, keyframe, decoder));
+		boid_dequantize(header, decoder, Span<Boid>(boids.data(), NUM_BOIDS));
+
+		const float pos_step = header.cell_size / (float)(1 << header.pos_bits);
+		for (uint32_t i = 0; i < NUM_BOIDS; i++) {
+			CHECK(glm::all(glm::lessThanEqual(glm::abs(boids[i].pos - pos[i]), glm::vec3(pos_step))));
+			CHECK(glm::all(glm::lessThanEqual(glm::abs(boids[i].vel - vel[i]), glm::vec3(header.vel_step))));
+		}
+
+		// Extra bytes are rejected
+		data.push_back(0);
+		BoidQuantState copy;
+		copy.pos = Vector<glm::ivec3>(NUM_BOIDS);
+		copy.vel = Vector<glm::ivec3>(NUM_BOIDS);
+		CHECK(!boid_decode_frame(Span<const uint8_t>(data.data(), data.size()), NUM_BOIDS, keyframe, copy));
+	}
+
+	// A delta frame can't start from a different number of boids
+	Vector<uint8_t> data;
+	boid_encode_frame(Span<const glm::vec3>(pos.data(), NUM_BOIDS), Span<const glm::vec3>(vel.data(), NUM_BOIDS),
+		header, encoder, false, data);
+	BoidQuantState empty;
+	CHECK(!boid_decode_frame(Span<const uint8_t>(data.data(), data.size()), NUM_BOIDS, false, empty));
+}
+
+TEST_CASE("Boid recordings play back what was recorded") {
+	const char* filename = "test_boid_recording.bin";
+	constexpr uint32_t NUM_BOIDS = 100;
+	constexpr uint32_t NUM_FRAMES = 130;
+	Vector<glm::vec3> pos(NUM_BOIDS), vel(NUM_BOIDS);
+	Vector<Boid> boids(NUM_BOIDS);
+
+	Pool* pool = pool_create(2);
+	{
+		BoidRecorder recorder(pool);
+		REQUIRE(recorder.start(filename, 10.0f, 1.0f));
+		for (uint32_t frame = 0; frame < NUM_FRAMES; frame++) {
+			test_boids(frame, pos, vel);
+			for (uint32_t i = 0; i < NUM_BOIDS; i++) {
+				boids[i].pos = pos[i];
+				boids[i].vel = vel[i];
+			}
+			recorder.record(Span<const Boid>(boids.data(), NUM_BOIDS));
+		}
+		recorder.stop();
+		CHECK(!recorder.is_recording());
+	}
+	pool_destroy(pool);
+
+	BoidPlayer player;
+	REQUIRE(player.open(filename));
+	REQUIRE(player.num_frames() == NUM_FRAMES);
+	// Backwards, forwards and across keyframes
+	for (uint32_t frame : {NUM_FRAMES - 1, 0u, 1u, 59u, 60u, 61u, 100u, 30u}) {
+		REQUIRE(player.read_frame(frame, Span<Boid>(boids.data(), NUM_BOIDS)));
+		test_boids(frame, pos, vel);
+		for (uint32_t i = 0; i < NUM_BOIDS; i++) {
+			CHECK(glm::distance(boids[i].pos, pos[i]) < 0.02f);
+			CHECK(glm::distance(boids[i].vel, vel[i]) < 0.002f);
+		}
+	}
+	CHECK(!player.read_frame(NUM_FRAMES, Span<Boid>(boids.data(), NUM_BOIDS)));
+	player.close();
+	remove(filename);
+}
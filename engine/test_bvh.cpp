@@ -0,0 +1,208 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "core/bvh.h"
+#include "core/cpu.h"
+
+#include <random>
+#include <algorithm>
+
+struct TestBox {
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
+	uint32_t leaf;
+};
+
+static TestBox random_box(std::mt19937& rng, float range = 200.0f) {
+	std::uniform_real_distribution<float> position(-range, range);
+	std::uniform_real_distribution<float> size(0.1f, 6.0f);
+	glm::vec3 center = glm::vec3(position(rng), position(rng), position(rng));
+	glm::vec3 half_extent = glm::vec3(size(rng), size(rng), size(rng));
+	return TestBox{center - half_extent, center + half_extent, DynamicBvh::NIL};
+}
+
+static Vector<uint32_t> sorted(Vector<uint32_t> users) {
+	std::sort(users.begin(), users.end());
+	return users;
+}
+
+static bool same_users(const Vector<uint32_t>& a, const Vector<uint32_t>& b) {
+	if (a.size() != b.size()) return false;
+	for (uint32_t i = 0; i < a.size(); i++) {
+		if (a[i] != b[i]) return false;
+	}
+	return true;
+}
+
+static Frustum test_frustum(glm::vec3 eye, glm::vec3 target) {
+	glm::mat4 proj = glm::perspective(glm::radians(70.0f), 1.5f, 0.1f, 150.0f);
+	return Frustum::from_matrix(proj * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+// Compares every query against testing all of the live boxes
+static void check_queries(const DynamicBvh& bvh, const Vector<TestBox>& boxes, std::mt19937& rng) {
+	std::uniform_real_distribution<float> position(-150.0f, 150.0f);
+	for (uint32_t i = 0; i < 20; i++) {
+		glm::vec3 a = glm::vec3(position(rng), position(rng), position(rng));
+		glm::vec3 b = glm::vec3(position(rng), position(rng), position(rng));
+		Frustum frustum = test_frustum(a, b);
+		glm::vec3 query_min = glm::min(a, b), query_max = glm::min(a, b) + glm::vec3(40.0f);
+		glm::vec3 dir = glm::normalize(b - a);
+
+		Vector<uint32_t> expected_frustum, expected_aabb, expected_ray;
+		for (uint32_t user = 0; user < boxes.size(); user++) {
+			const auto& box = boxes[user];
+			if (box.leaf == DynamicBvh::NIL) continue;
+			if (frustum.intersects_aabb(box.aabb_min, box.aabb_max)) {
+				expected_frustum.push_back(user);
+			}
+			if (glm::all(glm::lessThanEqual(box.aabb_min, query_max)) && glm::all(glm::greaterThanEqual(box.aabb_max, query_min))) {
+				expected_aabb.push_back(user);
+			}
+			// Ray against the box by sampling would be too coarse, use the slabs directly
+			float t0 = 0.0f, t1 = 400.0f;
+			for (int k = 0; k < 3; k++) {
+				float ta = (box.aabb_min[k] - a[k]) / dir[k];
+				float tb = (box.aabb_max[k] - a[k]) / dir[k];
+				t0 = glm::max(t0, glm::min(ta, tb));
+				t1 = glm::min(t1, glm::max(ta, tb));
+			}
+			if (t0 <= t1) {
+				expected_ray.push_back(user);
+			}
+		}
+
+		Vector<uint32_t> found_frustum, found_aabb, found_ray;
+		bvh.query_frustum_scalar(frustum, found_frustum);
+		bvh.query_aabb(query_min, query_max, found_aabb);
+		bvh.query_ray(a, dir, 400.0f, found_ray);
+		CHECK(same_users(sorted(found_frustum), expected_frustum));
+		CHECK(same_users(sorted(found_aabb), expected_aabb));
+		CHECK(same_users(sorted(found_ray), expected_ray));
+	}
+}
+
+TEST_CASE("Dynamic BVH queries match testing every box") {
+	std::mt19937 rng(7);
+	DynamicBvh bvh;
+	Vector<TestBox> boxes;
+	for (uint32_t i = 0; i < 600; i++) {
+		TestBox box = random_box(rng);
+		box.leaf = bvh.insert(i, box.aabb_min, box.aabb_max);
+		boxes.push_back(box);
+	}
+	REQUIRE(bvh.validate());
+	CHECK(bvh.size() == 600);
+	check_queries(bvh, boxes, rng);
+
+	// Remove every third box and move every other one
+	for (uint32_t i = 0; i < boxes.size(); i++) {
+		auto& box = boxes[i];
+		if (i % 3 == 0) {
+			bvh.remove(box.leaf);
+			box.leaf = DynamicBvh::NIL;
+		}
+		else if (i % 2 == 0) {
+			TestBox moved = random_box(rng);
+			box.aabb_min = moved.aabb_min;
+			box.aabb_max = moved.aabb_max;
+			bvh.refit(box.leaf, box.aabb_min, box.aabb_max);
+		}
+	}
+	REQUIRE(bvh.validate());
+	CHECK(bvh.size() == 400);
+	for (uint32_t i = 0; i < boxes.size(); i++) {
+		if (boxes[i].leaf == DynamicBvh::NIL) continue;
+		CHECK(bvh.user(boxes[i].leaf) == i);
+	}
+	check_queries(bvh, boxes, rng);
+
+	// Removed leaves are reused
+	TestBox box = random_box(rng);
+	box.leaf = bvh.insert(boxes.size(), box.aabb_min, box.aabb_max);
+	boxes.push_back(box);
+	CHECK(bvh.validate());
+	check_queries(bvh, boxes, rng);
+}
+
+TEST_CASE("Dynamic BVH can be emptied and refilled") {
+	DynamicBvh bvh;
+	Vector<uint32_t> users;
+	bvh.query_aabb(glm::vec3(-1000.0f), glm::vec3(1000.0f), users);
+	CHECK(users.empty());
+	CHECK(bvh.height() == 0);
+
+	uint32_t a = bvh.insert(1, glm::vec3(0.0f), glm::vec3(1.0f));
+	CHECK(bvh.height() == 1);
+	uint32_t b = bvh.insert(2, glm::vec3(5.0f), glm::vec3(6.0f));
+	CHECK(bvh.height() == 2);
+	bvh.remove(a);
+	CHECK(bvh.validate());
+	bvh.remove(b);
+	CHECK(bvh.validate());
+	CHECK(bvh.size() == 0);
+
+	bvh.insert(3, glm::vec3(0.0f), glm::vec3(1.0f));
+	bvh.query_aabb(glm::vec3(0.5f), glm::vec3(2.0f), users);
+	REQUIRE(users.size() == 1);
+	CHECK(users[0] == 3);
+}
+
+TEST_CASE("Rebuilding a degraded BVH keeps its leaves and lowers its cost") {
+	std::mt19937 rng(11);
+	DynamicBvh bvh;
+	Vector<TestBox> boxes;
+	// Enough boxes for the subtrees to be built in parallel
+	for (uint32_t i = 0; i < 3000; i++) {
+		TestBox box = random_box(rng, 20.0f);
+		box.leaf = bvh.insert(i, box.aabb_min, box.aabb_max);
+		boxes.push_back(box);
+	}
+	// Everything scatters away from where the tree was built for it
+	for (auto& box : boxes) {
+		TestBox moved = random_box(rng, 400.0f);
+		box.aabb_min = moved.aabb_min;
+		box.aabb_max = moved.aabb_max;
+		bvh.refit(box.leaf, box.aabb_min, box.aabb_max);
+	}
+	REQUIRE(bvh.validate());
+	float degraded_cost = bvh.cost();
+
+	bvh.rebuild();
+	REQUIRE(bvh.validate());
+	CHECK(bvh.size() == 3000);
+	CHECK(bvh.cost() < degraded_cost);
+	for (uint32_t i = 0; i < boxes.size(); i++) {
+		CHECK(bvh.user(boxes[i].leaf) == i);
+		CHECK(bvh.aabb_min(boxes[i].leaf) == boxes[i].aabb_min);
+	}
+	check_queries(bvh, boxes, rng);
+
+	// Balanced enough that the traversal stack stays short
+	CHECK(bvh.height() < 40);
+}
+
+TEST_CASE("Scalar and AVX2 frustum queries find the same leaves") {
+	if (!cpu_supports_avx2()) return;
+
+	std::mt19937 rng(5);
+	DynamicBvh bvh;
+	for (uint32_t i = 0; i < 2000; i++) {
+		TestBox box = random_box(rng);
+		bvh.insert(i, box.aabb_min, box.aabb_max);
+	}
+	bvh.rebuild();
+
+	std::uniform_real_distribution<float> position(-150.0f, 150.0f);
+	for (uint32_t i = 0; i < 50; i++) {
+		Frustum frustum = test_frustum(glm::vec3(position(rng), position(rng), position(rng)),
+			glm::vec3(position(rng), position(rng), position(rng)));
+		Vector<uint32_t> scalar, avx2;
+		bvh.query_frustum_scalar(frustum, scalar);
+		bvh.query_frustum_avx2(frustum, avx2);
+		CHECK(same_users(sorted(scalar), sorted(avx2)));
+	}
+}
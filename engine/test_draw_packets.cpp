@@ -0,0 +1,132 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/draw_packets.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "nanothread/nanothread.h"
+
+TEST_CASE("Draw sort keys order by state first, then front to back") {
+	CHECK(make_draw_sort_key(0, 1, 5, 100.0f) < make_draw_sort_key(0, 2, 0, 1.0f));
+	CHECK(make_draw_sort_key(0, 1, 5, 100.0f) < make_draw_sort_key(1, 0, 0, 0.0f));
+	CHECK(make_draw_sort_key(0, 1, 5, 1.0f) < make_draw_sort_key(0, 1, 6, 0.5f));
+
+	float prev_depth = 0.0f;
+	for (float depth : {0.001f, 0.5f, 1.0f, 3.0f, 10.0f, 1000.0f, 1e6f}) {
+		CHECK(make_draw_sort_key(0, 3, 7, prev_depth) < make_draw_sort_key(0, 3, 7, depth));
+		CHECK(same_draw_state(make_draw_sort_key(0, 3, 7, prev_depth), make_draw_sort_key(0, 3, 7, depth)));
+		prev_depth = depth;
+	}
+	// Behind the camera is as close as it gets
+	CHECK(make_draw_sort_key(0, 3, 7, -5.0f) == make_draw_sort_key(0, 3, 7, 0.0f));
+	CHECK(!same_draw_state(make_draw_sort_key(0, 3, 7, 1.0f), make_draw_sort_key(0, 3, 8, 1.0f)));
+}
+
+TEST_CASE("Radix sort of draw packets is a stable sort by key") {
+	std::mt19937_64 rng(5);
+	for (uint32_t n : {0u, 1u, 2u, 100u, 5000u}) {
+		Vector<DrawPacket> packets(n), scratch(n);
+		for (uint32_t i = 0; i < n; i++) {
+			// Few distinct states and coarse depths, so there are plenty of equal keys
+			uint32_t state = rng() % 8;
+			float depth = (float)(rng() % 16);
+			packets[i].sort_key = make_draw_sort_key(state % 2, state / 2, state, depth);
+			packets[i].transform = i;
+		}
+		std::vector<DrawPacket> expected(packets.begin(), packets.end());
+		std::stable_sort(expected.begin(), expected.end(), [](const DrawPacket& a, const DrawPacket& b) {
+			return a.sort_key < b.sort_key;
+		});
+
+		radix_sort_draw_packets(packets, scratch);
+		for (uint32_t i = 0; i < n; i++) {
+			CHECK(packets[i].sort_key == expected[i].sort_key);
+			CHECK(packets[i].transform == expected[i].transform);
+		}
+	}
+}
+
+TEST_CASE("Draw packets extracted from multiple threads are merged into sorted batches") {
+	const uint32_t num_entities = 5000;
+	const Ref<TexturedMesh> meshes[3] = {
+		Ref<TexturedMesh>::from_uint64(11), Ref<TexturedMesh>::from_uint64(22), Ref<TexturedMesh>::from_uint64(33)
+	};
+
+	Pool* pool = pool_create(4);
+	DrawPacketList list;
+	for (int frame = 0; frame < 3; frame++) {
+		// Entity i has mesh i % 3 with material i % 2 at depth (i * 37) % 1000, every fourth one also has mesh 0
+		uint32_t entity_count = num_entities >> frame;
+		list.begin(pool);
+		drjit::parallel_for(drjit::blocked_range<uint32_t>(0, entity_count, 64), [&](auto range) {
+			auto& arena = list.arena();
+			for (uint32_t i : range) {
+				glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3((float)i, 0, 0));
+				uint32_t transform_idx = arena.add_transform(transform);
+				float depth = (float)((i * 37) % 1000);
+				arena.packets.push_back({make_draw_sort_key(0, i % 2, i % 3, depth), meshes[i % 3], i % 2, transform_idx});
+				if (i % 4 == 0) {
+					arena.packets.push_back({make_draw_sort_key(0, i % 2, 0, depth), meshes[0], i % 2, transform_idx});
+				}
+			}
+		}, pool);
+		list.finish();
+
+		auto packets = list.packets();
+		auto batches = list.batches();
+		auto instance_transforms = list.instance_transforms();
+		CHECK(list.transforms().size() == entity_count);
+		CHECK(packets.size() == entity_count + (entity_count + 3) / 4);
+		REQUIRE(instance_transforms.size() == packets.size());
+		REQUIRE(batches.size() == 6);
+
+		Vector<uint32_t> seen(entity_count, 0);
+		uint32_t first_instance = 0;
+		for (const auto& batch : batches) {
+			CHECK(batch.first_instance == first_instance);
+			for (uint32_t i = batch.first_instance; i < batch.first_instance + batch.instance_count; i++) {
+				const auto& packet = packets[i];
+				CHECK(packet.mesh == batch.mesh);
+				CHECK(packet.material == batch.material);
+				if (i > batch.first_instance) {
+					CHECK(packets[i - 1].sort_key <= packet.sort_key);
+				}
+				CHECK(instance_transforms[i] == list.transforms()[packet.transform]);
+				seen[(uint32_t)instance_transforms[i][3].x]++;
+			}
+			first_instance += batch.instance_count;
+		}
+		for (uint32_t i = 0; i < entity_count; i++) {
+			CHECK(seen[i] == (i % 4 == 0 ? 2u : 1u));
+		}
+	}
+	pool_destroy(pool);
+}
+
+TEST_CASE("Draw packets whose sort keys collide aren't batched together") {
+	// Mesh and material indices past their key bits truncate to the same key as the first ones
+	const Ref<TexturedMesh> mesh_a = Ref<TexturedMesh>::from_uint64(5);
+	const Ref<TexturedMesh> mesh_b = Ref<TexturedMesh>::from_uint64(6);
+	DrawPacketList list;
+	list.begin();
+	auto& arena = list.arena();
+	uint32_t transform_idx = arena.add_transform(glm::mat4(1.0f));
+	arena.packets.push_back({make_draw_sort_key(0, 3, 5, 1.0f), mesh_a, 3, transform_idx});
+	arena.packets.push_back({make_draw_sort_key(0, 3, 5 + (1 << 20), 2.0f), mesh_b, 3, transform_idx});
+	arena.packets.push_back({make_draw_sort_key(0, 3 + (1 << 12), 5, 3.0f), mesh_a, 3 + (1 << 12), transform_idx});
+	list.finish();
+
+	auto batches = list.batches();
+	REQUIRE(batches.size() == 3);
+	CHECK(batches[0].mesh == mesh_a);
+	CHECK(batches[1].mesh == mesh_b);
+	CHECK(batches[2].material == 3 + (1 << 12));
+	for (const auto& batch : batches) {
+		CHECK(batch.instance_count == 1);
+	}
+}
@@ -0,0 +1,114 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/geometry_arena.h"
+
+#include <random>
+#include <vector>
+
+TEST_CASE("Range allocator picks the best fit and merges freed neighbours") {
+	RangeAllocator alloc;
+	alloc.init(100);
+
+	uint32_t a, gap, b, c, d;
+	REQUIRE(alloc.allocate(10, a));
+	REQUIRE(alloc.allocate(5, gap));
+	REQUIRE(alloc.allocate(20, b));
+	REQUIRE(alloc.allocate(30, c));
+	CHECK(a == 0);
+	CHECK(gap == 10);
+	CHECK(b == 15);
+	CHECK(c == 35);
+	CHECK(alloc.free_size() == 35);
+
+	// Holes of 10, 20 and 35, a 15 goes into the 20 even though the 10 comes first
+	alloc.free(a, 10);
+	alloc.free(b, 0);
+	alloc.free(b, 20);
+	CHECK(alloc.num_free_ranges() == 3);
+	REQUIRE(alloc.allocate(15, d));
+	CHECK(d == 15);
+	alloc.free(d, 15);
+
+	alloc.free(gap, 5);
+	CHECK(alloc.num_free_ranges() == 2);
+	alloc.free(c, 30);
+	CHECK(alloc.num_free_ranges() == 1);
+	CHECK(alloc.free_size() == 100);
+
+	CHECK(!alloc.allocate(101, d));
+	REQUIRE(alloc.allocate(0, d));
+	REQUIRE(alloc.allocate(100, d));
+	CHECK(d == 0);
+	CHECK(!alloc.allocate(1, d));
+}
+
+TEST_CASE("Range allocations never overlap and freeing everything restores one range") {
+	struct Allocation {
+		uint32_t offset, size;
+	};
+
+	std::mt19937 rng(7);
+	RangeAllocator alloc;
+	alloc.init(10000);
+
+	std::vector<Allocation> live;
+	for (int step = 0; step < 20000; step++) {
+		if (!live.empty() && rng() % 2 == 0) {
+			uint32_t idx = rng() % live.size();
+			alloc.free(live[idx].offset, live[idx].size);
+			live[idx] = live.back();
+			live.pop_back();
+			continue;
+		}
+		uint32_t size = 1 + rng() % 300;
+		uint32_t offset;
+		if (!alloc.allocate(size, offset)) continue;
+		CHECK(offset + size <= alloc.capacity());
+		for (const auto& other : live) {
+			CHECK((offset + size <= other.offset || other.offset + other.size <= offset));
+		}
+		live.push_back({offset, size});
+	}
+
+	uint32_t live_size = 0;
+	for (const auto& allocation : live) {
+		live_size += allocation.size;
+	}
+	CHECK(alloc.free_size() == alloc.capacity() - live_size);
+
+	for (const auto& allocation : live) {
+		alloc.free(allocation.offset, allocation.size);
+	}
+	CHECK(alloc.free_size() == alloc.capacity());
+	CHECK(alloc.num_free_ranges() == 1);
+}
+
+TEST_CASE("Geometry arena fills blocks in order and asks for a new one when full") {
+	GeometryArena arena;
+	GeometryAllocation a, b, c;
+	CHECK(!arena.allocate(10, 30, a));
+
+	CHECK(arena.add_block(100, 300) == 0);
+	REQUIRE(arena.allocate(60, 180, a));
+	CHECK(a.block == 0);
+	CHECK(a.vertex_offset == 0);
+	CHECK(a.first_index == 0);
+
+	// Enough vertices left but not enough indices
+	CHECK(!arena.allocate(30, 200, b));
+	CHECK(arena.add_block(100, 300) == 1);
+	REQUIRE(arena.allocate(30, 200, b));
+	CHECK(b.block == 1);
+
+	// Non indexed meshes only take vertices
+	REQUIRE(arena.allocate(40, 0, c));
+	CHECK(c.block == 0);
+	CHECK(c.vertex_offset == 60);
+
+	arena.free(a, 60, 180);
+	REQUIRE(arena.allocate(50, 150, a));
+	CHECK(a.block == 0);
+	CHECK(a.vertex_offset == 0);
+	CHECK(a.first_index == 0);
+}
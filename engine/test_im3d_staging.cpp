@@ -0,0 +1,131 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/im3d_staging.h"
+
+#include "nanothread/nanothread.h"
+
+#include <vector>
+
+TEST_CASE("Im3d staging batches vertices by style") {
+	Im3dStaging staging;
+	staging.push_line({0, 0, 0}, {1, 0, 0});
+	staging.set_line_color({1, 0, 0, 1});
+	staging.set_line_color({1, 0, 0, 1});
+	staging.push_line({0, 1, 0}, {1, 1, 0});
+	staging.push_line({0, 2, 0}, {1, 2, 0});
+	// Changing the style of an empty batch doesn't close it
+	staging.set_line_width(2.0f);
+	staging.set_line_width(3.0f);
+	staging.push_line({0, 3, 0}, {1, 3, 0});
+	// Other types keep their own style
+	staging.push_point({5, 5, 5});
+
+	CHECK(staging.num_vertices(Im3dPrimType::Line) == 8);
+	CHECK(staging.num_vertices(Im3dPrimType::Point) == 1);
+	CHECK(staging.num_vertices(Im3dPrimType::Triangle) == 0);
+
+	std::vector<glm::vec3> vertices(8);
+	Vector<Im3dBatch> batches;
+	staging.write(Im3dPrimType::Line, vertices.data(), 0, batches);
+	REQUIRE(batches.size() == 3);
+	CHECK(batches[0].first_vertex == 0);
+	CHECK(batches[0].num_vertices == 2);
+	CHECK(batches[0].style == Im3dStyle{});
+	CHECK(batches[1].first_vertex == 2);
+	CHECK(batches[1].num_vertices == 4);
+	CHECK(batches[1].style.color == glm::vec4(1, 0, 0, 1));
+	CHECK(batches[2].first_vertex == 6);
+	CHECK(batches[2].num_vertices == 2);
+	CHECK(batches[2].style.prim_width == 3.0f);
+	CHECK(vertices[5] == glm::vec3(1, 2, 0));
+
+	batches.truncate();
+	staging.write(Im3dPrimType::Point, vertices.data(), 0, batches);
+	REQUIRE(batches.size() == 1);
+	CHECK(batches[0].style == Im3dStyle{});
+
+	staging.clear();
+	CHECK(staging.num_vertices(Im3dPrimType::Line) == 0);
+	batches.truncate();
+	staging.write(Im3dPrimType::Line, vertices.data(), 0, batches);
+	CHECK(batches.empty());
+}
+
+TEST_CASE("Im3d staging bulk pushes drop incomplete primitives") {
+	Im3dStaging staging;
+	glm::vec3 points[7];
+	for (int i = 0; i < 7; i++) {
+		points[i] = glm::vec3((float)i);
+	}
+	staging.push_points(Span<const glm::vec3>(points, 7));
+	staging.push_lines(Span<const glm::vec3>(points, 7));
+	staging.push_tris(Span<const glm::vec3>(points, 7));
+	staging.push_tri(points[0], points[1], points[2]);
+
+	CHECK(staging.num_vertices(Im3dPrimType::Point) == 7);
+	CHECK(staging.num_vertices(Im3dPrimType::Line) == 6);
+	CHECK(staging.num_vertices(Im3dPrimType::Triangle) == 9);
+
+	std::vector<glm::vec3> vertices(9);
+	Vector<Im3dBatch> batches;
+	staging.write(Im3dPrimType::Triangle, vertices.data(), 0, batches);
+	for (int i = 0; i < 6; i++) {
+		CHECK(vertices[i] == points[i]);
+	}
+	CHECK(vertices[6] == points[0]);
+	CHECK(vertices[8] == points[2]);
+}
+
+TEST_CASE("Im3d stagings filled from the thread pool are gathered in order") {
+	Pool* pool = pool_create(4);
+	uint32_t num_threads = pool_size(pool) + 1;
+	Vector<Im3dStaging> stagings(num_threads);
+
+	constexpr uint32_t NUM_LINES = 100000;
+	drjit::parallel_for(drjit::blocked_range<uint32_t>(0, NUM_LINES, 1000), [&](auto range) {
+		Vector<glm::vec3> lines;
+		for (uint32_t i : range) {
+			lines.push_back(glm::vec3((float)i, 0, 0));
+			lines.push_back(glm::vec3((float)i, 1, 0));
+		}
+		auto& staging = stagings[pool_thread_id()];
+		staging.set_line_color(glm::vec4((float)range.begin(), 0, 0, 1));
+		staging.push_lines(Span<const glm::vec3>(lines.data(), lines.size()));
+	}, pool);
+
+	uint32_t num_vertices = 0;
+	for (const auto& staging : stagings) {
+		num_vertices += staging.num_vertices(Im3dPrimType::Line);
+	}
+	REQUIRE(num_vertices == 2 * NUM_LINES);
+
+	std::vector<glm::vec3> vertices(num_vertices);
+	Vector<Im3dBatch> batches;
+	uint32_t first_vertex = 0;
+	for (const auto& staging : stagings) {
+		staging.write(Im3dPrimType::Line, vertices.data() + first_vertex, first_vertex, batches);
+		first_vertex += staging.num_vertices(Im3dPrimType::Line);
+	}
+
+	// Every block is one batch whose color is where it started, covering its own lines
+	std::vector<int> seen(NUM_LINES, 0);
+	uint32_t next_vertex = 0;
+	for (const auto& batch : batches) {
+		CHECK(batch.first_vertex == next_vertex);
+		CHECK(batch.num_vertices == 2000);
+		uint32_t begin = (uint32_t)batch.style.color.r;
+		for (uint32_t v = 0; v < batch.num_vertices; v += 2) {
+			uint32_t line = (uint32_t)vertices[batch.first_vertex + v].x;
+			CHECK(line == begin + v / 2);
+			seen[line]++;
+		}
+		next_vertex += batch.num_vertices;
+	}
+	CHECK(next_vertex == num_vertices);
+	for (int count : seen) {
+		CHECK(count == 1);
+	}
+
+	pool_destroy(pool);
+}
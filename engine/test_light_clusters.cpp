@@ -0,0 +1,149 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "render/light_clusters.h"
+
+#include <random>
+#include <algorithm>
+
+constexpr glm::vec2 VIEWPORT = glm::vec2(1600.0f, 900.0f);
+
+// Same conventions as the engine's camera: [0, 1] depth and y flipped for Vulkan
+static glm::mat4 test_proj() {
+	glm::mat4 proj = glm::perspectiveFov(glm::radians(70.0f), VIEWPORT.x, VIEWPORT.y, 0.1f, 300.0f);
+	proj[1][1] *= -1;
+	return proj;
+}
+
+static glm::mat4 test_view() {
+	return glm::lookAt(glm::vec3(10.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0f, -50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+static Vector<glm::vec4> random_lights(std::mt19937& rng, uint32_t count) {
+	std::uniform_real_distribution<float> xz(-150.0f, 150.0f);
+	std::uniform_real_distribution<float> y(-10.0f, 30.0f);
+	std::uniform_real_distribution<float> radius(0.5f, 25.0f);
+	Vector<glm::vec4> lights;
+	for (uint32_t i = 0; i < count; i++) {
+		lights.push_back(glm::vec4(xz(rng), y(rng), xz(rng), radius(rng)));
+	}
+	return lights;
+}
+
+static Span<const glm::vec4> as_span(const Vector<glm::vec4>& lights) {
+	return Span<const glm::vec4>(lights.data(), lights.size());
+}
+
+TEST_CASE("Light clusters match testing every light against every cluster") {
+	std::mt19937 rng(1);
+	Vector<glm::vec4> lights = random_lights(rng, 256);
+	glm::mat4 view = test_view();
+
+	LightClusters clusters;
+	clusters.build(view, test_proj(), VIEWPORT, as_span(lights));
+	REQUIRE(clusters.clusters().size() == LIGHT_CLUSTER_COUNT);
+	CHECK(clusters.num_dropped() == 0);
+
+	uint32_t total = 0, mismatches = 0;
+	for (uint32_t z = 0; z < LIGHT_CLUSTERS_Z; z++) {
+		for (uint32_t y = 0; y < LIGHT_CLUSTERS_Y; y++) {
+			for (uint32_t x = 0; x < LIGHT_CLUSTERS_X; x++) {
+				glm::vec3 aabb_min, aabb_max;
+				clusters.cluster_bounds(x, y, z, aabb_min, aabb_max);
+				Vector<uint32_t> expected;
+				for (uint32_t i = 0; i < lights.size(); i++) {
+					glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(lights[i]), 1.0f));
+					float dx = glm::max(glm::max(aabb_min.x - center.x, center.x - aabb_max.x), 0.0f);
+					float dy = glm::max(glm::max(aabb_min.y - center.y, center.y - aabb_max.y), 0.0f);
+					float dz = glm::max(glm::max(aabb_min.z - center.z, center.z - aabb_max.z), 0.0f);
+					if (dx * dx + dy * dy + dz * dz <= lights[i].w * lights[i].w) {
+						expected.push_back(i);
+					}
+				}
+
+				glm::uvec2 cluster = clusters.clusters()[clusters.cluster_index(x, y, z)];
+				bool same = cluster.y == expected.size();
+				for (uint32_t k = 0; same && k < cluster.y; k++) {
+					same = clusters.light_indices()[cluster.x + k] == expected[k];
+				}
+				mismatches += !same;
+				total += cluster.y;
+			}
+		}
+	}
+	CHECK(mismatches == 0);
+	CHECK(total == clusters.light_indices().size());
+	// Far fewer than every light in every cluster
+	CHECK(total > 0);
+	CHECK(total < LIGHT_CLUSTER_COUNT * lights.size() / 8);
+}
+
+TEST_CASE("Fragments find the lights around them in their cluster") {
+	std::mt19937 rng(2);
+	Vector<glm::vec4> lights = random_lights(rng, 200);
+	glm::mat4 view = test_view();
+	glm::mat4 view_proj = test_proj() * view;
+
+	LightClusters clusters;
+	clusters.build(view, test_proj(), VIEWPORT, as_span(lights));
+
+	std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+	uint32_t num_checked = 0;
+	for (uint32_t i = 0; i < lights.size(); i++) {
+		for (uint32_t k = 0; k < 20; k++) {
+			// Well inside of the light, so that rounding at the cluster borders doesn't matter
+			glm::vec3 position = glm::vec3(lights[i]) + lights[i].w * glm::vec3(offset(rng), offset(rng), offset(rng));
+			glm::vec4 clip = view_proj * glm::vec4(position, 1.0f);
+			if (clip.w <= 0.0f) continue;
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			if (glm::abs(ndc.x) >= 1.0f || glm::abs(ndc.y) >= 1.0f || ndc.z <= 0.0f || ndc.z >= 1.0f) continue;
+
+			glm::vec2 frag_coord = (glm::vec2(ndc) * 0.5f + 0.5f) * VIEWPORT;
+			glm::uvec2 cluster = clusters.clusters()[clusters.cluster_at(frag_coord, position)];
+			const uint32_t* first = clusters.light_indices().data() + cluster.x;
+			CHECK(std::find(first, first + cluster.y, i) != first + cluster.y);
+			num_checked++;
+		}
+	}
+	CHECK(num_checked > 100);
+}
+
+TEST_CASE("Light clusters are split exponentially in depth") {
+	LightClusters clusters;
+	clusters.build(test_view(), test_proj(), VIEWPORT, Span<const glm::vec4>());
+	CHECK(clusters.light_indices().empty());
+
+	CHECK(clusters.slice_of(0.0f) == 0);
+	CHECK(clusters.slice_of(0.99f) == 0);
+	CHECK(clusters.slice_of(1.01f) == 1);
+	CHECK(clusters.slice_of(299.0f) == LIGHT_CLUSTERS_Z - 1);
+	CHECK(clusters.slice_of(1000.0f) == LIGHT_CLUSTERS_Z - 1);
+	for (uint32_t z = 1; z + 1 < LIGHT_CLUSTERS_Z; z++) {
+		glm::vec3 near_min, near_max, far_min, far_max;
+		clusters.cluster_bounds(0, 0, z, near_min, near_max);
+		clusters.cluster_bounds(0, 0, z + 1, far_min, far_max);
+		CHECK(far_max.z == near_min.z);
+		// Constant ratio between the depths of consecutive slices
+		CHECK((-far_min.z / -far_max.z) == doctest::Approx(-near_min.z / -near_max.z).epsilon(1e-3));
+		// The center of the slice maps back to it
+		CHECK(clusters.slice_of(-0.5f * (near_min.z + near_max.z)) == z);
+	}
+}
+
+TEST_CASE("Light clusters drop lights past their capacity") {
+	// Huge lights around the camera touch every cluster
+	Vector<glm::vec4> lights;
+	for (uint32_t i = 0; i < 80; i++) {
+		lights.push_back(glm::vec4(10.0f, 5.0f, 20.0f, 1000.0f));
+	}
+	LightClusters clusters;
+	clusters.build(test_view(), test_proj(), VIEWPORT, as_span(lights));
+	CHECK(clusters.light_indices().size() == MAX_LIGHT_CLUSTER_INDICES);
+	CHECK(clusters.num_dropped() == LIGHT_CLUSTER_COUNT * 80 - MAX_LIGHT_CLUSTER_INDICES);
+	glm::uvec2 last = clusters.clusters()[LIGHT_CLUSTER_COUNT - 1];
+	CHECK(last.y == 0);
+	CHECK(last.x == MAX_LIGHT_CLUSTER_INDICES);
+}
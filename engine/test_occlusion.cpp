@@ -0,0 +1,176 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "render/occlusion.h"
+#include "core/cpu.h"
+
+#include <random>
+
+// Camera looking down -z
+static glm::mat4 test_view_proj(glm::vec3 eye = glm::vec3(0.0f)) {
+	glm::mat4 proj = glm::perspective(glm::radians(90.0f), 2.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	return proj * view;
+}
+
+static void rasterize(OcclusionBuffer& buffer) {
+	for (uint32_t band = 0; band < OcclusionBuffer::NUM_BANDS; band++) {
+		buffer.rasterize_band(band);
+	}
+}
+
+static void add_wall(OcclusionBuffer& buffer, float z, float half_width, float half_height) {
+	glm::vec3 vertices[] = {
+		{-half_width, -half_height, z}, {half_width, -half_height, z},
+		{half_width, half_height, z}, {-half_width, half_height, z}
+	};
+	uint32_t indices[] = {0, 1, 2, 0, 2, 3};
+	buffer.add_triangles(Span<const glm::vec3>(vertices, 4), Span<const uint32_t>(indices, 6));
+}
+
+TEST_CASE("Occlusion buffer without occluders only rejects boxes outside of the screen") {
+	OcclusionBuffer buffer;
+	buffer.begin(test_view_proj());
+	rasterize(buffer);
+
+	CHECK(buffer.num_triangles() == 0);
+	CHECK(buffer.depth(0, 0) == 1.0f);
+	CHECK(buffer.tile_max_depth(3, 5) == 1.0f);
+
+	CHECK(buffer.is_visible(glm::vec3(-1, -1, -51), glm::vec3(1, 1, -49)));
+	CHECK(buffer.is_visible(glm::vec3(-1, -1, -900), glm::vec3(1, 1, -899)));
+	// Behind the camera, or to the side
+	CHECK(!buffer.is_visible(glm::vec3(-1, -1, 49), glm::vec3(1, 1, 51)));
+	CHECK(!buffer.is_visible(glm::vec3(200, -1, -51), glm::vec3(202, 1, -49)));
+	// Around the camera, crossing the near plane
+	CHECK(buffer.is_visible(glm::vec3(-1), glm::vec3(1)));
+	// Beyond the far plane
+	CHECK(!buffer.is_visible(glm::vec3(-1, -1, -2000), glm::vec3(1, 1, -1999)));
+}
+
+TEST_CASE("Occlusion buffer hides boxes behind a wall") {
+	OcclusionBuffer buffer;
+	buffer.begin(test_view_proj());
+	add_wall(buffer, -10.0f, 8.0f, 4.0f);
+	rasterize(buffer);
+	CHECK(buffer.num_triangles() == 2);
+
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -30.0f));
+	CHECK(!buffer.is_visible(glm::vec3(-1), glm::vec3(1), model));
+	CHECK(!buffer.is_visible(glm::vec3(-10, -5, -31), glm::vec3(10, 5, -29)));
+	// In front of the wall, or sticking out above it
+	CHECK(buffer.is_visible(glm::vec3(-1, -1, -6), glm::vec3(1, 1, -5)));
+	CHECK(buffer.is_visible(glm::vec3(-1, -1, -31), glm::vec3(1, 16, -29)));
+	// Just in front of the wall
+	CHECK(buffer.is_visible(glm::vec3(-1, -1, -9.9f), glm::vec3(1, 1, -9.9f)));
+
+	// The next frame starts without occluders
+	buffer.begin(test_view_proj());
+	rasterize(buffer);
+	CHECK(buffer.is_visible(glm::vec3(-1), glm::vec3(1), model));
+}
+
+TEST_CASE("Occlusion buffer keeps boxes just above the silhouette of an occluder") {
+	OcclusionBuffer buffer;
+	buffer.begin(test_view_proj());
+	add_wall(buffer, -10.0f, 8.0f, 4.0f);
+	rasterize(buffer);
+
+	// Entirely above the wall, but within the last row of pixels it covers
+	CHECK(buffer.is_visible(glm::vec3(-0.5f, 8.06f, -20.5f), glm::vec3(0.5f, 8.09f, -19.5f)));
+	for (int i = 0; i < 16; i++) {
+		float y = 8.01f + 0.02f * i;
+		CHECK(buffer.is_visible(glm::vec3(-0.5f, y, -20.0f), glm::vec3(0.5f, y + 0.01f, -20.0f)));
+	}
+	// Further down it's still hidden
+	CHECK(!buffer.is_visible(glm::vec3(-0.5f, 6.0f, -20.5f), glm::vec3(0.5f, 7.0f, -19.5f)));
+}
+
+TEST_CASE("Occluders are clipped at the near plane") {
+	OcclusionBuffer buffer;
+	buffer.begin(test_view_proj());
+	// Floor below the camera going from behind it into the distance, seen only from its near end onwards
+	glm::vec3 vertices[] = {{-500, -1, 50}, {500, -1, 50}, {500, -1, -500}, {-500, -1, -500}};
+	uint32_t indices[] = {0, 1, 2, 0, 2, 3};
+	buffer.add_triangles(Span<const glm::vec3>(vertices, 4), Span<const uint32_t>(indices, 6));
+	rasterize(buffer);
+	CHECK(buffer.num_triangles() > 0);
+
+	CHECK(!buffer.is_visible(glm::vec3(-1, -5, -21), glm::vec3(1, -3, -19)));
+	CHECK(buffer.is_visible(glm::vec3(-1, 0, -21), glm::vec3(1, 2, -19)));
+}
+
+TEST_CASE("Heightfield occluders stay below the cells they stand for") {
+	// Rows of cells along z from -40 to 20, seen from behind the last one
+	OccluderHeightfield ridge;
+	ridge.origin = glm::vec2(-30.0f, -40.0f);
+	ridge.cell_size = 20.0f;
+	ridge.res = 3;
+	ridge.min_heights = Vector<float>(9, 0.0f);
+	glm::mat4 view_proj = test_view_proj(glm::vec3(0.0f, 5.0f, 30.0f));
+	glm::vec3 box_min = glm::vec3(-1, 0.5f, -61), box_max = glm::vec3(1, 1.5f, -59);
+
+	// A single high cell can't raise any corner, they all touch a low cell too
+	ridge.min_heights[4] = 10.0f;
+	OcclusionBuffer buffer;
+	buffer.begin(view_proj);
+	buffer.add_heightfield(ridge);
+	rasterize(buffer);
+	CHECK(buffer.num_triangles() > 0);
+	CHECK(buffer.is_visible(box_min, box_max));
+
+	// Two high rows raise the corners between them
+	for (uint32_t i = 0; i < 6; i++) {
+		ridge.min_heights[i] = 10.0f;
+	}
+	buffer.begin(view_proj);
+	buffer.add_heightfield(ridge);
+	rasterize(buffer);
+	CHECK(!buffer.is_visible(box_min, box_max));
+	CHECK(buffer.is_visible(box_min + glm::vec3(0, 20, 0), box_max + glm::vec3(0, 20, 0)));
+}
+
+TEST_CASE("Scalar and AVX2 rasterization write the same depth") {
+	if (!cpu_supports_avx2()) return;
+
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> xy(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> z(-200.0f, 5.0f);
+	Vector<glm::vec3> vertices;
+	Vector<uint32_t> indices;
+	for (uint32_t i = 0; i < 300; i++) {
+		vertices.push_back(glm::vec3(xy(rng), xy(rng), z(rng)));
+		indices.push_back(i);
+	}
+
+	OcclusionBuffer scalar, avx2;
+	scalar.begin(test_view_proj());
+	avx2.begin(test_view_proj());
+	scalar.add_triangles(Span<const glm::vec3>(vertices.data(), vertices.size()), Span<const uint32_t>(indices.data(), indices.size()));
+	avx2.add_triangles(Span<const glm::vec3>(vertices.data(), vertices.size()), Span<const uint32_t>(indices.data(), indices.size()));
+	for (uint32_t band = 0; band < OcclusionBuffer::NUM_BANDS; band++) {
+		scalar.rasterize_band_scalar(band);
+		avx2.rasterize_band_avx2(band);
+	}
+
+	// The compiler may fuse the multiply-adds of either version, so the depth can be off by an ulp
+	uint32_t covered = 0, coverage_mismatches = 0, depth_mismatches = 0;
+	for (uint32_t y = 0; y < OcclusionBuffer::HEIGHT; y++) {
+		for (uint32_t x = 0; x < OcclusionBuffer::WIDTH; x++) {
+			covered += scalar.depth(x, y) < 1.0f;
+			coverage_mismatches += (scalar.depth(x, y) < 1.0f) != (avx2.depth(x, y) < 1.0f);
+			depth_mismatches += scalar.depth(x, y) != doctest::Approx(avx2.depth(x, y)).epsilon(1e-5);
+		}
+	}
+	CHECK(covered > 1000);
+	CHECK(coverage_mismatches == 0);
+	CHECK(depth_mismatches == 0);
+	for (uint32_t ty = 0; ty < OcclusionBuffer::TILES_Y; ty++) {
+		for (uint32_t tx = 0; tx < OcclusionBuffer::TILES_X; tx++) {
+			CHECK(scalar.tile_max_depth(tx, ty) == doctest::Approx(avx2.tile_max_depth(tx, ty)).epsilon(1e-5));
+		}
+	}
+}
@@ -0,0 +1,215 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/render_graph.h"
+
+constexpr uint32_t COLOR_FORMAT = 44;
+constexpr uint32_t DEPTH_FORMAT = 126;
+
+static uint32_t step_of(const RenderGraph& graph, uint32_t pass) {
+	for (uint32_t i = 0; i < graph.schedule().size(); i++) {
+		if (graph.schedule()[i].pass == pass) return i;
+	}
+	return UINT32_MAX;
+}
+
+TEST_CASE("Render graph keeps overlays in one scope and only transitions at the ends") {
+	RenderGraph graph;
+	uint32_t backbuffer = graph.add_imported_image(COLOR_FORMAT, RenderAccess::None, RenderAccess::Present);
+	uint32_t depth = graph.add_transient_image(DEPTH_FORMAT);
+
+	uint32_t ui = graph.add_pass();
+	uint32_t scene = graph.add_pass();
+	uint32_t debug = graph.add_pass();
+	for (uint32_t pass : {ui, scene, debug}) {
+		graph.use(pass, backbuffer, RenderAccess::ColorAttachment);
+		graph.use(pass, depth, RenderAccess::DepthAttachment);
+	}
+	graph.add_dependency(ui, scene);
+	graph.add_dependency(ui, debug);
+	REQUIRE(graph.compile());
+
+	const auto& schedule = graph.schedule();
+	REQUIRE(schedule.size() == 3);
+	CHECK(schedule[0].pass == scene);
+	CHECK(schedule[1].pass == debug);
+	CHECK(schedule[2].pass == ui);
+
+	CHECK(schedule[0].begins_scope);
+	CHECK(!schedule[0].ends_scope);
+	CHECK(!schedule[1].begins_scope);
+	CHECK(!schedule[2].begins_scope);
+	CHECK(schedule[2].ends_scope);
+
+	// Both attachments are discarded at the start, the depth buffer waits for its writes of the previous frame
+	REQUIRE(schedule[0].barrier_count == 2);
+	CHECK(schedule[1].barrier_count == 0);
+	CHECK(schedule[2].barrier_count == 0);
+	for (uint32_t i = 0; i < 2; i++) {
+		const auto& barrier = graph.barriers()[schedule[0].first_barrier + i];
+		CHECK(barrier.discard);
+		if (barrier.resource == backbuffer) {
+			CHECK(barrier.src == RenderAccess::Present);
+			CHECK(barrier.dst == RenderAccess::ColorAttachment);
+		}
+		else {
+			CHECK(barrier.resource == depth);
+			CHECK(barrier.src == RenderAccess::DepthAttachment);
+			CHECK(barrier.dst == RenderAccess::DepthAttachment);
+		}
+	}
+
+	REQUIRE(graph.final_barriers().size() == 1);
+	CHECK(graph.final_barriers()[0].resource == backbuffer);
+	CHECK(graph.final_barriers()[0].src == RenderAccess::ColorAttachment);
+	CHECK(graph.final_barriers()[0].dst == RenderAccess::Present);
+
+	CHECK(graph.num_physical_images() == 1);
+	CHECK(graph.physical_image(depth) == 0);
+	CHECK(graph.physical_image(backbuffer) == UINT32_MAX);
+}
+
+TEST_CASE("Render graph synchronizes attachments written by a previous scope") {
+	RenderGraph graph;
+	uint32_t backbuffer = graph.add_imported_image(COLOR_FORMAT, RenderAccess::None, RenderAccess::Present);
+	uint32_t depth = graph.add_transient_image(DEPTH_FORMAT);
+
+	uint32_t scene = graph.add_pass();
+	graph.use(scene, backbuffer, RenderAccess::ColorAttachment);
+	graph.use(scene, depth, RenderAccess::DepthAttachment);
+	uint32_t overlay = graph.add_pass();
+	graph.use(overlay, backbuffer, RenderAccess::ColorAttachment);
+	graph.add_dependency(overlay, scene);
+	REQUIRE(graph.compile());
+
+	const auto& schedule = graph.schedule();
+	REQUIRE(schedule.size() == 2);
+	CHECK(schedule[0].pass == scene);
+	CHECK(schedule[0].ends_scope);
+	CHECK(schedule[1].begins_scope);
+
+	// The overlay loads the backbuffer the scene stored in its own rendering scope
+	REQUIRE(schedule[1].barrier_count == 1);
+	const auto& barrier = graph.barriers()[schedule[1].first_barrier];
+	CHECK(barrier.resource == backbuffer);
+	CHECK(barrier.src == RenderAccess::ColorAttachment);
+	CHECK(barrier.dst == RenderAccess::ColorAttachment);
+	CHECK(!barrier.discard);
+}
+
+TEST_CASE("Render graph runs producers first and synchronizes their results") {
+	RenderGraph graph;
+	uint32_t backbuffer = graph.add_imported_image(COLOR_FORMAT, RenderAccess::None, RenderAccess::Present);
+	uint32_t shadow_map = graph.add_transient_image(DEPTH_FORMAT);
+	uint32_t culled = graph.add_imported_buffer(RenderAccess::None, RenderAccess::None);
+
+	// Added in the wrong order on purpose
+	uint32_t main = graph.add_pass();
+	graph.use(main, culled, RenderAccess::StorageRead);
+	graph.use(main, shadow_map, RenderAccess::SampledRead);
+	graph.use(main, backbuffer, RenderAccess::ColorAttachment);
+	uint32_t shadow = graph.add_pass();
+	graph.use(shadow, culled, RenderAccess::StorageRead);
+	graph.use(shadow, shadow_map, RenderAccess::DepthAttachment);
+	uint32_t cull = graph.add_pass();
+	graph.use(cull, culled, RenderAccess::StorageWrite);
+	REQUIRE(graph.compile());
+
+	CHECK(step_of(graph, cull) < step_of(graph, shadow));
+	CHECK(step_of(graph, shadow) < step_of(graph, main));
+
+	// The culling pass has no attachments, the other two have different ones
+	const auto& schedule = graph.schedule();
+	CHECK(!schedule[step_of(graph, cull)].begins_scope);
+	CHECK(!schedule[step_of(graph, cull)].ends_scope);
+	CHECK(schedule[step_of(graph, shadow)].begins_scope);
+	CHECK(schedule[step_of(graph, shadow)].ends_scope);
+	CHECK(schedule[step_of(graph, main)].begins_scope);
+
+	// The shadow pass waits for the culling results, the main pass doesn't have to wait again
+	const auto& shadow_step = schedule[step_of(graph, shadow)];
+	bool waits_for_culling = false;
+	for (uint32_t i = 0; i < shadow_step.barrier_count; i++) {
+		const auto& barrier = graph.barriers()[shadow_step.first_barrier + i];
+		waits_for_culling |= barrier.resource == culled && barrier.src == RenderAccess::StorageWrite;
+	}
+	CHECK(waits_for_culling);
+
+	const auto& main_step = schedule[step_of(graph, main)];
+	bool shadow_map_transition = false;
+	for (uint32_t i = 0; i < main_step.barrier_count; i++) {
+		const auto& barrier = graph.barriers()[main_step.first_barrier + i];
+		CHECK(barrier.resource != culled);
+		if (barrier.resource == shadow_map) {
+			shadow_map_transition = true;
+			CHECK(barrier.src == RenderAccess::DepthAttachment);
+			CHECK(barrier.dst == RenderAccess::SampledRead);
+			CHECK(!barrier.discard);
+		}
+	}
+	CHECK(shadow_map_transition);
+}
+
+TEST_CASE("Render graph aliases transient images whose lifetimes don't overlap") {
+	RenderGraph graph;
+	uint32_t a = graph.add_transient_image(COLOR_FORMAT);
+	uint32_t b = graph.add_transient_image(COLOR_FORMAT);
+	uint32_t c = graph.add_transient_image(COLOR_FORMAT);
+	uint32_t d = graph.add_transient_image(DEPTH_FORMAT);
+
+	uint32_t write_a = graph.add_pass();
+	graph.use(write_a, a, RenderAccess::ColorAttachment);
+	graph.use(write_a, d, RenderAccess::DepthAttachment);
+	uint32_t a_to_b = graph.add_pass();
+	graph.use(a_to_b, a, RenderAccess::SampledRead);
+	graph.use(a_to_b, b, RenderAccess::ColorAttachment);
+	uint32_t b_to_c = graph.add_pass();
+	graph.use(b_to_c, b, RenderAccess::SampledRead);
+	graph.use(b_to_c, c, RenderAccess::ColorAttachment);
+	REQUIRE(graph.compile());
+
+	// a is dead by the time c is written, b overlaps with both
+	CHECK(graph.num_physical_images() == 3);
+	CHECK(graph.physical_image(a) == graph.physical_image(c));
+	CHECK(graph.physical_image(a) != graph.physical_image(b));
+	CHECK(graph.physical_image(d) != graph.physical_image(a));
+	CHECK(graph.physical_image_format(graph.physical_image(d)) == DEPTH_FORMAT);
+
+	// c takes over from a, and a takes over from c of the previous frame
+	const auto& barriers = graph.barriers();
+	for (const auto& barrier : barriers) {
+		if (barrier.resource == c) {
+			CHECK(barrier.discard);
+			CHECK(barrier.src == RenderAccess::SampledRead);
+		}
+		if (barrier.resource == a && barrier.discard) {
+			CHECK(barrier.src == RenderAccess::ColorAttachment);
+		}
+	}
+	CHECK(graph.final_barriers().empty());
+}
+
+TEST_CASE("Render graph rejects cycles and can be rebuilt") {
+	RenderGraph graph;
+	uint32_t x = graph.add_imported_buffer(RenderAccess::None, RenderAccess::None);
+	uint32_t y = graph.add_imported_buffer(RenderAccess::None, RenderAccess::None);
+	uint32_t first = graph.add_pass();
+	graph.use(first, x, RenderAccess::StorageWrite);
+	graph.use(first, y, RenderAccess::StorageRead);
+	uint32_t second = graph.add_pass();
+	graph.use(second, y, RenderAccess::StorageWrite);
+	graph.use(second, x, RenderAccess::StorageRead);
+	CHECK(!graph.compile());
+	CHECK(graph.schedule().empty());
+
+	graph.reset();
+	uint32_t backbuffer = graph.add_imported_image(COLOR_FORMAT, RenderAccess::None, RenderAccess::Present);
+	REQUIRE(graph.compile());
+	CHECK(graph.schedule().empty());
+
+	// Nothing drew into the backbuffer, it still has to be presentable
+	REQUIRE(graph.final_barriers().size() == 1);
+	CHECK(graph.final_barriers()[0].resource == backbuffer);
+	CHECK(graph.final_barriers()[0].discard);
+	CHECK(graph.final_barriers()[0].dst == RenderAccess::Present);
+}
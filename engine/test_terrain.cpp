@@ -0,0 +1,464 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "terrain_algo.h"
+#include "terrain_cache.h"
+#include "terrain_clipmap.h"
+#include "terrain_raycast.h"
+#include "terrain_tile_store.h"
+#include "core/cpu.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+
+#include <chrono>
+
+static Vector<glm::vec2> make_test_points(uint32_t count) {
+	// Deterministic spread of points, including negative coordinates and lattice boundaries
+	Vector<glm::vec2> points(count);
+	uint32_t state = 12345;
+	for (uint32_t i = 0; i < count; i++) {
+		state = state * 1664525u + 1013904223u;
+		float x = (float)(state >> 8) / (float)(1 << 24) * 2000.0f - 1000.0f;
+		state = state * 1664525u + 1013904223u;
+		float y = (float)(state >> 8) / (float)(1 << 24) * 2000.0f - 1000.0f;
+		points[i] = (i % 16 == 0) ? glm::floor(glm::vec2(x, y)) : glm::vec2(x, y);
+	}
+	return points;
+}
+
+static void check_batch_matches_reference(const Terrain& terrain, bool use_avx2) {
+	auto points = make_test_points(1003);
+	Vector<glm::vec3> out(points.size());
+	Span<const glm::vec2> in_span(points.data(), points.size());
+	if (use_avx2) {
+		calc_terrain_with_gradient_batch_avx2(in_span, out, terrain);
+	}
+	else {
+		calc_terrain_with_gradient_batch_scalar(in_span, out, terrain);
+	}
+
+	const float eps = 1e-3f * terrain.height_multiplier;
+	for (uint32_t i = 0; i < points.size(); i++) {
+		glm::vec3 ref = calc_terrain_with_gradient(terrain, points[i]);
+		CHECK(glm::abs(out[i].x - ref.x) < eps);
+		CHECK(glm::abs(out[i].y - ref.y) < eps);
+		CHECK(glm::abs(out[i].z - ref.z) < eps);
+	}
+}
+
+TEST_CASE("Terrain batch (scalar) matches reference") {
+	Terrain terrain;
+	check_batch_matches_reference(terrain, false);
+}
+
+TEST_CASE("Terrain batch (AVX2) matches reference") {
+	if (!cpu_supports_avx2()) {
+		MESSAGE("AVX2 not supported on this CPU, skipping");
+		return;
+	}
+
+	Terrain terrain;
+	check_batch_matches_reference(terrain, true);
+
+	terrain.octaves = 1;
+	terrain.scale = 1.5f;
+	check_batch_matches_reference(terrain, true);
+
+	terrain.octaves = 6;
+	terrain.persistance = 0.5f;
+	terrain.lacunarity = 3.0f;
+	terrain.chunk_width = 3.0f;
+	terrain.height_multiplier = 50.0f;
+	check_batch_matches_reference(terrain, true);
+}
+
+TEST_CASE("Terrain raycast matches marching the height cache") {
+	Terrain terrain;
+	TerrainHeightCache cache(nullptr, &terrain);
+	cache.update(glm::vec2(32.0f));
+	cache.wait_all();
+
+	float min_height, max_height;
+	calc_terrain_height_bounds(terrain, min_height, max_height);
+
+	auto march = [&](glm::vec3 origin, glm::vec3 dir, float max_t) {
+		for (float t = 0.0f; t <= max_t; t += 0.01f) {
+			glm::vec3 p = origin + t * dir;
+			glm::vec3 res;
+			if (!cache.try_sample(glm::vec2(p.x, p.z), res)) return -2.0f;
+			if (p.y <= res.x) return t;
+		}
+		return -1.0f;
+	};
+
+	// Rays stay inside the cached ring, which covers [-128, 192) around the center tile
+	auto points = make_test_points(200);
+	Vector<TerrainRay> rays(points.size());
+	for (uint32_t i = 0; i < points.size(); i++) {
+		glm::vec2 from = 32.0f + points[i] * 0.08f;
+		glm::vec2 to = 32.0f + points[(i * 7 + 3) % points.size()] * 0.08f;
+		rays[i].origin = glm::vec3(from.x, max_height * (i % 2 ? 0.5f : 1.2f), from.y);
+		rays[i].dir = glm::vec3(to.x - from.x, min_height - rays[i].origin.y, to.y - from.y) / 100.0f;
+		rays[i].max_t = 100.0f;
+	}
+
+	Vector<TerrainRayHit> hits(rays.size());
+	terrain_raycast_batch(cache, Span<const TerrainRay>(rays.data(), rays.size()), hits);
+	for (uint32_t i = 0; i < rays.size(); i++) {
+		float t_ref = march(rays[i].origin, rays[i].dir, rays[i].max_t);
+		REQUIRE(t_ref > -2.0f);
+		REQUIRE(hits[i].valid == (t_ref >= 0.0f));
+		if (hits[i].valid) {
+			CHECK(glm::abs(hits[i].t - t_ref) < 0.02f);
+
+			glm::vec3 res;
+			cache.try_sample(glm::vec2(hits[i].pos.x, hits[i].pos.z), res);
+			CHECK(glm::abs(hits[i].pos.y - res.x) < 1e-2f);
+		}
+	}
+
+	// Line of sight well above the terrain, and straight through it
+	CHECK(!terrain_segment_intersects(cache, glm::vec3(0, max_height + 1, 0), glm::vec3(64, max_height + 1, 64)));
+	CHECK(terrain_segment_intersects(cache, glm::vec3(0, max_height + 1, 0), glm::vec3(64, min_height - 1, 64)));
+}
+
+TEST_CASE("Terrain cache min heights bound the cached surface") {
+	Terrain terrain;
+	TerrainHeightCache cache(nullptr, &terrain);
+	cache.update(glm::vec2(32.0f));
+	cache.wait_all();
+
+	float min_height, max_height;
+	calc_terrain_height_bounds(terrain, min_height, max_height);
+
+	// Cells of 8 units covering the ring and one more on each side, which isn't cached
+	constexpr int LEVEL = 3, RES = 42;
+	const float cell_size = cache.tile_size() / (TerrainHeightCache::TILE_RES >> LEVEL);
+	const glm::ivec2 first_cell = glm::ivec2(-17);
+	Vector<float> heights(RES * RES);
+	cache.min_heights(LEVEL, first_cell, RES, heights);
+
+	uint32_t uncached = 0;
+	for (int y = 0; y < RES; y++) {
+		for (int x = 0; x < RES; x++) {
+			glm::vec2 cell_origin = glm::vec2(first_cell + glm::ivec2(x, y)) * cell_size;
+			float lowest = FLT_MAX;
+			bool cached = true;
+			for (int sy = 0; sy <= 4 && cached; sy++) {
+				for (int sx = 0; sx <= 4 && cached; sx++) {
+					glm::vec3 res;
+					cached = cache.try_sample(cell_origin + glm::vec2(sx, sy) * (cell_size / 4.0f) * 0.999f, res);
+					lowest = glm::min(lowest, res.x);
+				}
+			}
+			if (!cached) {
+				uncached++;
+				CHECK(heights[y * RES + x] == min_height);
+				continue;
+			}
+			CHECK(heights[y * RES + x] <= lowest + 1e-4f);
+			CHECK(heights[y * RES + x] > min_height);
+		}
+	}
+	CHECK(uncached == RES * RES - 40 * 40);
+}
+
+TEST_CASE("Terrain tile store round trips the baked terrain") {
+	const char* filename = "test_terrain_tiles.bin";
+	Terrain terrain;
+	TerrainBakeParams params;
+	params.origin_tile = glm::ivec2(-2, -1);
+	params.num_tiles = glm::ivec2(5, 3);
+	params.tile_size = 64.0f;
+	params.tile_res = 32;
+	params.num_mips = 3;
+	REQUIRE(bake_terrain_tiles(filename, params, terrain));
+
+	TerrainTileStore store;
+	REQUIRE(store.open(filename, 4));
+	CHECK(store.num_tiles(1) == glm::ivec2(3, 2));
+	CHECK(store.num_tiles(2) == glm::ivec2(2, 1));
+
+	// Every sample of mip 0, quantized heights and 8-bit normals
+	const float spacing = params.tile_size / params.tile_res;
+	const glm::ivec2 num_samples = params.num_tiles * (int)params.tile_res + 1;
+	float max_height_error = 0.0f, min_normal_dot = 1.0f;
+	for (int y = 0; y < num_samples.y; y++) {
+		for (int x = 0; x < num_samples.x; x++) {
+			glm::vec2 pos = (glm::vec2(params.origin_tile) * params.tile_size) + spacing * glm::vec2(x, y);
+			glm::vec3 ref = calc_terrain_with_gradient(terrain, pos);
+			glm::vec3 res;
+			REQUIRE(store.sample(pos, 0, res));
+			max_height_error = glm::max(max_height_error, glm::abs(res.x - ref.x));
+			glm::vec3 n_ref = glm::normalize(glm::vec3(-ref.y, 1.0f, -ref.z));
+			glm::vec3 n_res = glm::normalize(glm::vec3(-res.y, 1.0f, -res.z));
+			min_normal_dot = glm::min(min_normal_dot, glm::dot(n_ref, n_res));
+
+			// Coarser mips share every 2^mip-th sample
+			if (x % 4 == 0 && y % 4 == 0) {
+				glm::vec3 coarse;
+				REQUIRE(store.sample(pos, 2, coarse));
+				CHECK(glm::abs(coarse.x - ref.x) < 1e-2f);
+			}
+		}
+	}
+	CHECK(max_height_error < 1e-2f);
+	CHECK(min_normal_dot > 0.999f);
+
+	// Coarse tiles bound the finer tiles below them
+	for (int mip = 1; mip < store.num_mips(); mip++) {
+		glm::ivec2 child_tiles = store.num_tiles(mip - 1);
+		for (int cy = 0; cy < child_tiles.y; cy++) {
+			for (int cx = 0; cx < child_tiles.x; cx++) {
+				auto child = store.find_entry(mip - 1, glm::ivec2(cx, cy));
+				auto parent = store.find_entry(mip, glm::ivec2(cx, cy) / 2);
+				REQUIRE(parent);
+				CHECK(parent->min_height <= child->min_height);
+				CHECK(parent->max_height >= child->max_height);
+			}
+		}
+	}
+
+	glm::vec3 res;
+	CHECK(!store.sample(glm::vec2(-200.0f, 0.0f), 0, res));
+	CHECK(!store.find_entry(0, glm::ivec2(5, 0)));
+	CHECK(store.num_decoded > 0);
+	CHECK(store.num_cache_hits > 0);
+
+	store.close();
+	remove(filename);
+
+	// Any height source can be baked, planar patches compress to almost nothing
+	auto plane = [](void*, Span<const glm::vec2> pos, Span<glm::vec3> out) {
+		for (uint32_t i = 0; i < pos.size(); i++) {
+			out[i] = glm::vec3(0.25f * pos[i].x - 0.5f * pos[i].y + 3.0f, 0.25f, -0.5f);
+		}
+	};
+	REQUIRE(bake_terrain_tiles(filename, params, plane, nullptr));
+	REQUIRE(store.open(filename));
+	// The single row of mip 2 tiles reaches past the baked region up to z = 192
+	CHECK(store.header().min_height == doctest::Approx(0.25f * -128.0f - 0.5f * 192.0f + 3.0f));
+	for (int mip = 0; mip < store.num_mips(); mip++) {
+		CHECK(store.find_entry(mip, glm::ivec2(0))->compressed_size < 1000);
+		REQUIRE(store.sample(glm::vec2(10.3f, 20.7f), mip, res));
+		CHECK(res.x == doctest::Approx(0.25f * 10.3f - 0.5f * 20.7f + 3.0f).epsilon(1e-4));
+		CHECK(glm::abs(res.y - 0.25f) < 1e-2f);
+		CHECK(glm::abs(res.z + 0.5f) < 1e-2f);
+	}
+	store.close();
+	remove(filename);
+}
+
+TEST_CASE("Terrain clipmap strips cover exactly the newly exposed texels") {
+	const int res = 16;
+	const glm::ivec2 moves[][2] = {
+		{{0, 0}, {3, 0}}, {{0, 0}, {0, -5}}, {{-7, 4}, {-2, -3}}, {{13, -20}, {1, 2}},
+		{{-30, -30}, {-31, -18}}, {{5, 5}, {40, 5}}, {{0, 0}, {0, 0}}
+	};
+	for (const auto& move : moves) {
+		glm::ivec2 old_origin = move[0], new_origin = move[1];
+		Vector<TerrainClipmapRegion> regions;
+		TerrainClipmap::dirty_regions(old_origin, new_origin, res, false, regions);
+
+		int coverage[res][res] = {};
+		for (const auto& region : regions) {
+			// Inside the new window and not wrapping around the texture
+			CHECK(glm::all(glm::greaterThanEqual(region.texel, new_origin)));
+			CHECK(glm::all(glm::lessThanEqual(region.texel + region.size, new_origin + res)));
+			glm::ivec2 wrapped = ((region.texel % res) + res) % res;
+			CHECK(glm::all(glm::lessThanEqual(wrapped + region.size, glm::ivec2(res))));
+			for (int y = 0; y < region.size.y; y++) {
+				for (int x = 0; x < region.size.x; x++) {
+					glm::ivec2 t = region.texel + glm::ivec2(x, y) - new_origin;
+					coverage[t.y][t.x]++;
+				}
+			}
+		}
+		for (int y = 0; y < res; y++) {
+			for (int x = 0; x < res; x++) {
+				glm::ivec2 t = new_origin + glm::ivec2(x, y);
+				bool in_old = glm::all(glm::greaterThanEqual(t, old_origin)) && glm::all(glm::lessThan(t, old_origin + res));
+				CHECK(coverage[y][x] == (in_old ? 0 : 1));
+			}
+		}
+	}
+}
+
+TEST_CASE("Terrain clipmap matches the terrain after moving around") {
+	Terrain terrain;
+	const int num_levels = 3, res = 32;
+	TerrainClipmap clipmap(nullptr, &terrain, num_levels, res);
+
+	// CPU stand-in for the clipmap texture, one res x res layer per level
+	Vector<glm::vec4> texture(num_levels * res * res);
+	auto step = [&](glm::vec2 center) {
+		clipmap.update(center);
+		clipmap.wait_all();
+		Vector<TerrainClipmapUpload> uploads;
+		clipmap.collect_uploads(uploads);
+		auto data = clipmap.upload_data();
+		uint32_t num_texels = 0;
+		for (const auto& upload : uploads) {
+			const auto& region = upload.region;
+			for (int y = 0; y < region.size.y; y++) {
+				for (int x = 0; x < region.size.x; x++) {
+					glm::ivec2 t = ((region.texel + glm::ivec2(x, y)) % res + res) % res;
+					texture[(upload.level * res + t.y) * res + t.x] = data[upload.first_texel + y * region.size.x + x];
+				}
+			}
+			num_texels += region.size.x * region.size.y;
+		}
+		CHECK(num_texels == data.size());
+		return num_texels;
+	};
+
+	auto check_levels = [&](glm::vec2 center) {
+		for (int k = 0; k < num_levels; k++) {
+			const auto& level = clipmap.levels()[k];
+			REQUIRE(level.valid);
+			CHECK(level.origin == clipmap.window_origin(k, center));
+			for (int y = 0; y < res; y += 3) {
+				for (int x = 0; x < res; x += 3) {
+					glm::ivec2 t = level.origin + glm::ivec2(x, y);
+					glm::vec3 ref = calc_terrain_with_gradient(terrain, level.spacing * glm::vec2(t));
+					glm::ivec2 w = (t % res + res) % res;
+					glm::vec4 texel = texture[(k * res + w.y) * res + w.x];
+					CHECK(glm::abs(texel.x - ref.x) < 1e-3f * terrain.height_multiplier);
+					CHECK(glm::abs(texel.y - ref.y) < 1e-3f * terrain.height_multiplier);
+				}
+			}
+		}
+	};
+
+	// Everything at first, then only strips
+	CHECK(step(glm::vec2(0.0f)) == num_levels * res * res);
+	check_levels(glm::vec2(0.0f));
+	const glm::vec2 centers[] = {{0.3f, 0.1f}, {1.3f, -0.7f}, {-5.0f, 7.0f}, {40.0f, -30.0f}, {-1000.0f, 1000.0f}};
+	for (glm::vec2 center : centers) {
+		uint32_t num_texels = step(center);
+		CHECK(num_texels <= num_levels * res * res);
+		check_levels(center);
+	}
+	CHECK(step(centers[4]) == 0);
+
+	// Changing the terrain regenerates every level
+	terrain.seed = 7;
+	CHECK(step(centers[4]) == num_levels * res * res);
+	check_levels(centers[4]);
+}
+
+struct NoiseStats {
+	float mean = 0.0f, stddev = 0.0f, min = 0.0f, max = 0.0f;
+	float grad_error = 0.0f;	// max difference between the analytic and finite difference gradient
+	float anisotropy = 0.0f;	// ratio of the gradient variance along x and z
+};
+
+static NoiseStats calc_noise_stats(const Terrain& terrain) {
+	auto points = make_test_points(20000);
+	Vector<glm::vec3> out(points.size());
+	calc_terrain_with_gradient_batch(Span<const glm::vec2>(points.data(), points.size()), out, terrain);
+
+	NoiseStats stats;
+	stats.min = stats.max = out[0].x;
+	double sum = 0.0, sum_sq = 0.0, grad_x_sq = 0.0, grad_z_sq = 0.0;
+	for (uint32_t i = 0; i < points.size(); i++) {
+		sum += out[i].x;
+		sum_sq += out[i].x * out[i].x;
+		grad_x_sq += out[i].y * out[i].y;
+		grad_z_sq += out[i].z * out[i].z;
+		stats.min = glm::min(stats.min, out[i].x);
+		stats.max = glm::max(stats.max, out[i].x);
+
+		if (i % 16 == 0) {
+			const float h = 1e-3f;
+			float dx = (calc_terrain_with_gradient(terrain, points[i] + glm::vec2(h, 0)).x - calc_terrain_with_gradient(terrain, points[i] - glm::vec2(h, 0)).x) / (2 * h);
+			float dz = (calc_terrain_with_gradient(terrain, points[i] + glm::vec2(0, h)).x - calc_terrain_with_gradient(terrain, points[i] - glm::vec2(0, h)).x) / (2 * h);
+			stats.grad_error = glm::max(stats.grad_error, glm::max(glm::abs(dx - out[i].y), glm::abs(dz - out[i].z)));
+		}
+	}
+	stats.mean = (float)(sum / points.size());
+	stats.stddev = (float)std::sqrt(sum_sq / points.size() - (double)stats.mean * stats.mean);
+	stats.anisotropy = (float)(grad_x_sq / grad_z_sq);
+	return stats;
+}
+
+TEST_CASE("Terrain table noise has the same statistics as the hash noise") {
+	for (int octaves = 1; octaves <= 6; octaves++) {
+		Terrain terrain;
+		terrain.octaves = octaves;
+		NoiseStats hash = calc_noise_stats(terrain);
+		terrain.noise = TerrainNoise::Table;
+		NoiseStats table = calc_noise_stats(terrain);
+
+		MESSAGE("octaves " << octaves
+			<< ": hash mean " << hash.mean << " stddev " << hash.stddev << " range [" << hash.min << ", " << hash.max << "] anisotropy " << hash.anisotropy
+			<< " / table mean " << table.mean << " stddev " << table.stddev << " range [" << table.min << ", " << table.max << "] anisotropy " << table.anisotropy);
+
+		float min_height, max_height;
+		calc_terrain_height_bounds(terrain, min_height, max_height);
+		CHECK(table.min >= min_height);
+		CHECK(table.max <= max_height);
+		CHECK(glm::abs(table.mean) < 0.1f * hash.stddev + 0.05f * max_height);
+		CHECK(table.stddev > 0.75f * hash.stddev);
+		CHECK(table.stddev < 1.33f * hash.stddev);
+		CHECK(table.anisotropy > 0.8f);
+		CHECK(table.anisotropy < 1.25f);
+		CHECK(table.grad_error < 0.01f * max_height);
+	}
+}
+
+TEST_CASE("Terrain table noise depends on the seed") {
+	Terrain terrain;
+	terrain.noise = TerrainNoise::Table;
+	glm::vec3 a = calc_terrain_with_gradient(terrain, glm::vec2(12.3f, 45.6f));
+	CHECK(a == calc_terrain_with_gradient(terrain, glm::vec2(12.3f, 45.6f)));
+
+	terrain.seed = 1;
+	glm::vec3 b = calc_terrain_with_gradient(terrain, glm::vec2(12.3f, 45.6f));
+	CHECK(a != b);
+
+	// Specialized and runtime octave loops give the same result
+	const auto& table = terrain_noise_table(terrain.seed);
+	glm::vec3 c = calc_terrain_with_gradient_table<0>(table, glm::vec2(12.3f, 45.6f), terrain.scale, terrain.octaves,
+		terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+	CHECK(b == c);
+}
+
+// Run with --no-skip to see the timings
+TEST_CASE("Terrain noise benchmark" * doctest::skip()) {
+	auto points = make_test_points(1 << 18);
+	Span<const glm::vec2> in_span(points.data(), points.size());
+	Vector<glm::vec3> out(points.size());
+
+	auto bench = [&](doctest::String name, auto&& func) {
+		func();		// warm up
+		auto start = std::chrono::steady_clock::now();
+		constexpr int REPEATS = 4;
+		for (int k = 0; k < REPEATS; k++) {
+			func();
+		}
+		auto end = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(end - start).count() / (REPEATS * points.size());
+		MESSAGE(name << ": " << ns << " ns/sample");
+	};
+
+	for (int octaves = 1; octaves <= 4; octaves++) {
+		Terrain terrain;
+		terrain.octaves = octaves;
+		const auto& table = terrain_noise_table(terrain.seed);
+		MESSAGE("octaves " << octaves);
+		bench("  hash scalar", [&] { calc_terrain_with_gradient_batch_scalar(in_span, out, terrain); });
+		if (cpu_supports_avx2()) {
+			bench("  hash avx2", [&] { calc_terrain_with_gradient_batch_avx2(in_span, out, terrain); });
+		}
+		bench("  table runtime octaves", [&] {
+			for (uint32_t i = 0; i < points.size(); i++) {
+				out[i] = calc_terrain_with_gradient_table<0>(table, points[i], terrain.scale, terrain.octaves,
+					terrain.persistance, terrain.lacunarity, terrain.chunk_width, terrain.height_multiplier);
+			}
+		});
+		bench("  table specialized", [&] { calc_terrain_with_gradient_table_batch(table, in_span, out, terrain); });
+	}
+}
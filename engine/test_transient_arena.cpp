@@ -0,0 +1,52 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/transient_arena.h"
+
+TEST_CASE("Transient arena allocates linearly until reset") {
+	TransientArena arena;
+	arena.reset(1024);
+
+	size_t a, b, c;
+	REQUIRE(arena.allocate(100, 16, a));
+	REQUIRE(arena.allocate(10, 4, b));
+	REQUIRE(arena.allocate(200, 16, c));
+	CHECK(a == 0);
+	CHECK(b == 100);
+	CHECK(c == 112);
+	CHECK(arena.used() == 312);
+	CHECK(arena.demand() == 312);
+
+	arena.reset(1024);
+	CHECK(arena.used() == 0);
+	CHECK(arena.demand() == 0);
+	REQUIRE(arena.allocate(1024, 16, a));
+	CHECK(a == 0);
+}
+
+TEST_CASE("Transient arena keeps track of what didn't fit") {
+	TransientArena arena;
+	arena.reset(256);
+
+	size_t a, b, c;
+	REQUIRE(arena.allocate(200, 16, a));
+	CHECK(!arena.allocate(100, 16, b));
+	// A failed allocation doesn't take up space, smaller ones still fit after it
+	REQUIRE(arena.allocate(40, 16, c));
+	CHECK(c == 208);
+	CHECK(arena.used() == 248);
+
+	// Growing the arena to the demand fits the same allocations
+	size_t demand = arena.demand();
+	CHECK(demand == 200 + 8 + 100 + 12 + 40);
+	arena.reset(demand);
+	REQUIRE(arena.allocate(200, 16, a));
+	REQUIRE(arena.allocate(100, 16, b));
+	REQUIRE(arena.allocate(40, 16, c));
+	CHECK(arena.used() == demand);
+
+	// Empty arenas fit nothing
+	arena.reset(0);
+	CHECK(!arena.allocate(1, 1, a));
+	CHECK(arena.demand() == 1);
+}
@@ -0,0 +1,107 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "render/upload_ring.h"
+
+#include <random>
+#include <vector>
+
+TEST_CASE("Upload ring allocates linearly and frees whole batches") {
+	UploadRing ring;
+	ring.init(1024);
+
+	size_t a, b, c;
+	REQUIRE(ring.allocate(100, 16, a));
+	REQUIRE(ring.allocate(100, 16, b));
+	CHECK(a == 0);
+	CHECK(b == 112);
+	CHECK(ring.used() == 212);
+
+	uint64_t open_serial = ring.next_serial();
+	uint64_t first = ring.close_batch();
+	CHECK(first == open_serial);
+	REQUIRE(ring.allocate(500, 256, c));
+	CHECK(c == 256);
+	uint64_t second = ring.close_batch();
+	CHECK(second > first);
+
+	// Full until the first batch is released
+	size_t d;
+	CHECK(!ring.allocate(400, 16, d));
+	ring.release(first);
+	CHECK(ring.used() == 756 - 212);
+	REQUIRE(ring.allocate(200, 16, d));
+	CHECK(d == 768);
+	CHECK(ring.used() == 544 + 12 + 200);
+
+	// Doesn't fit before the end anymore, wraps around into the space of the first batch
+	size_t e;
+	REQUIRE(ring.allocate(150, 16, e));
+	CHECK(e == 0);
+	CHECK(ring.used() == 756 + (1024 - 968) + 150);
+
+	uint64_t third = ring.close_batch();
+	ring.release(second);
+	ring.release(second);
+	CHECK(ring.used() == 12 + 200 + (1024 - 968) + 150);
+	ring.release(third);
+	CHECK(ring.used() == 0);
+
+	// Oversized allocations never fit
+	CHECK(!ring.allocate(2048, 16, d));
+}
+
+TEST_CASE("Upload ring allocations in flight never overlap") {
+	struct Allocation {
+		uint64_t serial;
+		size_t offset, size;
+	};
+
+	std::mt19937 rng(3);
+	UploadRing ring;
+	ring.init(1 << 16);
+
+	std::vector<Allocation> in_flight;
+	std::vector<uint64_t> submitted;
+	uint64_t prev_serial = 0;
+	for (int frame = 0; frame < 2000; frame++) {
+		// Frames in flight are retired in order, two behind the current one
+		if (submitted.size() > 2) {
+			uint64_t serial = submitted.front();
+			submitted.erase(submitted.begin());
+			ring.release(serial);
+			std::erase_if(in_flight, [&](const Allocation& alloc) { return alloc.serial <= serial; });
+		}
+
+		std::vector<Allocation> batch;
+		int count = rng() % 8;
+		for (int i = 0; i < count; i++) {
+			size_t size = 1 + rng() % 12000;
+			size_t alignment = (size_t)1 << (rng() % 9);
+			size_t offset;
+			if (!ring.allocate(size, alignment, offset)) continue;
+			CHECK(offset % alignment == 0);
+			CHECK(offset + size <= ring.capacity());
+			for (const auto& other : in_flight) {
+				CHECK((offset + size <= other.offset || other.offset + other.size <= offset));
+			}
+			for (const auto& other : batch) {
+				CHECK((offset + size <= other.offset || other.offset + other.size <= offset));
+			}
+			batch.push_back({0, offset, size});
+		}
+		uint64_t serial = ring.close_batch();
+		CHECK(serial > prev_serial);
+		prev_serial = serial;
+		for (auto& alloc : batch) {
+			alloc.serial = serial;
+			in_flight.push_back(alloc);
+		}
+		submitted.push_back(serial);
+	}
+
+	for (uint64_t serial : submitted) {
+		ring.release(serial);
+	}
+	CHECK(ring.used() == 0);
+}
@@ -1 +1,92 @@
-#include "renderer.h"
\ No newline at end of file
+#include "terrain_algo.h"
+#include "terrain_tile_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "nanothread/nanothread.h"
+
+static void print_usage() {
+    printf(
+        "usage: packer <command> [options]\n"
+        "\n"
+        "commands:\n"
+        "  bake-terrain <output file>   bake the procedural terrain into a tile store\n"
+        "    --origin <x> <y>           first tile (default 0 0)\n"
+        "    --tiles <x> <y>            number of mip 0 tiles (default 16 16)\n"
+        "    --tile-size <size>         world size of a mip 0 tile (default 64)\n"
+        "    --res <cells>              cells per tile side (default 64)\n"
+        "    --mips <count>             number of mips (default 5)\n"
+        "    --noise <hash|table>       noise function (default hash)\n"
+        "    --seed <seed>\n"
+        "    --scale <scale>\n"
+        "    --octaves <count>\n"
+        "    --persistance <value>\n"
+        "    --lacunarity <value>\n"
+        "    --chunk-width <width>\n"
+        "    --height <multiplier>\n");
+}
+
+static int bake_terrain(int argc, char** argv) {
+    if (argc < 1) {
+        print_usage();
+        return 1;
+    }
+    const char* output = argv[0];
+
+    Terrain terrain;
+    TerrainBakeParams params;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        int remaining = argc - i - 1;
+        if (!strcmp(arg, "--origin") && remaining >= 2) {
+            params.origin_tile = glm::ivec2(atoi(argv[i + 1]), atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if (!strcmp(arg, "--tiles") && remaining >= 2) {
+            params.num_tiles = glm::ivec2(atoi(argv[i + 1]), atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if (!strcmp(arg, "--tile-size") && remaining >= 1) params.tile_size = (float)atof(argv[++i]);
+        else if (!strcmp(arg, "--res") && remaining >= 1) params.tile_res = (uint32_t)atoi(argv[++i]);
+        else if (!strcmp(arg, "--mips") && remaining >= 1) params.num_mips = (uint32_t)atoi(argv[++i]);
+        else if (!strcmp(arg, "--noise") && remaining >= 1) {
+            terrain.noise = !strcmp(argv[++i], "table") ? TerrainNoise::Table : TerrainNoise::Hash;
+        }
+        else if (!strcmp(arg, "--seed") && remaining >= 1) terrain.seed = atoi(argv[++i]);
+        else if (!strcmp(arg, "--scale") && remaining >= 1) terrain.scale = (float)atof(argv[++i]);
+        else if (!strcmp(arg, "--octaves") && remaining >= 1) terrain.octaves = atoi(argv[++i]);
+        else if (!strcmp(arg, "--persistance") && remaining >= 1) terrain.persistance = (float)atof(argv[++i]);
+        else if (!strcmp(arg, "--lacunarity") && remaining >= 1) terrain.lacunarity = (float)atof(argv[++i]);
+        else if (!strcmp(arg, "--chunk-width") && remaining >= 1) terrain.chunk_width = (float)atof(argv[++i]);
+        else if (!strcmp(arg, "--height") && remaining >= 1) terrain.height_multiplier = (float)atof(argv[++i]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            print_usage();
+            return 1;
+        }
+    }
+
+    Pool* thread_pool = pool_create(std::thread::hardware_concurrency());
+    bool ok = bake_terrain_tiles(output, params, terrain, thread_pool);
+    pool_destroy(thread_pool);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "bake-terrain")) {
+        return bake_terrain(argc - 2, argv + 2);
+    }
+
+    fprintf(stderr, "Unknown command %s\n", argv[1]);
+    print_usage();
+    return 1;
+}